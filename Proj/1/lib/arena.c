@@ -0,0 +1,73 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vector.h"
+
+#define BLOCK_SIZE (64 * 1024)
+
+void arena_new(string_arena* a)
+{
+    assert(a);
+
+    vector_new(&a->blocks);
+    a->current = NULL;
+    a->available = 0;
+}
+
+void arena_free(string_arena* a)
+{
+    assert(a);
+
+    for (int i = 0; i < vector_size(&a->blocks); ++i)
+        free(vector_get(&a->blocks, i));
+
+    vector_free(&a->blocks);
+    arena_new(a);
+}
+
+void arena_reset(string_arena* a)
+{
+    assert(a);
+
+    if (vector_size(&a->blocks) == 0)
+        return;
+
+    // blocks are always pushed at the back, erase from there
+    while (vector_size(&a->blocks) > 1)
+    {
+        free(vector_get(&a->blocks, vector_size(&a->blocks) - 1));
+        vector_erase(&a->blocks, vector_size(&a->blocks) - 1);
+    }
+
+    a->current = vector_get(&a->blocks, 0);
+    a->available = BLOCK_SIZE;
+}
+
+char* arena_strdup(string_arena* a, const char* str)
+{
+    assert(a);
+    assert(str);
+
+    size_t size = strlen(str) + 1;
+
+    if (size > a->available)
+    {
+        size_t block_size = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+        char* block = malloc(block_size);
+        vector_push_back(&a->blocks, block);
+
+        a->current = block;
+        a->available = block_size;
+    }
+
+    char* result = a->current;
+    memcpy(result, str, size);
+
+    a->current += size;
+    a->available -= size;
+
+    return result;
+}
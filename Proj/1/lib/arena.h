@@ -0,0 +1,54 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+#include "vector.h"
+
+/** @defgroup arena arena
+ * @{
+ * Bump allocator for strings that share the same lifetime.
+ *
+ * Strings are copied back to back into large blocks, so adding one is
+ * usually a pointer increment and all of them are released at once.
+ */
+
+/**
+ * Holds the blocks of a string arena
+ */
+typedef struct
+{
+    vector blocks; ///< vector<char*>, allocated blocks
+    char* current; ///< Next free byte of the last block
+    size_t available; ///< Free bytes left in the last block
+} string_arena;
+
+/**
+ * Initializes a new, empty, string arena
+ * @param a string_arena pointer. Must not be NULL.
+ */
+void arena_new(string_arena* a);
+
+/**
+ * Releases every string of the arena
+ * @param a string_arena pointer. Must not be NULL.
+ */
+void arena_free(string_arena* a);
+
+/**
+ * Releases every string of the arena but keeps the first block for reuse
+ * @param a string_arena pointer. Must not be NULL.
+ */
+void arena_reset(string_arena* a);
+
+/**
+ * Copies a string into the arena
+ * @param  a   string_arena pointer. Must not be NULL.
+ * @param  str String to copy. Must not be NULL.
+ * @return     Copy of str, valid until the arena is freed or reset
+ */
+char* arena_strdup(string_arena* a, const char* str);
+
+/**@}*/
+
+#endif
@@ -1,31 +1,28 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include "backupinfo.h"
-#include "vector.h"
 #include "fileinfo.h"
+#include "fileinfolist.h"
+#include "namesort.h"
+#include "frontcode.h"
 
 void backup_info_new(backup_info* bi)
 {
     assert(bi);
 
     bi->iter = -1;
-    vector_new(&bi->file_list);
+    file_info_list_new(&bi->file_list);
 }
 
 void backup_info_free(backup_info* bi)
 {
     assert(bi);
 
-    for (int i = 0; i < vector_size(&bi->file_list); ++i)
-    {
-        void* element = vector_get(&bi->file_list, i);
-        file_info_free((file_info*)element);
-        free(element);
-    }
-
-    vector_free(&bi->file_list);
+    file_info_list_free(&bi->file_list);
 }
 
 int backup_info_read(FILE* source, backup_info* result)
@@ -35,7 +32,7 @@ int backup_info_read(FILE* source, backup_info* result)
 
     int iter;
 
-    if (fscanf(source, "%d\n", &iter) == EOF)
+    if (backup_info_read_header(source, &iter) == EOF)
         return EOF;
 
     result->iter = iter;
@@ -56,25 +53,180 @@ int backup_info_write(FILE* dest, const backup_info* backup)
     assert(dest);
     assert(backup);
 
-    char file_info_buffer[1000];
+    backup_info_writer writer;
+    int result = backup_info_writer_open(&writer, dest, backup->iter);
+
+    for (int i = 0; result == 0 && i < file_info_list_size(&backup->file_list); ++i)
+        result = backup_info_writer_add(&writer, file_info_list_get(&backup->file_list, i));
+
+    backup_info_writer_close(&writer);
+
+    return result;
+}
+
+int backup_info_read_header(FILE* source, int* iter)
+{
+    assert(source);
+    assert(iter);
+
+    if (fscanf(source, "%d\n", iter) != 1)
+        return EOF;
+
+    return 0;
+}
+
+/**
+ * Finds the first entry with a full name (shared prefix length 0) that starts
+ *  at or after offset and before end
+ * @param  name Set to the full name of the entry, stored in line
+ * @return      Offset of the entry, -1 if there is none
+ */
+static long find_restart(FILE* source, long offset, long start, long end, char** line, size_t* line_size, const char** name)
+{
+    if (offset > start)
+    {
+        // offset may be in the middle of a line, skip to the next one
+        fseek(source, offset - 1, SEEK_SET);
+        for (int c = getc(source); c != EOF && c != '\n'; c = getc(source))
+            ;
+    }
+    else
+        fseek(source, start, SEEK_SET);
+
+    for (long position = ftell(source); position < end; position = ftell(source))
+    {
+        ssize_t length = getline(line, line_size, source);
+        if (length <= 0)
+            return -1;
+
+        size_t shared;
+        int name_start = 0;
+        // suppressed conversions take no length modifier, %*d also skips the long long fields
+        if (sscanf(*line, "%*c %*d %*d %*d %*x %*d %*d %zu%n", &shared, &name_start) == 1 && name_start > 0 && shared == 0
+            && (*line)[name_start] == ' ')
+        {
+            if ((*line)[length - 1] == '\n')
+                (*line)[length - 1] = '\0';
+
+            *name = *line + name_start + 1; // exactly one separator, as in file_info_read
+            return position;
+        }
+    }
+
+    return -1;
+}
+
+int backup_info_find(FILE* source, const char* name, file_info* result)
+{
+    assert(source);
+    assert(name);
+    assert(result);
+
+    int iter;
+
+    rewind(source);
+    if (backup_info_read_header(source, &iter) == EOF)
+        return EOF;
+
+    long start = ftell(source);
+    if (start < 0 || fseek(source, 0, SEEK_END) != 0)
+        return EOF;
+    long end = ftell(source);
+
+    // find the last block whose first name is not greater than name
+    char* line = NULL;
+    size_t line_size = 0;
+    long block = start;
+    long low = start, high = end;
+
+    while (low < high)
+    {
+        long middle = low + (high - low) / 2;
+        const char* restart_name;
+        long position = find_restart(source, middle, start, high, &line, &line_size, &restart_name);
+
+        if (position >= 0 && name_compare(restart_name, name) <= 0)
+        {
+            block = position;
+            low = position + 1;
+        }
+        else
+            high = middle;
+    }
+
+    free(line);
 
-    fprintf(dest, "%d\n", backup->iter);
+    if (fseek(source, block, SEEK_SET) != 0)
+        return EOF;
 
-    for (int i = 0; i < vector_size(&backup->file_list); ++i)
+    while (file_info_read(source, result) != EOF)
     {
-        file_info_to_string((file_info*)vector_get(&backup->file_list, i), file_info_buffer);
-        fprintf(dest, "%s\n", file_info_buffer);
+        int cmp = name_compare(result->file_name, name);
+        if (cmp == 0)
+            return 0;
+        else if (cmp > 0)
+            break;
     }
 
+    return 1;
+}
+
+int backup_info_writer_open(backup_info_writer* w, FILE* dest, int iter)
+{
+    assert(w);
+    assert(dest);
+
+    w->dest = dest;
+    w->count = 0;
+    w->prev_name = NULL;
+    w->prev_name_capacity = 0;
+
+    return fprintf(dest, "%d\n", iter) < 0;
+}
+
+int backup_info_writer_add(backup_info_writer* w, const file_info* fi)
+{
+    assert(w);
+    assert(fi);
+    assert(fi->file_name);
+
+    // backups are merged by name, entries must be kept in byte order
+    assert(w->count == 0 || name_compare(w->prev_name, fi->file_name) < 0);
+
+    size_t shared = 0;
+    if (w->count % NAME_DICT_RESTART_INTERVAL != 0)
+        shared = common_prefix(w->prev_name, fi->file_name);
+
+    if (fprintf(w->dest, "%c %d %lld %lld %" PRIx64 " %d %lld %zu %s\n", (char)fi->state, fi->iter, fi->size,
+                fi->mtime, fi->tail_hash, fi->base_iter, fi->base_size, shared, fi->file_name + shared) < 0)
+        return 1;
+
+    size_t size = strlen(fi->file_name) + 1;
+    if (size > w->prev_name_capacity)
+    {
+        w->prev_name = realloc(w->prev_name, size);
+        w->prev_name_capacity = size;
+    }
+
+    memcpy(w->prev_name, fi->file_name, size);
+    w->count++;
+
     return 0;
 }
 
+void backup_info_writer_close(backup_info_writer* w)
+{
+    assert(w);
+
+    free(w->prev_name);
+    w->prev_name = NULL;
+    w->prev_name_capacity = 0;
+}
+
 void backup_info_add_file(backup_info* bi, file_info* fi)
 {
     assert(bi);
     assert(fi);
 
-    file_info* fi_to_be_added = NULL;
-    file_info_copy(fi, &fi_to_be_added);
-    vector_push_back(&bi->file_list, fi_to_be_added);
+    file_info_list_push_back(&bi->file_list, fi);
 }
@@ -4,8 +4,8 @@
 #include <dirent.h>
 #include <stdio.h>
 
-#include "vector.h"
 #include "fileinfo.h"
+#include "fileinfolist.h"
 
 /** @defgroup backup_shared backup_shared
  * @{
@@ -18,7 +18,7 @@
 typedef struct
 {
     int iter; ///< step
-    vector file_list; ///< vector<file_info>
+    file_info_list file_list; ///< Entries, in byte order of their names
 } backup_info;
 
 /**
@@ -50,7 +50,62 @@ int backup_info_read(FILE* source, backup_info* result); // read from file
 int backup_info_write(FILE* dest, const backup_info* backup); // write to file
 
 /**
- * Adds a new file_info to the backup_info struct. The specified file_info struct is copied.
+ * Reads the header of a backup_info stream. Entries can then be read one by one with file_info_read.
+ * @param  source File stream where backup_info data is stored
+ * @param  iter   pointer to save the iteration of the backup. Must not be NULL
+ * @return        0 upon success, EOF if the stream is empty
+ */
+int backup_info_read_header(FILE* source, int* iter);
+
+/**
+ * Finds the entry of a file in a backup_info stream without reading the whole stream.
+ *  Entries with a full name (one every NAME_DICT_RESTART_INTERVAL) are binary searched
+ *  by file offset, then the matching block is decoded sequentially.
+ * @param  source File stream where backup_info data is stored. Must be seekable.
+ * @param  name   Name of the file to find. Must not be NULL.
+ * @param  result file_info pointer to save the entry. Must not be NULL.
+ * @return        0 if found, 1 if the stream has no such entry, EOF on errors
+ */
+int backup_info_find(FILE* source, const char* name, file_info* result);
+
+/**
+ * Holds the state of a backup_info being written entry by entry.
+ *  Names are front coded: each entry only stores what differs from the
+ *  previous name, with a full name every NAME_DICT_RESTART_INTERVAL entries.
+ */
+typedef struct
+{
+    FILE* dest; ///< File stream where backup_info is written
+    int count; ///< Number of entries written
+    char* prev_name; ///< Name of the previous entry
+    size_t prev_name_capacity; ///< Bytes allocated for prev_name
+} backup_info_writer;
+
+/**
+ * Starts writing a backup_info stream (writes its header)
+ * @param  w    backup_info_writer struct to initialize. Must not be NULL.
+ * @param  dest File stream where backup_info is to be written
+ * @param  iter iteration of the backup
+ * @return      0 upon success, different otherwise
+ */
+int backup_info_writer_open(backup_info_writer* w, FILE* dest, int iter);
+
+/**
+ * Writes a single file_info entry. Entries must be written in strictly increasing byte order of their names.
+ * @param  w  backup_info_writer struct. Must not be NULL.
+ * @param  fi file_info struct to write. Must not be NULL.
+ * @return    0 upon success, different otherwise
+ */
+int backup_info_writer_add(backup_info_writer* w, const file_info* fi);
+
+/**
+ * Releases the resources of the writer. The file stream is not closed.
+ * @param w backup_info_writer struct. Must not be NULL.
+ */
+void backup_info_writer_close(backup_info_writer* w);
+
+/**
+ * Adds a new file_info to the backup_info struct. The specified file_info struct (and its name) is copied.
  * @param  bi backup_info struct to receive the new value. Must not be NULL.
  * @param  fi file_info struct to add. Must not be NULL.
  */
@@ -0,0 +1,282 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "hash.h"
+
+void capture_init(capture* c, cipher_file* file, off_t offset, long long resumed)
+{
+    assert(c);
+
+    c->file = file;
+    c->offset = offset;
+    c->size = resumed;
+    c->sums = NULL;
+    c->blocks = (resumed + CAPTURE_BLOCK_SIZE - 1) / CAPTURE_BLOCK_SIZE;
+    c->capacity = 0;
+    c->first = c->blocks;
+    c->crc = 0;
+    c->consistent = true;
+    c->failed = false;
+}
+
+/**
+ * Sets the checksum of a block, growing the array of checksums if needed
+ */
+static void set_sum(capture* c, long long block, uint32_t sum)
+{
+    if (block >= c->capacity)
+    {
+        long long capacity = c->capacity ? c->capacity : 64;
+        while (capacity <= block)
+            capacity *= 2;
+
+        c->sums = realloc(c->sums, capacity * sizeof(uint32_t));
+        c->capacity = capacity;
+    }
+
+    c->sums[block] = sum;
+}
+
+void capture_update(capture* c, const void* data, size_t size)
+{
+    assert(c);
+
+    const char* bytes = data;
+
+    while (size > 0)
+    {
+        long long block = c->size / CAPTURE_BLOCK_SIZE;
+        size_t within = c->size % CAPTURE_BLOCK_SIZE;
+        size_t piece = CAPTURE_BLOCK_SIZE - within < size ? CAPTURE_BLOCK_SIZE - within : size;
+
+        // the block where an interrupted copy stopped has no checksum
+        if (block >= c->first)
+        {
+            uint32_t sum = within == 0 ? 0 : c->sums[block];
+            set_sum(c, block, hash_crc32c(sum, bytes, piece));
+            c->blocks = block + 1;
+        }
+
+        c->size += piece;
+        bytes += piece;
+        size -= piece;
+    }
+}
+
+/**
+ * Checks if two status of a file are of the same version of its contents
+ */
+static bool same_version(const struct stat* a, const struct stat* b)
+{
+    return a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec
+           && a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+/**
+ * Reads a block of a file, or what is left of it before its end
+ * @return Number of bytes read, -1 on errors
+ */
+static ssize_t read_block(cipher_file* file, char* buffer, off_t position)
+{
+    ssize_t length = 0;
+
+    while (length < CAPTURE_BLOCK_SIZE)
+    {
+        ssize_t count = cipher_file_pread(file, buffer + length, CAPTURE_BLOCK_SIZE - length, position + length);
+        if (count < 0)
+            return -1;
+        if (count == 0)
+            break;
+        length += count;
+    }
+
+    return length;
+}
+
+/**
+ * Checks if a block of the source differs from the one stored
+ * @param  block  Index of the block
+ * @param  data   Block read from the source
+ * @param  length Number of bytes of data
+ * @param  sum    CRC32C of data
+ * @param  stored Buffer to read the stored block, if it has no checksum
+ * @return        true if it must be written again
+ */
+static bool block_changed(const capture* c, long long block, const char* data, ssize_t length, uint32_t sum, char* stored)
+{
+    if (block >= c->blocks)
+        return true;
+
+    long long position = block * CAPTURE_BLOCK_SIZE;
+    long long stored_length = c->size - position < CAPTURE_BLOCK_SIZE ? c->size - position : CAPTURE_BLOCK_SIZE;
+    if (stored_length != length)
+        return true;
+
+    if (block >= c->first)
+        return c->sums[block] != sum;
+
+    // stored by an interrupted copy, whose checksums were lost
+    return read_block(c->file, stored, position) != length || memcmp(stored, data, length) != 0;
+}
+
+/**
+ * Reads a source once and writes the blocks that changed to the copies that start at the same offset
+ * @return false if the source could not be read
+ */
+static bool repair_pass(cipher_file* source, capture** group, int count, char* buffer, char* stored, io_limits* limits)
+{
+    off_t offset = group[0]->offset;
+    long long length = 0;
+    uint32_t crc = 0;
+
+    for (long long block = 0; ; ++block)
+    {
+        ssize_t size = read_block(source, buffer, offset + length);
+
+        if (size < 0)
+        {
+            perror("Error reading source file");
+            return false;
+        }
+
+        io_limits_take(limits, size, 1);
+
+        if (size == 0)
+            break;
+
+        uint32_t sum = hash_crc32c(0, buffer, size);
+        crc = hash_crc32c(crc, buffer, size);
+
+        for (int i = 0; i < count; ++i)
+        {
+            capture* c = group[i];
+            if (c->failed)
+                continue;
+
+            if (block_changed(c, block, buffer, size, sum, stored))
+            {
+                io_limits_take(limits, size, 1);
+                if (!cipher_file_pwrite(c->file, buffer, size, length))
+                {
+                    perror("Error writing destination file");
+                    c->failed = true;
+                    continue;
+                }
+            }
+
+            set_sum(c, block, sum);
+        }
+
+        length += size;
+        if (size < CAPTURE_BLOCK_SIZE)
+            break;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        capture* c = group[i];
+        if (c->failed)
+            continue;
+
+        // a source that shrank leaves stale bytes after its new end
+        if (c->size > length && !cipher_file_truncate(c->file, length))
+        {
+            perror("Error truncating destination file");
+            c->failed = true;
+            continue;
+        }
+
+        c->size = length;
+        c->blocks = (length + CAPTURE_BLOCK_SIZE - 1) / CAPTURE_BLOCK_SIZE;
+        c->first = 0;
+        c->crc = crc;
+    }
+
+    return true;
+}
+
+bool capture_check(int sourcefd, const struct stat* before, capture* captures, int count, io_limits* limits)
+{
+    assert(before);
+    assert(captures);
+    assert(count > 0);
+
+    struct stat now;
+    if (fstat(sourcefd, &now) != 0)
+    {
+        perror("Error reading source file status");
+        return false;
+    }
+
+    bool changed = !same_version(before, &now);
+    bool success = true;
+
+    // the source is read as it is, the copies through their cipher
+    cipher_file source;
+    cipher_file_plain(&source, sourcefd);
+    char* buffer = NULL;
+    char* stored = NULL;
+    capture** group = NULL;
+
+    if (changed)
+    {
+        buffer = malloc(CAPTURE_BLOCK_SIZE);
+        stored = malloc(CAPTURE_BLOCK_SIZE);
+        group = malloc(count * sizeof(capture*));
+    }
+
+    for (int pass = 0; success && changed && pass < CAPTURE_MAX_PASSES; ++pass)
+    {
+        struct stat start = now;
+
+        // copies that start at the same offset share the reads
+        for (int i = 0; success && i < count; ++i)
+        {
+            bool grouped = false;
+            for (int j = 0; j < i; ++j)
+                grouped = grouped || captures[j].offset == captures[i].offset;
+
+            if (grouped)
+                continue;
+
+            int members = 0;
+            for (int j = i; j < count; ++j)
+                if (captures[j].offset == captures[i].offset)
+                    group[members++] = &captures[j];
+
+            success = repair_pass(&source, group, members, buffer, stored, limits);
+        }
+
+        if (success && fstat(sourcefd, &now) != 0)
+        {
+            perror("Error reading source file status");
+            success = false;
+        }
+
+        changed = !same_version(&start, &now);
+    }
+
+    for (int i = 0; i < count; ++i)
+        captures[i].consistent = !changed;
+
+    free(buffer);
+    free(stored);
+    free(group);
+
+    return success;
+}
+
+void capture_free(capture* c)
+{
+    assert(c);
+
+    free(c->sums);
+    c->sums = NULL;
+    c->blocks = 0;
+    c->capacity = 0;
+}
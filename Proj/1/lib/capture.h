@@ -0,0 +1,84 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "throttle.h"
+#include "cipher.h"
+
+/** @defgroup capture capture
+ * @{
+ * Consistent copies of files that are written while they are copied.
+ *
+ * The CRC32C of every block of the stored data is kept while a file is
+ * copied. If the size, modification time or change time of the source
+ * differ once the copy is done, the source is read again and only the
+ * blocks whose checksum changed are written, until a whole pass sees the
+ * source unchanged or CAPTURE_MAX_PASSES passes were made. The stored
+ * data is not read back, except the blocks stored by an interrupted copy.
+ */
+
+/// Number of bytes of each checksummed block
+#define CAPTURE_BLOCK_SIZE (1024 * 1024)
+
+/// Maximum number of passes over a source that keeps changing before its copy is left inconsistent
+#define CAPTURE_MAX_PASSES 3
+
+/**
+ * Copy of a file being captured
+ */
+typedef struct
+{
+    cipher_file* file; ///< Destination file, opened for reading and writing
+    off_t offset; ///< Offset in the source of the first byte stored
+    long long size; ///< Number of bytes stored
+    uint32_t* sums; ///< CRC32C of each block of the stored data
+    long long blocks; ///< Number of blocks of sums
+    long long capacity; ///< Capacity of sums
+    long long first; ///< First block with a checksum, the ones before it were stored by an interrupted copy
+    uint32_t crc; ///< CRC32C of the stored data, set by the caller and updated by capture_check
+    bool consistent; ///< Set by capture_check if the stored data is the source as it was during a whole pass
+    bool failed; ///< Set by capture_check if the destination could not be written
+} capture;
+
+/**
+ * Initializes the capture of a copy
+ * @param c       capture struct to initialize. Must not be NULL.
+ * @param file    Destination file, opened for reading and writing
+ * @param offset  Offset in the source of the first byte stored
+ * @param resumed Number of bytes already stored by an interrupted copy
+ */
+void capture_init(capture* c, cipher_file* file, off_t offset, long long resumed);
+
+/**
+ * Adds data written to the end of the destination to the block checksums
+ * @param c    capture struct. Must not be NULL.
+ * @param data Data written
+ * @param size Number of bytes of data
+ */
+void capture_update(capture* c, const void* data, size_t size);
+
+/**
+ * Checks if a source changed since its copies started and, if it did, copies the changed
+ *  blocks again (see the module description). Sets the consistent, failed and crc fields.
+ * @param  sourcefd Source file
+ * @param  before   Status of the source when the copies started
+ * @param  captures Copies of the source, the ones whose failed field is set are skipped
+ * @param  count    Number of copies
+ * @param  limits   I/O limits of the reads and writes, NULL for none
+ * @return          true if successful, false if the source could not be read
+ */
+bool capture_check(int sourcefd, const struct stat* before, capture* captures, int count, io_limits* limits);
+
+/**
+ * Releases the resources of a capture (the destination file is not closed)
+ * @param c capture struct. Must not be NULL.
+ */
+void capture_free(capture* c);
+
+/**@}*/
+
+#endif
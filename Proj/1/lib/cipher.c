@@ -0,0 +1,765 @@
+#define _GNU_SOURCE // required for fopencookie
+
+#include "cipher.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+/// Bytes stored with each chunk besides its ciphertext
+#define CHUNK_OVERHEAD (CIPHER_NONCE_SIZE + CIPHER_TAG_SIZE)
+
+static unsigned char Key[CIPHER_KEY_SIZE]; ///< Key loaded by cipher_load_key
+static bool KeyLoaded = false; ///< Set once Key is loaded
+
+/**
+ * Stream opened by cipher_fopen
+ */
+typedef struct
+{
+    cipher_file file; ///< File read or written
+    bool write; ///< Opened to be written (it is only appended to)
+} cipher_stream;
+
+/**
+ * Returns the value of a hexadecimal digit, -1 if it is not one
+ */
+static int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool cipher_load_key(const char* path)
+{
+    assert(path);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    struct stat buf;
+    if (fstat(fileno(file), &buf) == 0 && (buf.st_mode & 077) != 0)
+        fprintf(stderr, "Warning: key file %s can be read by other users.\n", path);
+
+    // one byte more than the longest valid file, so longer ones are refused
+    unsigned char data[2 * CIPHER_KEY_SIZE + 3];
+    size_t length = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    bool valid = length == CIPHER_KEY_SIZE;
+    if (valid)
+        memcpy(Key, data, CIPHER_KEY_SIZE);
+    else
+    {
+        while (length > 2 * CIPHER_KEY_SIZE && (data[length - 1] == '\n' || data[length - 1] == '\r'))
+            length--;
+
+        valid = length == 2 * CIPHER_KEY_SIZE;
+        for (int i = 0; valid && i < CIPHER_KEY_SIZE; ++i)
+        {
+            int high = hex_value(data[2 * i]), low = hex_value(data[2 * i + 1]);
+            valid = high >= 0 && low >= 0;
+            Key[i] = high << 4 | low;
+        }
+    }
+
+    OPENSSL_cleanse(data, sizeof(data));
+
+    if (!valid)
+    {
+        fprintf(stderr, "Key file %s must hold %d bytes, raw or as %d hexadecimal digits.\n", path, CIPHER_KEY_SIZE,
+                2 * CIPHER_KEY_SIZE);
+        OPENSSL_cleanse(Key, sizeof(Key));
+        return false;
+    }
+
+    KeyLoaded = true;
+    return true;
+}
+
+bool cipher_enabled(void)
+{
+    return KeyLoaded;
+}
+
+/**
+ * Encrypts bytes under a random nonce
+ * @param out Buffer of the nonce, the ciphertext and the tag (length + CHUNK_OVERHEAD bytes)
+ * @return    true if successful, false otherwise
+ */
+static bool seal(EVP_CIPHER_CTX* ctx, const unsigned char* aad, int aad_length, const unsigned char* plain, int length,
+                 unsigned char* out)
+{
+    int count;
+    return RAND_bytes(out, CIPHER_NONCE_SIZE) == 1
+           && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, Key, out) == 1
+           && (aad_length == 0 || EVP_EncryptUpdate(ctx, NULL, &count, aad, aad_length) == 1)
+           && EVP_EncryptUpdate(ctx, out + CIPHER_NONCE_SIZE, &count, plain, length) == 1
+           && EVP_EncryptFinal_ex(ctx, out + CIPHER_NONCE_SIZE + count, &count) == 1
+           && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, CIPHER_TAG_SIZE, out + CIPHER_NONCE_SIZE + length) == 1;
+}
+
+/**
+ * Decrypts bytes written by seal
+ * @param in     Nonce, ciphertext and tag
+ * @param length Number of bytes of the ciphertext
+ * @return       true if successful, false if they are not authentic
+ */
+static bool unseal(EVP_CIPHER_CTX* ctx, const unsigned char* aad, int aad_length, const unsigned char* in, int length,
+                   unsigned char* plain)
+{
+    int count;
+    return EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, Key, in) == 1
+           && (aad_length == 0 || EVP_DecryptUpdate(ctx, NULL, &count, aad, aad_length) == 1)
+           && EVP_DecryptUpdate(ctx, plain, &count, in + CIPHER_NONCE_SIZE, length) == 1
+           && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, CIPHER_TAG_SIZE, (void*)(in + CIPHER_NONCE_SIZE + length)) == 1
+           && EVP_DecryptFinal_ex(ctx, plain + count, &count) == 1;
+}
+
+/**
+ * Returns the offset of a chunk in an encrypted file
+ */
+static off_t chunk_offset(long long index)
+{
+    return CIPHER_HEADER_SIZE + index * (off_t)(CIPHER_CHUNK_SIZE + CHUNK_OVERHEAD);
+}
+
+/**
+ * Sets the authenticated data of a chunk: its index, big endian, and whether it is the last one
+ */
+static void chunk_aad(long long index, bool last, unsigned char aad[9])
+{
+    for (int i = 0; i < 8; ++i)
+        aad[i] = (uint64_t)index >> (56 - 8 * i);
+    aad[8] = last;
+}
+
+/**
+ * Reads or writes bytes at an offset, retrying short transfers
+ * @return true if successful, false otherwise (errno is EBADMSG if the file is too short)
+ */
+static bool transfer(int fd, void* buffer, size_t length, off_t offset, bool write)
+{
+    unsigned char* bytes = buffer;
+
+    while (length > 0)
+    {
+        ssize_t done = write ? pwrite(fd, bytes, length, offset) : pread(fd, bytes, length, offset);
+        if (done < 0)
+            return false;
+        if (done == 0)
+        {
+            errno = EBADMSG;
+            return false;
+        }
+
+        bytes += done;
+        length -= done;
+        offset += done;
+    }
+
+    return true;
+}
+
+/**
+ * Encrypts and writes a chunk
+ * @return true if successful, false otherwise
+ */
+static bool write_chunk(cipher_file* f, long long index, const unsigned char* plain, size_t length, bool last)
+{
+    unsigned char aad[9];
+    chunk_aad(index, last, aad);
+
+    if (!seal(f->ctx, aad, sizeof(aad), plain, length, f->io))
+    {
+        errno = EIO;
+        return false;
+    }
+
+    return transfer(f->fd, f->io, length + CHUNK_OVERHEAD, chunk_offset(index), true);
+}
+
+/**
+ * Reads and decrypts a chunk
+ * @param  length Number of bytes of plaintext of the chunk
+ * @return        true if successful, false otherwise (errno is EBADMSG if it is not authentic)
+ */
+static bool read_chunk(cipher_file* f, long long index, unsigned char* plain, size_t length, bool last)
+{
+    if (!transfer(f->fd, f->io, length + CHUNK_OVERHEAD, chunk_offset(index), false))
+        return false;
+
+    unsigned char aad[9];
+    chunk_aad(index, last, aad);
+
+    if (!unseal(f->ctx, aad, sizeof(aad), f->io, length, plain))
+    {
+        errno = EBADMSG;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Sets the header of an encrypted file: CIPHER_MAGIC, the chunk size (big endian) and zeros
+ */
+static void make_header(unsigned char header[CIPHER_HEADER_SIZE])
+{
+    memset(header, 0, CIPHER_HEADER_SIZE);
+    memcpy(header, CIPHER_MAGIC, strlen(CIPHER_MAGIC));
+
+    for (int i = 0; i < 4; ++i)
+        header[8 + i] = (uint32_t)CIPHER_CHUNK_SIZE >> (24 - 8 * i);
+}
+
+/**
+ * Checks the header of an encrypted file
+ * @return true if it is valid, false otherwise (errno is EBADMSG if it is not the expected one)
+ */
+static bool check_header(int fd)
+{
+    unsigned char header[CIPHER_HEADER_SIZE], expected[CIPHER_HEADER_SIZE];
+    make_header(expected);
+
+    if (!transfer(fd, header, CIPHER_HEADER_SIZE, 0, false))
+        return false;
+
+    if (memcmp(header, expected, CIPHER_HEADER_SIZE) != 0)
+    {
+        errno = EBADMSG;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Initializes a cipher_file struct, with its buffers if it is encrypted
+ */
+static void init_file(cipher_file* f, int fd, bool encrypted)
+{
+    memset(f, 0, sizeof(cipher_file));
+    f->fd = fd;
+    f->encrypted = encrypted;
+    f->cached = -1;
+
+    if (encrypted)
+    {
+        f->tail = malloc(CIPHER_CHUNK_SIZE);
+        f->cache = malloc(CIPHER_CHUNK_SIZE);
+        f->io = malloc(CIPHER_CHUNK_SIZE + CHUNK_OVERHEAD);
+        f->ctx = EVP_CIPHER_CTX_new();
+    }
+}
+
+/**
+ * Releases the buffers of a cipher_file struct, keeping errno
+ * @return false, for the callers that failed
+ */
+static bool release_file(cipher_file* f)
+{
+    int error = errno;
+
+    free(f->tail);
+    free(f->cache);
+    free(f->io);
+    EVP_CIPHER_CTX_free(f->ctx);
+    memset(f, 0, sizeof(cipher_file));
+    f->fd = -1;
+
+    errno = error;
+    return false;
+}
+
+bool cipher_file_create(cipher_file* f, int fd)
+{
+    assert(f);
+
+    init_file(f, fd, KeyLoaded);
+    if (!KeyLoaded)
+        return true;
+
+    unsigned char header[CIPHER_HEADER_SIZE];
+    make_header(header);
+
+    if (f->ctx == NULL || !transfer(fd, header, CIPHER_HEADER_SIZE, 0, true))
+        return release_file(f);
+
+    // even an empty file has a last chunk
+    f->dirty = true;
+    return true;
+}
+
+bool cipher_file_open(cipher_file* f, int fd)
+{
+    assert(f);
+
+    init_file(f, fd, KeyLoaded);
+    if (!KeyLoaded)
+        return true;
+
+    struct stat buf;
+    if (f->ctx == NULL || fstat(fd, &buf) != 0 || !check_header(fd))
+        return release_file(f);
+
+    // every chunk is full but the last one, which is shorter
+    long long stored = buf.st_size - CIPHER_HEADER_SIZE;
+    long long chunks = (stored + CIPHER_CHUNK_SIZE + CHUNK_OVERHEAD - 1) / (CIPHER_CHUNK_SIZE + CHUNK_OVERHEAD);
+    long long last = chunks > 0 ? stored - (chunks - 1) * (CIPHER_CHUNK_SIZE + CHUNK_OVERHEAD) - CHUNK_OVERHEAD : -1;
+
+    if (last < 0 || last >= CIPHER_CHUNK_SIZE)
+    {
+        errno = EBADMSG;
+        return release_file(f);
+    }
+
+    f->size = (chunks - 1) * CIPHER_CHUNK_SIZE + last;
+    if (!read_chunk(f, chunks - 1, f->tail, last, true))
+        return release_file(f);
+
+    return true;
+}
+
+bool cipher_file_resume(cipher_file* f, int fd, long long size)
+{
+    assert(f);
+    assert(size >= 0);
+
+    init_file(f, fd, KeyLoaded);
+    if (!KeyLoaded)
+        return (ftruncate(fd, size) == 0 && lseek(fd, size, SEEK_SET) != (off_t)-1) || release_file(f);
+
+    struct stat buf;
+    if (f->ctx == NULL || fstat(fd, &buf) != 0)
+        return release_file(f);
+
+    // cut before its header was written
+    unsigned char header[CIPHER_HEADER_SIZE];
+    make_header(header);
+    if (buf.st_size < CIPHER_HEADER_SIZE && size == 0)
+    {
+        if (!transfer(fd, header, CIPHER_HEADER_SIZE, 0, true))
+            return release_file(f);
+        buf.st_size = CIPHER_HEADER_SIZE;
+    }
+    else if (!check_header(fd))
+        return release_file(f);
+
+    long long index = size / CIPHER_CHUNK_SIZE;
+    size_t kept = size % CIPHER_CHUNK_SIZE;
+
+    if (buf.st_size < chunk_offset(index))
+    {
+        errno = EBADMSG;
+        return release_file(f);
+    }
+
+    // the chunk of the last bytes kept was full if another one follows it, otherwise it was the last one
+    if (kept > 0)
+    {
+        bool full = buf.st_size >= chunk_offset(index + 1);
+        long long length = full ? CIPHER_CHUNK_SIZE : buf.st_size - chunk_offset(index) - CHUNK_OVERHEAD;
+
+        if (length < (long long)kept)
+        {
+            errno = EBADMSG;
+            return release_file(f);
+        }
+
+        if (!read_chunk(f, index, f->tail, length, !full))
+            return release_file(f);
+    }
+
+    if (ftruncate(fd, chunk_offset(index)) != 0)
+        return release_file(f);
+
+    f->size = size;
+    f->position = size;
+    f->dirty = true;
+    return true;
+}
+
+void cipher_file_plain(cipher_file* f, int fd)
+{
+    assert(f);
+
+    init_file(f, fd, false);
+}
+
+ssize_t cipher_file_pread(cipher_file* f, void* buffer, size_t size, long long offset)
+{
+    assert(f);
+
+    if (!f->encrypted)
+        return pread(f->fd, buffer, size, offset);
+
+    unsigned char* bytes = buffer;
+    size_t done = 0;
+
+    while (done < size && offset < f->size)
+    {
+        long long index = offset / CIPHER_CHUNK_SIZE;
+        size_t within = offset % CIPHER_CHUNK_SIZE;
+        size_t piece = CIPHER_CHUNK_SIZE - within < size - done ? CIPHER_CHUNK_SIZE - within : size - done;
+        if ((long long)piece > f->size - offset)
+            piece = f->size - offset;
+
+        const unsigned char* chunk = f->tail;
+        if (index != f->size / CIPHER_CHUNK_SIZE)
+        {
+            if (f->cached != index)
+            {
+                f->cached = -1;
+                if (!read_chunk(f, index, f->cache, CIPHER_CHUNK_SIZE, false))
+                    return -1;
+                f->cached = index;
+            }
+            chunk = f->cache;
+        }
+
+        memcpy(bytes + done, chunk + within, piece);
+        done += piece;
+        offset += piece;
+    }
+
+    return done;
+}
+
+ssize_t cipher_file_read(cipher_file* f, void* buffer, size_t size)
+{
+    assert(f);
+
+    if (!f->encrypted)
+        return read(f->fd, buffer, size);
+
+    ssize_t count = cipher_file_pread(f, buffer, size, f->position);
+    if (count > 0)
+        f->position += count;
+
+    return count;
+}
+
+bool cipher_file_pwrite(cipher_file* f, const void* data, size_t size, long long offset)
+{
+    assert(f);
+
+    const unsigned char* bytes = data;
+
+    if (!f->encrypted)
+        return transfer(f->fd, (void*)bytes, size, offset, true);
+
+    assert(offset <= f->size);
+
+    while (size > 0)
+    {
+        long long index = offset / CIPHER_CHUNK_SIZE;
+        size_t within = offset % CIPHER_CHUNK_SIZE;
+        size_t piece = CIPHER_CHUNK_SIZE - within < size ? CIPHER_CHUNK_SIZE - within : size;
+
+        if (index == f->size / CIPHER_CHUNK_SIZE)
+        {
+            // the last chunk is only written once full, or when the file is synced or closed
+            memcpy(f->tail + within, bytes, piece);
+            if (offset + (long long)piece > f->size)
+                f->size = offset + piece;
+            f->dirty = true;
+
+            if (within + piece == CIPHER_CHUNK_SIZE && !write_chunk(f, index, f->tail, CIPHER_CHUNK_SIZE, false))
+                return false;
+        }
+        else
+        {
+            // a full chunk before the last one, read back unless it is replaced
+            if (piece < CIPHER_CHUNK_SIZE && f->cached != index)
+            {
+                f->cached = -1;
+                if (!read_chunk(f, index, f->cache, CIPHER_CHUNK_SIZE, false))
+                    return false;
+            }
+
+            f->cached = index;
+            memcpy(f->cache + within, bytes, piece);
+
+            if (!write_chunk(f, index, f->cache, CIPHER_CHUNK_SIZE, false))
+            {
+                f->cached = -1;
+                return false;
+            }
+        }
+
+        bytes += piece;
+        offset += piece;
+        size -= piece;
+    }
+
+    return true;
+}
+
+bool cipher_file_write(cipher_file* f, const void* data, size_t size)
+{
+    assert(f);
+
+    if (!f->encrypted)
+    {
+        const char* bytes = data;
+        for (size_t written = 0; written < size; )
+        {
+            ssize_t count = write(f->fd, bytes + written, size - written);
+            if (count < 0)
+                return false;
+            written += count;
+        }
+        return true;
+    }
+
+    bool success = cipher_file_pwrite(f, data, size, f->size);
+    f->position = f->size;
+    return success;
+}
+
+bool cipher_file_truncate(cipher_file* f, long long size)
+{
+    assert(f);
+
+    if (!f->encrypted)
+        return ftruncate(f->fd, size) == 0;
+
+    assert(size >= 0 && size <= f->size);
+
+    // the new last chunk was a full one
+    long long index = size / CIPHER_CHUNK_SIZE;
+    if (index != f->size / CIPHER_CHUNK_SIZE && size % CIPHER_CHUNK_SIZE != 0)
+    {
+        if (f->cached == index)
+            memcpy(f->tail, f->cache, CIPHER_CHUNK_SIZE);
+        else if (!read_chunk(f, index, f->tail, CIPHER_CHUNK_SIZE, false))
+            return false;
+    }
+
+    if (f->cached >= index)
+        f->cached = -1;
+
+    if (ftruncate(f->fd, chunk_offset(index)) != 0)
+        return false;
+
+    f->size = size;
+    f->dirty = true;
+    if (f->position > size)
+        f->position = size;
+
+    return true;
+}
+
+/**
+ * Writes the last chunk of a file, if it changed, and cuts what followed it
+ * @return true if successful, false otherwise
+ */
+static bool flush(cipher_file* f)
+{
+    if (!f->dirty)
+        return true;
+
+    long long index = f->size / CIPHER_CHUNK_SIZE;
+    size_t length = f->size % CIPHER_CHUNK_SIZE;
+
+    if (!write_chunk(f, index, f->tail, length, true) || ftruncate(f->fd, chunk_offset(index) + length + CHUNK_OVERHEAD) != 0)
+        return false;
+
+    f->dirty = false;
+    return true;
+}
+
+bool cipher_file_sync(cipher_file* f)
+{
+    assert(f);
+
+    return (!f->encrypted || flush(f)) && fdatasync(f->fd) == 0;
+}
+
+bool cipher_file_close(cipher_file* f)
+{
+    assert(f);
+
+    bool success = !f->encrypted || flush(f);
+    close(f->fd);
+    release_file(f);
+
+    return success;
+}
+
+/**
+ * Reads from a stream opened by cipher_fopen
+ */
+static ssize_t stream_read(void* cookie, char* buffer, size_t size)
+{
+    cipher_stream* stream = cookie;
+    return cipher_file_read(&stream->file, buffer, size);
+}
+
+/**
+ * Writes to a stream opened by cipher_fopen
+ */
+static ssize_t stream_write(void* cookie, const char* data, size_t size)
+{
+    cipher_stream* stream = cookie;
+    return cipher_file_write(&stream->file, data, size) ? (ssize_t)size : 0;
+}
+
+/**
+ * Moves the position of a stream opened by cipher_fopen (the ones written stay at their end)
+ */
+static int stream_seek(void* cookie, off64_t* offset, int whence)
+{
+    cipher_stream* stream = cookie;
+    cipher_file* f = &stream->file;
+
+    long long position = *offset;
+    if (whence == SEEK_CUR)
+        position += f->position;
+    else if (whence == SEEK_END)
+        position += f->size;
+
+    if (position < 0 || position > f->size || (stream->write && position != f->size))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    f->position = position;
+    *offset = position;
+    return 0;
+}
+
+/**
+ * Closes a stream opened by cipher_fopen
+ */
+static int stream_close(void* cookie)
+{
+    cipher_stream* stream = cookie;
+    bool success = cipher_file_close(&stream->file);
+    free(stream);
+
+    return success ? 0 : EOF;
+}
+
+FILE* cipher_fopen(const char* path, const char* mode)
+{
+    assert(path);
+    assert(mode && (strcmp(mode, "r") == 0 || strcmp(mode, "w") == 0));
+
+    bool write = mode[0] == 'w';
+
+    if (!KeyLoaded)
+    {
+        FILE* file = fopen(path, mode);
+        if (file == NULL || write)
+            return file;
+
+        // it would only be read as garbage
+        char magic[sizeof(CIPHER_MAGIC) - 1];
+        if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, CIPHER_MAGIC, sizeof(magic)) == 0)
+        {
+            fprintf(stderr, "%s is encrypted, its key is needed (-k).\n", path);
+            fclose(file);
+            errno = EACCES;
+            return NULL;
+        }
+
+        rewind(file);
+        return file;
+    }
+
+    int fd = write ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666) : open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    cipher_stream* stream = malloc(sizeof(cipher_stream));
+    stream->write = write;
+
+    if (!(write ? cipher_file_create(&stream->file, fd) : cipher_file_open(&stream->file, fd)))
+    {
+        int error = errno;
+        if (error == EBADMSG)
+            fprintf(stderr, "%s is not encrypted with this key, or was damaged.\n", path);
+
+        close(fd);
+        free(stream);
+        errno = error;
+        return NULL;
+    }
+
+    cookie_io_functions_t io = { stream_read, stream_write, stream_seek, stream_close };
+    FILE* file = fopencookie(stream, mode, io);
+    if (file == NULL)
+        stream_close(stream);
+
+    return file;
+}
+
+int cipher_seal_line(const char* line, int length, char* sealed)
+{
+    assert(line && length > 0);
+    assert(sealed);
+
+    int raw_length = length + CHUNK_OVERHEAD;
+    unsigned char* raw = malloc(raw_length);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+    int count = -1;
+    if (ctx != NULL && seal(ctx, NULL, 0, (const unsigned char*)line, length, raw))
+    {
+        count = EVP_EncodeBlock((unsigned char*)sealed, raw, raw_length);
+        sealed[count++] = '\n';
+        sealed[count] = '\0';
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+    free(raw);
+    return count;
+}
+
+int cipher_open_line(char* line, int length)
+{
+    assert(line);
+
+    int encoded = length - 1;
+    if (length < 2 || line[encoded] != '\n' || encoded % 4 != 0)
+        return -1;
+
+    unsigned char* raw = malloc(encoded / 4 * 3);
+    int raw_length = EVP_DecodeBlock(raw, (const unsigned char*)line, encoded);
+
+    // the padding of the last group is decoded as zeros
+    if (raw_length > 0 && line[encoded - 1] == '=')
+        raw_length -= line[encoded - 2] == '=' ? 2 : 1;
+
+    int plain_length = raw_length - CHUNK_OVERHEAD;
+    EVP_CIPHER_CTX* ctx = plain_length > 0 ? EVP_CIPHER_CTX_new() : NULL;
+    bool success = ctx != NULL && unseal(ctx, NULL, 0, raw, plain_length, (unsigned char*)line);
+
+    if (success)
+        line[plain_length] = '\0';
+
+    EVP_CIPHER_CTX_free(ctx);
+    free(raw);
+    return success ? plain_length : -1;
+}
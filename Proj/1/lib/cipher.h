@@ -0,0 +1,205 @@
+#ifndef CIPHER_H_
+#define CIPHER_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** @defgroup cipher cipher
+ * @{
+ * Authenticated encryption at rest of the files of a backup destination.
+ *
+ * Once a key is loaded (see cipher_load_key), stored files are written as
+ * a CIPHER_HEADER_SIZE header followed by chunks of CIPHER_CHUNK_SIZE bytes
+ * of plaintext, each encrypted with AES-256-GCM under its own random nonce
+ * (stored before it, its tag after it). The index of the chunk and whether
+ * it is the last one are authenticated with it, so chunks can not be moved
+ * and a file can not be cut at a chunk boundary unnoticed. Every chunk but
+ * the last one is full, so a chunk is found from the offset of its bytes:
+ * files are read and rewritten in place one chunk at a time, the chunks
+ * are independent of each other. The processor's AES and carry-less
+ * multiply instructions are used by OpenSSL when it has them.
+ *
+ * The manifests read through stdio are stored the same way (cipher_fopen).
+ * Append-only logs, whose lines are written by concurrent copies and may
+ * be cut by a crash, seal each line instead (cipher_seal_line).
+ *
+ * Without a key, files are read and written as they are.
+ */
+
+/// Size of a key, in bytes
+#define CIPHER_KEY_SIZE 32
+
+/// Number of bytes of plaintext of each chunk (the last one of a file is shorter)
+#define CIPHER_CHUNK_SIZE (64 * 1024)
+
+/// Number of bytes of the nonce stored before each chunk
+#define CIPHER_NONCE_SIZE 12
+
+/// Number of bytes of the tag stored after each chunk
+#define CIPHER_TAG_SIZE 16
+
+/// First bytes of an encrypted file
+#define CIPHER_MAGIC "BCKPGCM1"
+
+/// Number of bytes of the header of an encrypted file: CIPHER_MAGIC and the chunk size
+#define CIPHER_HEADER_SIZE 16
+
+/// Size of the buffer cipher_seal_line needs for a line of length bytes
+#define CIPHER_SEALED_SIZE(length) ((((length) + CIPHER_NONCE_SIZE + CIPHER_TAG_SIZE + 2) / 3) * 4 + 2)
+
+struct evp_cipher_ctx_st;
+
+/**
+ * File of a backup destination, encrypted if a key is loaded
+ */
+typedef struct
+{
+    int fd; ///< File descriptor, closed by cipher_file_close
+    bool encrypted; ///< Read and written by chunks, otherwise as it is
+    long long size; ///< Number of bytes of plaintext
+    long long position; ///< Offset of the next cipher_file_read
+    unsigned char* tail; ///< Plaintext of the last chunk, written once full or when the file is synced or closed
+    bool dirty; ///< The last chunk changed since it was written
+    unsigned char* cache; ///< Plaintext of the chunk read last
+    long long cached; ///< Index of the chunk in cache, -1 if none
+    unsigned char* io; ///< Encrypted chunk being read or written
+    struct evp_cipher_ctx_st* ctx; ///< OpenSSL cipher context
+} cipher_file;
+
+/**
+ * Loads the key used by the rest of the process. The key file holds 32 bytes, either raw or as
+ *  64 hexadecimal digits (e.g. "head -c 32 /dev/urandom > key").
+ * @param  path Path of the key file
+ * @return      true if successful, false otherwise (an error is printed)
+ */
+bool cipher_load_key(const char* path);
+
+/**
+ * Checks if a key was loaded
+ * @return true if files are encrypted, false otherwise
+ */
+bool cipher_enabled(void);
+
+/**
+ * Starts writing a new, empty file
+ * @param  f  cipher_file struct to initialize. Must not be NULL.
+ * @param  fd Empty file, opened for writing (and reading, if it is rewritten in place)
+ * @return    true if successful, false otherwise (fd is not closed)
+ */
+bool cipher_file_create(cipher_file* f, int fd);
+
+/**
+ * Opens an existing file
+ * @param  f  cipher_file struct to initialize. Must not be NULL.
+ * @param  fd File, opened for reading (and writing, if it is written)
+ * @return    true if successful, false if it could not be read, is not encrypted with the key, or was
+ *            damaged or cut (errno is EBADMSG) (fd is not closed)
+ */
+bool cipher_file_open(cipher_file* f, int fd);
+
+/**
+ * Opens a file whose writing was interrupted, keeping its first bytes (the rest may not have reached the disk)
+ * @param  f    cipher_file struct to initialize. Must not be NULL.
+ * @param  fd   File, opened for reading and writing
+ * @param  size Number of bytes of plaintext kept
+ * @return      true if successful, false if those bytes could not be read back (fd is not closed)
+ */
+bool cipher_file_resume(cipher_file* f, int fd, long long size);
+
+/**
+ * Uses a file as it is, even if a key is loaded (e.g. a restored file)
+ * @param f  cipher_file struct to initialize. Must not be NULL.
+ * @param fd File descriptor
+ */
+void cipher_file_plain(cipher_file* f, int fd);
+
+/**
+ * Reads the next bytes of a file
+ * @param  f      cipher_file struct. Must not be NULL.
+ * @param  buffer Buffer to read to
+ * @param  size   Maximum number of bytes read
+ * @return        Number of bytes read, 0 at the end of the file, -1 on errors
+ */
+ssize_t cipher_file_read(cipher_file* f, void* buffer, size_t size);
+
+/**
+ * Reads bytes of a file at an offset
+ * @param  f      cipher_file struct. Must not be NULL.
+ * @param  buffer Buffer to read to
+ * @param  size   Maximum number of bytes read
+ * @param  offset Offset of the first byte read
+ * @return        Number of bytes read, 0 at the end of the file, -1 on errors
+ */
+ssize_t cipher_file_pread(cipher_file* f, void* buffer, size_t size, long long offset);
+
+/**
+ * Appends bytes to a file
+ * @param  f    cipher_file struct. Must not be NULL.
+ * @param  data Bytes to write
+ * @param  size Number of bytes of data
+ * @return      true if successful, false otherwise
+ */
+bool cipher_file_write(cipher_file* f, const void* data, size_t size);
+
+/**
+ * Writes bytes of a file at an offset, up to its end
+ * @param  f      cipher_file struct. Must not be NULL.
+ * @param  data   Bytes to write
+ * @param  size   Number of bytes of data
+ * @param  offset Offset of the first byte written, at most the size of the file
+ * @return        true if successful, false otherwise
+ */
+bool cipher_file_pwrite(cipher_file* f, const void* data, size_t size, long long offset);
+
+/**
+ * Cuts a file
+ * @param  f    cipher_file struct. Must not be NULL.
+ * @param  size New size, at most the current one
+ * @return      true if successful, false otherwise
+ */
+bool cipher_file_truncate(cipher_file* f, long long size);
+
+/**
+ * Writes the last chunk of a file and waits until its data is on disk (see fdatasync)
+ * @param  f cipher_file struct. Must not be NULL.
+ * @return   true if successful, false otherwise
+ */
+bool cipher_file_sync(cipher_file* f);
+
+/**
+ * Writes the last chunk of a file, closes it and releases the resources of f
+ * @param  f cipher_file struct. Must not be NULL.
+ * @return   true if successful, false if the last chunk could not be written
+ */
+bool cipher_file_close(cipher_file* f);
+
+/**
+ * Opens a manifest of a backup destination as a stream, encrypted if a key is loaded. Without
+ *  a key, an encrypted file is not opened.
+ * @param  path Path of the file
+ * @param  mode "r" to read it or "w" to write it from the start
+ * @return      The stream, NULL on errors (an error is printed if the file is encrypted differently)
+ */
+FILE* cipher_fopen(const char* path, const char* mode);
+
+/**
+ * Encrypts a line of an append-only log, as a line of base64 text
+ * @param  line   Line, ending with '\n'
+ * @param  length Number of bytes of line
+ * @param  sealed Buffer of CIPHER_SEALED_SIZE(length) bytes to write the sealed line to, ending with '\n'
+ * @return        Number of bytes of the sealed line, -1 on errors
+ */
+int cipher_seal_line(const char* line, int length, char* sealed);
+
+/**
+ * Decrypts a line written by cipher_seal_line, in place (followed by a null character)
+ * @param  line   Sealed line, ending with '\n'. Must not be NULL.
+ * @param  length Number of bytes of line
+ * @return        Number of bytes of the line, -1 if it is cut, was not sealed with the key or was changed
+ */
+int cipher_open_line(char* line, int length);
+
+/**@}*/
+
+#endif
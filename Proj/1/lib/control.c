@@ -0,0 +1,161 @@
+#include "control.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <assert.h>
+
+/**
+ * Fills the address of a socket
+ * @return true if the path fits, false otherwise
+ */
+static bool control_address(const char* path, struct sockaddr_un* address)
+{
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Control socket path %s is too long.\n", path);
+        return false;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+int control_listen(const char* path)
+{
+    assert(path);
+
+    struct sockaddr_un address;
+    if (!control_address(path, &address))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    int bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    if (bound != 0 && errno == EADDRINUSE)
+    {
+        // left by a backup that was killed, unless it is still answering
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool alive = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0)
+            close(probe);
+
+        if (alive)
+        {
+            fprintf(stderr, "Another backup is listening on %s.\n", path);
+            close(fd);
+            return -1;
+        }
+
+        unlink(path);
+        bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    }
+
+    if (bound != 0 || listen(fd, 8) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int control_accept(int fd, char* command, size_t size)
+{
+    assert(command);
+    assert(size > 0);
+
+    int client = accept(fd, NULL, NULL);
+    if (client < 0)
+        return -1;
+
+    fcntl(client, F_SETFD, FD_CLOEXEC);
+
+    // a client that connects and says nothing must not hold up the backup
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    size_t length = 0;
+    while (length < size - 1)
+    {
+        ssize_t count = read(client, command + length, size - 1 - length);
+        if (count <= 0)
+            break;
+
+        length += count;
+        if (memchr(command, '\n', length) != NULL)
+            break;
+    }
+
+    command[length] = '\0';
+    command[strcspn(command, "\r\n")] = '\0';
+
+    return client;
+}
+
+int control_request(const char* path, const char* command, FILE* out)
+{
+    assert(path);
+    assert(command);
+    assert(out);
+
+    struct sockaddr_un address;
+    if (!control_address(path, &address))
+        return 2;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 2;
+    }
+
+    char line[CONTROL_COMMAND_SIZE];
+    int length = snprintf(line, sizeof(line), "%s\n", command);
+    if (length >= (int)sizeof(line) || write(fd, line, length) != length)
+    {
+        fprintf(stderr, "Could not send command %s.\n", command);
+        close(fd);
+        return 2;
+    }
+
+    char buffer[4096];
+    ssize_t count;
+    size_t total = 0;
+    bool ok = false;
+
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        if (total == 0)
+            ok = count >= 2 && strncmp(buffer, "ok", 2) == 0;
+
+        fwrite(buffer, 1, count, out);
+        total += count;
+    }
+
+    close(fd);
+
+    if (count < 0 || total == 0)
+    {
+        fprintf(stderr, "No reply to command %s.\n", command);
+        return 2;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/** @defgroup control control
+ * @{
+ * Unix-domain control socket of a running backup.
+ *
+ * A client connects, writes one command line and reads the reply until the
+ * server closes the connection. Replies start with "ok" or "error"; the
+ * lines after the first one are command specific. Commands are served one
+ * at a time by the process waiting for the next iteration.
+ */
+
+/// File name of the control socket of a backup destination, when no other path is given
+#define CONTROL_SOCKET_NAME "__bckpctl__"
+
+/// Maximum length of a command line, including the newline
+#define CONTROL_COMMAND_SIZE 64
+
+/**
+ * Creates a listening control socket. A stale socket file is replaced, but not
+ *  one another process still listens on.
+ * @param  path Path of the socket
+ * @return      The listening file descriptor (non-blocking), -1 on errors
+ */
+int control_listen(const char* path);
+
+/**
+ * Accepts a client and reads its command, waiting at most a second for it
+ * @param  fd      Listening file descriptor returned by control_listen
+ * @param  command Buffer for the command, without the newline
+ * @param  size    Size of command
+ * @return         The file descriptor of the client, to write the reply to and close, -1 on errors
+ */
+int control_accept(int fd, char* command, size_t size);
+
+/**
+ * Sends a command to a control socket and copies the reply to a stream
+ * @param  path    Path of the socket
+ * @param  command Command to send
+ * @param  out     Where the reply is written. Must not be NULL.
+ * @return         0 if the reply starts with "ok", 1 if it does not, 2 on errors
+ */
+int control_request(const char* path, const char* command, FILE* out);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,136 @@
+#include "copyrecord.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "namesort.h"
+#include "cipher.h"
+
+bool copy_record_add(const char* folder, const char* name, uint32_t crc, bool consistent)
+{
+    assert(folder);
+    assert(name);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, COPY_RECORD_NAME);
+
+    // one write per line, appends of concurrent copies do not interleave
+    char line[PATH_MAX + 16];
+    int length = snprintf(line, sizeof(line), "%08" PRIx32 "%s %s\n", crc, consistent ? "" : "!", name);
+    if (length >= (int)sizeof(line))
+        return false;
+
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0664);
+    if (fd < 0)
+    {
+        perror("Error opening copy record");
+        return false;
+    }
+
+    // sealed whole, a line cut by a crash does not open
+    char sealed[CIPHER_SEALED_SIZE(sizeof(line))];
+    if (cipher_enabled())
+        length = cipher_seal_line(line, length, sealed);
+
+    bool success = length > 0 && write(fd, cipher_enabled() ? sealed : line, length) == length;
+    if (!success)
+        perror("Error writing copy record");
+
+    close(fd);
+    return success;
+}
+
+/**
+ * qsort comparator of copy_record_entry by name
+ */
+static int entry_compare(const void* a, const void* b)
+{
+    return name_compare(((const copy_record_entry*)a)->name, ((const copy_record_entry*)b)->name);
+}
+
+int copy_record_read(const char* folder, copy_record* record)
+{
+    assert(folder);
+    assert(record);
+
+    record->entries = NULL;
+    record->count = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, COPY_RECORD_NAME);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 1;
+
+    int capacity = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &line_size, file)) > 0)
+    {
+        if (cipher_enabled() && (length = cipher_open_line(line, length)) < 0)
+            continue;
+
+        uint32_t crc;
+        int crc_end = 0;
+
+        if (line[length - 1] == '\n')
+            line[length - 1] = '\0';
+
+        if (sscanf(line, "%" SCNx32 "%n", &crc, &crc_end) != 1 || crc_end == 0)
+            continue; // a copy interrupted while writing its line
+
+        bool consistent = line[crc_end] != '!';
+        int name_start = crc_end + (consistent ? 1 : 2);
+        if (line[name_start - 1] != ' ' || line[name_start] == '\0')
+            continue;
+
+        if (record->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            record->entries = realloc(record->entries, capacity * sizeof(copy_record_entry));
+        }
+
+        record->entries[record->count].name = strdup(line + name_start);
+        record->entries[record->count].crc = crc;
+        record->entries[record->count].consistent = consistent;
+        record->count++;
+    }
+
+    free(line);
+    fclose(file);
+
+    // lines are in the order the copies finished
+    qsort(record->entries, record->count, sizeof(copy_record_entry), entry_compare);
+
+    return 0;
+}
+
+const copy_record_entry* copy_record_find(const copy_record* record, const char* name)
+{
+    assert(record);
+    assert(name);
+
+    copy_record_entry key = { (char*)name, 0, true };
+    return bsearch(&key, record->entries, record->count, sizeof(copy_record_entry), entry_compare);
+}
+
+void copy_record_free(copy_record* record)
+{
+    assert(record);
+
+    for (int i = 0; i < record->count; ++i)
+        free(record->entries[i].name);
+
+    free(record->entries);
+    record->entries = NULL;
+    record->count = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef COPYRECORD_H_
+#define COPYRECORD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @defgroup copyrecord copyrecord
+ * @{
+ * Checksums of the files stored in an iteration folder.
+ *
+ * Files are copied by parallel processes after the backup info of the
+ * iteration is written, so each copy appends its own line
+ * ("<crc32c> <name>") to a record file in the folder, in a single write.
+ * A file that kept changing while it was copied, so its stored data may
+ * mix several versions, is recorded as "<crc32c>! <name>".
+ */
+
+/// File name of the copy record of an iteration folder
+#define COPY_RECORD_NAME "__bckpcrc__"
+
+/**
+ * Checksum of a stored file
+ */
+typedef struct
+{
+    char* name; ///< Name of the file
+    uint32_t crc; ///< CRC32C of the stored data (see hash_crc32c)
+    bool consistent; ///< Cleared if the file kept changing while it was copied (see capture_check)
+} copy_record_entry;
+
+/**
+ * Copy record of an iteration folder
+ */
+typedef struct
+{
+    copy_record_entry* entries; ///< Entries, in byte order of their names
+    int count; ///< Number of entries
+} copy_record;
+
+/**
+ * Appends the checksum of a stored file to the copy record of a folder
+ * @param  folder     Iteration folder
+ * @param  name       Name of the stored file
+ * @param  crc        CRC32C of the stored data
+ * @param  consistent false if the file kept changing while it was copied
+ * @return            true if successful, false otherwise
+ */
+bool copy_record_add(const char* folder, const char* name, uint32_t crc, bool consistent);
+
+/**
+ * Reads the copy record of a folder
+ * @param  folder Iteration folder
+ * @param  record copy_record struct to initialize. Must not be NULL.
+ * @return        0 upon success, 1 if the folder has no copy record (record is empty), EOF on errors
+ */
+int copy_record_read(const char* folder, copy_record* record);
+
+/**
+ * Finds the entry of a file
+ * @param  record copy_record struct. Must not be NULL.
+ * @param  name   Name of the file. Must not be NULL.
+ * @return        The entry, NULL if not found
+ */
+const copy_record_entry* copy_record_find(const copy_record* record, const char* name);
+
+/**
+ * Releases the resources of a copy record
+ * @param record copy_record struct. Must not be NULL.
+ */
+void copy_record_free(copy_record* record);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,337 @@
+#include "dedup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "hash.h"
+#include "cipher.h"
+
+#define DEDUP_BUFFER_SIZE (256 * 1024)
+
+/**
+ * Slot of a size and checksum in a table of the specified capacity
+ */
+static size_t entry_slot(uint32_t crc, long long size, size_t capacity)
+{
+    uint64_t hash = (crc ^ (uint64_t)size * 0x9e3779b97f4a7c15ULL) * 0xff51afd7ed558ccdULL;
+    return (hash >> 32) & (capacity - 1);
+}
+
+/**
+ * Slot of a size in a table of the specified capacity
+ */
+static size_t size_slot(long long size, size_t capacity)
+{
+    return (((uint64_t)size * 0x9e3779b97f4a7c15ULL) >> 32) & (capacity - 1);
+}
+
+/**
+ * Doubles the capacity of the entries table
+ */
+static void grow_entries(dedup_index* index)
+{
+    dedup_entry* old = index->entries;
+    size_t old_capacity = index->capacity;
+
+    index->capacity = old_capacity ? old_capacity * 2 : 1024;
+    index->entries = calloc(index->capacity, sizeof(dedup_entry));
+
+    for (size_t i = 0; i < old_capacity; ++i)
+    {
+        if (old[i].path == NULL)
+            continue;
+
+        size_t slot = entry_slot(old[i].crc, old[i].size, index->capacity);
+        while (index->entries[slot].path != NULL)
+            slot = (slot + 1) & (index->capacity - 1);
+
+        index->entries[slot] = old[i];
+    }
+
+    free(old);
+}
+
+/**
+ * Doubles the capacity of the sizes table
+ */
+static void grow_sizes(dedup_index* index)
+{
+    long long* old = index->sizes;
+    size_t old_capacity = index->sizes_capacity;
+
+    index->sizes_capacity = old_capacity ? old_capacity * 2 : 1024;
+    index->sizes = malloc(index->sizes_capacity * sizeof(long long));
+    for (size_t i = 0; i < index->sizes_capacity; ++i)
+        index->sizes[i] = -1;
+
+    for (size_t i = 0; i < old_capacity; ++i)
+    {
+        if (old[i] < 0)
+            continue;
+
+        size_t slot = size_slot(old[i], index->sizes_capacity);
+        while (index->sizes[slot] >= 0)
+            slot = (slot + 1) & (index->sizes_capacity - 1);
+
+        index->sizes[slot] = old[i];
+    }
+
+    free(old);
+}
+
+int dedup_index_load(dedup_index* index, const char* dst)
+{
+    assert(index);
+    assert(dst);
+
+    memset(index, 0, sizeof(dedup_index));
+    grow_entries(index);
+    grow_sizes(index);
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", dst, DEDUP_INDEX_NAME);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0; // nothing stored yet, or backed up before the index existed
+
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &line_size, file)) > 0)
+    {
+        unsigned int crc;
+        long long size;
+        int path_start = 0;
+
+        // a line cut by a crash is ignored
+        if (cipher_enabled() && (length = cipher_open_line(line, length)) < 0)
+            continue;
+        if (line[length - 1] != '\n' || sscanf(line, "%x %lld%n", &crc, &size, &path_start) != 2
+            || line[path_start] != ' ')
+            continue;
+
+        line[length - 1] = '\0';
+        dedup_index_add(index, crc, size, line + path_start + 1, false);
+    }
+
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+void dedup_index_add_size(dedup_index* index, long long size)
+{
+    assert(index);
+
+    if (dedup_index_has_size(index, size))
+        return;
+
+    if (2 * (index->sizes_count + 1) > index->sizes_capacity)
+        grow_sizes(index);
+
+    size_t slot = size_slot(size, index->sizes_capacity);
+    while (index->sizes[slot] >= 0)
+        slot = (slot + 1) & (index->sizes_capacity - 1);
+
+    index->sizes[slot] = size;
+    index->sizes_count++;
+}
+
+bool dedup_index_has_size(const dedup_index* index, long long size)
+{
+    assert(index);
+
+    for (size_t slot = size_slot(size, index->sizes_capacity); index->sizes[slot] >= 0;
+         slot = (slot + 1) & (index->sizes_capacity - 1))
+        if (index->sizes[slot] == size)
+            return true;
+
+    return false;
+}
+
+const dedup_entry* dedup_index_find(const dedup_index* index, uint32_t crc, long long size)
+{
+    assert(index);
+
+    for (size_t slot = entry_slot(crc, size, index->capacity); index->entries[slot].path != NULL;
+         slot = (slot + 1) & (index->capacity - 1))
+        if (index->entries[slot].crc == crc && index->entries[slot].size == size)
+            return &index->entries[slot];
+
+    return NULL;
+}
+
+void dedup_index_add(dedup_index* index, uint32_t crc, long long size, const char* path, bool pending)
+{
+    assert(index);
+    assert(path);
+
+    if (2 * (index->count + 1) > index->capacity)
+        grow_entries(index);
+
+    size_t slot = entry_slot(crc, size, index->capacity);
+    while (index->entries[slot].path != NULL)
+        slot = (slot + 1) & (index->capacity - 1);
+
+    index->entries[slot].crc = crc;
+    index->entries[slot].size = size;
+    index->entries[slot].path = strdup(path);
+    index->entries[slot].pending = pending;
+    index->count++;
+
+    dedup_index_add_size(index, size);
+}
+
+bool dedup_index_save(dedup_index* index, const char* dst)
+{
+    assert(index);
+    assert(dst);
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", dst, DEDUP_INDEX_NAME);
+
+    FILE* file = NULL;
+
+    for (size_t i = 0; i < index->capacity; ++i)
+    {
+        dedup_entry* entry = &index->entries[i];
+        if (entry->path == NULL || !entry->pending)
+            continue;
+
+        if (file == NULL && (file = fopen(path, "a")) == NULL)
+        {
+            perror(path);
+            return false;
+        }
+
+        char line[PATH_MAX + 64];
+        int length = snprintf(line, sizeof(line), "%08x %lld %s\n", entry->crc, entry->size, entry->path);
+
+        char sealed[CIPHER_SEALED_SIZE(sizeof(line))];
+        if (cipher_enabled())
+            length = cipher_seal_line(line, length, sealed);
+
+        if (length > 0)
+            fwrite(cipher_enabled() ? sealed : line, 1, length, file);
+        entry->pending = false;
+    }
+
+    if (file != NULL && fclose(file) != 0)
+    {
+        perror(path);
+        return false;
+    }
+
+    return true;
+}
+
+void dedup_index_free(dedup_index* index)
+{
+    assert(index);
+
+    for (size_t i = 0; i < index->capacity; ++i)
+        free(index->entries[i].path);
+
+    free(index->entries);
+    free(index->sizes);
+    memset(index, 0, sizeof(dedup_index));
+}
+
+bool dedup_file_crc(const char* path, uint32_t* crc)
+{
+    assert(path);
+    assert(crc);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char* buffer = malloc(DEDUP_BUFFER_SIZE);
+    ssize_t count;
+
+    *crc = 0;
+    while ((count = read(fd, buffer, DEDUP_BUFFER_SIZE)) > 0)
+        *crc = hash_crc32c(*crc, buffer, count);
+
+    free(buffer);
+    close(fd);
+
+    return count == 0;
+}
+
+/**
+ * Reads up to size bytes, retrying short reads
+ * @return Number of bytes read, -1 on errors
+ */
+static ssize_t read_full(cipher_file* file, char* buffer, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t count = cipher_file_read(file, buffer + done, size - done);
+        if (count < 0)
+            return -1;
+        if (count == 0)
+            break;
+        done += count;
+    }
+
+    return done;
+}
+
+bool dedup_files_equal(const char* a, const char* b, uint32_t* crc)
+{
+    assert(a);
+    assert(b);
+
+    // the source file is read as it is, the stored one through its cipher
+    cipher_file file_a, file_b;
+    int fd_a = open(a, O_RDONLY);
+    int fd_b = open(b, O_RDONLY);
+    if (fd_a >= 0)
+        cipher_file_plain(&file_a, fd_a);
+    if (fd_b >= 0 && !cipher_file_open(&file_b, fd_b))
+    {
+        close(fd_b);
+        fd_b = -1;
+    }
+
+    char* buffer_a = malloc(2 * DEDUP_BUFFER_SIZE);
+    char* buffer_b = buffer_a + DEDUP_BUFFER_SIZE;
+    bool equal = fd_a >= 0 && fd_b >= 0;
+    uint32_t checksum = 0;
+
+    while (equal)
+    {
+        ssize_t count_a = read_full(&file_a, buffer_a, DEDUP_BUFFER_SIZE);
+        ssize_t count_b = read_full(&file_b, buffer_b, DEDUP_BUFFER_SIZE);
+
+        if (count_a < 0 || count_a != count_b || memcmp(buffer_a, buffer_b, count_a) != 0)
+            equal = false;
+        else if (count_a == 0)
+            break;
+        else
+            checksum = hash_crc32c(checksum, buffer_a, count_a);
+    }
+
+    free(buffer_a);
+    if (fd_a >= 0)
+        cipher_file_close(&file_a);
+    if (fd_b >= 0)
+        cipher_file_close(&file_b);
+
+    if (equal && crc != NULL)
+        *crc = checksum;
+
+    return equal;
+}
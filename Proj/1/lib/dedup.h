@@ -0,0 +1,126 @@
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @defgroup dedup dedup
+ * @{
+ * Index of the contents stored in a backup destination, used to store
+ * identical files only once.
+ *
+ * The index maps the size and CRC32C of a stored file to its path (relative
+ * to the destination, "<folder>/<name>"), in a file appended to after each
+ * iteration. A file whose size and checksum are in the index is compared
+ * byte by byte with the stored one and hardlinked to it instead of being
+ * copied, so a checksum collision never links different contents.
+ */
+
+/// File name of the content index of a backup destination
+#define DEDUP_INDEX_NAME "__bckpdedup__"
+
+/// Files smaller than this are always copied (a link saves little and the checksum costs a read)
+#define DEDUP_MIN_SIZE 4096
+
+/**
+ * Stored content
+ */
+typedef struct
+{
+    uint32_t crc; ///< CRC32C of the contents
+    long long size; ///< Size of the contents
+    char* path; ///< Path of the stored file, relative to the destination (NULL for free slots)
+    bool pending; ///< Stored in the current iteration, not yet in the index file (and maybe not yet copied)
+} dedup_entry;
+
+/**
+ * Content index of a backup destination, in memory
+ */
+typedef struct
+{
+    dedup_entry* entries; ///< Hash table of entries, by size and checksum (open addressing)
+    size_t capacity; ///< Number of slots of entries (a power of 2)
+    size_t count; ///< Number of entries
+    long long* sizes; ///< Hash table of the sizes worth checksumming (-1 for free slots)
+    size_t sizes_capacity; ///< Number of slots of sizes (a power of 2)
+    size_t sizes_count; ///< Number of sizes
+} dedup_index;
+
+/**
+ * Loads the content index of a destination (an empty one if it has none)
+ * @param  index dedup_index struct to initialize. Must not be NULL.
+ * @param  dst   Backup destination
+ * @return       0 upon success, different otherwise
+ */
+int dedup_index_load(dedup_index* index, const char* dst);
+
+/**
+ * Marks a size as worth checksumming, e.g. because several new files have it
+ * @param index dedup_index struct. Must not be NULL.
+ * @param size  Size of a file
+ */
+void dedup_index_add_size(dedup_index* index, long long size);
+
+/**
+ * Checks if files of a size may be stored already (see dedup_index_add_size)
+ * @param  index dedup_index struct. Must not be NULL.
+ * @param  size  Size of a file
+ * @return       true if it is worth checksumming files of this size, false otherwise
+ */
+bool dedup_index_has_size(const dedup_index* index, long long size);
+
+/**
+ * Finds stored contents with the specified size and checksum
+ * @param  index dedup_index struct. Must not be NULL.
+ * @param  crc   CRC32C of the contents
+ * @param  size  Size of the contents
+ * @return       The entry, NULL if none
+ */
+const dedup_entry* dedup_index_find(const dedup_index* index, uint32_t crc, long long size);
+
+/**
+ * Adds stored contents to the index, in memory (see dedup_index_save)
+ * @param index   dedup_index struct. Must not be NULL.
+ * @param crc     CRC32C of the contents
+ * @param size    Size of the contents
+ * @param path    Path of the stored file, relative to the destination
+ * @param pending true if the file is being stored in the current iteration
+ */
+void dedup_index_add(dedup_index* index, uint32_t crc, long long size, const char* path, bool pending);
+
+/**
+ * Appends the pending entries to the index file of a destination. Must only be called
+ *  once they are all stored.
+ * @param  index dedup_index struct. Must not be NULL.
+ * @param  dst   Backup destination
+ * @return       true if successful, false otherwise
+ */
+bool dedup_index_save(dedup_index* index, const char* dst);
+
+/**
+ * Releases the resources of an index
+ * @param index dedup_index struct. Must not be NULL.
+ */
+void dedup_index_free(dedup_index* index);
+
+/**
+ * Computes the CRC32C of a whole file
+ * @param  path Path of the file
+ * @param  crc  Resulting checksum. Must not be NULL.
+ * @return      true if successful, false otherwise
+ */
+bool dedup_file_crc(const char* path, uint32_t* crc);
+
+/**
+ * Compares the contents of two files
+ * @param  a   Path of a source file
+ * @param  b   Path of a stored file (encrypted if a key is loaded)
+ * @param  crc If not NULL, set to the CRC32C of the contents when they are equal
+ * @return     true if both files have the same contents, false otherwise (or on errors)
+ */
+bool dedup_files_equal(const char* a, const char* b, uint32_t* crc);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,469 @@
+#include "estimate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "hash.h"
+
+#define BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Listing of a directory, with the sizes of a sample of its files
+ */
+typedef struct
+{
+    char* path; ///< Path of the directory
+    char** subdirs; ///< Names of its subdirectories
+    int subdir_count; ///< Number of subdirectories
+    long long files; ///< Number of regular files
+    int samples; ///< Number of files sampled
+    long long sizes[ESTIMATE_FILE_SAMPLES]; ///< Sizes of the sampled files
+    bool excluded; ///< The directory is the excluded one, nothing in it is counted
+} dir_listing;
+
+/**
+ * State of a sampling
+ */
+typedef struct
+{
+    tree_estimate* estimate; ///< Estimate being made
+    bool exclude; ///< A directory is excluded
+    dev_t exclude_dev; ///< Device of the excluded directory
+    ino_t exclude_ino; ///< Inode of the excluded directory
+    const rule_set* rules; ///< Rules of the entries not counted, NULL if none
+    size_t root_length; ///< Length of the path of the root, stripped from the paths checked against rules
+    dir_listing* cache[ESTIMATE_CACHE_SIZE]; ///< Listings kept
+    int cached; ///< Number of listings kept
+    uint64_t random; ///< State of the random number generator
+} sampling;
+
+/**
+ * Returns the seconds elapsed since a time
+ */
+static double elapsed_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Returns a random number (xorshift64*), uniform enough for choosing among entries
+ */
+static uint64_t next_random(sampling* s)
+{
+    s->random ^= s->random >> 12;
+    s->random ^= s->random << 25;
+    s->random ^= s->random >> 27;
+    return s->random * 2685821657736338717ULL;
+}
+
+long long estimate_bucket_bound(int bucket)
+{
+    assert(bucket >= 0 && bucket < ESTIMATE_BUCKETS);
+
+    if (bucket == 0)
+        return 1;
+    if (bucket == ESTIMATE_BUCKETS - 1)
+        return -1;
+
+    return ESTIMATE_FIRST_BOUND << (4 * (bucket - 1));
+}
+
+/**
+ * Returns the size bucket of a file size
+ */
+static int size_bucket(long long size)
+{
+    int bucket = 0;
+    while (bucket < ESTIMATE_BUCKETS - 1 && size >= estimate_bucket_bound(bucket))
+        bucket++;
+
+    return bucket;
+}
+
+/**
+ * Keeps a sampled file among the largest ones, for the read probe
+ */
+static void keep_probe_file(tree_estimate* estimate, const char* path, long long size)
+{
+    int i = ESTIMATE_PROBE_FILES;
+    while (i > 0 && (estimate->probe_files[i - 1] == NULL || estimate->probe_sizes[i - 1] < size))
+        i--;
+
+    if (i == ESTIMATE_PROBE_FILES)
+        return;
+
+    for (int j = 0; j < ESTIMATE_PROBE_FILES; ++j) // a file sampled again is not kept twice
+        if (estimate->probe_files[j] != NULL && strcmp(estimate->probe_files[j], path) == 0)
+            return;
+
+    free(estimate->probe_files[ESTIMATE_PROBE_FILES - 1]);
+    memmove(estimate->probe_files + i + 1, estimate->probe_files + i, (ESTIMATE_PROBE_FILES - 1 - i) * sizeof(char*));
+    memmove(estimate->probe_sizes + i + 1, estimate->probe_sizes + i, (ESTIMATE_PROBE_FILES - 1 - i) * sizeof(long long));
+
+    estimate->probe_files[i] = strdup(path);
+    estimate->probe_sizes[i] = size;
+}
+
+/**
+ * Frees a listing
+ */
+static void listing_free(dir_listing* listing)
+{
+    for (int i = 0; i < listing->subdir_count; ++i)
+        free(listing->subdirs[i]);
+
+    free(listing->subdirs);
+    free(listing->path);
+    free(listing);
+}
+
+/**
+ * Checks if an entry of a directory is excluded by the rules of the sampling
+ */
+static bool rules_exclude(const sampling* s, const char* path, const char* name, bool is_dir)
+{
+    if (s->rules == NULL)
+        return false;
+
+    const char* relative = path + s->root_length;
+    relative += strspn(relative, "/");
+
+    char entry_path[4096];
+    snprintf(entry_path, sizeof(entry_path), "%s%s%s", relative, *relative ? "/" : "", name);
+    return rule_set_excludes(s->rules, entry_path, is_dir);
+}
+
+/**
+ * Lists a directory and stats a random sample of its files (reservoir sampling)
+ * @return The listing, NULL if the directory cannot be listed
+ */
+static dir_listing* list_dir(sampling* s, const char* path)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return NULL;
+
+    dir_listing* listing = calloc(1, sizeof(dir_listing));
+    listing->path = strdup(path);
+
+    struct stat buf;
+    if (s->exclude && fstat(dirfd(dir), &buf) == 0 && buf.st_dev == s->exclude_dev && buf.st_ino == s->exclude_ino)
+    {
+        listing->excluded = true;
+        closedir(dir);
+        return listing;
+    }
+
+    char* sampled[ESTIMATE_FILE_SAMPLES];
+    int capacity = 0;
+    struct dirent* entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // the same entries as the scan (see walker_open)
+        if (entry->d_type == DT_REG && !rules_exclude(s, path, entry->d_name, false))
+        {
+            listing->files++;
+
+            if (listing->files <= ESTIMATE_FILE_SAMPLES)
+                sampled[listing->samples++] = strdup(entry->d_name);
+            else
+            {
+                uint64_t j = next_random(s) % listing->files;
+                if (j < ESTIMATE_FILE_SAMPLES)
+                {
+                    free(sampled[j]);
+                    sampled[j] = strdup(entry->d_name);
+                }
+            }
+        }
+        else if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0
+                 && !rules_exclude(s, path, entry->d_name, true))
+        {
+            if (listing->subdir_count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 16;
+                listing->subdirs = realloc(listing->subdirs, capacity * sizeof(char*));
+            }
+
+            listing->subdirs[listing->subdir_count++] = strdup(entry->d_name);
+        }
+    }
+
+    closedir(dir);
+
+    s->estimate->listed++;
+    s->estimate->list_seconds += elapsed_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int kept = 0;
+    for (int i = 0; i < listing->samples; ++i)
+    {
+        char file_path[4096];
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, sampled[i]);
+
+        if (stat(file_path, &buf) == 0)
+        {
+            listing->sizes[kept++] = buf.st_size;
+            keep_probe_file(s->estimate, file_path, buf.st_size);
+        }
+
+        free(sampled[i]);
+    }
+
+    s->estimate->stated += listing->samples;
+    s->estimate->stat_seconds += elapsed_since(&start);
+    listing->samples = kept;
+
+    return listing;
+}
+
+/**
+ * Returns the listing of a directory, from the cache if it was listed before
+ */
+static dir_listing* get_listing(sampling* s, const char* path, bool* cached)
+{
+    for (int i = 0; i < s->cached; ++i)
+        if (strcmp(s->cache[i]->path, path) == 0)
+        {
+            *cached = true;
+            return s->cache[i];
+        }
+
+    dir_listing* listing = list_dir(s, path);
+
+    *cached = listing != NULL && s->cached < ESTIMATE_CACHE_SIZE;
+    if (*cached)
+        s->cache[s->cached++] = listing;
+
+    return listing;
+}
+
+bool estimate_tree(const char* root, const char* exclude, const rule_set* rules, int probes, double seconds,
+                   tree_estimate* estimate)
+{
+    assert(root);
+    assert(probes > 0);
+    assert(estimate);
+
+    memset(estimate, 0, sizeof(tree_estimate));
+
+    sampling s;
+    memset(&s, 0, sizeof(s));
+    s.estimate = estimate;
+    s.rules = rules;
+    s.root_length = strlen(root);
+    s.random = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid() ^ 0x9e3779b97f4a7c15ULL;
+
+    struct stat buf;
+    if (exclude != NULL && stat(exclude, &buf) == 0)
+    {
+        s.exclude = true;
+        s.exclude_dev = buf.st_dev;
+        s.exclude_ino = buf.st_ino;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    double files_sum = 0, files_squares = 0, bytes_sum = 0, bytes_squares = 0;
+    bool root_listed = false;
+
+    while (estimate->probes < probes && (estimate->probes == 0 || elapsed_since(&start) < seconds))
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s", root);
+
+        double weight = 1, files = 0, bytes = 0;
+
+        for (;;)
+        {
+            bool cached;
+            dir_listing* listing = get_listing(&s, path, &cached);
+            if (listing == NULL)
+                break;
+
+            root_listed = true;
+
+            if (!listing->excluded)
+            {
+                estimate->dirs += weight;
+                files += weight * listing->files;
+
+                // each sampled file stands for its share of the files of the directory
+                for (int i = 0; i < listing->samples; ++i)
+                {
+                    double share = weight * listing->files / listing->samples;
+                    long long size = listing->sizes[i];
+                    int bucket = size_bucket(size);
+
+                    estimate->bucket_files[bucket] += share;
+                    estimate->bucket_bytes[bucket] += share * size;
+                    estimate->tail_bytes += share * (size < HASH_TAIL_BLOCK_SIZE ? size : HASH_TAIL_BLOCK_SIZE);
+                    bytes += share * size;
+                }
+            }
+
+            bool descend = !listing->excluded && listing->subdir_count > 0;
+            if (descend)
+            {
+                const char* subdir = listing->subdirs[next_random(&s) % listing->subdir_count];
+                size_t length = strlen(path);
+                descend = length + 1 + strlen(subdir) < sizeof(path);
+
+                if (descend)
+                    snprintf(path + length, sizeof(path) - length, "/%s", subdir);
+                weight *= listing->subdir_count;
+            }
+
+            if (!cached)
+                listing_free(listing);
+            if (!descend)
+                break;
+        }
+
+        if (!root_listed)
+            break;
+
+        estimate->probes++;
+        files_sum += files;
+        files_squares += files * files;
+        bytes_sum += bytes;
+        bytes_squares += bytes * bytes;
+    }
+
+    for (int i = 0; i < s.cached; ++i)
+        listing_free(s.cache[i]);
+
+    if (!root_listed)
+        return false;
+
+    int n = estimate->probes;
+    estimate->files = files_sum / n;
+    estimate->bytes = bytes_sum / n;
+    estimate->dirs /= n;
+    estimate->tail_bytes /= n;
+
+    for (int i = 0; i < ESTIMATE_BUCKETS; ++i)
+    {
+        estimate->bucket_files[i] /= n;
+        estimate->bucket_bytes[i] /= n;
+    }
+
+    // standard error of the mean of the probes
+    if (n > 1)
+    {
+        double files_variance = (files_squares - files_sum * files_sum / n) / (n - 1);
+        double bytes_variance = (bytes_squares - bytes_sum * bytes_sum / n) / (n - 1);
+        estimate->files_error = 1.96 * sqrt(files_variance > 0 ? files_variance / n : 0);
+        estimate->bytes_error = 1.96 * sqrt(bytes_variance > 0 ? bytes_variance / n : 0);
+    }
+
+    return true;
+}
+
+double estimate_read_rate(const tree_estimate* estimate, double seconds)
+{
+    assert(estimate);
+
+    char* buffer = malloc(BUFFER_SIZE);
+    long long total = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < ESTIMATE_PROBE_FILES && estimate->probe_files[i] != NULL; ++i)
+    {
+        int fd = open(estimate->probe_files[i], O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        // data in the page cache would measure the memory, not the disk
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        ssize_t count;
+        while (total < ESTIMATE_PROBE_SIZE && elapsed_since(&start) < seconds &&
+               (count = read(fd, buffer, BUFFER_SIZE)) > 0)
+            total += count;
+
+        close(fd);
+
+        if (total >= ESTIMATE_PROBE_SIZE || elapsed_since(&start) >= seconds)
+            break;
+    }
+
+    double elapsed = elapsed_since(&start);
+    free(buffer);
+
+    return total > 0 && elapsed > 0 ? total / elapsed : 0;
+}
+
+double estimate_write_rate(const char* dir, double seconds)
+{
+    assert(dir);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/__bckpprobe__.%d", dir, (int)getpid());
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        perror("Error creating probe file");
+        return 0;
+    }
+
+    char* buffer = malloc(BUFFER_SIZE);
+    for (int i = 0; i < BUFFER_SIZE; ++i) // not zeros, which some file systems do not write
+        buffer[i] = (char)(i * 31 + 7);
+
+    long long total = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (total < ESTIMATE_PROBE_SIZE && elapsed_since(&start) < seconds)
+    {
+        ssize_t count = write(fd, buffer, BUFFER_SIZE);
+        if (count <= 0)
+            break;
+        total += count;
+    }
+
+    // the data is only written once it is on the disk
+    if (fdatasync(fd) != 0)
+        total = 0;
+
+    double elapsed = elapsed_since(&start);
+
+    close(fd);
+    unlink(path);
+    free(buffer);
+
+    return total > 0 && elapsed > 0 ? total / elapsed : 0;
+}
+
+void estimate_free(tree_estimate* estimate)
+{
+    assert(estimate);
+
+    for (int i = 0; i < ESTIMATE_PROBE_FILES; ++i)
+    {
+        free(estimate->probe_files[i]);
+        estimate->probe_files[i] = NULL;
+    }
+}
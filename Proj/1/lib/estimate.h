@@ -0,0 +1,108 @@
+#ifndef ESTIMATE_H_
+#define ESTIMATE_H_
+
+#include <stdbool.h>
+
+#include "rules.h"
+
+/** @defgroup estimate estimate
+ * @{
+ * Estimation of the size of a directory tree by sampling, without walking it.
+ *
+ * Each probe is a random descent from the root (Knuth's estimator): at each
+ * directory one subdirectory is chosen at random, and what is found there is
+ * weighted by the product of the numbers of subdirectories on the way, the
+ * inverse of the probability of reaching it. The mean over the probes is an
+ * unbiased estimate of the totals of the tree. The sizes of a few files of
+ * each directory reached are sampled, also weighted, for the size histogram.
+ *
+ * Listing and stat'ing times are measured on the way, and short read and
+ * write probes measure the throughput of the disks.
+ */
+
+/// Number of buckets of the size histogram: empty files, then < 4 KiB, < 64 KiB, ... (x16), the last one unbounded
+#define ESTIMATE_BUCKETS 8
+
+/// Smallest size bound of the histogram (of its second bucket)
+#define ESTIMATE_FIRST_BOUND 4096LL
+
+/// Maximum number of files whose size is sampled in each directory
+#define ESTIMATE_FILE_SAMPLES 8
+
+/// Maximum number of directory listings kept, the ones near the root are reached by every probe
+#define ESTIMATE_CACHE_SIZE 256
+
+/// Number of the largest sampled files kept for the read probe
+#define ESTIMATE_PROBE_FILES 16
+
+/// Maximum number of bytes read or written by a throughput probe
+#define ESTIMATE_PROBE_SIZE (64 * 1024 * 1024LL)
+
+/**
+ * Estimated totals of a tree
+ */
+typedef struct
+{
+    int probes; ///< Number of probes done
+    double files; ///< Estimated number of regular files
+    double dirs; ///< Estimated number of directories
+    double bytes; ///< Estimated number of bytes of the files
+    double tail_bytes; ///< Estimated number of bytes read to hash the tails of the files (see hash_file_tail)
+    double files_error; ///< Half-width of the 95% confidence interval of files
+    double bytes_error; ///< Half-width of the 95% confidence interval of bytes
+    double bucket_files[ESTIMATE_BUCKETS]; ///< Estimated number of files of each size bucket
+    double bucket_bytes[ESTIMATE_BUCKETS]; ///< Estimated number of bytes of each size bucket
+    long long listed; ///< Directories listed
+    double list_seconds; ///< Time spent listing them
+    long long stated; ///< Files stat'ed
+    double stat_seconds; ///< Time spent stat'ing them
+    char* probe_files[ESTIMATE_PROBE_FILES]; ///< Largest files sampled, NULL when there are less
+    long long probe_sizes[ESTIMATE_PROBE_FILES]; ///< Their sizes
+} tree_estimate;
+
+/**
+ * Estimates the totals of a tree by random probes
+ * @param  root     Root directory
+ * @param  exclude  Directory not counted (the destination, if inside the root), NULL for none
+ * @param  rules    Rules of the entries not counted, as in the scan (see walker_open), NULL for none
+ * @param  probes   Maximum number of probes
+ * @param  seconds  Maximum duration of the sampling (at least one probe is done)
+ * @param  estimate tree_estimate struct to fill. Must not be NULL.
+ * @return          true if successful, false if the root cannot be listed
+ */
+bool estimate_tree(const char* root, const char* exclude, const rule_set* rules, int probes, double seconds,
+                   tree_estimate* estimate);
+
+/**
+ * Returns the upper bound of a size bucket
+ * @param  bucket Bucket, between 0 and ESTIMATE_BUCKETS - 1
+ * @return        Sizes of the bucket are lower than this, -1 for the last one
+ */
+long long estimate_bucket_bound(int bucket);
+
+/**
+ * Measures the read throughput of the disk of a tree, reading its largest sampled files
+ *  after dropping them from the page cache
+ * @param  estimate Estimate of the tree. Must not be NULL.
+ * @param  seconds  Maximum duration of the probe
+ * @return          Bytes read per second, 0 if nothing could be read
+ */
+double estimate_read_rate(const tree_estimate* estimate, double seconds);
+
+/**
+ * Measures the write throughput of the disk of a directory, writing (and syncing) a temporary file
+ * @param  dir     Directory
+ * @param  seconds Maximum duration of the probe
+ * @return         Bytes written per second, 0 if nothing could be written
+ */
+double estimate_write_rate(const char* dir, double seconds);
+
+/**
+ * Releases the resources of an estimate
+ * @param estimate tree_estimate struct. Must not be NULL.
+ */
+void estimate_free(tree_estimate* estimate);
+
+/**@}*/
+
+#endif
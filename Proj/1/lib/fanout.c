@@ -0,0 +1,488 @@
+#include "fanout.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "hash.h"
+#include "journal.h"
+#include "capture.h"
+#include "cipher.h"
+#include "utilities.h"
+
+/**
+ * Buffer of the ring
+ */
+typedef struct
+{
+    char* data; ///< Bytes read from the source
+    off_t position; ///< Offset of data in the source
+    ssize_t length; ///< Number of bytes of data
+    unsigned holders; ///< Bit set of the attached writers that did not write it yet
+} fanout_buffer;
+
+struct fanout_ring;
+
+/**
+ * Writer of a destination
+ */
+typedef struct
+{
+    struct fanout_ring* ring; ///< Ring it writes from
+    fanout_target* target; ///< Destination
+    int fd; ///< Destination file, -1 if it could not be created
+    cipher_file file; ///< Destination file, written through its cipher
+    long long next; ///< Next chunk of the ring to write
+    long long current; ///< Chunk being written, -1 if none
+    bool waiting; ///< Waiting for the reader to fill the next chunk
+    bool detached; ///< Reads the rest of the source by itself
+    bool finished; ///< Does not write from the ring anymore
+    long long stored; ///< Bytes written
+    long long checkpoint; ///< Bytes written at which the next checkpoint is made
+    capture* capture; ///< Checksums of the blocks written
+    pthread_t thread; ///< Writer thread
+} fanout_writer;
+
+/**
+ * State shared by the reader and the writers of a copy
+ */
+typedef struct fanout_ring
+{
+    pthread_mutex_t lock; ///< Protects the buffers and the state of the writers
+    pthread_cond_t filled; ///< Signaled when a chunk is read, a writer is detached or the reader is done
+    pthread_cond_t released; ///< Signaled when a writer releases a buffer or stops
+    fanout_buffer buffers[FANOUT_BUFFERS]; ///< Chunk i of the source is in buffers[i % FANOUT_BUFFERS]
+    long long chunks; ///< Number of chunks read
+    bool done; ///< No more chunks will be read
+    bool failed; ///< The source could not be read
+    int sourcefd; ///< Source file, read with pread by the detached writers
+    long long size; ///< Size of the source when the copy started
+    const char* file_name; ///< File name of the file copied
+    io_limits* limits; ///< I/O limits, NULL for none
+    fanout_writer writers[FANOUT_MAX_TARGETS]; ///< Writers, one per destination
+    capture captures[FANOUT_MAX_TARGETS]; ///< Captures of the writers, checked together once they are done
+    int count; ///< Number of writers
+} fanout_ring;
+
+/**
+ * Writes the part of a chunk of the source that is stored in a destination
+ * @return true if successful, false otherwise
+ */
+static bool write_chunk(fanout_writer* w, const char* data, off_t position, ssize_t length)
+{
+    off_t offset = w->target->offset;
+    if (position + length <= offset)
+        return true;
+
+    if (position < offset)
+    {
+        data += offset - position;
+        length -= offset - position;
+    }
+
+    io_limits_take(w->ring->limits, 0, 1);
+    w->target->crc = hash_crc32c(w->target->crc, data, length);
+    capture_update(w->capture, data, length);
+
+    if (!cipher_file_write(&w->file, data, length))
+        return false;
+
+    w->stored += length;
+
+    // large files are checkpointed once each part is on disk, as copy_file does
+    if (w->stored >= w->checkpoint && w->stored < w->ring->size - offset)
+    {
+        if (!cipher_file_sync(&w->file) || !journal_checkpoint(w->target->dir, w->ring->file_name, w->stored, w->target->crc))
+            return false;
+
+        w->checkpoint = w->stored + JOURNAL_CHECKPOINT_SIZE;
+    }
+
+    return true;
+}
+
+/**
+ * Copies the rest of the source to the destination of a detached writer
+ * @param  position Offset of the first byte not written yet
+ * @return          true if successful, false otherwise
+ */
+static bool copy_detached(fanout_writer* w, off_t position)
+{
+    char* buffer = malloc(FANOUT_BUFFER_SIZE);
+    bool success = true;
+
+    if (position < w->target->offset)
+        position = w->target->offset;
+
+    for (;;)
+    {
+        ssize_t size = pread(w->ring->sourcefd, buffer, FANOUT_BUFFER_SIZE, position);
+        io_limits_take(w->ring->limits, size > 0 ? size : 0, 1);
+
+        if (size <= 0)
+        {
+            success = size == 0;
+            break;
+        }
+
+        if (!write_chunk(w, buffer, position, size))
+        {
+            success = false;
+            break;
+        }
+
+        position += size;
+    }
+
+    free(buffer);
+    return success;
+}
+
+/**
+ * Writer thread: writes the chunks of the ring to a destination, or the rest of the source once detached
+ */
+static void* writer_main(void* arg)
+{
+    fanout_writer* w = arg;
+    fanout_ring* ring = w->ring;
+    unsigned bit = 1u << (w - ring->writers);
+    off_t position = 0; // end of the last chunk written
+    bool success = true;
+
+    pthread_mutex_lock(&ring->lock);
+
+    for (;;)
+    {
+        w->waiting = true;
+        while (!w->detached && w->next == ring->chunks && !ring->done)
+            pthread_cond_wait(&ring->filled, &ring->lock);
+        w->waiting = false;
+
+        if (w->detached || w->next == ring->chunks)
+            break;
+
+        fanout_buffer* buffer = &ring->buffers[w->next % FANOUT_BUFFERS];
+        w->current = w->next;
+        pthread_mutex_unlock(&ring->lock);
+
+        success = write_chunk(w, buffer->data, buffer->position, buffer->length);
+        position = buffer->position + buffer->length;
+        if (!success)
+            fprintf(stderr, "Error copying %s to %s (%s).\n", ring->file_name, w->target->dir, strerror(errno));
+
+        pthread_mutex_lock(&ring->lock);
+        buffer->holders &= ~bit;
+        w->current = -1;
+        w->next++;
+        pthread_cond_broadcast(&ring->released);
+
+        if (!success)
+            break;
+    }
+
+    // the reader reports its own errors
+    bool detached = w->detached;
+    if (!detached && ring->failed)
+        success = false;
+
+    // the buffers it did not write are not waited for anymore
+    w->finished = true;
+    for (int i = 0; i < FANOUT_BUFFERS; ++i)
+        ring->buffers[i].holders &= ~bit;
+    pthread_cond_broadcast(&ring->released);
+    pthread_mutex_unlock(&ring->lock);
+
+    if (success && detached && !copy_detached(w, position))
+    {
+        fprintf(stderr, "Error copying %s to %s (%s).\n", ring->file_name, w->target->dir, strerror(errno));
+        success = false;
+    }
+
+    w->target->copied = success;
+    w->target->detached = detached;
+    return NULL;
+}
+
+/**
+ * Detaches the writers that hold a buffer the reader needs, unless none of the
+ *  others is waiting for data (then they are all slower than the source)
+ */
+static void detach_slow_writers(fanout_ring* ring, fanout_buffer* buffer)
+{
+    bool waiting = false;
+    for (int i = 0; i < ring->count; ++i)
+        if (ring->writers[i].waiting && !ring->writers[i].finished)
+            waiting = true;
+
+    if (!waiting)
+        return;
+
+    for (int i = 0; i < ring->count; ++i)
+    {
+        fanout_writer* w = &ring->writers[i];
+        unsigned bit = 1u << i;
+
+        if (!(buffer->holders & bit))
+            continue;
+
+        // the chunk it is writing stays held until it is written
+        w->detached = true;
+        for (long long chunk = w->next; chunk < ring->chunks; ++chunk)
+            if (chunk != w->current)
+                ring->buffers[chunk % FANOUT_BUFFERS].holders &= ~bit;
+    }
+
+    pthread_cond_broadcast(&ring->filled);
+}
+
+/**
+ * Checks if a writer still writes from the ring
+ */
+static bool is_attached(const fanout_writer* w)
+{
+    return w->fd != -1 && !w->finished && !w->detached;
+}
+
+int fanout_copy(const char* src_dir, const char* file_name, fanout_target* targets, int count, io_limits* limits,
+                bool drop_cache)
+{
+    assert(src_dir);
+    assert(file_name);
+    assert(targets);
+    assert(count >= 1 && count <= FANOUT_MAX_TARGETS);
+
+    for (int i = 0; i < count; ++i)
+    {
+        targets[i].copied = false;
+        targets[i].detached = false;
+        targets[i].crc = 0;
+        targets[i].consistent = true;
+    }
+
+    char src_file_name[PATH_MAX];
+
+    struct stat buf;
+    int sourcefd = path_join(src_file_name, src_dir, file_name) ? open(src_file_name, O_RDONLY) : -1;
+    if (sourcefd < 0 || fstat(sourcefd, &buf) != 0)
+    {
+        perror("Error opening source file");
+        if (sourcefd >= 0)
+            close(sourcefd);
+        return 0;
+    }
+
+    fanout_ring* ring = malloc(sizeof(fanout_ring));
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->filled, NULL);
+    pthread_cond_init(&ring->released, NULL);
+    ring->chunks = 0;
+    ring->done = false;
+    ring->failed = false;
+    ring->sourcefd = sourcefd;
+    ring->size = buf.st_size;
+    ring->file_name = file_name;
+    ring->limits = limits;
+    ring->count = count;
+
+    for (int i = 0; i < FANOUT_BUFFERS; ++i)
+    {
+        ring->buffers[i].data = malloc(FANOUT_BUFFER_SIZE);
+        ring->buffers[i].holders = 0;
+    }
+
+    // the reads start at the first byte stored in any destination
+    off_t start = targets[0].offset;
+    int writers = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        fanout_writer* w = &ring->writers[i];
+        w->ring = ring;
+        w->target = &targets[i];
+        w->next = 0;
+        w->current = -1;
+        w->waiting = false;
+        w->detached = false;
+        w->finished = false;
+        w->stored = 0;
+        w->checkpoint = JOURNAL_CHECKPOINT_SIZE;
+        w->capture = &ring->captures[i];
+
+        char dst_file_name[PATH_MAX];
+        w->fd = path_join(dst_file_name, targets[i].dir, file_name) ? open(dst_file_name, O_CREAT | O_EXCL | O_RDWR, buf.st_mode) : -1;
+        if (w->fd == -1 && errno == ENOENT && make_parent_dirs(dst_file_name)) // file in a subdirectory
+            w->fd = open(dst_file_name, O_CREAT | O_EXCL | O_RDWR, buf.st_mode);
+
+        if (w->fd != -1 && !cipher_file_create(&w->file, w->fd))
+        {
+            close(w->fd);
+            w->fd = -1;
+        }
+
+        capture_init(w->capture, &w->file, targets[i].offset, 0);
+
+        if (w->fd == -1)
+        {
+            fprintf(stderr, "Error opening destination file %s (%s).\n", dst_file_name, strerror(errno));
+            w->capture->failed = true;
+            continue;
+        }
+
+        if (targets[i].offset < start)
+            start = targets[i].offset;
+
+        if (pthread_create(&w->thread, NULL, writer_main, w) != 0)
+        {
+            perror("pthread_create");
+            cipher_file_close(&w->file);
+            w->fd = -1;
+            w->capture->failed = true;
+            continue;
+        }
+
+        writers++;
+    }
+
+    if (writers > 0 && start != 0 && lseek(sourcefd, start, SEEK_SET) == (off_t)-1)
+    {
+        perror("Error seeking source file");
+        ring->failed = true;
+    }
+
+    posix_fadvise(sourcefd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    off_t position = start;
+    long long stalled = 0; // nanoseconds the reader waited for buffers since the last detach check
+    pthread_mutex_lock(&ring->lock);
+
+    while (writers > 0 && !ring->failed)
+    {
+        bool attached = false;
+        for (int i = 0; i < count; ++i)
+            attached = attached || is_attached(&ring->writers[i]);
+
+        if (!attached)
+            break;
+
+        fanout_buffer* buffer = &ring->buffers[ring->chunks % FANOUT_BUFFERS];
+
+        while (buffer->holders != 0)
+        {
+            struct timespec before, deadline, after;
+            clock_gettime(CLOCK_REALTIME, &before);
+            deadline = before;
+            deadline.tv_nsec += FANOUT_DETACH_DELAY * 1000000L - stalled;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+
+            pthread_cond_timedwait(&ring->released, &ring->lock, &deadline);
+
+            // a destination that keeps the reader waiting a little at every buffer is as slow as one that stops
+            clock_gettime(CLOCK_REALTIME, &after);
+            stalled += (after.tv_sec - before.tv_sec) * 1000000000LL + after.tv_nsec - before.tv_nsec;
+            if (stalled >= FANOUT_DETACH_DELAY * 1000000LL)
+            {
+                if (buffer->holders != 0)
+                    detach_slow_writers(ring, buffer);
+                stalled = 0;
+            }
+        }
+
+        pthread_mutex_unlock(&ring->lock);
+
+        ssize_t size = read(sourcefd, buffer->data, FANOUT_BUFFER_SIZE);
+        io_limits_take(limits, size > 0 ? size : 0, 1);
+
+        pthread_mutex_lock(&ring->lock);
+
+        if (size <= 0)
+        {
+            if (size < 0)
+            {
+                perror("Error reading source file");
+                ring->failed = true;
+            }
+            break;
+        }
+
+        buffer->position = position;
+        buffer->length = size;
+        position += size;
+
+        buffer->holders = 0;
+        for (int i = 0; i < count; ++i)
+            if (is_attached(&ring->writers[i]))
+                buffer->holders |= 1u << i;
+
+        ring->chunks++;
+        pthread_cond_broadcast(&ring->filled);
+    }
+
+    ring->done = true;
+    pthread_cond_broadcast(&ring->filled);
+    pthread_mutex_unlock(&ring->lock);
+
+    for (int i = 0; i < count; ++i)
+    {
+        fanout_writer* w = &ring->writers[i];
+        if (w->fd == -1)
+            continue;
+
+        pthread_join(w->thread, NULL);
+        w->capture->crc = targets[i].crc;
+        w->capture->failed = !targets[i].copied;
+    }
+
+    // a file written while it was copied may be stored torn
+    bool checked = capture_check(sourcefd, &buf, ring->captures, count, limits);
+
+    int copied = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        fanout_writer* w = &ring->writers[i];
+        targets[i].copied = checked && targets[i].copied && !w->capture->failed;
+        targets[i].crc = w->capture->crc;
+        targets[i].consistent = w->capture->consistent;
+        capture_free(w->capture);
+
+        if (w->fd == -1)
+            continue;
+
+        if (drop_cache && targets[i].copied)
+        {
+            // dirty pages cannot be dropped, so the copy is written back first
+            cipher_file_sync(&w->file);
+            posix_fadvise(w->fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+
+        // its last chunk is only written now
+        if (!cipher_file_close(&w->file) && targets[i].copied)
+        {
+            fprintf(stderr, "Error copying %s to %s (%s).\n", file_name, targets[i].dir, strerror(errno));
+            targets[i].copied = false;
+        }
+
+        copied += targets[i].copied;
+    }
+
+    if (drop_cache)
+        posix_fadvise(sourcefd, 0, 0, POSIX_FADV_DONTNEED);
+    close(sourcefd);
+
+    for (int i = 0; i < FANOUT_BUFFERS; ++i)
+        free(ring->buffers[i].data);
+    pthread_cond_destroy(&ring->filled);
+    pthread_cond_destroy(&ring->released);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+
+    return copied;
+}
@@ -0,0 +1,65 @@
+#ifndef FANOUT_H_
+#define FANOUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "throttle.h"
+
+/** @defgroup fanout fanout
+ * @{
+ * Copy of a file to several backup folders with a single read of the source.
+ *
+ * The source is read once into a ring of buffers and each destination is
+ * written by its own thread; a buffer is filled again once every destination
+ * wrote it. When a destination is waiting for data while another one still
+ * holds the oldest buffer, the slow one is detached: it reads the rest of the
+ * source by itself, at its own pace, instead of holding the others back. A
+ * destination that fails only stops its own copy.
+ */
+
+/// Number of bytes of each buffer of the ring (and read at a time by a detached destination)
+#define FANOUT_BUFFER_SIZE (256 * 1024)
+
+/// Number of buffers of the ring
+#define FANOUT_BUFFERS 32
+
+/// Maximum number of destinations of a copy
+#define FANOUT_MAX_TARGETS 8
+
+/// Milliseconds the reader may wait in total for the slowest destinations, while another one is waiting for data, before detaching them
+#define FANOUT_DETACH_DELAY 200
+
+/**
+ * Destination of a copy
+ */
+typedef struct
+{
+    const char* dir; ///< Backup folder the file is copied to
+    off_t offset; ///< Offset of the first byte stored in it (0 for the whole file)
+    bool copied; ///< Set if the copy succeeded
+    bool detached; ///< Set if it fell behind the others and read the source by itself
+    uint32_t crc; ///< Set to the CRC32C of the stored data
+    bool consistent; ///< Cleared if the source kept changing while it was copied (see capture_check)
+} fanout_target;
+
+/**
+ * Copies a file to several directories, reading it once. Large files are checkpointed
+ *  in the journal of each destination directory, if it has one (see journal_checkpoint).
+ *  The blocks of the source that changed during the copy are then copied again to
+ *  every destination, reading them once too (see capture_check).
+ * @param  src_dir    Source directory name
+ * @param  file_name  File name of the file to copy
+ * @param  targets    Destinations, between 1 and FANOUT_MAX_TARGETS, whose results are set
+ * @param  count      Number of destinations
+ * @param  limits     I/O limits of the reads and writes, NULL for none
+ * @param  drop_cache Drop the copied data from the page cache once written back
+ * @return            Number of destinations the file was copied to
+ */
+int fanout_copy(const char* src_dir, const char* file_name, fanout_target* targets, int count, io_limits* limits,
+                bool drop_cache);
+
+/**@}*/
+
+#endif
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
 
 #include "fileinfo.h"
 
@@ -15,6 +17,11 @@ void file_info_new(file_info* fi, const char* file_name)
 
     fi->state = STATE_INALTERED;
     fi->iter = -1;
+    fi->size = 0;
+    fi->mtime = 0;
+    fi->tail_hash = 0;
+    fi->base_iter = -1;
+    fi->base_size = 0;
 }
 
 void file_info_free(file_info* fi)
@@ -63,24 +70,86 @@ int file_info_read(FILE* source, file_info* result)
 
     char st;
     int iter;
-    char name_buffer[1000];
-
-    if (fscanf(source, "%c %d ", &st, &iter) == EOF)
+    long long size;
+    long long mtime;
+    uint64_t tail_hash;
+    int base_iter;
+    long long base_size;
+    size_t shared;
+
+    if (fscanf(source, "%c %d %lld %lld %" SCNx64 " %d %lld %zu", &st, &iter, &size, &mtime, &tail_hash, &base_iter, &base_size, &shared) != 8)
         return EOF;
 
-    fgets(name_buffer, 1000, source);
+    // exactly one separator, the suffix of the name may start with spaces
+    if (getc(source) != ' ')
+        return EOF;
 
-    if (feof(source))
+    if (shared > 0 && (!result->file_name || shared > strlen(result->file_name)))
+    {
+        fprintf(stderr, "file_info_read: invalid shared prefix length %zu\n", shared);
         return EOF;
+    }
+
+    // names of any length are read, most fit in the stack buffer
+    char stack_buffer[1024];
+    char* name_buffer = stack_buffer;
+    size_t capacity = sizeof(stack_buffer);
+    size_t length = shared;
+
+    if (shared + 2 > capacity)
+    {
+        capacity = (shared + 2) * 2;
+        name_buffer = malloc(capacity);
+    }
+
+    if (shared > 0)
+        memcpy(name_buffer, result->file_name, shared);
+
+    bool complete = false;
+    while (fgets(name_buffer + length, capacity - length, source) != NULL)
+    {
+        length += strlen(name_buffer + length);
+
+        if (length > 0 && name_buffer[length - 1] == '\n')
+        {
+            name_buffer[--length] = '\0';
+            complete = true;
+            break;
+        }
+
+        if (length + 2 > capacity)
+        {
+            capacity *= 2;
+            if (name_buffer == stack_buffer)
+            {
+                name_buffer = malloc(capacity);
+                memcpy(name_buffer, stack_buffer, length + 1);
+            }
+            else
+                name_buffer = realloc(name_buffer, capacity);
+        }
+    }
 
-    int size = strlen(name_buffer);
-    if (name_buffer[size-1] == '\n')
-        name_buffer[size-1] = '\0';
+    // a line cut by a crash is not an entry
+    if (!complete)
+    {
+        if (name_buffer != stack_buffer)
+            free(name_buffer);
+        return EOF;
+    }
 
     result->state = st;
     result->iter = iter;
+    result->size = size;
+    result->mtime = mtime;
+    result->tail_hash = tail_hash;
+    result->base_iter = base_iter;
+    result->base_size = base_size;
     file_info_set_name(result, name_buffer);
 
+    if (name_buffer != stack_buffer)
+        free(name_buffer);
+
     return 0;
 }
 
@@ -95,5 +164,25 @@ void file_info_copy(const file_info* source, file_info** dest)
     {
         (*dest)->iter = source->iter;
         (*dest)->state = source->state;
+        (*dest)->size = source->size;
+        (*dest)->mtime = source->mtime;
+        (*dest)->tail_hash = source->tail_hash;
+        (*dest)->base_iter = source->base_iter;
+        (*dest)->base_size = source->base_size;
     }
 }
+
+void file_info_assign(file_info* dest, const file_info* source)
+{
+    assert(dest);
+    assert(source);
+
+    file_info_set_name(dest, source->file_name);
+    dest->state = source->state;
+    dest->iter = source->iter;
+    dest->size = source->size;
+    dest->mtime = source->mtime;
+    dest->tail_hash = source->tail_hash;
+    dest->base_iter = source->base_iter;
+    dest->base_size = source->base_size;
+}
@@ -2,6 +2,7 @@
 #define FILEINFO_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 /** @defgroup backup_shared backup_shared
  * @{
@@ -16,7 +17,8 @@ typedef enum
     STATE_ADDED = '+', ///< New file
     STATE_MODIFIED = '/', ///< File was changed
     STATE_REMOVED = '-', ///< File was removed
-    STATE_INALTERED = '.' ///< File did not change
+    STATE_INALTERED = '.', ///< File did not change
+    STATE_APPENDED = '>' ///< File grew, only the bytes after base_size were stored
 } file_state;
 
 /**
@@ -27,6 +29,11 @@ typedef struct
     char* file_name; ///< File name
     file_state state; ///< File state
     int iter; ///< Step of the last change to this file
+    long long size; ///< Size of the file
+    long long mtime; ///< Modification time of the file, in nanoseconds since the epoch
+    uint64_t tail_hash; ///< Hash of the last bytes of the file (see hash_file_tail)
+    int base_iter; ///< Step of the version the stored data was appended to, -1 if the whole file was stored
+    long long base_size; ///< Size of the version the stored data was appended to
 } file_info;
 
 /**
@@ -43,6 +50,13 @@ void file_info_new(file_info* fi, const char* file_name);
  */
 void file_info_copy(const file_info* source, file_info** dest);
 
+/**
+ * file_info_assign Copies every field of source, including its name, to an initialized file_info struct
+ * @param dest   file_info struct to overwrite. Must not be NULL
+ * @param source file_info struct to copy. Must not be NULL
+ */
+void file_info_assign(file_info* dest, const file_info* source);
+
 /**
  * file_info_free frees the specified file_info struct
  * @param fi file_info pointer to be initialized. Must not be NULL
@@ -64,9 +78,11 @@ void file_info_set_name(file_info* fi, const char* file_name);
 void file_info_to_string(file_info* fi, char* dest);
 
 /**
- * file_info_read Reads file_info struct from specified file stream
+ * file_info_read Reads file_info struct from specified file stream, in the "<state char> <iteration> <size>
+ *  <mtime> <tail hash> <base iteration> <base size> <shared length> <name suffix>" format written by backup_info_writer
  * @param  source File stream to be read from
- * @param  result file_info pointer to store the read data
+ * @param  result file_info pointer to store the read data. Its name must be the name of the
+ *                previous entry read from the stream (names are front coded)
  * @return        0 on success, different otherwise, EOF if end of file
  */
 int file_info_read(FILE* source, file_info* result);
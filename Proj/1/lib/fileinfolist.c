@@ -0,0 +1,96 @@
+#include "fileinfolist.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "frontcode.h"
+
+#define DEFAULT_CAPACITY 64
+#define CAPACITY_RATE 1.5f
+
+void file_info_list_new(file_info_list* l)
+{
+    assert(l);
+
+    l->buffer = NULL;
+    l->capacity = 0;
+    l->count = 0;
+    name_dict_new(&l->names);
+    file_info_new(&l->current, NULL);
+}
+
+void file_info_list_free(file_info_list* l)
+{
+    assert(l);
+
+    free(l->buffer);
+    name_dict_free(&l->names);
+    file_info_list_new(l);
+}
+
+int file_info_list_size(const file_info_list* l)
+{
+    assert(l);
+
+    return l->count;
+}
+
+void file_info_list_reserve(file_info_list* l, int capacity)
+{
+    assert(l);
+
+    if (capacity <= l->capacity)
+        return;
+
+    l->capacity = capacity;
+    l->buffer = (file_info*)realloc(l->buffer, l->capacity * sizeof(file_info));
+    assert(l->buffer);
+}
+
+void file_info_list_push_back(file_info_list* l, const file_info* fi)
+{
+    assert(l);
+    assert(fi);
+
+    if (l->capacity == l->count)
+        file_info_list_reserve(l, l->capacity ? l->capacity * CAPACITY_RATE : DEFAULT_CAPACITY);
+
+    assert(fi->file_name);
+
+    file_info* record = &l->buffer[l->count];
+    *record = *fi;
+    record->file_name = NULL;
+    name_dict_add(&l->names, fi->file_name);
+
+    l->count++;
+}
+
+// decoding a name only moves the dictionary's cursor, the contents of the list are not changed
+#define MUTABLE(l) ((file_info_list*)(l))
+
+const file_info* file_info_list_get(const file_info_list* l, int index)
+{
+    assert(l);
+    assert(index >= 0);
+    assert(index < l->count);
+
+    file_info* current = &MUTABLE(l)->current;
+    *current = l->buffer[index];
+    current->file_name = (char*)name_dict_get(&MUTABLE(l)->names, index);
+
+    return current;
+}
+
+int file_info_list_lower_bound(const file_info_list* l, const char* name)
+{
+    assert(l);
+
+    return name_dict_lower_bound(&MUTABLE(l)->names, name);
+}
+
+int file_info_list_find(const file_info_list* l, const char* name)
+{
+    assert(l);
+
+    return name_dict_find(&MUTABLE(l)->names, name);
+}
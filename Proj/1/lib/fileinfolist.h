@@ -0,0 +1,86 @@
+#ifndef FILEINFOLIST_H_
+#define FILEINFOLIST_H_
+
+#include "fileinfo.h"
+#include "frontcode.h"
+
+/** @defgroup backup_shared backup_shared
+ * @{
+ * Structs and functions used by both backup and restore programs.
+ */
+
+/**
+ * Contiguous list of file_info structs, in byte order of their names.
+ *  Records are stored inline and their names are front coded in a
+ *  name_dict owned by the list, so adding an entry does not allocate per
+ *  file, names take a fraction of their size and can be binary searched.
+ */
+typedef struct
+{
+    file_info* buffer; ///< Records (their file_name is not used)
+    int capacity; ///< Allocated size of records
+    int count; ///< Number of records
+    name_dict names; ///< Front coded names of the records
+    file_info current; ///< Last record returned by file_info_list_get, with its decoded name
+} file_info_list;
+
+/**
+ * Initializes a new, empty, file_info_list
+ * @param l file_info_list pointer. Must not be NULL.
+ */
+void file_info_list_new(file_info_list* l);
+
+/**
+ * Releases the records and names of the list
+ * @param l file_info_list pointer. Must not be NULL.
+ */
+void file_info_list_free(file_info_list* l);
+
+/**
+ * Number of records of the list
+ * @param  l file_info_list pointer. Must not be NULL.
+ * @return   Number of records
+ */
+int file_info_list_size(const file_info_list* l);
+
+/**
+ * Reserves space for at least capacity records
+ * @param l        file_info_list pointer. Must not be NULL.
+ * @param capacity Number of records
+ */
+void file_info_list_reserve(file_info_list* l, int capacity);
+
+/**
+ * Adds a copy of the specified file_info to the back of the list. Names must be added in strictly increasing byte order.
+ * @param l  file_info_list pointer. Must not be NULL.
+ * @param fi file_info to copy. Must not be NULL.
+ */
+void file_info_list_push_back(file_info_list* l, const file_info* fi);
+
+/**
+ * Record at position index. Sequential access decodes each name in O(1).
+ * @param  l     file_info_list pointer. Must not be NULL.
+ * @param  index Position of the record
+ * @return       Record, valid until the next call on this list
+ */
+const file_info* file_info_list_get(const file_info_list* l, int index);
+
+/**
+ * Finds the position of the first record whose name is not lower than the specified one
+ * @param  l    file_info_list pointer. Must not be NULL.
+ * @param  name File name. Must not be NULL.
+ * @return      Position of the record, or the number of records if there is none
+ */
+int file_info_list_lower_bound(const file_info_list* l, const char* name);
+
+/**
+ * Finds the position of the record with the specified name
+ * @param  l    file_info_list pointer. Must not be NULL.
+ * @param  name File name. Must not be NULL.
+ * @return      Position of the record, -1 if not found
+ */
+int file_info_list_find(const file_info_list* l, const char* name);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,223 @@
+#include "frontcode.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "namesort.h"
+
+#define DEFAULT_CAPACITY 4096
+#define CAPACITY_RATE 1.5f
+
+size_t common_prefix(const char* a, const char* b)
+{
+    assert(a);
+    assert(b);
+
+    size_t i = 0;
+    while (a[i] != '\0' && a[i] == b[i])
+        ++i;
+
+    return i;
+}
+
+void name_dict_new(name_dict* d)
+{
+    assert(d);
+
+    d->data = NULL;
+    d->size = 0;
+    d->capacity = 0;
+    d->restarts = NULL;
+    d->count = 0;
+    d->name = NULL;
+    d->name_capacity = 0;
+    d->name_index = -1;
+    d->name_next = 0;
+}
+
+void name_dict_free(name_dict* d)
+{
+    assert(d);
+
+    free(d->data);
+    free(d->restarts);
+    free(d->name);
+    name_dict_new(d);
+}
+
+/**
+ * Makes sure at least size more bytes fit in data
+ */
+static void reserve_data(name_dict* d, size_t size)
+{
+    if (d->size + size <= d->capacity)
+        return;
+
+    size_t capacity = d->capacity ? d->capacity * CAPACITY_RATE : DEFAULT_CAPACITY;
+    if (capacity < d->size + size)
+        capacity = d->size + size;
+
+    d->data = realloc(d->data, capacity);
+    d->capacity = capacity;
+    assert(d->data);
+}
+
+/**
+ * Makes sure a name of length size fits in name
+ */
+static void reserve_name(name_dict* d, size_t size)
+{
+    if (size + 1 <= d->name_capacity)
+        return;
+
+    d->name_capacity = size + 1 > 2 * d->name_capacity ? size + 1 : 2 * d->name_capacity;
+    d->name = realloc(d->name, d->name_capacity);
+    assert(d->name);
+}
+
+/**
+ * Decodes the entry at offset into name, using the name currently held as the previous one
+ * @return Offset of the next entry
+ */
+static size_t decode(name_dict* d, size_t offset)
+{
+    size_t shared = 0;
+    int shift = 0;
+    unsigned char byte;
+
+    do
+    {
+        byte = d->data[offset++];
+        shared |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    }
+    while (byte & 0x80);
+
+    const char* suffix = d->data + offset;
+    size_t suffix_length = strlen(suffix);
+
+    reserve_name(d, shared + suffix_length);
+    memcpy(d->name + shared, suffix, suffix_length + 1);
+
+    return offset + suffix_length + 1;
+}
+
+int name_dict_add(name_dict* d, const char* name)
+{
+    assert(d);
+    assert(name);
+
+    // the last added name is kept decoded so the shared prefix can be computed
+    if (d->count > 0 && d->name_index != d->count - 1)
+        name_dict_get(d, d->count - 1);
+
+    assert(d->count == 0 || name_compare(d->name, name) < 0);
+
+    size_t shared = 0;
+    if (d->count % NAME_DICT_RESTART_INTERVAL == 0)
+    {
+        int blocks = d->count / NAME_DICT_RESTART_INTERVAL;
+        if ((blocks & (blocks - 1)) == 0) // grow when the number of blocks reaches a power of 2
+            d->restarts = realloc(d->restarts, (blocks ? 2 * blocks : 1) * sizeof(size_t));
+
+        d->restarts[blocks] = d->size;
+    }
+    else
+        shared = common_prefix(d->name, name);
+
+    size_t suffix_length = strlen(name + shared);
+    reserve_data(d, 10 + suffix_length + 1);
+
+    size_t value = shared;
+    do
+    {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        d->data[d->size++] = byte | (value ? 0x80 : 0);
+    }
+    while (value);
+
+    memcpy(d->data + d->size, name + shared, suffix_length + 1);
+    d->size += suffix_length + 1;
+
+    reserve_name(d, shared + suffix_length);
+    strcpy(d->name + shared, name + shared);
+    d->name_index = d->count;
+    d->name_next = d->size;
+
+    return d->count++;
+}
+
+const char* name_dict_get(name_dict* d, int index)
+{
+    assert(d);
+    assert(index >= 0);
+    assert(index < d->count);
+
+    if (d->name_index == index)
+        return d->name;
+
+    size_t offset;
+    int i;
+
+    // continue from the current name if it is in the same block and before index
+    if (d->name_index >= 0 && d->name_index < index &&
+        d->name_index / NAME_DICT_RESTART_INTERVAL == index / NAME_DICT_RESTART_INTERVAL)
+    {
+        offset = d->name_next;
+        i = d->name_index + 1;
+    }
+    else
+    {
+        offset = d->restarts[index / NAME_DICT_RESTART_INTERVAL];
+        i = index - index % NAME_DICT_RESTART_INTERVAL;
+    }
+
+    for (; i <= index; ++i)
+        offset = decode(d, offset);
+
+    d->name_index = index;
+    d->name_next = offset;
+
+    return d->name;
+}
+
+int name_dict_lower_bound(name_dict* d, const char* name)
+{
+    assert(d);
+    assert(name);
+
+    // restart entries have a shared length of 0, encoded in a single byte
+    int low = 0, high = (d->count + NAME_DICT_RESTART_INTERVAL - 1) / NAME_DICT_RESTART_INTERVAL;
+    while (low < high) // first block whose first name is > name
+    {
+        int middle = low + (high - low) / 2;
+        if (name_compare(d->data + d->restarts[middle] + 1, name) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low == 0)
+        return 0;
+
+    int index = (low - 1) * NAME_DICT_RESTART_INTERVAL;
+    int end = low * NAME_DICT_RESTART_INTERVAL < d->count ? low * NAME_DICT_RESTART_INTERVAL : d->count;
+
+    for (; index < end; ++index)
+        if (name_compare(name_dict_get(d, index), name) >= 0)
+            break;
+
+    return index;
+}
+
+int name_dict_find(name_dict* d, const char* name)
+{
+    int index = name_dict_lower_bound(d, name);
+
+    if (index < d->count && name_compare(name_dict_get(d, index), name) == 0)
+        return index;
+
+    return -1;
+}
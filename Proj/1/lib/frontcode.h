@@ -0,0 +1,90 @@
+#ifndef FRONTCODE_H_
+#define FRONTCODE_H_
+
+#include <stddef.h>
+
+/** @defgroup frontcode frontcode
+ * @{
+ * Front coding (prefix compression) of sorted file names.
+ *
+ * Each name is stored as the number of bytes it shares with the previous
+ * name followed by the remaining suffix. Every NAME_DICT_RESTART_INTERVAL
+ * names the full name is stored (a restart point), so a name can be
+ * decoded without decoding the whole list and the restart points can be
+ * binary searched.
+ */
+
+/// Number of names between two restart points
+#define NAME_DICT_RESTART_INTERVAL 16
+
+/**
+ * Front coded dictionary of names, added in byte order
+ */
+typedef struct
+{
+    char* data; ///< Encoded names: varint shared length followed by the '\0' terminated suffix
+    size_t size; ///< Bytes used in data
+    size_t capacity; ///< Bytes allocated for data
+    size_t* restarts; ///< Offset in data of each restart point
+    int count; ///< Number of names
+    char* name; ///< Last decoded (or added) name
+    size_t name_capacity; ///< Bytes allocated for name
+    int name_index; ///< Index of the name held in name, -1 if none
+    size_t name_next; ///< Offset in data of the entry after name_index
+} name_dict;
+
+/**
+ * Number of bytes shared at the start of two strings
+ * @param  a First string. Must not be NULL.
+ * @param  b Second string. Must not be NULL.
+ * @return   Length of the common prefix of a and b
+ */
+size_t common_prefix(const char* a, const char* b);
+
+/**
+ * Initializes a new, empty, dictionary
+ * @param d name_dict pointer. Must not be NULL.
+ */
+void name_dict_new(name_dict* d);
+
+/**
+ * Releases the resources of a dictionary
+ * @param d name_dict pointer. Must not be NULL.
+ */
+void name_dict_free(name_dict* d);
+
+/**
+ * Adds a name at the end of the dictionary. Names must be added in strictly increasing byte order.
+ * @param  d    name_dict pointer. Must not be NULL.
+ * @param  name Name to add. Must not be NULL.
+ * @return      Index of the name
+ */
+int name_dict_add(name_dict* d, const char* name);
+
+/**
+ * Decodes the name at position index. Sequential access is O(1) per name.
+ * @param  d     name_dict pointer. Must not be NULL.
+ * @param  index Position of the name
+ * @return       The name, valid until the next call on this dictionary
+ */
+const char* name_dict_get(name_dict* d, int index);
+
+/**
+ * Finds the position of the first name not lower than the specified one (binary search on restart points)
+ * @param  d    name_dict pointer. Must not be NULL.
+ * @param  name Name to look for. Must not be NULL.
+ * @return      Index of the first name >= name, or the number of names if there is none
+ */
+int name_dict_lower_bound(name_dict* d, const char* name);
+
+/**
+ * Finds the position of a name
+ * @param  d    name_dict pointer. Must not be NULL.
+ * @param  name Name to look for. Must not be NULL.
+ * @return      Index of the name, -1 if not found
+ */
+int name_dict_find(name_dict* d, const char* name);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,141 @@
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#if defined(__x86_64__)
+#  include <nmmintrin.h>
+#endif
+
+#define FNV1A_PRIME 0x100000001b3ULL
+
+/// Reflected CRC32C (Castagnoli) polynomial
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+static uint32_t Crc32cTable[8][256]; ///< Slicing-by-8 tables of the software CRC32C
+static pthread_once_t Crc32cOnce = PTHREAD_ONCE_INIT; ///< Guards crc32c_init
+static uint32_t (*Crc32cUpdate)(uint32_t crc, const unsigned char* data, size_t size); ///< Implementation picked by crc32c_init
+
+uint64_t hash_fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FNV1A_PRIME;
+    }
+
+    return hash;
+}
+
+bool hash_file_tail(const char* path, off_t size, uint64_t* result)
+{
+    assert(path);
+    assert(result);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    off_t offset = size > HASH_TAIL_BLOCK_SIZE ? size - HASH_TAIL_BLOCK_SIZE : 0;
+    size_t length = size - offset;
+
+    char buffer[HASH_TAIL_BLOCK_SIZE];
+    ssize_t count = pread(fd, buffer, length, offset);
+    close(fd);
+
+    if (count != (ssize_t)length)
+        return false;
+
+    *result = hash_fnv1a(HASH_FNV1A_INIT, buffer, length);
+    return true;
+}
+
+/**
+ * Software CRC32C, 8 bytes at a time (slicing-by-8)
+ */
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* data, size_t size)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+
+        uint32_t low = (uint32_t)word ^ crc;
+        uint32_t high = word >> 32;
+
+        crc = Crc32cTable[7][low & 0xFF] ^ Crc32cTable[6][(low >> 8) & 0xFF]
+            ^ Crc32cTable[5][(low >> 16) & 0xFF] ^ Crc32cTable[4][low >> 24]
+            ^ Crc32cTable[3][high & 0xFF] ^ Crc32cTable[2][(high >> 8) & 0xFF]
+            ^ Crc32cTable[1][(high >> 16) & 0xFF] ^ Crc32cTable[0][high >> 24];
+    }
+#endif
+
+    for (; size > 0; data++, size--)
+        crc = Crc32cTable[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * CRC32C with the SSE4.2 crc32 instruction
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size)
+{
+    uint64_t crc64 = crc;
+
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = crc64;
+    for (; size > 0; data++, size--)
+        crc = _mm_crc32_u8(crc, *data);
+
+    return crc;
+}
+#endif
+
+/**
+ * Builds the tables of the software CRC32C and picks the fastest implementation
+ */
+static void crc32c_init(void)
+{
+    for (int n = 0; n < 256; ++n)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+
+        Crc32cTable[0][n] = crc;
+    }
+
+    for (int n = 0; n < 256; ++n)
+        for (int k = 1; k < 8; ++k)
+            Crc32cTable[k][n] = Crc32cTable[0][Crc32cTable[k - 1][n] & 0xFF] ^ (Crc32cTable[k - 1][n] >> 8);
+
+    Crc32cUpdate = crc32c_table;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        Crc32cUpdate = crc32c_sse42;
+#endif
+}
+
+uint32_t hash_crc32c(uint32_t crc, const void* data, size_t size)
+{
+    pthread_once(&Crc32cOnce, crc32c_init);
+
+    return ~Crc32cUpdate(~crc, data, size);
+}
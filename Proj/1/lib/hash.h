@@ -0,0 +1,51 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** @defgroup hash hash
+ * @{
+ * Non cryptographic hashing of memory and file contents
+ */
+
+/// Initial value of a FNV-1a hash
+#define HASH_FNV1A_INIT 0xcbf29ce484222325ULL
+
+/// Number of bytes at the end of a file covered by its tail hash
+#define HASH_TAIL_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Updates a 64 bit FNV-1a hash with the specified data
+ * @param  hash Current hash (HASH_FNV1A_INIT for a new one)
+ * @param  data Data to hash
+ * @param  size Number of bytes of data
+ * @return      Updated hash
+ */
+uint64_t hash_fnv1a(uint64_t hash, const void* data, size_t size);
+
+/**
+ * Updates a CRC32C (Castagnoli) checksum with the specified data. Uses the
+ *  SSE4.2 crc32 instruction when the processor has it, a table otherwise.
+ * @param  crc  Current checksum (0 for a new one)
+ * @param  data Data to checksum
+ * @param  size Number of bytes of data
+ * @return      Updated checksum
+ */
+uint32_t hash_crc32c(uint32_t crc, const void* data, size_t size);
+
+/**
+ * Hashes the last HASH_TAIL_BLOCK_SIZE bytes (or less if the file is smaller) before
+ *  the specified size of a file. Used to tell if a file that grew was only appended to.
+ * @param  path   Path of the file
+ * @param  size   Size of the (possibly older version of the) file
+ * @param  result Resulting hash. Must not be NULL.
+ * @return        true if successful, false otherwise
+ */
+bool hash_file_tail(const char* path, off_t size, uint64_t* result);
+
+/**@}*/
+
+#endif
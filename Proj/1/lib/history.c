@@ -0,0 +1,573 @@
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "namesort.h"
+#include "store.h"
+
+/// Length of the name of a segment file ("<first folder>-<last folder>")
+#define SEGMENT_NAME_LENGTH (19 + 1 + 19)
+
+/**
+ * Segment file of a history
+ */
+typedef struct
+{
+    char first[20]; ///< First iteration folder of the segment
+    char last[20]; ///< Last iteration folder of the segment
+    long long size; ///< Size of the file
+} history_segment;
+
+/**
+ * qsort comparator of history_segment, by first folder and then by last folder, the widest first
+ */
+static int segment_compare(const void* a, const void* b)
+{
+    const history_segment* segment_a = a;
+    const history_segment* segment_b = b;
+
+    int cmp = strcmp(segment_a->first, segment_b->first);
+    return cmp != 0 ? cmp : -strcmp(segment_a->last, segment_b->last);
+}
+
+/**
+ * Lists the segments of a history, oldest first. Segments covered by another one
+ *  (left by a merge that was interrupted before removing them) are skipped.
+ * @return Number of segments (0 if there is no history), -1 on errors
+ */
+static int list_segments(const char* hist_dir, history_segment** segments)
+{
+    *segments = NULL;
+
+    DIR* dir = opendir(hist_dir);
+    if (dir == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    int count = 0, capacity = 0;
+    struct dirent* entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strlen(entry->d_name) != SEGMENT_NAME_LENGTH || entry->d_name[19] != '-')
+            continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", hist_dir, entry->d_name);
+
+        struct stat buf;
+        if (stat(path, &buf) != 0)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            *segments = realloc(*segments, capacity * sizeof(history_segment));
+        }
+
+        history_segment* segment = &(*segments)[count++];
+        snprintf(segment->first, sizeof(segment->first), "%.19s", entry->d_name);
+        snprintf(segment->last, sizeof(segment->last), "%.19s", entry->d_name + 20);
+        segment->size = buf.st_size;
+    }
+
+    closedir(dir);
+
+    if (count > 0)
+        qsort(*segments, count, sizeof(history_segment), segment_compare);
+
+    int kept = 0;
+    for (int i = 0; i < count; ++i)
+        if (kept == 0 || strcmp((*segments)[i].last, (*segments)[kept - 1].last) > 0)
+            (*segments)[kept++] = (*segments)[i];
+
+    return kept;
+}
+
+/**
+ * Path of a segment file
+ */
+static void segment_path(const char* hist_dir, const history_segment* segment, char* path, size_t size)
+{
+    snprintf(path, size, "%s/%s-%s", hist_dir, segment->first, segment->last);
+}
+
+/**
+ * Returns the name of a segment line (after its eight other fields)
+ */
+static const char* line_name(const char* line)
+{
+    for (int fields = 0; fields < 8 && line != NULL; ++fields)
+    {
+        line = strchr(line, ' ');
+        if (line != NULL)
+            line++;
+    }
+
+    return line != NULL ? line : "";
+}
+
+/**
+ * Reads a line of a segment, without its newline
+ * @return Length of the line, -1 at the end of the file
+ */
+static ssize_t read_line(FILE* file, char** line, size_t* size)
+{
+    ssize_t length = getline(line, size, file);
+    if (length > 0 && (*line)[length - 1] == '\n')
+        (*line)[--length] = '\0';
+
+    return length;
+}
+
+/**
+ * Parses a segment line
+ * @return true if the line is valid, false otherwise
+ */
+static bool parse_line(const char* line, history_entry* entry)
+{
+    char state;
+    if (sscanf(line, "%19s %d %c %lld %lld %" SCNx64 " %d %lld", entry->folder, &entry->iter, &state, &entry->size,
+               &entry->mtime, &entry->tail_hash, &entry->base_iter, &entry->base_size) != 8)
+        return false;
+
+    entry->state = state;
+    return true;
+}
+
+/**
+ * Writes the segment of the changes of an iteration folder
+ */
+static bool write_folder_segment(const char* dst, const char* hist_dir, const char* folder)
+{
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s/%s/%s", dst, folder, BACKUP_FILE_INFO_NAME);
+
+    FILE* info = cipher_fopen(info_path, "r");
+    int iter;
+    if (info == NULL || backup_info_read_header(info, &iter) == EOF)
+    {
+        fprintf(stderr, "Could not read the backup info of %s.\n", folder);
+        if (info != NULL)
+            fclose(info);
+        return false;
+    }
+
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s/segment.%d", hist_dir, (int)getpid());
+
+    FILE* out = cipher_fopen(temp_path, "w");
+    if (out == NULL)
+    {
+        perror("Error creating history segment");
+        fclose(info);
+        return false;
+    }
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    // the backup info is already in name order
+    while (file_info_read(info, &fi) != EOF)
+        if (fi.state != STATE_INALTERED)
+            fprintf(out, "%s %d %c %lld %lld %016" PRIx64 " %d %lld %s\n", folder, iter, (char)fi.state, fi.size, fi.mtime,
+                    fi.tail_hash, fi.base_iter, fi.base_size, fi.file_name);
+
+    file_info_free(&fi);
+    fclose(info);
+
+    history_segment segment;
+    snprintf(segment.first, sizeof(segment.first), "%s", folder);
+    snprintf(segment.last, sizeof(segment.last), "%s", folder);
+
+    char path[PATH_MAX];
+    segment_path(hist_dir, &segment, path, sizeof(path));
+
+    if (fclose(out) != 0 || rename(temp_path, path) != 0)
+    {
+        perror("Error writing history segment");
+        unlink(temp_path);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Merges two consecutive segments into one
+ */
+static bool merge_segments(const char* hist_dir, const history_segment* older, const history_segment* newer)
+{
+    char older_path[PATH_MAX], newer_path[PATH_MAX], temp_path[PATH_MAX];
+    segment_path(hist_dir, older, older_path, sizeof(older_path));
+    segment_path(hist_dir, newer, newer_path, sizeof(newer_path));
+    snprintf(temp_path, sizeof(temp_path), "%s/segment.%d", hist_dir, (int)getpid());
+
+    FILE* a = cipher_fopen(older_path, "r");
+    FILE* b = cipher_fopen(newer_path, "r");
+    FILE* out = cipher_fopen(temp_path, "w");
+    bool success = a != NULL && b != NULL && out != NULL;
+
+    if (success)
+    {
+        char* line_a = NULL;
+        char* line_b = NULL;
+        size_t size_a = 0, size_b = 0;
+        bool has_a = read_line(a, &line_a, &size_a) >= 0;
+        bool has_b = read_line(b, &line_b, &size_b) >= 0;
+
+        // on equal names the older version goes first
+        while (has_a || has_b)
+        {
+            if (has_a && (!has_b || name_compare(line_name(line_a), line_name(line_b)) <= 0))
+            {
+                fprintf(out, "%s\n", line_a);
+                has_a = read_line(a, &line_a, &size_a) >= 0;
+            }
+            else
+            {
+                fprintf(out, "%s\n", line_b);
+                has_b = read_line(b, &line_b, &size_b) >= 0;
+            }
+        }
+
+        free(line_a);
+        free(line_b);
+    }
+
+    if (a != NULL)
+        fclose(a);
+    if (b != NULL)
+        fclose(b);
+    if (out != NULL && fclose(out) != 0)
+        success = false;
+
+    history_segment merged;
+    memcpy(merged.first, older->first, sizeof(merged.first));
+    memcpy(merged.last, newer->last, sizeof(merged.last));
+
+    char merged_path[PATH_MAX];
+    segment_path(hist_dir, &merged, merged_path, sizeof(merged_path));
+
+    // readers skip the merged segments until they are removed (see list_segments)
+    if (!success || rename(temp_path, merged_path) != 0)
+    {
+        perror("Error merging history segments");
+        unlink(temp_path);
+        return false;
+    }
+
+    unlink(older_path);
+    unlink(newer_path);
+    return true;
+}
+
+/**
+ * Merges the newest segments while the one before is not larger, or while there are too many
+ */
+static bool compact_segments(const char* hist_dir)
+{
+    for (;;)
+    {
+        history_segment* segments;
+        int count = list_segments(hist_dir, &segments);
+
+        bool merge = count >= 2 && (count > HISTORY_MAX_SEGMENTS || segments[count - 2].size <= segments[count - 1].size);
+        bool success = !merge || merge_segments(hist_dir, &segments[count - 2], &segments[count - 1]);
+
+        free(segments);
+
+        if (!merge || !success)
+            return success;
+    }
+}
+
+bool history_add(const char* dst, const char* folder)
+{
+    assert(dst);
+    assert(folder);
+
+    char hist_dir[PATH_MAX];
+    snprintf(hist_dir, sizeof(hist_dir), "%s/%s", dst, HISTORY_DIR_NAME);
+
+    if (mkdir(hist_dir, 0775) != 0 && errno != EEXIST)
+    {
+        perror(hist_dir);
+        return false;
+    }
+
+    char last[20];
+    if (!history_last(dst, last))
+        return false;
+
+    bool success = true;
+
+    // finished folders missing from the history, the folder being added is not finished yet
+    backup_store store;
+    if (store_open(&store, dst) == 0)
+    {
+        for (int i = 0; i < store.count && success; ++i)
+            if (strcmp(store.folders[i], last) > 0 && strcmp(store.folders[i], folder) < 0)
+                success = write_folder_segment(dst, hist_dir, store.folders[i]) && compact_segments(hist_dir);
+    }
+    store_close(&store);
+
+    if (success && strcmp(folder, last) > 0)
+        success = write_folder_segment(dst, hist_dir, folder) && compact_segments(hist_dir);
+
+    return success;
+}
+
+bool history_last(const char* dst, char* folder)
+{
+    assert(dst);
+    assert(folder);
+
+    char hist_dir[PATH_MAX];
+    snprintf(hist_dir, sizeof(hist_dir), "%s/%s", dst, HISTORY_DIR_NAME);
+
+    history_segment* segments;
+    int count = list_segments(hist_dir, &segments);
+    if (count < 0)
+    {
+        perror(hist_dir);
+        return false;
+    }
+
+    snprintf(folder, 20, "%s", count > 0 ? segments[count - 1].last : "");
+    free(segments);
+    return true;
+}
+
+/**
+ * Appends the versions of a file in a segment to an array, using a binary search on the
+ *  byte offsets of the file: lines before lo have smaller names, lines from hi on do not
+ */
+static bool find_in_segment(const char* path, const char* name, history_entry** entries, int* count, int* capacity)
+{
+    FILE* file = cipher_fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    // an encrypted segment has no file descriptor of its plaintext
+    fseek(file, 0, SEEK_END);
+
+    long long lo = 0, hi = ftell(file);
+    char* line = NULL;
+    size_t size = 0;
+
+    while (hi - lo > 4096)
+    {
+        long long mid = lo + (hi - lo) / 2;
+
+        // the line after the one mid is in
+        fseek(file, mid - 1, SEEK_SET);
+        read_line(file, &line, &size);
+        long long start = ftell(file);
+
+        if (start >= hi || read_line(file, &line, &size) < 0)
+        {
+            hi = mid;
+            continue;
+        }
+
+        if (name_compare(line_name(line), name) < 0)
+            lo = ftell(file);
+        else
+            hi = start;
+    }
+
+    fseek(file, lo, SEEK_SET);
+
+    while (read_line(file, &line, &size) >= 0)
+    {
+        int cmp = name_compare(line_name(line), name);
+        if (cmp > 0)
+            break;
+        if (cmp < 0)
+            continue;
+
+        if (*count == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 8;
+            *entries = realloc(*entries, *capacity * sizeof(history_entry));
+        }
+
+        if (parse_line(line, &(*entries)[*count]))
+            (*count)++;
+    }
+
+    free(line);
+    fclose(file);
+    return true;
+}
+
+/**
+ * scandir selector of iteration folders
+ */
+static int folder_selection(const struct dirent* file)
+{
+    return file->d_type == DT_DIR && strlen(file->d_name) == 19;
+}
+
+/**
+ * Appends the versions of a file in the finished iteration folders after the last one of
+ *  the history (received from another destination, for instance), from their backup infos
+ */
+static bool find_in_folders(const char* dst, const char* last, const char* name, history_entry** entries, int* count,
+                            int* capacity)
+{
+    struct dirent** dirs;
+    int size = scandir(dst, &dirs, folder_selection, bytesort);
+    if (size < 0)
+    {
+        perror(dst);
+        return false;
+    }
+
+    bool success = true;
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    for (int i = 0; i < size; ++i)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dst, dirs[i]->d_name);
+
+        FILE* info = NULL;
+        if (success && strcmp(dirs[i]->d_name, last) > 0 && !journal_exists(path))
+        {
+            snprintf(path, sizeof(path), "%s/%s/%s", dst, dirs[i]->d_name, BACKUP_FILE_INFO_NAME);
+            info = cipher_fopen(path, "r");
+        }
+
+        int iter;
+        if (info != NULL && backup_info_read_header(info, &iter) == 0)
+        {
+            int found = backup_info_find(info, name, &fi);
+            if (found == EOF)
+                success = false;
+            else if (found == 0 && fi.state != STATE_INALTERED)
+            {
+                if (*count == *capacity)
+                {
+                    *capacity = *capacity ? *capacity * 2 : 8;
+                    *entries = realloc(*entries, *capacity * sizeof(history_entry));
+                }
+
+                history_entry* entry = &(*entries)[(*count)++];
+                snprintf(entry->folder, sizeof(entry->folder), "%.19s", dirs[i]->d_name);
+                entry->iter = iter;
+                entry->state = fi.state;
+                entry->size = fi.size;
+                entry->mtime = fi.mtime;
+                entry->tail_hash = fi.tail_hash;
+                entry->base_iter = fi.base_iter;
+                entry->base_size = fi.base_size;
+            }
+        }
+
+        if (info != NULL)
+            fclose(info);
+        free(dirs[i]);
+    }
+
+    free(dirs);
+    file_info_free(&fi);
+    return success;
+}
+
+int history_find(const char* dst, const char* name, history_entry** entries)
+{
+    assert(dst);
+    assert(name);
+    assert(entries);
+
+    char hist_dir[PATH_MAX];
+    snprintf(hist_dir, sizeof(hist_dir), "%s/%s", dst, HISTORY_DIR_NAME);
+
+    *entries = NULL;
+
+    history_segment* segments;
+    int segment_count = list_segments(hist_dir, &segments);
+    if (segment_count < 0)
+    {
+        perror(hist_dir);
+        return -1;
+    }
+
+    int count = 0, capacity = 0;
+    bool success = true;
+
+    // the segments are in chronological order, and so are the versions in each one
+    for (int i = 0; i < segment_count && success; ++i)
+    {
+        char path[PATH_MAX];
+        segment_path(hist_dir, &segments[i], path, sizeof(path));
+        success = find_in_segment(path, name, entries, &count, &capacity);
+    }
+
+    if (success)
+        success = find_in_folders(dst, segment_count > 0 ? segments[segment_count - 1].last : "", name, entries, &count,
+                                  &capacity);
+
+    free(segments);
+
+    if (!success)
+    {
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+
+    return count;
+}
+
+int history_resolve(const char* dst, const char* name, const history_entry* entries, int index, file_segment** segments)
+{
+    assert(dst);
+    assert(name);
+    assert(entries);
+    assert(segments);
+
+    // an appended version is stored after the previous version of the file
+    int first = index;
+    while (entries[first].state == STATE_APPENDED)
+    {
+        if (first == 0 || entries[first - 1].state == STATE_REMOVED || entries[first - 1].iter != entries[first].base_iter)
+        {
+            fprintf(stderr, "Could not find version %d of %s.\n", entries[first].base_iter, name);
+            return -1;
+        }
+
+        first--;
+    }
+
+    int count = index - first + 1;
+    *segments = malloc(count * sizeof(file_segment));
+
+    for (int i = 0; i < count; ++i)
+    {
+        const history_entry* entry = &entries[first + i];
+        size_t length = strlen(dst) + 1 + strlen(entry->folder) + 1;
+
+        (*segments)[i].dir = malloc(length);
+        snprintf((*segments)[i].dir, length, "%s/%s", dst, entry->folder);
+        (*segments)[i].offset = entry->state == STATE_APPENDED ? entry->base_size : 0;
+    }
+
+    return count;
+}
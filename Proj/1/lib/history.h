@@ -0,0 +1,87 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fileinfo.h"
+#include "utilities.h"
+
+/** @defgroup history history
+ * @{
+ * Version history of every file of a backup destination.
+ *
+ * The history is a directory of segment files, each holding the changes
+ * (added, modified, appended and removed entries) of a range of iteration
+ * folders, one per line ("<folder> <iter> <state> <size> <mtime> <tail hash>
+ * <base iter> <base size> <name>"), sorted by name and then by folder. Each
+ * iteration adds the segment of its own changes; the newest segments are
+ * merged while they are about as large as the one before them, so there are
+ * O(log n) segments. The versions of a file are found with a binary search
+ * in each segment, without reading the backup infos.
+ */
+
+/// Name of the history directory of a destination
+#define HISTORY_DIR_NAME "__bckphist__"
+
+/// Maximum number of segments, the newest ones are merged beyond it
+#define HISTORY_MAX_SEGMENTS 16
+
+/**
+ * Version of a file
+ */
+typedef struct
+{
+    char folder[20]; ///< Iteration folder the version was recorded in
+    int iter; ///< Iteration the version was recorded in
+    file_state state; ///< STATE_ADDED, STATE_MODIFIED, STATE_APPENDED or STATE_REMOVED
+    long long size; ///< Size of the file
+    long long mtime; ///< Modification time of the file, in nanoseconds since the epoch
+    uint64_t tail_hash; ///< Hash of the last bytes of the file (see hash_file_tail)
+    int base_iter; ///< Iteration of the version the stored data was appended to, -1 if the whole file was stored
+    long long base_size; ///< Size of the version the stored data was appended to
+} history_entry;
+
+/**
+ * Adds the changes of an iteration folder to the history of its destination. The
+ *  finished folders after the last one in the history (received from another
+ *  destination, for instance) are added first.
+ * @param  dst    Destination of the backup
+ * @param  folder Name of the iteration folder
+ * @return        true if successful, false otherwise
+ */
+bool history_add(const char* dst, const char* folder);
+
+/**
+ * Finds the last iteration folder in the history of a destination
+ * @param  dst    Destination of the backup
+ * @param  folder Set to the name of the folder, empty if there is no history (20 chars)
+ * @return        true if successful, false otherwise
+ */
+bool history_last(const char* dst, char* folder);
+
+/**
+ * Finds every version of a file in the history of a destination. The finished folders
+ *  after the last one in the history are searched in their backup infos.
+ * @param  dst     Destination of the backup
+ * @param  name    Name of the file. Must not be NULL.
+ * @param  entries Resulting array of versions, oldest first, must be freed by the caller
+ * @return         Number of versions, -1 on errors
+ */
+int history_find(const char* dst, const char* name, history_entry** entries);
+
+/**
+ * Finds where the data of a version is stored. A version that was appended to its
+ *  previous one is made of several segments.
+ * @param  dst      Destination of the backup
+ * @param  name     Name of the file. Must not be NULL.
+ * @param  entries  Versions of the file, oldest first (see history_find)
+ * @param  index    Index of the version, which must not be a removal
+ * @param  segments Resulting array of segments (see copy_file_segments), must be freed with store_free_segments
+ * @return          Number of segments, -1 if a previous version is missing
+ */
+int history_resolve(const char* dst, const char* name, const history_entry* entries, int index, file_segment** segments);
+
+/**@}*/
+
+#endif
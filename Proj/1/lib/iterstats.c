@@ -0,0 +1,73 @@
+#include "iterstats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "cipher.h"
+
+bool iteration_stats_write(const char* folder, const iteration_stats* stats)
+{
+    assert(folder);
+    assert(stats);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, ITERATION_STATS_NAME);
+
+    FILE* file = cipher_fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("Error creating iteration stats");
+        return false;
+    }
+
+    fprintf(file, "scanned %lld\n", stats->scanned);
+    fprintf(file, "changed %lld\n", stats->changed);
+    fprintf(file, "stored %lld\n", stats->stored);
+    fprintf(file, "scan_bytes %lld\n", stats->scan_bytes);
+    fprintf(file, "copy_bytes %lld\n", stats->copy_bytes);
+    fprintf(file, "scan_seconds %.3f\n", stats->scan_seconds);
+    fprintf(file, "copy_seconds %.3f\n", stats->copy_seconds);
+
+    return fclose(file) == 0;
+}
+
+int iteration_stats_read(const char* folder, iteration_stats* stats)
+{
+    assert(folder);
+    assert(stats);
+
+    memset(stats, 0, sizeof(iteration_stats));
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, ITERATION_STATS_NAME);
+
+    FILE* file = cipher_fopen(path, "r");
+    if (file == NULL)
+        return 1;
+
+    char key[32];
+    double value;
+
+    while (fscanf(file, "%31s %lf", key, &value) == 2)
+    {
+        if (strcmp(key, "scanned") == 0)
+            stats->scanned = value;
+        else if (strcmp(key, "changed") == 0)
+            stats->changed = value;
+        else if (strcmp(key, "stored") == 0)
+            stats->stored = value;
+        else if (strcmp(key, "scan_bytes") == 0)
+            stats->scan_bytes = value;
+        else if (strcmp(key, "copy_bytes") == 0)
+            stats->copy_bytes = value;
+        else if (strcmp(key, "scan_seconds") == 0)
+            stats->scan_seconds = value;
+        else if (strcmp(key, "copy_seconds") == 0)
+            stats->copy_seconds = value;
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef ITERSTATS_H_
+#define ITERSTATS_H_
+
+#include <stdbool.h>
+
+/** @defgroup iterstats iterstats
+ * @{
+ * Statistics of an iteration, recorded in its folder ("<key> <value>" lines)
+ * once its files are stored, so the cost of the next iterations can be
+ * estimated from the ones already done.
+ */
+
+/// File name of the statistics of an iteration folder
+#define ITERATION_STATS_NAME "__bckpstats__"
+
+/**
+ * Statistics of an iteration
+ */
+typedef struct
+{
+    long long scanned; ///< Files found by the scan
+    long long changed; ///< Entries added, modified, appended or removed
+    long long stored; ///< Files stored (copied or linked)
+    long long scan_bytes; ///< Bytes read by the scan
+    long long copy_bytes; ///< Bytes of the files stored
+    double scan_seconds; ///< Duration of the scan
+    double copy_seconds; ///< Duration of the copies
+} iteration_stats;
+
+/**
+ * Writes the statistics of an iteration to its folder
+ * @param  folder Iteration folder
+ * @param  stats  Statistics. Must not be NULL.
+ * @return        true if successful, false otherwise
+ */
+bool iteration_stats_write(const char* folder, const iteration_stats* stats);
+
+/**
+ * Reads the statistics of an iteration
+ * @param  folder Iteration folder
+ * @param  stats  iteration_stats struct to fill (unknown keys are ignored, missing ones are 0). Must not be NULL.
+ * @return        0 upon success, 1 if the folder has no statistics
+ */
+int iteration_stats_read(const char* folder, iteration_stats* stats);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,205 @@
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "namesort.h"
+#include "cipher.h"
+
+bool journal_create(const char* folder)
+{
+    assert(folder);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, JOURNAL_NAME);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0)
+    {
+        perror("Error creating journal");
+        return false;
+    }
+
+    // the folder must not look finished after a crash
+    bool success = fsync(fd) == 0;
+    close(fd);
+    return success;
+}
+
+bool journal_exists(const char* folder)
+{
+    assert(folder);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, JOURNAL_NAME);
+
+    return access(path, F_OK) == 0;
+}
+
+bool journal_checkpoint(const char* folder, const char* name, long long offset, uint32_t crc)
+{
+    assert(folder);
+    assert(name);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, JOURNAL_NAME);
+
+    // one write per line, appends of concurrent copies do not interleave
+    char line[PATH_MAX + 32];
+    int length = snprintf(line, sizeof(line), "%lld %08" PRIx32 " %s\n", offset, crc, name);
+    if (length >= (int)sizeof(line))
+        return false;
+
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd < 0)
+        return errno == ENOENT;
+
+    // sealed whole, a line cut by a crash does not open
+    char sealed[CIPHER_SEALED_SIZE(sizeof(line))];
+    if (cipher_enabled())
+        length = cipher_seal_line(line, length, sealed);
+
+    bool success = length > 0 && write(fd, cipher_enabled() ? sealed : line, length) == length;
+    if (!success)
+        perror("Error writing journal");
+
+    close(fd);
+    return success;
+}
+
+/**
+ * qsort comparator of journal_entry by name, then by offset
+ */
+static int entry_compare(const void* a, const void* b)
+{
+    const journal_entry* entry_a = a;
+    const journal_entry* entry_b = b;
+
+    int cmp = name_compare(entry_a->name, entry_b->name);
+    if (cmp != 0)
+        return cmp;
+
+    return (entry_a->offset > entry_b->offset) - (entry_a->offset < entry_b->offset);
+}
+
+/**
+ * bsearch comparator of journal_entry by name only
+ */
+static int name_entry_compare(const void* a, const void* b)
+{
+    return name_compare(((const journal_entry*)a)->name, ((const journal_entry*)b)->name);
+}
+
+int journal_read(const char* folder, journal* j)
+{
+    assert(folder);
+    assert(j);
+
+    j->entries = NULL;
+    j->count = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, JOURNAL_NAME);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 1;
+
+    int capacity = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &line_size, file)) > 0)
+    {
+        if (cipher_enabled() && (length = cipher_open_line(line, length)) < 0)
+            continue;
+
+        long long offset;
+        uint32_t crc;
+        int name_start = 0;
+
+        // a line cut by a crash is ignored
+        if (line[length - 1] != '\n' || sscanf(line, "%lld %" SCNx32 "%n", &offset, &crc, &name_start) != 2
+            || line[name_start] != ' ')
+            continue;
+
+        line[length - 1] = '\0';
+
+        if (j->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            j->entries = realloc(j->entries, capacity * sizeof(journal_entry));
+        }
+
+        j->entries[j->count].name = strdup(line + name_start + 1);
+        j->entries[j->count].offset = offset;
+        j->entries[j->count].crc = crc;
+        j->count++;
+    }
+
+    free(line);
+    fclose(file);
+
+    qsort(j->entries, j->count, sizeof(journal_entry), entry_compare);
+
+    // only the last checkpoint of each file is kept
+    int kept = 0;
+    for (int i = 0; i < j->count; ++i)
+    {
+        if (i + 1 < j->count && strcmp(j->entries[i].name, j->entries[i + 1].name) == 0)
+        {
+            free(j->entries[i].name);
+            continue;
+        }
+
+        j->entries[kept++] = j->entries[i];
+    }
+    j->count = kept;
+
+    return 0;
+}
+
+const journal_entry* journal_find(const journal* j, const char* name)
+{
+    assert(j);
+    assert(name);
+
+    journal_entry key = { (char*)name, 0, 0 };
+    return bsearch(&key, j->entries, j->count, sizeof(journal_entry), name_entry_compare);
+}
+
+void journal_free(journal* j)
+{
+    assert(j);
+
+    for (int i = 0; i < j->count; ++i)
+        free(j->entries[i].name);
+
+    free(j->entries);
+    j->entries = NULL;
+    j->count = 0;
+}
+
+bool journal_remove(const char* folder)
+{
+    assert(folder);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", folder, JOURNAL_NAME);
+
+    if (unlink(path) != 0 && errno != ENOENT)
+    {
+        perror("Error removing journal");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @defgroup journal journal
+ * @{
+ * Progress journal of an iteration folder whose files are being stored.
+ *
+ * The journal is created with the folder and removed once every file is
+ * stored, so a folder that still has one belongs to an interrupted
+ * iteration. Files stored completely are in the copy record of the folder;
+ * large files also append a checkpoint ("<offset> <crc32c> <name>") each
+ * time another JOURNAL_CHECKPOINT_SIZE bytes are on disk, so their copy is
+ * resumed from the last checkpoint instead of from the start.
+ */
+
+/// File name of the progress journal of an iteration folder
+#define JOURNAL_NAME "__bckpjournal__"
+
+/// Bytes copied between two checkpoints of a file
+#define JOURNAL_CHECKPOINT_SIZE (64 * 1024 * 1024LL)
+
+/**
+ * Last checkpoint of a file
+ */
+typedef struct
+{
+    char* name; ///< Name of the file
+    long long offset; ///< Number of bytes of the stored data on disk
+    uint32_t crc; ///< CRC32C of those bytes (see hash_crc32c)
+} journal_entry;
+
+/**
+ * Progress journal of an iteration folder
+ */
+typedef struct
+{
+    journal_entry* entries; ///< Last checkpoint of each file, in byte order of their names
+    int count; ///< Number of entries
+} journal;
+
+/**
+ * Creates the journal of a folder, marking its iteration as not finished
+ * @param  folder Iteration folder
+ * @return        true if successful, false otherwise
+ */
+bool journal_create(const char* folder);
+
+/**
+ * Checks if the iteration of a folder was interrupted
+ * @param  folder Iteration folder
+ * @return        true if the folder has a journal, false otherwise
+ */
+bool journal_exists(const char* folder);
+
+/**
+ * Appends a checkpoint of a file to the journal of a folder, if it has one
+ * @param  folder Iteration folder
+ * @param  name   Name of the file being stored
+ * @param  offset Number of bytes of the stored data already on disk
+ * @param  crc    CRC32C of those bytes
+ * @return        true if successful (or the folder has no journal), false otherwise
+ */
+bool journal_checkpoint(const char* folder, const char* name, long long offset, uint32_t crc);
+
+/**
+ * Reads the journal of a folder
+ * @param  folder Iteration folder
+ * @param  j      journal struct to initialize. Must not be NULL.
+ * @return        0 upon success, 1 if the folder has no journal (j is empty)
+ */
+int journal_read(const char* folder, journal* j);
+
+/**
+ * Finds the last checkpoint of a file
+ * @param  j    journal struct. Must not be NULL.
+ * @param  name Name of the file. Must not be NULL.
+ * @return      The entry, NULL if the file has none
+ */
+const journal_entry* journal_find(const journal* j, const char* name);
+
+/**
+ * Releases the resources of a journal
+ * @param j journal struct. Must not be NULL.
+ */
+void journal_free(journal* j);
+
+/**
+ * Removes the journal of a folder, once its iteration is finished
+ * @param  folder Iteration folder
+ * @return        true if successful, false otherwise
+ */
+bool journal_remove(const char* folder);
+
+/**@}*/
+
+#endif
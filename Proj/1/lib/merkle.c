@@ -0,0 +1,743 @@
+#include "merkle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "fileinfo.h"
+#include "hash.h"
+#include "namesort.h"
+#include "utilities.h"
+
+/**
+ * Final mix of a hash (from MurmurHash3), spreads FNV-1a's poorly mixed low bits
+ */
+static uint64_t mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * Adds a 64 bit value to a hash, in little endian order so hashes do not depend on the host
+ */
+static uint64_t hash_u64(uint64_t hash, uint64_t value)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = value >> (8 * i);
+
+    return hash_fnv1a(hash, bytes, sizeof(bytes));
+}
+
+uint64_t merkle_leaf_hash(const file_info* fi)
+{
+    assert(fi);
+
+    uint64_t hash = hash_fnv1a(HASH_FNV1A_INIT, fi->file_name, strlen(fi->file_name) + 1);
+    hash = hash_u64(hash, fi->size);
+    hash = hash_u64(hash, fi->mtime);
+    hash = hash_u64(hash, fi->tail_hash);
+
+    return mix(hash);
+}
+
+/**
+ * Appends a node to a level of a tree
+ */
+static void push_node(merkle_tree* tree, int level, int* capacity, const merkle_node* node)
+{
+    if (tree->counts[level] == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        tree->nodes[level] = realloc(tree->nodes[level], *capacity * sizeof(merkle_node));
+    }
+
+    tree->nodes[level][tree->counts[level]++] = *node;
+}
+
+/**
+ * Appends a directory to a tree
+ */
+static void push_dir(merkle_tree* tree, int* capacity, const merkle_dir* dir)
+{
+    if (tree->dir_count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        tree->dirs = realloc(tree->dirs, *capacity * sizeof(merkle_dir));
+    }
+
+    tree->dirs[tree->dir_count++] = *dir;
+}
+
+/**
+ * Length of the directory part of a name (0 for names in the root)
+ */
+static size_t dir_length(const char* name)
+{
+    const char* slash = strrchr(name, '/');
+    return slash ? (size_t)(slash - name) : 0;
+}
+
+/**
+ * Checks if a directory is dir or one of its ancestors
+ */
+static bool is_ancestor(const char* ancestor, const char* dir, size_t length)
+{
+    size_t ancestor_length = strlen(ancestor);
+
+    return ancestor_length == 0 || (ancestor_length <= length && strncmp(ancestor, dir, ancestor_length) == 0
+                                    && (ancestor_length == length || dir[ancestor_length] == '/'));
+}
+
+/**
+ * qsort comparator of merkle_dir by name
+ */
+static int dir_compare(const void* a, const void* b)
+{
+    return name_compare(((const merkle_dir*)a)->name, ((const merkle_dir*)b)->name);
+}
+
+/**
+ * Builds the levels above level 0
+ */
+static void build_levels(merkle_tree* tree)
+{
+    if (tree->counts[0] == 0)
+        return;
+
+    int level = 0;
+    for (; tree->counts[level] > 1 && level + 1 < MERKLE_MAX_LEVELS; ++level)
+    {
+        int capacity = 0;
+        merkle_node parent = { HASH_FNV1A_INIT, 0, 0, NULL };
+
+        for (int i = 0; i < tree->counts[level]; ++i)
+        {
+            uint64_t hash = tree->nodes[level][i].hash;
+
+            parent.hash = hash_u64(parent.hash, hash);
+            parent.count++;
+
+            // at least 2 children per node, so the number of nodes always decreases
+            if ((parent.count >= 2 && (hash >> 32) % MERKLE_FANOUT == 0) || i + 1 == tree->counts[level])
+            {
+                parent.hash = mix(parent.hash);
+                push_node(tree, level + 1, &capacity, &parent);
+
+                parent.hash = HASH_FNV1A_INIT;
+                parent.count = 0;
+                parent.first = i + 1;
+            }
+        }
+    }
+
+    tree->levels = level + 1;
+}
+
+void merkle_build(FILE* source, merkle_tree* tree)
+{
+    assert(source);
+    assert(tree);
+
+    memset(tree, 0, sizeof(merkle_tree));
+
+    int capacity = 0, dir_capacity = 0;
+    merkle_node chunk = { HASH_FNV1A_INIT, 0, 0, NULL };
+
+    // directories containing the current entry, from the root
+    merkle_dir stack[MERKLE_MAX_LEVELS * 8];
+    int depth = 1;
+    stack[0].name = strdup("");
+    stack[0].hash = HASH_FNV1A_INIT;
+    stack[0].entries = 0;
+
+    char* prev_name = NULL;
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    while (file_info_read(source, &fi) != EOF)
+    {
+        if (fi.state == STATE_REMOVED)
+            continue;
+
+        const char* name = fi.file_name;
+        size_t length = dir_length(name);
+        uint64_t leaf = merkle_leaf_hash(&fi);
+
+        // chunks do not span directories
+        if (chunk.count > 0 && (length != dir_length(prev_name) || strncmp(prev_name, name, length) != 0))
+        {
+            chunk.hash = mix(chunk.hash);
+            push_node(tree, 0, &capacity, &chunk);
+            chunk.count = 0;
+        }
+
+        if (chunk.count == 0)
+        {
+            chunk.hash = HASH_FNV1A_INIT;
+            chunk.first = tree->entries;
+            chunk.first_name = strdup(name);
+        }
+
+        chunk.hash = hash_u64(chunk.hash, leaf);
+        chunk.count++;
+
+        // leave the directories that do not contain this entry, then enter the ones that do
+        while (depth > 1 && !is_ancestor(stack[depth - 1].name, name, length))
+        {
+            stack[depth - 1].hash = mix(stack[depth - 1].hash);
+            push_dir(tree, &dir_capacity, &stack[--depth]);
+        }
+
+        for (size_t i = strlen(stack[depth - 1].name) + 1; i <= length; ++i)
+        {
+            if ((i < length && name[i] != '/') || depth == (int)(sizeof(stack) / sizeof(stack[0])))
+                continue;
+
+            stack[depth].name = strndup(name, i);
+            stack[depth].hash = HASH_FNV1A_INIT;
+            stack[depth].entries = 0;
+            depth++;
+        }
+
+        for (int i = 0; i < depth; ++i)
+        {
+            stack[i].hash = hash_u64(stack[i].hash, leaf);
+            stack[i].entries++;
+        }
+
+        tree->entries++;
+        free(prev_name);
+        prev_name = strdup(name);
+
+        if (leaf % MERKLE_FANOUT == 0)
+        {
+            chunk.hash = mix(chunk.hash);
+            push_node(tree, 0, &capacity, &chunk);
+            chunk.count = 0;
+        }
+    }
+
+    if (chunk.count > 0)
+    {
+        chunk.hash = mix(chunk.hash);
+        push_node(tree, 0, &capacity, &chunk);
+    }
+
+    while (depth > 0)
+    {
+        stack[depth - 1].hash = mix(stack[depth - 1].hash);
+        push_dir(tree, &dir_capacity, &stack[--depth]);
+    }
+
+    qsort(tree->dirs, tree->dir_count, sizeof(merkle_dir), dir_compare);
+
+    free(prev_name);
+    file_info_free(&fi);
+
+    build_levels(tree);
+}
+
+/**
+ * Writes a tree: "<entries> <levels> <directories>", then for each level its number of nodes
+ *  followed by a line per node ("<hash> <children>", plus " <first name>" in level 0), then
+ *  a line per directory ("<hash> <entries> <name>")
+ */
+static bool merkle_write(FILE* dest, const merkle_tree* tree)
+{
+    fprintf(dest, "%d %d %d\n", tree->entries, tree->levels, tree->dir_count);
+
+    for (int level = 0; level < tree->levels; ++level)
+    {
+        fprintf(dest, "%d\n", tree->counts[level]);
+
+        for (int i = 0; i < tree->counts[level]; ++i)
+        {
+            const merkle_node* node = &tree->nodes[level][i];
+
+            if (level == 0)
+                fprintf(dest, "%016" PRIx64 " %d %s\n", node->hash, node->count, node->first_name);
+            else
+                fprintf(dest, "%016" PRIx64 " %d\n", node->hash, node->count);
+        }
+    }
+
+    for (int i = 0; i < tree->dir_count; ++i)
+        fprintf(dest, "%016" PRIx64 " %d %s\n", tree->dirs[i].hash, tree->dirs[i].entries, tree->dirs[i].name);
+
+    return !ferror(dest);
+}
+
+/**
+ * Reads a tree written by merkle_write
+ * @return 0 upon success, different otherwise
+ */
+static int merkle_read(FILE* source, merkle_tree* tree)
+{
+    memset(tree, 0, sizeof(merkle_tree));
+
+    if (fscanf(source, "%d %d %d\n", &tree->entries, &tree->levels, &tree->dir_count) != 3
+        || tree->levels < 0 || tree->levels > MERKLE_MAX_LEVELS || tree->dir_count < 0)
+        return 1;
+
+    int dir_count = tree->dir_count;
+    tree->dir_count = 0;
+
+    char* line = NULL;
+    size_t line_size = 0;
+    int result = 0;
+
+    for (int level = 0; result == 0 && level < tree->levels; ++level)
+    {
+        int count;
+        if (fscanf(source, "%d\n", &count) != 1 || count <= 0)
+        {
+            result = 1;
+            break;
+        }
+
+        tree->nodes[level] = calloc(count, sizeof(merkle_node));
+
+        for (int first = 0; tree->counts[level] < count; ++tree->counts[level])
+        {
+            merkle_node* node = &tree->nodes[level][tree->counts[level]];
+            int name_start = 0;
+            ssize_t length = getline(&line, &line_size, source);
+
+            if (length <= 0 || sscanf(line, "%" SCNx64 " %d%n", &node->hash, &node->count, &name_start) != 2
+                || line[name_start] != ' ')
+            {
+                result = 1;
+                break;
+            }
+
+            if (level == 0)
+            {
+                line[length - 1] = '\0';
+                node->first_name = strdup(line + name_start + 1);
+            }
+
+            node->first = first;
+            first += node->count;
+        }
+    }
+
+    if (result == 0)
+        tree->dirs = malloc((dir_count ? dir_count : 1) * sizeof(merkle_dir));
+
+    for (; result == 0 && tree->dir_count < dir_count; ++tree->dir_count)
+    {
+        merkle_dir* dir = &tree->dirs[tree->dir_count];
+        int name_start = 0;
+        ssize_t length = getline(&line, &line_size, source);
+
+        if (length <= 0 || sscanf(line, "%" SCNx64 " %d%n", &dir->hash, &dir->entries, &name_start) != 2
+            || line[name_start] != ' ')
+        {
+            result = 1;
+            break;
+        }
+
+        line[length - 1] = '\0';
+        dir->name = strdup(line + name_start + 1);
+    }
+
+    free(line);
+    return result;
+}
+
+bool merkle_build_folder(const char* folder)
+{
+    assert(folder);
+
+    char info_path[PATH_MAX + 16], tree_path[PATH_MAX + 16];
+    snprintf(info_path, sizeof(info_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+    snprintf(tree_path, sizeof(tree_path), "%s/%s", folder, MERKLE_TREE_NAME);
+
+    FILE* info = cipher_fopen(info_path, "r");
+    int iter;
+
+    if (info == NULL || backup_info_read_header(info, &iter) == EOF)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", info_path);
+        if (info != NULL)
+            fclose(info);
+        return false;
+    }
+
+    merkle_tree tree;
+    merkle_build(info, &tree);
+    fclose(info);
+
+    FILE* dest = cipher_fopen(tree_path, "w");
+    bool success = dest != NULL && merkle_write(dest, &tree);
+
+    if (dest == NULL || fclose(dest) != 0 || !success)
+    {
+        perror(tree_path);
+        success = false;
+    }
+
+    merkle_free(&tree);
+    return success;
+}
+
+int merkle_load(const char* folder, merkle_tree* tree)
+{
+    assert(folder);
+    assert(tree);
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", folder, MERKLE_TREE_NAME);
+
+    FILE* source = cipher_fopen(path, "r");
+    if (source != NULL)
+    {
+        int result = merkle_read(source, tree);
+        fclose(source);
+
+        if (result == 0)
+            return 0;
+
+        fprintf(stderr, "%s is invalid, rebuilding it.\n", path);
+        merkle_free(tree);
+    }
+
+    // iterations backed up before trees were written
+    snprintf(path, sizeof(path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+    source = cipher_fopen(path, "r");
+
+    int iter;
+    if (source == NULL || backup_info_read_header(source, &iter) == EOF)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", path);
+        if (source != NULL)
+            fclose(source);
+        return 1;
+    }
+
+    merkle_build(source, tree);
+    fclose(source);
+
+    return 0;
+}
+
+uint64_t merkle_root(const merkle_tree* tree)
+{
+    assert(tree);
+
+    return tree->levels > 0 ? tree->nodes[tree->levels - 1][0].hash : mix(HASH_FNV1A_INIT);
+}
+
+const merkle_dir* merkle_find_dir(const merkle_tree* tree, const char* name)
+{
+    assert(tree);
+    assert(name);
+
+    merkle_dir key = { (char*)name, 0, 0 };
+    return bsearch(&key, tree->dirs, tree->dir_count, sizeof(merkle_dir), dir_compare);
+}
+
+void merkle_free(merkle_tree* tree)
+{
+    assert(tree);
+
+    for (int level = 0; level < MERKLE_MAX_LEVELS; ++level)
+    {
+        for (int i = 0; level == 0 && i < tree->counts[0]; ++i)
+            free(tree->nodes[0][i].first_name);
+
+        free(tree->nodes[level]);
+        tree->nodes[level] = NULL;
+        tree->counts[level] = 0;
+    }
+
+    for (int i = 0; i < tree->dir_count; ++i)
+        free(tree->dirs[i].name);
+
+    free(tree->dirs);
+    tree->dirs = NULL;
+    tree->dir_count = 0;
+    tree->levels = 0;
+}
+
+/**
+ * Node of one of the trees being compared
+ */
+typedef struct
+{
+    int level; ///< Level of the node
+    int index; ///< Index of the node in its level
+    uint64_t hash; ///< Hash of the node
+} node_ref;
+
+/**
+ * List of nodes of one of the trees being compared
+ */
+typedef struct
+{
+    node_ref* refs; ///< Nodes
+    int count; ///< Number of nodes
+    int capacity; ///< Allocated number of nodes
+} node_list;
+
+static void node_list_push(node_list* list, const merkle_tree* tree, int level, int index)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->refs = realloc(list->refs, list->capacity * sizeof(node_ref));
+    }
+
+    node_ref* ref = &list->refs[list->count++];
+    ref->level = level;
+    ref->index = index;
+    ref->hash = tree->nodes[level][index].hash;
+}
+
+static int ref_hash_compare(const void* a, const void* b)
+{
+    uint64_t x = ((const node_ref*)a)->hash, y = ((const node_ref*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+static int ref_index_compare(const void* a, const void* b)
+{
+    return ((const node_ref*)a)->index - ((const node_ref*)b)->index;
+}
+
+/**
+ * Removes the nodes with the same hash from both lists
+ */
+static void remove_common(node_list* a, node_list* b)
+{
+    qsort(a->refs, a->count, sizeof(node_ref), ref_hash_compare);
+    qsort(b->refs, b->count, sizeof(node_ref), ref_hash_compare);
+
+    int i = 0, j = 0, kept_a = 0, kept_b = 0;
+    while (i < a->count || j < b->count)
+    {
+        int cmp = i == a->count ? 1 : j == b->count ? -1 : ref_hash_compare(&a->refs[i], &b->refs[j]);
+
+        if (cmp < 0)
+            a->refs[kept_a++] = a->refs[i++];
+        else if (cmp > 0)
+            b->refs[kept_b++] = b->refs[j++];
+        else
+        {
+            i++;
+            j++;
+        }
+    }
+
+    a->count = kept_a;
+    b->count = kept_b;
+}
+
+/**
+ * Replaces the nodes of a level by their children
+ */
+static void expand(node_list* list, const merkle_tree* tree, int level)
+{
+    node_list expanded = { NULL, 0, 0 };
+
+    for (int i = 0; i < list->count; ++i)
+    {
+        const node_ref* ref = &list->refs[i];
+
+        if (ref->level != level)
+        {
+            node_list_push(&expanded, tree, ref->level, ref->index);
+            continue;
+        }
+
+        const merkle_node* node = &tree->nodes[level][ref->index];
+        for (int child = node->first; child < node->first + node->count; ++child)
+            node_list_push(&expanded, tree, level - 1, child);
+    }
+
+    free(list->refs);
+    *list = expanded;
+}
+
+/**
+ * Reads the live entries of a list of chunks
+ * @return Array of entries, by increasing name (count set to its size), NULL on errors
+ */
+static file_info* read_chunks(const char* folder, const merkle_tree* tree, node_list* chunks, int* count)
+{
+    char info_path[PATH_MAX + 16];
+    snprintf(info_path, sizeof(info_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+
+    *count = 0;
+    int total = 0;
+    for (int i = 0; i < chunks->count; ++i)
+        total += tree->nodes[0][chunks->refs[i].index].count;
+
+    file_info* entries = malloc((total ? total : 1) * sizeof(file_info));
+    if (total == 0)
+        return entries;
+
+    FILE* info = cipher_fopen(info_path, "r");
+    if (info == NULL)
+    {
+        perror(info_path);
+        free(entries);
+        return NULL;
+    }
+
+    qsort(chunks->refs, chunks->count, sizeof(node_ref), ref_index_compare);
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+    int next = -1; // index of the next live entry of the stream, -1 if not positioned
+    bool success = true;
+
+    for (int i = 0; success && i < chunks->count; ++i)
+    {
+        const merkle_node* chunk = &tree->nodes[0][chunks->refs[i].index];
+        int read = 0;
+
+        // consecutive chunks are read sequentially, the others are found with a binary search
+        if (next != chunk->first)
+        {
+            if (backup_info_find(info, chunk->first_name, &fi) != 0)
+            {
+                success = false;
+                break;
+            }
+
+            file_info_new(&entries[*count], NULL);
+            file_info_assign(&entries[(*count)++], &fi);
+            read = 1;
+        }
+
+        while (read < chunk->count)
+        {
+            if (file_info_read(info, &fi) == EOF)
+            {
+                success = false;
+                break;
+            }
+
+            if (fi.state == STATE_REMOVED)
+                continue;
+
+            file_info_new(&entries[*count], NULL);
+            file_info_assign(&entries[(*count)++], &fi);
+            read++;
+        }
+
+        next = chunk->first + chunk->count;
+    }
+
+    file_info_free(&fi);
+    fclose(info);
+
+    if (!success)
+    {
+        fprintf(stderr, "%s does not match its tree.\n", info_path);
+        for (int i = 0; i < *count; ++i)
+            file_info_free(&entries[i]);
+        free(entries);
+        return NULL;
+    }
+
+    return entries;
+}
+
+int merkle_diff(const char* folder_a, const merkle_tree* a, const char* folder_b, const merkle_tree* b,
+                merkle_diff_callback callback, void* data)
+{
+    assert(folder_a && a);
+    assert(folder_b && b);
+
+    node_list list_a = { NULL, 0, 0 }, list_b = { NULL, 0, 0 };
+
+    for (int i = 0; a->levels > 0 && i < a->counts[a->levels - 1]; ++i)
+        node_list_push(&list_a, a, a->levels - 1, i);
+    for (int i = 0; b->levels > 0 && i < b->counts[b->levels - 1]; ++i)
+        node_list_push(&list_b, b, b->levels - 1, i);
+
+    // descend the highest nodes that differ until only chunks are left
+    for (;;)
+    {
+        remove_common(&list_a, &list_b);
+
+        int level = 0;
+        for (int i = 0; i < list_a.count; ++i)
+            if (list_a.refs[i].level > level)
+                level = list_a.refs[i].level;
+        for (int i = 0; i < list_b.count; ++i)
+            if (list_b.refs[i].level > level)
+                level = list_b.refs[i].level;
+
+        if (level == 0)
+            break;
+
+        expand(&list_a, a, level);
+        expand(&list_b, b, level);
+    }
+
+    int count_a, count_b;
+    file_info* entries_a = read_chunks(folder_a, a, &list_a, &count_a);
+    file_info* entries_b = read_chunks(folder_b, b, &list_b, &count_b);
+
+    free(list_a.refs);
+    free(list_b.refs);
+
+    int changes = -1;
+
+    if (entries_a && entries_b)
+    {
+        changes = 0;
+
+        // both lists are sorted by name, merge them
+        int i = 0, j = 0;
+        while (i < count_a || j < count_b)
+        {
+            int cmp = i == count_a ? 1 : j == count_b ? -1 : name_compare(entries_a[i].file_name, entries_b[j].file_name);
+
+            if (cmp < 0)
+            {
+                callback('-', &entries_a[i++], NULL, data);
+                changes++;
+            }
+            else if (cmp > 0)
+            {
+                callback('+', NULL, &entries_b[j++], data);
+                changes++;
+            }
+            else
+            {
+                // chunks can differ only because their boundaries moved
+                if (merkle_leaf_hash(&entries_a[i]) != merkle_leaf_hash(&entries_b[j]))
+                {
+                    callback('/', &entries_a[i], &entries_b[j], data);
+                    changes++;
+                }
+                i++;
+                j++;
+            }
+        }
+    }
+
+    for (int i = 0; entries_a && i < count_a; ++i)
+        file_info_free(&entries_a[i]);
+    for (int i = 0; entries_b && i < count_b; ++i)
+        file_info_free(&entries_b[i]);
+
+    free(entries_a);
+    free(entries_b);
+
+    return changes;
+}
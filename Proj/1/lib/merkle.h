@@ -0,0 +1,146 @@
+#ifndef MERKLE_H_
+#define MERKLE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fileinfo.h"
+
+/** @defgroup merkle merkle
+ * @{
+ * Merkle tree summarizing the live entries of an iteration.
+ *
+ * Each entry (name, size, modification time and tail hash, i.e. what a
+ * restore produces) has a leaf hash. Entries are cut into chunks that end
+ * where a leaf hash is a multiple of MERKLE_FANOUT or where the directory
+ * changes, so inserting or removing entries only changes the chunks around
+ * them. Chunks are grouped the same way, level after level, up to a single
+ * root. Two iterations (of the same or of different stores) with the same
+ * root restore the same files; otherwise merkle_diff only descends into the
+ * subtrees whose hashes differ and only decodes the entries of the chunks
+ * that differ.
+ *
+ * The hash of each directory (over the entries under it) is also kept.
+ * Trees are stored in the MERKLE_TREE_NAME file of each iteration folder.
+ */
+
+/// File name of the tree of an iteration folder
+#define MERKLE_TREE_NAME "__bckptree__"
+
+/// Average number of children of a node
+#define MERKLE_FANOUT 16
+
+/// Maximum number of levels of a tree
+#define MERKLE_MAX_LEVELS 32
+
+/**
+ * Node of the tree. Level 0 nodes are chunks of entries, the children of
+ *  the nodes of the other levels are consecutive nodes of the level below.
+ */
+typedef struct
+{
+    uint64_t hash; ///< Hash of the children hashes
+    int count; ///< Number of children
+    int first; ///< Index of the first child (in the level below or in the live entries)
+    char* first_name; ///< Name of the first entry (level 0 nodes only)
+} merkle_node;
+
+/**
+ * Hash of a directory
+ */
+typedef struct
+{
+    char* name; ///< Path of the directory
+    uint64_t hash; ///< Hash of the leaf hashes of the entries under it
+    int entries; ///< Number of entries under it
+} merkle_dir;
+
+/**
+ * Tree of an iteration
+ */
+typedef struct
+{
+    int entries; ///< Number of live entries
+    int levels; ///< Number of levels (0 if there are no entries)
+    merkle_node* nodes[MERKLE_MAX_LEVELS]; ///< Nodes of each level
+    int counts[MERKLE_MAX_LEVELS]; ///< Number of nodes of each level
+    merkle_dir* dirs; ///< Directories, in byte order of their names
+    int dir_count; ///< Number of directories
+} merkle_tree;
+
+/**
+ * Hash of an entry, as used in the leaves of the tree
+ * @param  fi file_info struct. Must not be NULL.
+ * @return    Leaf hash
+ */
+uint64_t merkle_leaf_hash(const file_info* fi);
+
+/**
+ * Builds the tree of a backup_info stream
+ * @param  source File stream positioned after the header of a backup_info
+ * @param  tree   merkle_tree struct to initialize. Must not be NULL.
+ */
+void merkle_build(FILE* source, merkle_tree* tree);
+
+/**
+ * Builds the tree of an iteration folder and writes it to the folder
+ * @param  folder Iteration folder
+ * @return        true if successful, false otherwise
+ */
+bool merkle_build_folder(const char* folder);
+
+/**
+ * Reads the tree of an iteration folder, building it from the backup info if it was not written
+ * @param  folder Iteration folder
+ * @param  tree   merkle_tree struct to initialize. Must not be NULL.
+ * @return        0 upon success, different otherwise
+ */
+int merkle_load(const char* folder, merkle_tree* tree);
+
+/**
+ * Root hash of a tree
+ * @param  tree merkle_tree struct. Must not be NULL.
+ * @return      Root hash
+ */
+uint64_t merkle_root(const merkle_tree* tree);
+
+/**
+ * Finds the hash of a directory
+ * @param  tree merkle_tree struct. Must not be NULL.
+ * @param  name Path of the directory ("" for the whole iteration)
+ * @return      The directory, NULL if the tree has no entries under it
+ */
+const merkle_dir* merkle_find_dir(const merkle_tree* tree, const char* name);
+
+/**
+ * Releases the resources of a tree
+ * @param tree merkle_tree struct. Must not be NULL.
+ */
+void merkle_free(merkle_tree* tree);
+
+/**
+ * Called by merkle_diff for each entry that differs
+ * @param change '+' (only in b), '-' (only in a) or '/' (in both, with different contents)
+ * @param a      Entry in a, NULL if absent
+ * @param b      Entry in b, NULL if absent
+ * @param data   Data passed to merkle_diff
+ */
+typedef void (*merkle_diff_callback)(char change, const file_info* a, const file_info* b, void* data);
+
+/**
+ * Finds the entries that differ between two iterations, by increasing name
+ * @param  folder_a Iteration folder of a
+ * @param  a        Tree of folder_a. Must not be NULL.
+ * @param  folder_b Iteration folder of b
+ * @param  b        Tree of folder_b. Must not be NULL.
+ * @param  callback Function called for each entry that differs
+ * @param  data     Passed to callback
+ * @return          Number of entries that differ, -1 on errors
+ */
+int merkle_diff(const char* folder_a, const merkle_tree* a, const char* folder_b, const merkle_tree* b,
+                merkle_diff_callback callback, void* data);
+
+/**@}*/
+
+#endif
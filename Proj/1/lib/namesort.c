@@ -0,0 +1,109 @@
+#include "namesort.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/// Buckets smaller than this are sorted with insertion sort
+#define INSERTION_SORT_THRESHOLD 32
+
+/// Past this depth the remaining suffixes are sorted with qsort to bound the recursion
+#define MAX_RADIX_DEPTH 64
+
+/// Depth used by suffix_compare (qsort has no user data argument)
+static size_t SuffixDepth;
+
+int name_compare(const char* a, const char* b)
+{
+    assert(a);
+    assert(b);
+
+    // strcmp compares as unsigned char, independently of the locale
+    return strcmp(a, b);
+}
+
+int bytesort(const struct dirent** a, const struct dirent** b)
+{
+    return name_compare((*a)->d_name, (*b)->d_name);
+}
+
+/**
+ * qsort comparator of the suffixes of two names starting at SuffixDepth
+ */
+static int suffix_compare(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a + SuffixDepth, *(char* const*)b + SuffixDepth);
+}
+
+/**
+ * Sorts names that are known to share their first depth bytes
+ */
+static void insertion_sort(char** names, size_t count, size_t depth)
+{
+    for (size_t i = 1; i < count; ++i)
+    {
+        char* name = names[i];
+        size_t j = i;
+
+        for (; j > 0 && strcmp(names[j - 1] + depth, name + depth) > 0; --j)
+            names[j] = names[j - 1];
+
+        names[j] = name;
+    }
+}
+
+/**
+ * Sorts names that are known to share their first depth bytes by distributing
+ *  them on their depth-th byte and recursively sorting each bucket
+ */
+static void radix_sort(char** names, char** temp, size_t count, size_t depth)
+{
+    if (count < INSERTION_SORT_THRESHOLD)
+    {
+        insertion_sort(names, count, depth);
+        return;
+    }
+
+    if (depth >= MAX_RADIX_DEPTH)
+    {
+        SuffixDepth = depth;
+        qsort(names, count, sizeof(char*), suffix_compare);
+        return;
+    }
+
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < count; ++i)
+        counts[(unsigned char)names[i][depth]]++;
+
+    size_t offsets[256];
+    offsets[0] = 0;
+    for (int c = 1; c < 256; ++c)
+        offsets[c] = offsets[c - 1] + counts[c - 1];
+
+    for (size_t i = 0; i < count; ++i)
+        temp[offsets[(unsigned char)names[i][depth]]++] = names[i];
+
+    memcpy(names, temp, count * sizeof(char*));
+
+    // bucket 0 holds names that end here, they are all equal
+    size_t start = counts[0];
+    for (int c = 1; c < 256; ++c)
+    {
+        if (counts[c] > 1)
+            radix_sort(names + start, temp, counts[c], depth + 1);
+
+        start += counts[c];
+    }
+}
+
+void name_sort(char** names, size_t count)
+{
+    if (count < 2)
+        return;
+
+    assert(names);
+
+    char** temp = malloc(count * sizeof(char*));
+    radix_sort(names, temp, count, 0);
+    free(temp);
+}
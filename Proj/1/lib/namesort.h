@@ -0,0 +1,42 @@
+#ifndef NAMESORT_H_
+#define NAMESORT_H_
+
+#include <dirent.h>
+#include <stddef.h>
+
+/** @defgroup namesort namesort
+ * @{
+ * Locale independent (byte order) sorting of file names.
+ *
+ * Backup infos are merged by name, so every list of names (the scanner,
+ * the backup info files and the diff itself) must use the same order.
+ * alphasort uses strcoll, which is slow and depends on the locale of the
+ * environment, so it must not be used for names that end up in a backup info.
+ */
+
+/**
+ * Compares two file names in byte order
+ * @param  a First name. Must not be NULL.
+ * @param  b Second name. Must not be NULL.
+ * @return   Negative, zero or positive if a is respectively lower, equal or greater than b
+ */
+int name_compare(const char* a, const char* b);
+
+/**
+ * Sorts an array of file names in byte order (MSD radix sort)
+ * @param names Array of names to sort
+ * @param count Number of names in the array
+ */
+void name_sort(char** names, size_t count);
+
+/**
+ * Comparator to be used in scandir instead of alphasort, sorts in byte order
+ * @param  a First dirent
+ * @param  b Second dirent
+ * @return   Negative, zero or positive if a is respectively lower, equal or greater than b
+ */
+int bytesort(const struct dirent** a, const struct dirent** b);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,1004 @@
+#include "parity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#endif
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "fileinfo.h"
+#include "hash.h"
+#include "utilities.h"
+
+/// Irreducible polynomial of GF(256), x^8 + x^4 + x^3 + x^2 + 1
+#define GF_POLYNOMIAL 0x11d
+
+/// Bytes of the blocks of a row encoded at once, so the parity being computed stays in the cache
+#define ENCODE_TILE (16 * 1024)
+
+static uint8_t GfExp[512]; ///< Powers of the generator 2, twice so the sum of two logarithms needs no modulo
+static uint8_t GfLog[256]; ///< Logarithms of the non zero elements
+static uint8_t GfMul[256][256]; ///< Products of every pair of elements
+static pthread_once_t GfOnce = PTHREAD_ONCE_INIT; ///< Guards gf_init
+static void (*GfMulAdd)(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size); ///< Implementation picked by gf_init
+
+/**
+ * Parity set of a folder
+ */
+typedef struct
+{
+    int data; ///< Number of data shards (k)
+    int parity; ///< Number of parity shards (m)
+    int count; ///< Number of stored files
+    char** names; ///< Names of the stored files, in the order of the stream
+    long long* starts; ///< Offset of each file in the stream, followed by the size of the stream
+    long long shard_size; ///< Bytes of each shard
+    long long rows; ///< Blocks of each shard
+    uint32_t* sums; ///< CRC32C of each block, by row and then by shard (data shards first)
+    off_t shards_offset; ///< Offset of the first parity shard in the parity file
+    uint8_t matrix[PARITY_MAX_SHARDS][PARITY_MAX_SHARDS]; ///< Coefficient of each data shard in each parity shard
+} parity_set;
+
+/**
+ * Stored file kept open while a shard is read
+ */
+typedef struct
+{
+    int index; ///< Index of the file, -1 if none
+    int fd; ///< Its descriptor, -1 if it could not be opened
+} stream_cursor;
+
+/**
+ * Buffers and files used while checking the rows of a set
+ */
+typedef struct
+{
+    const char* folder; ///< Iteration folder
+    int fd; ///< Parity file, opened for reading and writing
+    io_limits* limits; ///< I/O limits of the reads and writes
+    stream_cursor cursors[PARITY_MAX_SHARDS]; ///< Open file of each data shard
+    uint8_t* blocks[PARITY_MAX_SHARDS]; ///< Block of each shard of the row
+    uint8_t* work[PARITY_MAX_SHARDS]; ///< Right-hand sides of the equations of the damaged blocks
+    bool damaged[PARITY_MAX_SHARDS]; ///< Whether each block of the row is damaged
+} repair_state;
+
+/**
+ * Multiplies a region by a constant and adds it to another, one byte at a time
+ */
+static void gf_mul_add_table(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size)
+{
+    const uint8_t* row = GfMul[c];
+
+    for (size_t i = 0; i < size; ++i)
+        dst[i] ^= row[src[i]];
+}
+
+#if defined(__x86_64__)
+/**
+ * Multiplies a region by a constant and adds it to another, 16 bytes at a time: the product
+ *  of each byte is the sum of the products of its two nibbles, looked up with pshufb
+ */
+__attribute__((target("ssse3")))
+static void gf_mul_add_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size)
+{
+    uint8_t low[16], high[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        low[i] = GfMul[c][i];
+        high[i] = GfMul[c][i << 4];
+    }
+
+    __m128i low_table = _mm_loadu_si128((const __m128i*)low);
+    __m128i high_table = _mm_loadu_si128((const __m128i*)high);
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low_table, _mm_and_si128(in, mask)),
+                                        _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+        __m128i out = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(out, product));
+    }
+
+    gf_mul_add_table(dst + i, src + i, c, size - i);
+}
+
+/**
+ * Multiplies a region by a constant and adds it to another, 32 bytes at a time (see gf_mul_add_ssse3)
+ */
+__attribute__((target("avx2")))
+static void gf_mul_add_avx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size)
+{
+    uint8_t low[16], high[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        low[i] = GfMul[c][i];
+        high[i] = GfMul[c][i << 4];
+    }
+
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)low));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)high));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low_table, _mm256_and_si256(in, mask)),
+                                           _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask)));
+        __m256i out = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(out, product));
+    }
+
+    gf_mul_add_table(dst + i, src + i, c, size - i);
+}
+#endif
+
+/**
+ * Builds the tables of GF(256) and picks the fastest implementation of gf_mul_add
+ */
+static void gf_init(void)
+{
+    unsigned x = 1;
+    for (int i = 0; i < 255; ++i)
+    {
+        GfExp[i] = GfExp[i + 255] = x;
+        GfLog[x] = i;
+
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLYNOMIAL;
+    }
+
+    for (int a = 1; a < 256; ++a)
+        for (int b = 1; b < 256; ++b)
+            GfMul[a][b] = GfExp[GfLog[a] + GfLog[b]];
+
+    GfMulAdd = gf_mul_add_table;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        GfMulAdd = gf_mul_add_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        GfMulAdd = gf_mul_add_ssse3;
+#endif
+}
+
+/**
+ * Multiplies a region by a constant and adds it to another (dst ^= c * src)
+ */
+static void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size)
+{
+    if (c != 0)
+        GfMulAdd(dst, src, c, size);
+}
+
+/**
+ * Returns the inverse of a non zero element
+ */
+static uint8_t gf_inverse(uint8_t a)
+{
+    return GfExp[255 - GfLog[a]];
+}
+
+/**
+ * Inverts a square matrix by Gauss-Jordan elimination
+ * @param  matrix  Matrix, destroyed
+ * @param  inverse Resulting inverse
+ * @param  n       Number of rows and columns
+ * @return         false if the matrix is singular
+ */
+static bool gf_invert(uint8_t matrix[][PARITY_MAX_SHARDS], uint8_t inverse[][PARITY_MAX_SHARDS], int n)
+{
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            inverse[i][j] = i == j;
+
+    for (int col = 0; col < n; ++col)
+    {
+        int pivot = col;
+        while (pivot < n && matrix[pivot][col] == 0)
+            pivot++;
+        if (pivot == n)
+            return false;
+
+        for (int j = 0; j < n; ++j)
+        {
+            uint8_t temp = matrix[col][j];
+            matrix[col][j] = matrix[pivot][j];
+            matrix[pivot][j] = temp;
+            temp = inverse[col][j];
+            inverse[col][j] = inverse[pivot][j];
+            inverse[pivot][j] = temp;
+        }
+
+        uint8_t scale = gf_inverse(matrix[col][col]);
+        for (int j = 0; j < n; ++j)
+        {
+            matrix[col][j] = GfMul[scale][matrix[col][j]];
+            inverse[col][j] = GfMul[scale][inverse[col][j]];
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            uint8_t factor = matrix[i][col];
+            if (i == col || factor == 0)
+                continue;
+
+            for (int j = 0; j < n; ++j)
+            {
+                matrix[i][j] ^= GfMul[factor][matrix[col][j]];
+                inverse[i][j] ^= GfMul[factor][inverse[col][j]];
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Sets the shard size, the number of rows and the coding matrix from the sizes of the stored
+ *  files and the number of shards. Parity shard p is the sum of the data shards j times
+ *  1 / ((k + p) + j), so any k of the k + m shards are independent.
+ */
+static void set_layout(parity_set* set)
+{
+    long long total = set->starts[set->count];
+
+    set->shard_size = (total + set->data - 1) / set->data;
+    set->rows = (set->shard_size + PARITY_BLOCK_SIZE - 1) / PARITY_BLOCK_SIZE;
+    set->sums = calloc(set->rows * (set->data + set->parity) + 1, sizeof(uint32_t));
+
+    for (int p = 0; p < set->parity; ++p)
+        for (int j = 0; j < set->data; ++j)
+            set->matrix[p][j] = gf_inverse((set->data + p) ^ j);
+}
+
+/**
+ * Returns the number of bytes of the blocks of a row
+ */
+static size_t row_length(const parity_set* set, long long row)
+{
+    long long length = set->shard_size - row * PARITY_BLOCK_SIZE;
+    return length < PARITY_BLOCK_SIZE ? length : PARITY_BLOCK_SIZE;
+}
+
+/**
+ * Releases the resources of a parity set
+ */
+static void parity_set_free(parity_set* set)
+{
+    for (int i = 0; i < set->count; ++i)
+        free(set->names[i]);
+
+    free(set->names);
+    free(set->starts);
+    free(set->sums);
+}
+
+/**
+ * Lists the files stored in a folder (the ones changed in its iteration) with their stored sizes
+ * @return true if successful, false if the backup info of the folder could not be read
+ */
+static bool list_stored_files(const char* folder, parity_set* set)
+{
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+
+    FILE* info = cipher_fopen(path, "r");
+    int iter;
+
+    if (info == NULL || backup_info_read_header(info, &iter) == EOF)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", path);
+        if (info != NULL)
+            fclose(info);
+        return false;
+    }
+
+    int capacity = 16;
+    set->count = 0;
+    set->names = malloc(capacity * sizeof(char*));
+    set->starts = malloc((capacity + 1) * sizeof(long long));
+    set->starts[0] = 0;
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    while (file_info_read(info, &fi) != EOF)
+    {
+        if (fi.iter != iter || (fi.state != STATE_ADDED && fi.state != STATE_MODIFIED && fi.state != STATE_APPENDED))
+            continue;
+
+        if (set->count == capacity)
+        {
+            capacity *= 2;
+            set->names = realloc(set->names, capacity * sizeof(char*));
+            set->starts = realloc(set->starts, (capacity + 1) * sizeof(long long));
+        }
+
+        // a file whose copy failed is not protected
+        char* file_path = malloc(strlen(folder) + strlen(fi.file_name) + 2);
+        sprintf(file_path, "%s/%s", folder, fi.file_name);
+
+        struct stat buf;
+        long long size = stat(file_path, &buf) == 0 ? buf.st_size : 0;
+        free(file_path);
+
+        set->names[set->count] = strdup(fi.file_name);
+        set->starts[set->count + 1] = set->starts[set->count] + size;
+        set->count++;
+    }
+
+    file_info_free(&fi);
+    fclose(info);
+    return true;
+}
+
+/**
+ * Writes a line of the header of a parity set, sealed when a key is loaded (it names the stored files)
+ * @return true if successful, false if the line is too long
+ */
+static bool write_header_line(FILE* stream, const char* format, ...)
+{
+    char line[PATH_MAX + 32];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length >= (int)sizeof(line))
+        return false;
+
+    char sealed[CIPHER_SEALED_SIZE(sizeof(line))];
+    if (cipher_enabled() && (length = cipher_seal_line(line, length, sealed)) < 0)
+        return false;
+
+    return fwrite(cipher_enabled() ? sealed : line, 1, length, stream) == (size_t)length;
+}
+
+/**
+ * Reads a line of the header of a parity set, opening it when a key is loaded
+ * @param  crc Checksum of the header, updated with the line as it is stored
+ * @return     Number of bytes of the line, -1 if it could not be read or opened
+ */
+static ssize_t read_header_line(FILE* file, char** line, size_t* line_size, uint32_t* crc)
+{
+    ssize_t length = getline(line, line_size, file);
+    if (length <= 0)
+        return -1;
+
+    *crc = hash_crc32c(*crc, *line, length);
+    return cipher_enabled() ? cipher_open_line(*line, length) : length;
+}
+
+/**
+ * Reads the parity set of a folder, checking the checksum of its header and block checksums
+ * @return 0 upon success, 1 if the folder has no parity set, EOF on errors
+ */
+static int parity_set_read(const char* folder, parity_set* set)
+{
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", folder, PARITY_NAME);
+
+    memset(set, 0, sizeof(parity_set));
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+            return 1;
+
+        perror(path);
+        return EOF;
+    }
+
+    char* line = NULL;
+    size_t line_size = 0;
+    uint32_t crc = 0;
+    ssize_t length = read_header_line(file, &line, &line_size, &crc);
+    int block_size = 0, count = 0;
+    bool valid = length > 0 && sscanf(line, "parity %d %d %d %d", &set->data, &set->parity, &block_size, &count) == 4
+                 && set->data >= 1 && set->parity >= 1 && set->data + set->parity <= PARITY_MAX_SHARDS
+                 && block_size == PARITY_BLOCK_SIZE && count >= 0;
+
+    if (valid)
+    {
+        set->names = malloc((count + 1) * sizeof(char*));
+        set->starts = malloc((count + 1) * sizeof(long long));
+        set->starts[0] = 0;
+    }
+
+    for (; valid && set->count < count; set->count++)
+    {
+        long long size;
+        int name_start = 0;
+
+        length = read_header_line(file, &line, &line_size, &crc);
+        valid = length > 1 && line[length - 1] == '\n' && sscanf(line, "%lld%n", &size, &name_start) == 1
+            && line[name_start] == ' ' && size >= 0;
+        if (!valid)
+            break;
+
+        line[length - 1] = '\0';
+
+        set->names[set->count] = strdup(line + name_start + 1);
+        set->starts[set->count + 1] = set->starts[set->count] + size;
+    }
+
+    free(line);
+
+    if (valid)
+    {
+        set_layout(set);
+
+        size_t sums = set->rows * (set->data + set->parity);
+        uint32_t stored;
+
+        valid = fread(set->sums, sizeof(uint32_t), sums, file) == sums && fread(&stored, sizeof(uint32_t), 1, file) == 1
+                && hash_crc32c(crc, set->sums, sums * sizeof(uint32_t)) == stored;
+        set->shards_offset = ftell(file);
+    }
+
+    fclose(file);
+
+    if (!valid)
+    {
+        fprintf(stderr, "The parity set of %s is damaged.\n", folder);
+        parity_set_free(set);
+        return EOF;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds the file of the stream that holds a byte (empty files hold none)
+ */
+static int find_file(const parity_set* set, long long offset)
+{
+    int low = 0, high = set->count - 1;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (set->starts[middle + 1] > offset)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    return low;
+}
+
+/**
+ * Reads or writes all the bytes of a region of a file
+ * @return true if successful, false otherwise (a short read included)
+ */
+static bool transfer(int fd, void* buffer, size_t length, off_t offset, bool write, io_limits* limits)
+{
+    char* bytes = buffer;
+
+    while (length > 0)
+    {
+        ssize_t done = write ? pwrite(fd, bytes, length, offset) : pread(fd, bytes, length, offset);
+        io_limits_take(limits, done > 0 ? done : 0, 1);
+
+        if (done <= 0)
+            return false;
+
+        bytes += done;
+        length -= done;
+        offset += done;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a region of the stream of stored files. The bytes after its end are zeros.
+ * @return true if successful, false if a part could not be read (it is left as zeros)
+ */
+static bool read_stream(const parity_set* set, const char* folder, stream_cursor* cursor, long long offset,
+                        uint8_t* buffer, size_t length, io_limits* limits)
+{
+    long long end = offset + length;
+    long long total = set->starts[set->count];
+    bool success = true;
+
+    while (offset < end)
+    {
+        if (offset >= total)
+        {
+            memset(buffer, 0, end - offset);
+            break;
+        }
+
+        int index = find_file(set, offset);
+        size_t part = (set->starts[index + 1] < end ? set->starts[index + 1] : end) - offset;
+
+        if (cursor->index != index)
+        {
+            if (cursor->fd >= 0)
+                close(cursor->fd);
+
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", folder, set->names[index]);
+            cursor->index = index;
+            cursor->fd = open(path, O_RDONLY);
+        }
+
+        if (cursor->fd < 0 || !transfer(cursor->fd, buffer, part, offset - set->starts[index], false, limits))
+        {
+            memset(buffer, 0, part);
+            success = false;
+        }
+
+        buffer += part;
+        offset += part;
+    }
+
+    return success;
+}
+
+/**
+ * Writes a region of the stream of stored files, creating the files that are missing
+ * @return true if successful, false otherwise
+ */
+static bool write_stream(const parity_set* set, const char* folder, long long offset, const uint8_t* buffer,
+                         size_t length, io_limits* limits)
+{
+    long long end = offset + length;
+    if (end > set->starts[set->count])
+        end = set->starts[set->count];
+
+    bool success = true;
+
+    while (offset < end)
+    {
+        int index = find_file(set, offset);
+        size_t part = (set->starts[index + 1] < end ? set->starts[index + 1] : end) - offset;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", folder, set->names[index]);
+
+        int fd = make_parent_dirs(path) ? open(path, O_WRONLY | O_CREAT, 0644) : -1;
+        if (fd < 0 || !transfer(fd, (void*)buffer, part, offset - set->starts[index], true, limits))
+        {
+            perror(path);
+            success = false;
+        }
+
+        if (fd >= 0)
+            close(fd);
+
+        buffer += part;
+        offset += part;
+    }
+
+    return success;
+}
+
+/**
+ * Computes the parity blocks of a row from its data blocks
+ * @param first First parity shard computed
+ * @param last  Parity shard after the last one computed
+ */
+static void encode_row(const parity_set* set, uint8_t** blocks, size_t length, int first, int last)
+{
+    for (size_t tile = 0; tile < length; tile += ENCODE_TILE)
+    {
+        size_t size = length - tile < ENCODE_TILE ? length - tile : ENCODE_TILE;
+
+        for (int p = first; p < last; ++p)
+        {
+            uint8_t* out = blocks[set->data + p] + tile;
+            memset(out, 0, size);
+
+            for (int j = 0; j < set->data; ++j)
+                gf_mul_add(out, blocks[j] + tile, set->matrix[p][j], size);
+        }
+    }
+}
+
+/**
+ * Returns the offset of a block of a parity shard in the parity file
+ */
+static off_t parity_offset(const parity_set* set, int p, long long row)
+{
+    return set->shards_offset + p * set->shard_size + row * PARITY_BLOCK_SIZE;
+}
+
+bool parity_build_folder(const char* folder, int data, int parity, io_limits* limits)
+{
+    assert(folder);
+    assert(data >= 1 && parity >= 1 && data + parity <= PARITY_MAX_SHARDS);
+
+    pthread_once(&GfOnce, gf_init);
+
+    parity_set set;
+    memset(&set, 0, sizeof(set));
+    if (!list_stored_files(folder, &set))
+        return false;
+
+    set.data = data;
+    set.parity = parity;
+    set_layout(&set);
+
+    char* header = NULL;
+    size_t header_size = 0;
+    FILE* stream = open_memstream(&header, &header_size);
+    bool success = write_header_line(stream, "parity %d %d %d %d\n", data, parity, PARITY_BLOCK_SIZE, set.count);
+    for (int i = 0; success && i < set.count; ++i)
+        success = write_header_line(stream, "%lld %s\n", set.starts[i + 1] - set.starts[i], set.names[i]);
+    fclose(stream);
+
+    // the shards follow the header as it is stored
+    size_t sums = set.rows * (data + parity);
+    set.shards_offset = header_size + (sums + 1) * sizeof(uint32_t);
+
+    char path[PATH_MAX + 32], temp_path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", folder, PARITY_NAME);
+    snprintf(temp_path, sizeof(temp_path), "%s/%s.tmp", folder, PARITY_NAME);
+
+    int fd = success ? open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    success = fd >= 0 && transfer(fd, header, header_size, 0, true, limits);
+
+    uint8_t* buffer = malloc((size_t)(data + parity) * PARITY_BLOCK_SIZE);
+    uint8_t* blocks[PARITY_MAX_SHARDS];
+    stream_cursor cursors[PARITY_MAX_SHARDS];
+
+    for (int s = 0; s < data + parity; ++s)
+    {
+        blocks[s] = buffer + (size_t)s * PARITY_BLOCK_SIZE;
+        cursors[s].index = -1;
+        cursors[s].fd = -1;
+    }
+
+    for (long long row = 0; success && row < set.rows; ++row)
+    {
+        size_t length = row_length(&set, row);
+        uint32_t* row_sums = set.sums + row * (data + parity);
+
+        for (int j = 0; success && j < data; ++j)
+        {
+            // the data is read as it is stored, the parity protects it from now on
+            if (!read_stream(&set, folder, &cursors[j], j * set.shard_size + row * PARITY_BLOCK_SIZE, blocks[j], length, limits))
+            {
+                fprintf(stderr, "Could not read the data of %s.\n", folder);
+                success = false;
+            }
+
+            row_sums[j] = hash_crc32c(0, blocks[j], length);
+        }
+
+        if (!success)
+            break;
+
+        encode_row(&set, blocks, length, 0, parity);
+
+        for (int p = 0; success && p < parity; ++p)
+        {
+            row_sums[data + p] = hash_crc32c(0, blocks[data + p], length);
+            success = transfer(fd, blocks[data + p], length, parity_offset(&set, p, row), true, limits);
+        }
+    }
+
+    if (success)
+    {
+        uint32_t crc = hash_crc32c(hash_crc32c(0, header, header_size), set.sums, sums * sizeof(uint32_t));
+        set.sums[sums] = crc;
+        success = transfer(fd, set.sums, (sums + 1) * sizeof(uint32_t), header_size, true, limits);
+    }
+
+    if (fd < 0 || close(fd) != 0 || !success || rename(temp_path, path) != 0)
+    {
+        perror(path);
+        unlink(temp_path);
+        success = false;
+    }
+
+    for (int j = 0; j < data; ++j)
+        if (cursors[j].fd >= 0)
+            close(cursors[j].fd);
+
+    free(buffer);
+    free(header);
+    parity_set_free(&set);
+    return success;
+}
+
+/**
+ * Reads a block of a row into the state and checks it
+ * @return true if it was read and matches its checksum
+ */
+static bool check_block(const parity_set* set, repair_state* state, long long row, int shard)
+{
+    size_t length = row_length(set, row);
+    bool read;
+
+    if (shard < set->data)
+        read = read_stream(set, state->folder, &state->cursors[shard], shard * set->shard_size + row * PARITY_BLOCK_SIZE,
+                           state->blocks[shard], length, state->limits);
+    else
+        read = transfer(state->fd, state->blocks[shard], length, parity_offset(set, shard - set->data, row), false,
+                        state->limits);
+
+    return read && hash_crc32c(0, state->blocks[shard], length) == set->sums[row * (set->data + set->parity) + shard];
+}
+
+/**
+ * Closes the files kept open by the cursors, which may have been replaced
+ */
+static void reset_cursors(const parity_set* set, repair_state* state)
+{
+    for (int j = 0; j < set->data; ++j)
+    {
+        if (state->cursors[j].fd >= 0)
+            close(state->cursors[j].fd);
+
+        state->cursors[j].index = -1;
+        state->cursors[j].fd = -1;
+    }
+}
+
+/**
+ * Checks a row of blocks and rebuilds the damaged ones from the others
+ * @param  hint Shard whose block is checked first, the rest of the row is only read if it is damaged
+ *              (-1 to check the whole row)
+ * @return      false if blocks were lost, true otherwise
+ */
+static bool repair_row(const parity_set* set, repair_state* state, long long row, int hint, parity_result* result)
+{
+    int shards = set->data + set->parity;
+    size_t length = row_length(set, row);
+
+    if (hint >= 0)
+    {
+        result->blocks++;
+        if (check_block(set, state, row, hint))
+            return true;
+    }
+
+    int damaged = 0;
+    for (int s = 0; s < shards; ++s)
+    {
+        if (s == hint)
+        {
+            state->damaged[s] = true;
+            damaged++;
+            continue;
+        }
+
+        result->blocks++;
+        state->damaged[s] = !check_block(set, state, row, s);
+        damaged += state->damaged[s];
+    }
+
+    if (damaged == 0)
+        return true;
+
+    result->damaged += damaged;
+
+    // the damaged data blocks are the unknowns of as many equations, given by intact parity blocks
+    int lost[PARITY_MAX_SHARDS], equations[PARITY_MAX_SHARDS];
+    int unknowns = 0, available = 0;
+
+    for (int j = 0; j < set->data; ++j)
+        if (state->damaged[j])
+            lost[unknowns++] = j;
+    for (int p = 0; p < set->parity && available < unknowns; ++p)
+        if (!state->damaged[set->data + p])
+            equations[available++] = p;
+
+    if (available < unknowns)
+    {
+        fprintf(stderr, "%s: %d damaged block(s) at offset %lld of the shards, only %d can be rebuilt.\n",
+                state->folder, damaged, row * PARITY_BLOCK_SIZE, set->parity);
+        result->lost += damaged;
+        return false;
+    }
+
+    if (unknowns > 0)
+    {
+        uint8_t matrix[PARITY_MAX_SHARDS][PARITY_MAX_SHARDS], inverse[PARITY_MAX_SHARDS][PARITY_MAX_SHARDS];
+
+        for (int a = 0; a < unknowns; ++a)
+        {
+            int p = equations[a];
+            for (int b = 0; b < unknowns; ++b)
+                matrix[a][b] = set->matrix[p][lost[b]];
+
+            // parity p minus the contributions of the intact data blocks
+            memcpy(state->work[a], state->blocks[set->data + p], length);
+            for (int j = 0; j < set->data; ++j)
+                if (!state->damaged[j])
+                    gf_mul_add(state->work[a], state->blocks[j], set->matrix[p][j], length);
+        }
+
+        gf_invert(matrix, inverse, unknowns); // square submatrices of a Cauchy matrix are invertible
+
+        for (int b = 0; b < unknowns; ++b)
+        {
+            uint8_t* block = state->blocks[lost[b]];
+            memset(block, 0, length);
+            for (int a = 0; a < unknowns; ++a)
+                gf_mul_add(block, state->work[a], inverse[b][a], length);
+        }
+
+        for (int b = 0; b < unknowns; ++b)
+        {
+            int j = lost[b];
+            if (hash_crc32c(0, state->blocks[j], length) != set->sums[row * shards + j]
+                || !write_stream(set, state->folder, j * set->shard_size + row * PARITY_BLOCK_SIZE, state->blocks[j],
+                                 length, state->limits))
+            {
+                fprintf(stderr, "%s: could not rebuild the block at offset %lld of data shard %d.\n", state->folder,
+                        row * PARITY_BLOCK_SIZE, j);
+                result->lost++;
+            }
+            else
+                result->repaired++;
+        }
+
+        reset_cursors(set, state);
+    }
+
+    for (int p = 0; p < set->parity; ++p)
+    {
+        if (!state->damaged[set->data + p])
+            continue;
+
+        encode_row(set, state->blocks, length, p, p + 1);
+        if (transfer(state->fd, state->blocks[set->data + p], length, parity_offset(set, p, row), true, state->limits))
+            result->repaired++;
+        else
+        {
+            fprintf(stderr, "%s: could not rewrite the block at offset %lld of parity shard %d.\n", state->folder,
+                    row * PARITY_BLOCK_SIZE, p);
+            result->lost++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Reads the parity set of a folder and prepares the buffers of its repair
+ * @return 0 upon success, 1 if the folder has no parity set, EOF on errors
+ */
+static int repair_open(const char* folder, io_limits* limits, parity_set* set, repair_state* state)
+{
+    pthread_once(&GfOnce, gf_init);
+
+    int read = parity_set_read(folder, set);
+    if (read != 0)
+        return read;
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", folder, PARITY_NAME);
+
+    state->folder = folder;
+    state->limits = limits;
+    state->fd = open(path, O_RDWR);
+    if (state->fd < 0)
+    {
+        perror(path);
+        parity_set_free(set);
+        return EOF;
+    }
+
+    int shards = set->data + set->parity;
+    uint8_t* buffer = malloc((size_t)(shards + set->parity) * PARITY_BLOCK_SIZE);
+
+    for (int s = 0; s < shards; ++s)
+        state->blocks[s] = buffer + (size_t)s * PARITY_BLOCK_SIZE;
+    for (int p = 0; p < set->parity; ++p)
+        state->work[p] = buffer + (size_t)(shards + p) * PARITY_BLOCK_SIZE;
+    for (int j = 0; j < set->data; ++j)
+    {
+        state->cursors[j].index = -1;
+        state->cursors[j].fd = -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases the resources of a repair
+ */
+static void repair_close(parity_set* set, repair_state* state)
+{
+    reset_cursors(set, state);
+    close(state->fd);
+    free(state->blocks[0]);
+    parity_set_free(set);
+}
+
+int parity_repair_folder(const char* folder, io_limits* limits, parity_result* result)
+{
+    assert(folder);
+    assert(result);
+
+    parity_set set;
+    repair_state state;
+    int opened = repair_open(folder, limits, &set, &state);
+    if (opened != 0)
+        return opened;
+
+    // a damaged row is checked entirely by its first damaged parity block, the others are then intact
+    bool success = true;
+    for (long long row = 0; row < set.rows; ++row)
+        for (int p = 0; p < set.parity; ++p)
+            if (!repair_row(&set, &state, row, set.data + p, result))
+            {
+                success = false;
+                break;
+            }
+
+    repair_close(&set, &state);
+    return success ? 0 : EOF;
+}
+
+int parity_repair_file(const char* folder, const char* name, io_limits* limits, parity_result* result)
+{
+    assert(folder);
+    assert(name);
+    assert(result);
+
+    parity_set set;
+    repair_state state;
+    int opened = repair_open(folder, limits, &set, &state);
+    if (opened != 0)
+        return opened;
+
+    int index = 0;
+    while (index < set.count && strcmp(set.names[index], name) != 0)
+        index++;
+
+    if (index == set.count)
+    {
+        repair_close(&set, &state);
+        return 1;
+    }
+
+    // the blocks of each shard the file is in, a lost row is only reported once
+    bool success = true;
+    bool* lost = calloc(set.rows, sizeof(bool));
+    long long start = set.starts[index], end = set.starts[index + 1];
+
+    for (int j = 0; start < end && j < set.data; ++j)
+    {
+        long long shard_start = j * set.shard_size, shard_end = shard_start + set.shard_size;
+        if (end <= shard_start || start >= shard_end)
+            continue;
+
+        long long first = ((start > shard_start ? start : shard_start) - shard_start) / PARITY_BLOCK_SIZE;
+        long long last = ((end < shard_end ? end : shard_end) - 1 - shard_start) / PARITY_BLOCK_SIZE;
+
+        for (long long row = first; row <= last; ++row)
+            if (!lost[row] && !repair_row(&set, &state, row, j, result))
+            {
+                lost[row] = true;
+                success = false;
+            }
+    }
+
+    free(lost);
+    repair_close(&set, &state);
+    return success ? 0 : EOF;
+}
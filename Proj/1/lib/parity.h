@@ -0,0 +1,87 @@
+#ifndef PARITY_H_
+#define PARITY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "throttle.h"
+
+/** @defgroup parity parity
+ * @{
+ * Reed-Solomon parity of the data stored in an iteration folder.
+ *
+ * The files stored in a folder (the ones changed in its iteration, in the
+ * order of its backup info) are seen as a single stream, cut into k data
+ * shards of the same size (the end of the last one is taken as zeros). m
+ * parity shards are computed from them with a systematic Reed-Solomon code
+ * over GF(256) (a Cauchy matrix), so the data can be rebuilt as long as, at
+ * each offset, at most m of the k + m shards are damaged. A bad sector, or
+ * a lost file smaller than a shard, only damages one or two of them.
+ *
+ * Shards are cut into PARITY_BLOCK_SIZE blocks, whose CRC32C are kept with
+ * the parity, so damaged blocks are found without any other record. The
+ * parity set of a folder is stored in its PARITY_NAME file: a header with
+ * k, m and the stored files with their sizes (each line sealed when a key
+ * is loaded, see cipher_seal_line), the checksums of the blocks of every
+ * shard, a checksum of the header and checksums, and the parity shards.
+ * Multiplications by constants use SSSE3 or AVX2 shuffles of two
+ * 16 entry tables when the processor has them, a full table otherwise.
+ */
+
+/// File name of the parity set of an iteration folder
+#define PARITY_NAME "__bckpparity__"
+
+/// Number of bytes of each checksummed block of a shard (rows of blocks are encoded at once)
+#define PARITY_BLOCK_SIZE (1024 * 1024)
+
+/// Maximum number of data and parity shards of a set
+#define PARITY_MAX_SHARDS 64
+
+/**
+ * Counters of a repair
+ */
+typedef struct
+{
+    long long blocks; ///< Blocks checked, of the data and parity shards
+    long long damaged; ///< Blocks that could not be read or whose checksum did not match
+    long long repaired; ///< Damaged blocks rebuilt and written back
+    long long lost; ///< Damaged blocks that could not be rebuilt (more than m damaged at the same offset)
+} parity_result;
+
+/**
+ * Computes the parity set of the files stored in an iteration folder and writes it to the
+ *  PARITY_NAME file of the folder (replaced once complete)
+ * @param  folder Iteration folder, whose files are all stored
+ * @param  data   Number of data shards (k), at least 1
+ * @param  parity Number of parity shards (m), at least 1, with data + parity at most PARITY_MAX_SHARDS
+ * @param  limits I/O limits of the reads and writes (NULL for none)
+ * @return        true if successful, false otherwise
+ */
+bool parity_build_folder(const char* folder, int data, int parity, io_limits* limits);
+
+/**
+ * Checks the blocks of the parity shards of an iteration folder and rebuilds the damaged ones
+ *  (the data blocks are checked when their files are, see parity_repair_file). The rows of
+ *  damaged blocks are read entirely, so their damaged data blocks are rebuilt too.
+ * @param  folder Iteration folder
+ * @param  limits I/O limits of the reads and writes (NULL for none)
+ * @param  result parity_result struct to add the counters to. Must not be NULL.
+ * @return        0 if nothing was lost, 1 if the folder has no parity set, EOF on errors or if blocks were lost
+ */
+int parity_repair_folder(const char* folder, io_limits* limits, parity_result* result);
+
+/**
+ * Checks the blocks of a stored file and rebuilds the damaged ones. Only the other blocks
+ *  at the offsets of the damaged ones are read.
+ * @param  folder Iteration folder
+ * @param  name   Name of the stored file. Must not be NULL.
+ * @param  limits I/O limits of the reads and writes (NULL for none)
+ * @param  result parity_result struct to add the counters to. Must not be NULL.
+ * @return        0 if nothing was lost, 1 if the folder has no parity set or the file is not in it,
+ *                EOF on errors or if blocks were lost
+ */
+int parity_repair_file(const char* folder, const char* name, io_limits* limits, parity_result* result);
+
+/**@}*/
+
+#endif
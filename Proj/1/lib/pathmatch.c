@@ -0,0 +1,147 @@
+#include "pathmatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <assert.h>
+
+#include "vector.h"
+#include "namesort.h"
+
+/**
+ * Frees the strings of a vector<char*> and the vector itself
+ */
+static void free_strings(vector* v)
+{
+    for (int i = 0; i < vector_size(v); ++i)
+        free(vector_get(v, i));
+
+    vector_free(v);
+}
+
+void pattern_set_new(pattern_set* set)
+{
+    assert(set);
+
+    vector_new(&set->literals);
+    vector_new(&set->prefixes);
+    vector_new(&set->globs);
+    set->compiled = true;
+}
+
+void pattern_set_free(pattern_set* set)
+{
+    assert(set);
+
+    free_strings(&set->literals);
+    free_strings(&set->prefixes);
+    free_strings(&set->globs);
+}
+
+void pattern_set_add(pattern_set* set, const char* pattern)
+{
+    assert(set);
+    assert(pattern);
+
+    size_t length = strlen(pattern);
+    size_t wildcard = strcspn(pattern, "*?[\\");
+
+    if (wildcard == length)
+        vector_push_back(&set->literals, strdup(pattern));
+    else if (wildcard == length - 1 && pattern[wildcard] == '*')
+        vector_push_back(&set->prefixes, strndup(pattern, wildcard));
+    else
+        vector_push_back(&set->globs, strdup(pattern));
+
+    set->compiled = false;
+}
+
+void pattern_set_compile(pattern_set* set)
+{
+    assert(set);
+
+    name_sort((char**)set->literals.buffer, vector_size(&set->literals));
+    set->compiled = true;
+}
+
+bool pattern_set_match(const pattern_set* set, const char* name)
+{
+    assert(set);
+    assert(set->compiled);
+    assert(name);
+
+    int low = 0, high = vector_size(&set->literals) - 1;
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+        int cmp = name_compare(vector_get(&set->literals, middle), name);
+
+        if (cmp == 0)
+            return true;
+        else if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    for (int i = 0; i < vector_size(&set->prefixes); ++i)
+    {
+        const char* prefix = vector_get(&set->prefixes, i);
+        if (strncmp(prefix, name, strlen(prefix)) == 0)
+            return true;
+    }
+
+    for (int i = 0; i < vector_size(&set->globs); ++i)
+        if (fnmatch(vector_get(&set->globs, i), name, 0) == 0)
+            return true;
+
+    return false;
+}
+
+int pattern_set_size(const pattern_set* set)
+{
+    assert(set);
+
+    return vector_size(&set->literals) + vector_size(&set->prefixes) + vector_size(&set->globs);
+}
+
+void path_filter_new(path_filter* filter)
+{
+    assert(filter);
+
+    pattern_set_new(&filter->include);
+    pattern_set_new(&filter->exclude);
+}
+
+void path_filter_free(path_filter* filter)
+{
+    assert(filter);
+
+    pattern_set_free(&filter->include);
+    pattern_set_free(&filter->exclude);
+}
+
+void path_filter_compile(path_filter* filter)
+{
+    assert(filter);
+
+    pattern_set_compile(&filter->include);
+    pattern_set_compile(&filter->exclude);
+}
+
+bool path_filter_match(const path_filter* filter, const char* name)
+{
+    assert(filter);
+
+    if (pattern_set_size(&filter->include) != 0 && !pattern_set_match(&filter->include, name))
+        return false;
+
+    return !pattern_set_match(&filter->exclude, name);
+}
+
+bool path_filter_is_literal(const path_filter* filter)
+{
+    assert(filter);
+
+    return vector_size(&filter->include.literals) != 0 && vector_size(&filter->include.literals) == pattern_set_size(&filter->include);
+}
@@ -0,0 +1,114 @@
+#ifndef PATHMATCH_H_
+#define PATHMATCH_H_
+
+#include <stdbool.h>
+
+#include "vector.h"
+
+/** @defgroup pathmatch pathmatch
+ * @{
+ * Matching of file names against sets of shell patterns (see fnmatch).
+ *
+ * Patterns are classified once, when added: literal names are kept sorted
+ * and binary searched, patterns whose only wildcard is a trailing '*' are
+ * matched as prefixes, and only the remaining ones go through fnmatch.
+ */
+
+/**
+ * Compiled set of patterns
+ */
+typedef struct
+{
+    vector literals; ///< vector<char*>, patterns without wildcards, sorted once compiled
+    vector prefixes; ///< vector<char*>, patterns with a single trailing '*' (stored without it)
+    vector globs; ///< vector<char*>, other patterns
+    bool compiled; ///< Whether literals are sorted
+} pattern_set;
+
+/**
+ * Include and exclude pattern sets. A name passes the filter if it matches
+ *  an include pattern (or there are none) and does not match any exclude pattern.
+ */
+typedef struct
+{
+    pattern_set include; ///< Include patterns
+    pattern_set exclude; ///< Exclude patterns
+} path_filter;
+
+/**
+ * Initializes a new, empty, pattern set
+ * @param set pattern_set pointer. Must not be NULL.
+ */
+void pattern_set_new(pattern_set* set);
+
+/**
+ * Releases the resources of a pattern set
+ * @param set pattern_set pointer. Must not be NULL.
+ */
+void pattern_set_free(pattern_set* set);
+
+/**
+ * Adds a pattern to the set. The pattern is copied.
+ * @param set     pattern_set pointer. Must not be NULL.
+ * @param pattern Shell pattern. Must not be NULL.
+ */
+void pattern_set_add(pattern_set* set, const char* pattern);
+
+/**
+ * Prepares the set for matching. Must be called after the last pattern is added.
+ * @param set pattern_set pointer. Must not be NULL.
+ */
+void pattern_set_compile(pattern_set* set);
+
+/**
+ * Checks if a name matches any pattern of the set
+ * @param  set  Compiled pattern_set. Must not be NULL.
+ * @param  name File name. Must not be NULL.
+ * @return      true if the name matches, false otherwise
+ */
+bool pattern_set_match(const pattern_set* set, const char* name);
+
+/**
+ * Number of patterns of the set
+ * @param  set pattern_set pointer. Must not be NULL.
+ * @return     Number of patterns
+ */
+int pattern_set_size(const pattern_set* set);
+
+/**
+ * Initializes a new filter that accepts every name
+ * @param filter path_filter pointer. Must not be NULL.
+ */
+void path_filter_new(path_filter* filter);
+
+/**
+ * Releases the resources of a filter
+ * @param filter path_filter pointer. Must not be NULL.
+ */
+void path_filter_free(path_filter* filter);
+
+/**
+ * Prepares the filter for matching. Must be called after the last pattern is added.
+ * @param filter path_filter pointer. Must not be NULL.
+ */
+void path_filter_compile(path_filter* filter);
+
+/**
+ * Checks if a name passes the filter
+ * @param  filter Compiled path_filter. Must not be NULL.
+ * @param  name   File name. Must not be NULL.
+ * @return        true if the name passes, false otherwise
+ */
+bool path_filter_match(const path_filter* filter, const char* name);
+
+/**
+ * Checks if the names accepted by the filter are all known in advance
+ *  (it has include patterns and all of them are literal names)
+ * @param  filter path_filter pointer. Must not be NULL.
+ * @return        true if only literal names are included, false otherwise
+ */
+bool path_filter_is_literal(const path_filter* filter);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,607 @@
+#include "replicate.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "fileinfo.h"
+#include "namesort.h"
+#include "utilities.h"
+#include "copyrecord.h"
+#include "parity.h"
+#include "merkle.h"
+
+/// Size of the buffer used to copy file data
+#define REPLICATION_BUFFER_SIZE (64 * 1024)
+
+/// Length of the name of an iteration folder (see BACKUP_FOLDER_NAME_FORMAT)
+#define FOLDER_NAME_LENGTH 19
+
+static void put_u32(FILE* out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        putc((value >> shift) & 0xFF, out);
+}
+
+static void put_u64(FILE* out, uint64_t value)
+{
+    put_u32(out, value >> 32);
+    put_u32(out, value & 0xFFFFFFFF);
+}
+
+static void put_string(FILE* out, const char* value)
+{
+    size_t length = strlen(value);
+    put_u32(out, length);
+    fwrite(value, sizeof(char), length, out);
+}
+
+static bool get_u32(FILE* in, uint32_t* value)
+{
+    unsigned char bytes[4];
+    if (fread(bytes, sizeof(bytes), 1, in) != 1)
+        return false;
+
+    *value = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+    return true;
+}
+
+static bool get_u64(FILE* in, uint64_t* value)
+{
+    uint32_t high, low;
+    if (!get_u32(in, &high) || !get_u32(in, &low))
+        return false;
+
+    *value = (uint64_t)high << 32 | low;
+    return true;
+}
+
+/**
+ * Reads a string (at most PATH_MAX bytes) into a buffer of PATH_MAX + 1 bytes
+ */
+static bool get_string(FILE* in, char* value)
+{
+    uint32_t length;
+    if (!get_u32(in, &length) || length > PATH_MAX || fread(value, sizeof(char), length, in) != length)
+        return false;
+
+    value[length] = '\0';
+    return memchr(value, '\0', length) == NULL;
+}
+
+static void put_entry(FILE* out, const file_info* fi)
+{
+    putc(fi->state, out);
+    put_u32(out, fi->iter);
+    put_u64(out, fi->size);
+    put_u64(out, fi->mtime);
+    put_u64(out, fi->tail_hash);
+    put_u32(out, fi->base_iter);
+    put_u64(out, fi->base_size);
+    put_string(out, fi->file_name);
+}
+
+static bool get_entry(FILE* in, file_info* fi, char* name)
+{
+    int state = getc(in);
+    uint32_t iter, base_iter;
+    uint64_t size, mtime, tail_hash, base_size;
+
+    if (state == EOF || !get_u32(in, &iter) || !get_u64(in, &size) || !get_u64(in, &mtime) || !get_u64(in, &tail_hash)
+        || !get_u32(in, &base_iter) || !get_u64(in, &base_size) || !get_string(in, name))
+        return false;
+
+    fi->state = state;
+    fi->iter = (int32_t)iter;
+    fi->size = size;
+    fi->mtime = mtime;
+    fi->tail_hash = tail_hash;
+    fi->base_iter = (int32_t)base_iter;
+    fi->base_size = base_size;
+    file_info_set_name(fi, name);
+
+    return fi->state == STATE_ADDED || fi->state == STATE_MODIFIED || fi->state == STATE_REMOVED
+        || fi->state == STATE_INALTERED || fi->state == STATE_APPENDED;
+}
+
+static bool same_entry(const file_info* a, const file_info* b)
+{
+    return a->state == b->state && a->iter == b->iter && a->size == b->size && a->mtime == b->mtime
+        && a->tail_hash == b->tail_hash && a->base_iter == b->base_iter && a->base_size == b->base_size;
+}
+
+/**
+ * Checks if a name received from a stream stays inside the folder it is written to
+ */
+static bool is_safe_name(const char* name)
+{
+    if (name[0] == '\0' || name[0] == '/')
+        return false;
+
+    for (const char* part = name; part != NULL; part = strchr(part, '/'))
+    {
+        if (*part == '/')
+            part++;
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0'))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Opens the backup info of a folder of the store and skips its header
+ * @return The stream, NULL on errors
+ */
+static FILE* open_info(const backup_store* store, int index)
+{
+    char* folder = store_folder_path(store, index);
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+    free(folder);
+
+    FILE* info = cipher_fopen(info_path, "r");
+    if (info == NULL)
+    {
+        perror("fopen(info_path)");
+        return NULL;
+    }
+
+    int iter;
+    if (backup_info_read_header(info, &iter) == EOF)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", info_path);
+        fclose(info);
+        return NULL;
+    }
+
+    return info;
+}
+
+/**
+ * Writes the entries of a folder that differ from the ones of the previous folder
+ * @return true if successful, false otherwise
+ */
+static bool send_entries(FILE* prev, FILE* curr, FILE* out)
+{
+    file_info prev_fi, curr_fi;
+    file_info_new(&prev_fi, NULL);
+    file_info_new(&curr_fi, NULL);
+
+    bool has_prev = prev != NULL && file_info_read(prev, &prev_fi) != EOF;
+    bool has_curr = file_info_read(curr, &curr_fi) != EOF;
+
+    while (has_prev || has_curr)
+    {
+        int cmp = !has_prev ? 1 : !has_curr ? -1 : name_compare(prev_fi.file_name, curr_fi.file_name);
+
+        if (cmp < 0)
+        {
+            putc('R', out);
+            put_string(out, prev_fi.file_name);
+        }
+        else if (cmp > 0 || !same_entry(&prev_fi, &curr_fi))
+        {
+            putc('E', out);
+            put_entry(out, &curr_fi);
+        }
+
+        if (cmp <= 0)
+            has_prev = file_info_read(prev, &prev_fi) != EOF;
+        if (cmp >= 0)
+            has_curr = file_info_read(curr, &curr_fi) != EOF;
+    }
+
+    file_info_free(&prev_fi);
+    file_info_free(&curr_fi);
+
+    return !ferror(out);
+}
+
+/**
+ * Writes a file stored in a folder as a 'D' record
+ * @return true if successful, false otherwise
+ */
+static bool send_data(const char* folder, const char* name, FILE* out, char* buffer)
+{
+    char path[PATH_MAX];
+    int fd = path_join(path, folder, name) ? open(path, O_RDONLY) : -1;
+    struct stat buf;
+
+    if (fd < 0 || fstat(fd, &buf) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    putc('D', out);
+    put_string(out, name);
+    put_u32(out, buf.st_mode & 07777);
+    put_u64(out, buf.st_size);
+
+    long long remaining = buf.st_size;
+    while (remaining > 0)
+    {
+        ssize_t size = read(fd, buffer, remaining < REPLICATION_BUFFER_SIZE ? remaining : REPLICATION_BUFFER_SIZE);
+        if (size <= 0)
+        {
+            // the length was already sent, the stream can not be completed
+            fprintf(stderr, "%s: could not be read completely.\n", path);
+            close(fd);
+            return false;
+        }
+
+        fwrite(buffer, sizeof(char), size, out);
+        remaining -= size;
+    }
+
+    close(fd);
+    return !ferror(out);
+}
+
+bool replicate_send(backup_store* store, int from, int to, FILE* out)
+{
+    assert(store);
+    assert(from >= -1 && to < store->count);
+    assert(out);
+
+    fwrite(REPLICATION_MAGIC, sizeof(char), strlen(REPLICATION_MAGIC), out);
+    put_u32(out, REPLICATION_VERSION);
+    put_u32(out, from >= 0 ? store->iters[from] : -1);
+    put_string(out, from >= 0 ? store->folders[from] : "");
+
+    char* buffer = malloc(REPLICATION_BUFFER_SIZE);
+    bool success = true;
+
+    for (int index = from + 1; success && index <= to; ++index)
+    {
+        FILE* prev = index > 0 ? open_info(store, index - 1) : NULL;
+        FILE* curr = open_info(store, index);
+
+        if (curr == NULL || (index > 0 && prev == NULL))
+            success = false;
+
+        if (success)
+        {
+            putc('I', out);
+            put_string(out, store->folders[index]);
+            put_u32(out, store->iters[index]);
+
+            success = send_entries(prev, curr, out);
+        }
+
+        // the data stored in this folder is the one of the entries changed in its iteration
+        char* folder = store_folder_path(store, index);
+        file_info fi;
+        file_info_new(&fi, NULL);
+
+        if (success)
+        {
+            rewind(curr);
+
+            int iter;
+            backup_info_read_header(curr, &iter);
+
+            while (success && file_info_read(curr, &fi) != EOF)
+                if (fi.iter == iter && (fi.state == STATE_ADDED || fi.state == STATE_MODIFIED || fi.state == STATE_APPENDED))
+                    success = send_data(folder, fi.file_name, out, buffer);
+        }
+
+        // the checksums of the stored files, if they were recorded
+        char record_path[PATH_MAX + 16];
+        snprintf(record_path, sizeof(record_path), "%s/%s", folder, COPY_RECORD_NAME);
+        if (success && access(record_path, F_OK) == 0)
+            success = send_data(folder, COPY_RECORD_NAME, out, buffer);
+
+        // the parity set holds for the received copies too, they are the same bytes
+        snprintf(record_path, sizeof(record_path), "%s/%s", folder, PARITY_NAME);
+        if (success && access(record_path, F_OK) == 0)
+            success = send_data(folder, PARITY_NAME, out, buffer);
+
+        if (success)
+            putc('C', out);
+
+        file_info_free(&fi);
+        free(folder);
+        if (prev != NULL)
+            fclose(prev);
+        if (curr != NULL)
+            fclose(curr);
+    }
+
+    free(buffer);
+
+    if (success)
+        putc('Z', out);
+
+    return success && fflush(out) == 0;
+}
+
+/**
+ * Holds the state of a folder being received
+ */
+typedef struct
+{
+    FILE* base; ///< Backup info of the previous folder, NULL if there is none
+    file_info base_fi; ///< Current entry of base
+    bool has_base; ///< Whether base_fi holds an entry
+    backup_info_writer writer; ///< Writer of the backup info of the folder
+    FILE* info; ///< Stream of writer
+    char* last_name; ///< Name of the last entry received, to check their order
+} receive_state;
+
+/**
+ * Writes the entries of the previous folder that are before a name (all of them if name is NULL)
+ *  and skips the one with that name
+ */
+static bool copy_base_until(receive_state* state, const char* name)
+{
+    while (state->has_base)
+    {
+        int cmp = name ? name_compare(state->base_fi.file_name, name) : -1;
+        if (cmp > 0)
+            break;
+
+        if (cmp < 0 && backup_info_writer_add(&state->writer, &state->base_fi) != 0)
+            return false;
+
+        state->has_base = file_info_read(state->base, &state->base_fi) != EOF;
+    }
+
+    return true;
+}
+
+/**
+ * Receives the records of a folder, after its 'I' record, into a temporary folder
+ * @return true if successful, false otherwise
+ */
+static bool receive_folder(receive_state* state, const char* temp_folder, FILE* in, char* name, char* buffer)
+{
+    file_info fi;
+    file_info_new(&fi, NULL);
+    bool entries_done = false;
+    bool success = false;
+
+    for (int tag = getc(in); tag != EOF; tag = getc(in))
+    {
+        if (tag == 'E' || tag == 'R')
+        {
+            bool read = tag == 'E' ? get_entry(in, &fi, name) : get_string(in, name);
+
+            if (!read || entries_done || !is_safe_name(name) || (state->last_name && name_compare(state->last_name, name) >= 0))
+            {
+                fprintf(stderr, "Invalid entry in the stream.\n");
+                break;
+            }
+
+            free(state->last_name);
+            state->last_name = strdup(name);
+
+            if (!copy_base_until(state, name) || (tag == 'E' && backup_info_writer_add(&state->writer, &fi) != 0))
+                break;
+        }
+        else if (tag == 'D' || tag == 'C')
+        {
+            if (!entries_done && !copy_base_until(state, NULL))
+                break;
+            entries_done = true;
+
+            if (tag == 'C')
+            {
+                success = true;
+                break;
+            }
+
+            uint32_t mode;
+            uint64_t length;
+            if (!get_string(in, name) || !is_safe_name(name) || !get_u32(in, &mode) || !get_u64(in, &length))
+            {
+                fprintf(stderr, "Invalid data in the stream.\n");
+                break;
+            }
+
+            char path[PATH_MAX];
+            int fd = path_join(path, temp_folder, name) ? open(path, O_CREAT | O_EXCL | O_WRONLY, mode & 07777) : -1;
+            if (fd < 0 && errno == ENOENT && make_parent_dirs(path)) // file in a subdirectory
+                fd = open(path, O_CREAT | O_EXCL | O_WRONLY, mode & 07777);
+            if (fd < 0)
+            {
+                perror(path);
+                break;
+            }
+
+            while (length > 0)
+            {
+                size_t size = length < REPLICATION_BUFFER_SIZE ? length : REPLICATION_BUFFER_SIZE;
+                if (fread(buffer, sizeof(char), size, in) != size)
+                    break;
+
+                ssize_t written = 0;
+                for (ssize_t count = 0; written < (ssize_t)size; written += count)
+                    if ((count = write(fd, buffer + written, size - written)) < 0)
+                        break;
+
+                if (written < (ssize_t)size)
+                    break;
+
+                length -= size;
+            }
+
+            close(fd);
+
+            if (length != 0)
+            {
+                fprintf(stderr, "%s: could not be received completely.\n", path);
+                break;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Invalid record in the stream.\n");
+            break;
+        }
+    }
+
+    file_info_free(&fi);
+    return success;
+}
+
+bool replicate_receive(const char* path, FILE* in)
+{
+    assert(path);
+    assert(in);
+
+    char magic[sizeof(REPLICATION_MAGIC) - 1];
+    uint32_t version, base_iter;
+    char* name = malloc(PATH_MAX + 1);
+
+    if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, REPLICATION_MAGIC, sizeof(magic)) != 0
+        || !get_u32(in, &version) || !get_u32(in, &base_iter) || !get_string(in, name))
+    {
+        fprintf(stderr, "Not a replication stream.\n");
+        free(name);
+        return false;
+    }
+
+    if (version != REPLICATION_VERSION)
+    {
+        fprintf(stderr, "Unsupported replication stream version %u.\n", version);
+        free(name);
+        return false;
+    }
+
+    if (mkdir(path, 0775) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Could not create directory %s (%s).\n", path, strerror(errno));
+        free(name);
+        return false;
+    }
+
+    backup_store store;
+    int opened = store_open(&store, path);
+    if (opened != 0)
+    {
+        if (opened == 1) // a missing or wrong key is reported once by store_open
+            perror(path);
+        store_close(&store);
+        free(name);
+        return false;
+    }
+
+    // the stream continues from the last folder of the store
+    int last = store.count - 1;
+    if ((int32_t)base_iter < 0 ? last >= 0 : last < 0 || store.iters[last] != (int32_t)base_iter || strcmp(store.folders[last], name) != 0)
+    {
+        if ((int32_t)base_iter < 0)
+            fprintf(stderr, "The stream starts from an empty store, %s is not empty.\n", path);
+        else
+            fprintf(stderr, "The stream starts after iteration %d (%s), the last one of %s is %d.\n",
+                    (int32_t)base_iter, name, path, last >= 0 ? store.iters[last] : -1);
+
+        store_close(&store);
+        free(name);
+        return false;
+    }
+
+    char base_path[PATH_MAX + 16] = "";
+    if (last >= 0)
+        snprintf(base_path, sizeof(base_path), "%s/%s/%s", path, store.folders[last], BACKUP_FILE_INFO_NAME);
+
+    store_close(&store);
+
+    char* buffer = malloc(REPLICATION_BUFFER_SIZE);
+    bool success = false;
+    int received = 0;
+
+    for (int tag = getc(in); tag != EOF; tag = getc(in))
+    {
+        if (tag == 'Z')
+        {
+            success = true;
+            break;
+        }
+
+        uint32_t iter;
+        if (tag != 'I' || !get_string(in, name) || strlen(name) != FOLDER_NAME_LENGTH || strchr(name, '/') || !get_u32(in, &iter))
+        {
+            fprintf(stderr, "Invalid folder in the stream.\n");
+            break;
+        }
+
+        char folder[PATH_MAX], temp_folder[PATH_MAX], info_path[PATH_MAX + 16];
+        snprintf(folder, sizeof(folder), "%s/%s", path, name);
+        snprintf(temp_folder, sizeof(temp_folder), "%s/%s.recv", path, name);
+        snprintf(info_path, sizeof(info_path), "%s/%s", temp_folder, BACKUP_FILE_INFO_NAME);
+
+        if (mkdir(temp_folder, 0775) != 0)
+        {
+            fprintf(stderr, "Could not create directory %s (%s).\n", temp_folder, strerror(errno));
+            break;
+        }
+
+        receive_state state;
+        state.base = base_path[0] ? cipher_fopen(base_path, "r") : NULL;
+        state.info = cipher_fopen(info_path, "w");
+        state.last_name = NULL;
+        file_info_new(&state.base_fi, NULL);
+
+        int prev_iter;
+        state.has_base = state.base != NULL && backup_info_read_header(state.base, &prev_iter) != EOF
+            && file_info_read(state.base, &state.base_fi) != EOF;
+
+        bool folder_received = state.info != NULL && (base_path[0] == '\0' || state.base != NULL)
+            && backup_info_writer_open(&state.writer, state.info, iter) == 0;
+
+        if (folder_received)
+        {
+            folder_received = receive_folder(&state, temp_folder, in, name, buffer);
+            backup_info_writer_close(&state.writer);
+        }
+        else
+            perror("backup info");
+
+        if (state.info != NULL && fclose(state.info) != 0)
+            folder_received = false;
+        if (state.base != NULL)
+            fclose(state.base);
+        file_info_free(&state.base_fi);
+        free(state.last_name);
+
+        // trees are not sent, the receiver builds its own from the merged backup_info
+        if (folder_received && !merkle_build_folder(temp_folder))
+            fprintf(stderr, "Could not write the tree of %s.\n", temp_folder);
+
+        // the folder only becomes visible to the store once it is complete
+        if (!folder_received || rename(temp_folder, folder) != 0)
+        {
+            if (folder_received)
+                perror("rename");
+            fprintf(stderr, "Could not receive %s, it was left in %s.\n", folder, temp_folder);
+            break;
+        }
+
+        snprintf(base_path, sizeof(base_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+        received++;
+    }
+
+    if (!success)
+        fprintf(stderr, "The stream is incomplete.\n");
+
+    printf("%d iteration(s) received.\n", received);
+
+    free(buffer);
+    free(name);
+    return success;
+}
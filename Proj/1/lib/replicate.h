@@ -0,0 +1,55 @@
+#ifndef REPLICATE_H_
+#define REPLICATE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "store.h"
+
+/** @defgroup replicate replicate
+ * @{
+ * Replication of iteration folders between backup stores through a binary stream.
+ *
+ * The stream starts with REPLICATION_MAGIC, the version and the iteration
+ * and folder name the receiving store must end with (-1 and "" if it must
+ * be empty). Then, for each iteration folder, in order:
+ *  - 'I' <folder name> <iteration>
+ *  - 'E' <entry> for each entry that differs from the previous backup info,
+ *    'R' <name> for each entry of the previous backup info that is gone,
+ *    by increasing name
+ *  - 'D' <name> <mode> <length> <bytes> for each file stored in the folder,
+ *    including its copy record
+ *  - 'C', the folder is complete
+ * and finally 'Z'. Integers are big endian, strings are a 32 bit length
+ * followed by their bytes. An entry is <state> <iter> <size> <mtime>
+ * <tail hash> <base iter> <base size> <name>.
+ */
+
+/// First bytes of a replication stream
+#define REPLICATION_MAGIC "BCKPSEND"
+
+/// Version of the replication stream format
+#define REPLICATION_VERSION 1
+
+/**
+ * Writes the iteration folders after from, up to to, as a replication stream
+ * @param  store backup_store to send from. Must not be NULL.
+ * @param  from  Index of the last folder the receiver already has, -1 if it has none
+ * @param  to    Index of the last folder to send
+ * @param  out   Stream to write to
+ * @return       true if successful, false otherwise
+ */
+bool replicate_send(backup_store* store, int from, int to, FILE* out);
+
+/**
+ * Applies a replication stream to a backup store. Each folder is written
+ *  under a temporary name and only renamed into place once it is complete.
+ * @param  path Path of the receiving store, created if it does not exist
+ * @param  in   Stream to read from
+ * @return      true if successful, false otherwise
+ */
+bool replicate_receive(const char* path, FILE* in);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,613 @@
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hash.h"
+
+/// What a token matches
+enum
+{
+    TOKEN_LITERAL, ///< Its character
+    TOKEN_ANY, ///< Any character but '/' ('?')
+    TOKEN_CLASS, ///< A character of its set, but '/' ("[...]")
+    TOKEN_STAR, ///< Any number of characters but '/' ('*')
+    TOKEN_DEEP, ///< Any number of characters ("**")
+    TOKEN_SKIP ///< No character, but the tokens it skips may be matched by nothing (before "**/")
+};
+
+/// Number of 64 bit words of a set of states of an automaton (one state per token, plus the accepting one)
+#define STATE_WORDS ((RULES_MAX_TOKENS + 1 + 63) / 64)
+
+/**
+ * Slot of a key in a table of the specified capacity
+ */
+static size_t key_slot(const char* key, size_t capacity)
+{
+    return hash_fnv1a(HASH_FNV1A_INIT, key, strlen(key)) & (capacity - 1);
+}
+
+/**
+ * Doubles the capacity of a table
+ */
+static void grow_table(rule_table* table)
+{
+    rule_slot* old = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->capacity = old_capacity ? old_capacity * 2 : 64;
+    table->slots = calloc(table->capacity, sizeof(rule_slot));
+
+    for (size_t i = 0; i < old_capacity; ++i)
+    {
+        if (old[i].key == NULL)
+            continue;
+
+        size_t slot = key_slot(old[i].key, table->capacity);
+        while (table->slots[slot].key != NULL)
+            slot = (slot + 1) & (table->capacity - 1);
+
+        table->slots[slot] = old[i];
+    }
+
+    free(old);
+}
+
+/**
+ * Finds the slot of a key
+ * @return The slot, NULL if the key is not in the table
+ */
+static rule_slot* table_find(const rule_table* table, const char* key)
+{
+    if (table->count == 0)
+        return NULL;
+
+    for (size_t slot = key_slot(key, table->capacity); table->slots[slot].key != NULL;
+         slot = (slot + 1) & (table->capacity - 1))
+        if (strcmp(table->slots[slot].key, key) == 0)
+            return &table->slots[slot];
+
+    return NULL;
+}
+
+/**
+ * Adds a rule to a table, as the last rule of its key
+ */
+static void table_add(rule_table* table, const char* key, int rule, bool dir_only)
+{
+    rule_slot* found = table_find(table, key);
+
+    if (found == NULL)
+    {
+        // at most half full, so probes stay short
+        if (2 * (table->count + 1) > table->capacity)
+            grow_table(table);
+
+        size_t slot = key_slot(key, table->capacity);
+        while (table->slots[slot].key != NULL)
+            slot = (slot + 1) & (table->capacity - 1);
+
+        found = &table->slots[slot];
+        found->key = strdup(key);
+        found->rule = -1;
+        found->dir_rule = -1;
+        table->count++;
+    }
+
+    if (dir_only)
+        found->dir_rule = rule;
+    else
+        found->rule = rule;
+}
+
+/**
+ * Last rule of a key that matches an entry
+ * @return Index of the rule, -1 if none
+ */
+static int table_rule(const rule_table* table, const char* key, bool is_dir)
+{
+    const rule_slot* slot = table_find(table, key);
+    if (slot == NULL)
+        return -1;
+
+    return is_dir && slot->dir_rule > slot->rule ? slot->dir_rule : slot->rule;
+}
+
+/**
+ * Releases the keys and slots of a table
+ */
+static void table_free(rule_table* table)
+{
+    for (size_t i = 0; i < table->capacity; ++i)
+        free(table->slots[i].key);
+
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+/**
+ * Parses a "[...]" class into a new character set of the rule set
+ * @return Number of characters of the class, 0 if it has no closing ']' (the '[' is then a literal)
+ */
+static int parse_class(rule_set* set, const char* class, int* index)
+{
+    uint32_t bits[8] = { 0 };
+    int i = 1;
+    bool negated = class[i] == '!' || class[i] == '^';
+    if (negated)
+        i++;
+
+    for (bool first = true; class[i] != ']' || first; first = false)
+    {
+        if (class[i] == '\0' || (class[i] == '\\' && class[i + 1] == '\0'))
+            return 0;
+
+        if (class[i] == '\\')
+            i++;
+        unsigned char low = class[i++], high = low;
+
+        if (class[i] == '-' && class[i + 1] != ']' && class[i + 1] != '\0')
+        {
+            i++;
+            if (class[i] == '\\' && class[i + 1] != '\0')
+                i++;
+            high = class[i++];
+        }
+
+        for (int c = low; c <= high; ++c)
+            bits[c >> 5] |= 1u << (c & 31);
+    }
+
+    for (int j = 0; negated && j < 8; ++j)
+        bits[j] = ~bits[j];
+    bits['/' >> 5] &= ~(1u << ('/' & 31));
+
+    set->sets = realloc(set->sets, (set->set_count + 1) * sizeof(*set->sets));
+    memcpy(set->sets[set->set_count], bits, sizeof(bits));
+    *index = set->set_count++;
+
+    return i + 1;
+}
+
+/**
+ * Compiles a pattern into tokens
+ * @param  tokens Array of RULES_MAX_TOKENS tokens to fill
+ * @return        Number of tokens, -1 if the pattern is not valid
+ */
+static int compile_pattern(rule_set* set, const char* pattern, rule_token* tokens)
+{
+    int count = 0;
+
+    for (size_t i = 0; pattern[i] != '\0'; )
+    {
+        // "**/" takes three tokens
+        if (count + 3 > RULES_MAX_TOKENS)
+            return -1;
+
+        rule_token* token = &tokens[count++];
+        token->op = TOKEN_LITERAL;
+        token->c = pattern[i];
+        token->skip = 1;
+        token->set = -1;
+
+        if (pattern[i] == '*')
+        {
+            size_t stars = strspn(pattern + i, "*");
+            bool component = (i == 0 || pattern[i - 1] == '/') && (pattern[i + stars] == '\0' || pattern[i + stars] == '/');
+            i += stars;
+
+            if (stars == 1 || !component)
+                token->op = TOKEN_STAR;
+            else if (pattern[i] == '\0')
+                token->op = TOKEN_DEEP;
+            else
+            {
+                // "**/" matches no directory too, but only where the "**" starts
+                token->op = TOKEN_SKIP;
+                token->skip = 3;
+                tokens[count] = *token;
+                tokens[count].op = TOKEN_DEEP;
+                tokens[count].skip = 1;
+                tokens[count + 1] = tokens[count];
+                tokens[count + 1].op = TOKEN_LITERAL;
+                tokens[count + 1].c = '/';
+                count += 2;
+                i++;
+            }
+        }
+        else if (pattern[i] == '?')
+        {
+            token->op = TOKEN_ANY;
+            i++;
+        }
+        else if (pattern[i] == '[')
+        {
+            int length = parse_class(set, pattern + i, &token->set);
+            token->op = length > 0 ? TOKEN_CLASS : TOKEN_LITERAL;
+            i += length > 0 ? length : 1;
+        }
+        else if (pattern[i] == '\\')
+        {
+            if (pattern[i + 1] == '\0')
+                return -1;
+
+            token->c = pattern[i + 1];
+            i += 2;
+        }
+        else
+            i++;
+    }
+
+    return count;
+}
+
+/**
+ * Adds the states reached without input from the states of a set (they are all after their source)
+ * @param words Number of words of the set used by the glob
+ */
+static void closure(const rule_glob* glob, uint64_t* states, int words)
+{
+    // only the states in the set, in order, so the ones added are visited too
+    for (int word = 0; word < words; ++word)
+        for (uint64_t bits = states[word]; bits != 0; )
+        {
+            int bit = __builtin_ctzll(bits);
+            int i = word * 64 + bit;
+            if (i == glob->count)
+                break;
+
+            const rule_token* token = &glob->tokens[i];
+            if (token->op == TOKEN_STAR || token->op == TOKEN_DEEP || token->op == TOKEN_SKIP)
+                states[(i + 1) >> 6] |= 1ULL << ((i + 1) & 63);
+            if (token->op == TOKEN_SKIP)
+                states[(i + token->skip) >> 6] |= 1ULL << ((i + token->skip) & 63);
+
+            bits = bit == 63 ? 0 : states[word] & (~0ULL << (bit + 1));
+        }
+}
+
+/**
+ * Checks a string starts and ends with the literals a glob starts and ends with
+ * @param length Length of subject
+ * @return true if it does, false if the glob can not match it
+ */
+static bool glob_bounds(const rule_glob* glob, const char* subject, size_t length)
+{
+    if (length < (size_t)(glob->prefix + glob->suffix))
+        return false;
+
+    for (int i = 0; i < glob->prefix; ++i)
+        if ((unsigned char)subject[i] != glob->tokens[i].c)
+            return false;
+
+    for (int i = 1; i <= glob->suffix; ++i)
+        if ((unsigned char)subject[length - i] != glob->tokens[glob->count - i].c)
+            return false;
+
+    return true;
+}
+
+/**
+ * Runs the automaton of a glob over a string
+ * @return true if the whole string matches
+ */
+static bool glob_match(const rule_set* set, const rule_glob* glob, const char* subject)
+{
+    int words = glob->count / 64 + 1;
+    uint64_t states[STATE_WORDS] = { 1 };
+    closure(glob, states, words);
+
+    for (const unsigned char* c = (const unsigned char*)subject; *c != '\0'; ++c)
+    {
+        uint64_t next[STATE_WORDS] = { 0 };
+        bool alive = false;
+
+        for (int word = 0; word < words; ++word)
+            for (uint64_t bits = states[word]; bits != 0; bits &= bits - 1)
+            {
+                int i = word * 64 + __builtin_ctzll(bits);
+                if (i == glob->count)
+                    continue; // accepting, but there is more input
+
+                const rule_token* token = &glob->tokens[i];
+                int to = -1;
+
+                switch (token->op)
+                {
+                case TOKEN_LITERAL:
+                    to = *c == token->c ? i + 1 : -1;
+                    break;
+                case TOKEN_ANY:
+                    to = *c != '/' ? i + 1 : -1;
+                    break;
+                case TOKEN_CLASS:
+                    to = set->sets[token->set][*c >> 5] >> (*c & 31) & 1 ? i + 1 : -1;
+                    break;
+                case TOKEN_STAR:
+                    to = *c != '/' ? i : -1;
+                    break;
+                case TOKEN_DEEP:
+                    to = i;
+                    break;
+                }
+
+                if (to >= 0)
+                {
+                    next[to >> 6] |= 1ULL << (to & 63);
+                    alive = true;
+                }
+            }
+
+        if (!alive)
+            return false;
+
+        closure(glob, next, words);
+        memcpy(states, next, words * sizeof(uint64_t));
+    }
+
+    return states[glob->count >> 6] >> (glob->count & 63) & 1;
+}
+
+void rule_set_new(rule_set* set)
+{
+    assert(set);
+
+    memset(set, 0, sizeof(rule_set));
+    set->hash = HASH_FNV1A_INIT;
+}
+
+void rule_set_free(rule_set* set)
+{
+    assert(set);
+
+    table_free(&set->names);
+    table_free(&set->paths);
+    table_free(&set->suffixes);
+
+    for (int i = 0; i < set->glob_count; ++i)
+    {
+        free(set->globs[i].tokens);
+        free(set->globs[i].required);
+    }
+
+    free(set->globs);
+    free(set->sets);
+    free(set->negated);
+    rule_set_new(set);
+}
+
+bool rule_set_add(rule_set* set, const char* line)
+{
+    assert(set);
+    assert(line);
+
+    // trailing blanks are ignored unless quoted
+    size_t length = strlen(line);
+    while (length > 0 && strchr(" \t\r", line[length - 1]) != NULL && !(length >= 2 && line[length - 2] == '\\'))
+        length--;
+
+    if (length == 0 || line[0] == '#')
+        return true;
+
+    char* pattern = strndup(line, length);
+    char* p = pattern;
+
+    bool negated = *p == '!';
+    if (negated)
+        p++;
+
+    bool dir_only = false;
+    for (size_t end = strlen(p); end > 0 && p[end - 1] == '/'; --end)
+    {
+        p[end - 1] = '\0';
+        dir_only = true;
+    }
+
+    bool anchored = strchr(p, '/') != NULL;
+    while (*p == '/')
+        p++;
+
+    // "**/name" matches the name at any depth, like a pattern without '/'
+    while (strncmp(p, "**/", 3) == 0 && strchr(p + 3, '/') == NULL)
+    {
+        p += 3;
+        anchored = false;
+    }
+
+    rule_token tokens[RULES_MAX_TOKENS];
+    int count = *p != '\0' ? compile_pattern(set, p, tokens) : -1;
+
+    if (count < 0)
+    {
+        free(pattern);
+        return false;
+    }
+
+    if (set->count == set->capacity)
+    {
+        set->capacity = set->capacity ? set->capacity * 2 : 64;
+        set->negated = realloc(set->negated, set->capacity * sizeof(bool));
+    }
+
+    int rule = set->count++;
+    set->negated[rule] = negated;
+
+    char flags[3] = { negated, dir_only, anchored };
+    set->hash = hash_fnv1a(set->hash, flags, sizeof(flags));
+    set->hash = hash_fnv1a(set->hash, p, strlen(p) + 1);
+
+    int literals = 0;
+    while (literals < count && tokens[literals].op == TOKEN_LITERAL)
+        literals++;
+
+    bool suffix = !anchored && count > 1 && tokens[0].op == TOKEN_STAR;
+    for (int i = 1; suffix && i < count; ++i)
+        suffix = tokens[i].op == TOKEN_LITERAL;
+
+    int suffix_index = 0;
+    while (suffix && suffix_index < set->suffix_length_count && set->suffix_lengths[suffix_index] != count - 1)
+        suffix_index++;
+    suffix = suffix && suffix_index < RULES_MAX_SUFFIX_LENGTHS;
+
+    char key[RULES_MAX_TOKENS + 1];
+
+    if (literals == count)
+    {
+        for (int i = 0; i < count; ++i)
+            key[i] = tokens[i].c;
+        key[count] = '\0';
+
+        table_add(anchored ? &set->paths : &set->names, key, rule, dir_only);
+    }
+    else if (suffix)
+    {
+        for (int i = 1; i < count; ++i)
+            key[i - 1] = tokens[i].c;
+        key[count - 1] = '\0';
+
+        table_add(&set->suffixes, key, rule, dir_only);
+        if (suffix_index == set->suffix_length_count)
+            set->suffix_lengths[set->suffix_length_count++] = count - 1;
+    }
+    else
+    {
+        if (set->glob_count == set->glob_capacity)
+        {
+            set->glob_capacity = set->glob_capacity ? set->glob_capacity * 2 : 16;
+            set->globs = realloc(set->globs, set->glob_capacity * sizeof(rule_glob));
+        }
+
+        rule_glob* glob = &set->globs[set->glob_count++];
+        glob->rule = rule;
+        glob->dir_only = dir_only;
+        glob->anchored = anchored;
+        glob->count = count;
+        glob->tokens = malloc(count * sizeof(rule_token));
+        memcpy(glob->tokens, tokens, count * sizeof(rule_token));
+
+        // the '/' of a "**/" may match nothing, it ends the literals of the end
+        glob->prefix = literals;
+        glob->suffix = 0;
+        for (int i = count - 1; i >= 0 && tokens[i].op == TOKEN_LITERAL && !(i >= 2 && tokens[i - 2].op == TOKEN_SKIP); --i)
+            glob->suffix++;
+
+        // most names are rejected by a substring search, before running the automaton (on ties, the
+        //  last literal is searched: the first ones are often a '.' that every name has)
+        int best = 0, best_start = 0;
+        for (int i = 0; i < count; )
+        {
+            // the '/' of a "**/" is skipped when it matches no directory
+            if (i >= 2 && tokens[i - 2].op == TOKEN_SKIP)
+                i++;
+
+            int start = i;
+            while (i < count && tokens[i].op == TOKEN_LITERAL)
+                i++;
+            if (i > start && i - start >= best)
+            {
+                best = i - start;
+                best_start = start;
+            }
+            if (i == start)
+                i++;
+        }
+
+        glob->required = NULL;
+        if (best >= 1)
+        {
+            glob->required = malloc(best + 1);
+            for (int i = 0; i < best; ++i)
+                glob->required[i] = tokens[best_start + i].c;
+            glob->required[best] = '\0';
+        }
+    }
+
+    free(pattern);
+    return true;
+}
+
+bool rule_set_load(rule_set* set, const char* path)
+{
+    assert(set);
+    assert(path);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    bool success = true;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    for (int number = 1; (length = getline(&line, &line_size, file)) > 0; ++number)
+    {
+        if (line[length - 1] == '\n')
+            line[length - 1] = '\0';
+
+        if (!rule_set_add(set, line))
+        {
+            fprintf(stderr, "%s:%d: invalid rule \"%s\".\n", path, number, line);
+            success = false;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return success;
+}
+
+bool rule_set_excludes(const rule_set* set, const char* path, bool is_dir)
+{
+    assert(set);
+    assert(path);
+
+    if (set->count == 0)
+        return false;
+
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL ? slash + 1 : path;
+    size_t name_length = strlen(name), path_length = name - path + name_length;
+
+    int best = table_rule(&set->names, name, is_dir);
+
+    int rule = table_rule(&set->paths, path, is_dir);
+    if (rule > best)
+        best = rule;
+
+    for (int i = 0; i < set->suffix_length_count; ++i)
+    {
+        if ((size_t)set->suffix_lengths[i] > name_length)
+            continue;
+
+        rule = table_rule(&set->suffixes, name + name_length - set->suffix_lengths[i], is_dir);
+        if (rule > best)
+            best = rule;
+    }
+
+    // the globs of the rules after the best match so far, from the last one
+    for (int i = set->glob_count - 1; i >= 0 && set->globs[i].rule > best; --i)
+    {
+        const rule_glob* glob = &set->globs[i];
+        const char* subject = glob->anchored ? path : name;
+
+        if ((glob->dir_only && !is_dir) || !glob_bounds(glob, subject, glob->anchored ? path_length : name_length) ||
+            (glob->required != NULL && strstr(subject, glob->required) == NULL))
+            continue;
+
+        if (glob_match(set, glob, subject))
+        {
+            best = glob->rule;
+            break;
+        }
+    }
+
+    return best >= 0 && !set->negated[best];
+}
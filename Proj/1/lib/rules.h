@@ -0,0 +1,140 @@
+#ifndef RULES_H_
+#define RULES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** @defgroup rules rules
+ * @{
+ * Include and exclude rules of a scan, in the syntax of gitignore files.
+ *
+ * Each line is a pattern of the entries to exclude; '!' before it includes
+ * them again, a trailing '/' only matches directories, and a pattern with a
+ * '/' before its end is matched against the whole path from the root, the
+ * others against the last component at any depth. '*', '?' and '[...]' do
+ * not match '/', a "**" component matches any number of directories. The
+ * last rule that matches an entry decides, and the contents of an excluded
+ * directory are never scanned. Blank lines and lines starting with '#' are
+ * ignored, '\' quotes the next character.
+ *
+ * Rules are compiled when added: literal names, literal paths and "*<literal>"
+ * suffixes go to hash tables, so checking them costs a few lookups whatever
+ * their number; the other patterns become automata matched in a single pass
+ * over the name, without backtracking, after a check of the literals they
+ * start and end with and of the longest literal they contain.
+ */
+
+/// Maximum number of tokens (characters, wildcards and classes) of a pattern
+#define RULES_MAX_TOKENS 255
+
+/// Maximum number of different suffix lengths of the "*<literal>" rules
+#define RULES_MAX_SUFFIX_LENGTHS 16
+
+/**
+ * Token of a compiled pattern
+ */
+typedef struct
+{
+    unsigned char op; ///< What it matches (see rules.c)
+    unsigned char c; ///< Character of a literal
+    unsigned char skip; ///< Tokens skipped without input by a wildcard (2 for "**/", which may match no directory)
+    int set; ///< Index of the character set of a class
+} rule_token;
+
+/**
+ * Pattern with wildcards, compiled into an automaton
+ */
+typedef struct
+{
+    int rule; ///< Index of the rule
+    bool dir_only; ///< Only matches directories
+    bool anchored; ///< Matched against the whole path instead of its last component
+    rule_token* tokens; ///< Tokens of the pattern
+    int count; ///< Number of tokens
+    char* required; ///< Longest literal run of the pattern, contained in every match (NULL if none)
+    int prefix; ///< Number of literal tokens it starts with, matched against the start of the subject
+    int suffix; ///< Number of literal tokens it ends with (none skipped by a "**/"), matched against its end
+} rule_glob;
+
+/**
+ * Slot of a hash table of literal rules
+ */
+typedef struct
+{
+    char* key; ///< Name, path or suffix (NULL if the slot is empty)
+    int rule; ///< Last rule with this key that matches any entry, -1 if none
+    int dir_rule; ///< Last rule with this key that only matches directories, -1 if none
+} rule_slot;
+
+/**
+ * Open addressing hash table of literal rules
+ */
+typedef struct
+{
+    rule_slot* slots; ///< Slots, the capacity is a power of 2
+    size_t capacity; ///< Number of slots
+    size_t count; ///< Number of keys
+} rule_table;
+
+/**
+ * Compiled set of rules
+ */
+typedef struct
+{
+    bool* negated; ///< Whether each rule includes what it matches, by index
+    int count; ///< Number of rules
+    int capacity; ///< Capacity of negated
+    rule_table names; ///< Literal patterns matched against the last component
+    rule_table paths; ///< Literal patterns matched against the whole path
+    rule_table suffixes; ///< "*<literal>" patterns matched against the end of the last component
+    int suffix_lengths[RULES_MAX_SUFFIX_LENGTHS]; ///< Lengths of the keys of suffixes
+    int suffix_length_count; ///< Number of different lengths of the keys of suffixes
+    rule_glob* globs; ///< Other patterns, in the order of the rules
+    int glob_count; ///< Number of globs
+    int glob_capacity; ///< Capacity of globs
+    uint32_t (*sets)[8]; ///< Character sets of the classes, 256 bits each
+    int set_count; ///< Number of character sets
+    uint64_t hash; ///< Hash of the rules, to tell if they changed between scans
+} rule_set;
+
+/**
+ * Initializes a new, empty, rule set (which excludes nothing)
+ * @param set rule_set pointer. Must not be NULL.
+ */
+void rule_set_new(rule_set* set);
+
+/**
+ * Releases the resources of a rule set
+ * @param set rule_set pointer. Must not be NULL.
+ */
+void rule_set_free(rule_set* set);
+
+/**
+ * Compiles a line of a rules file and adds it to the set
+ * @param  set  rule_set pointer. Must not be NULL.
+ * @param  line Line, without its newline. Must not be NULL.
+ * @return      true if successful (or the line is blank or a comment), false if it is not a valid rule
+ */
+bool rule_set_add(rule_set* set, const char* line);
+
+/**
+ * Adds the rules of a file to the set. Invalid lines are reported on stderr.
+ * @param  set  rule_set pointer. Must not be NULL.
+ * @param  path Path of the rules file
+ * @return      true if successful, false if the file could not be read or has invalid lines
+ */
+bool rule_set_load(rule_set* set, const char* path);
+
+/**
+ * Checks if an entry is excluded by the rules (its parent directories are not checked)
+ * @param  set    rule_set pointer. Must not be NULL.
+ * @param  path   Path of the entry relative to the root, without a trailing '/'. Must not be NULL.
+ * @param  is_dir Whether the entry is a directory
+ * @return        true if the last rule that matches it excludes it, false otherwise
+ */
+bool rule_set_excludes(const rule_set* set, const char* path, bool is_dir);
+
+/**@}*/
+
+#endif
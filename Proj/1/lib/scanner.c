@@ -0,0 +1,242 @@
+#include "scanner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vector.h"
+#include "arena.h"
+#include "namesort.h"
+
+/**
+ * Reads the next name of the run
+ * @return true if a name was read, false if the run is exhausted
+ */
+static bool run_advance(scanner_run* run)
+{
+    return getdelim(&run->name, &run->name_size, '\0', run->file) != -1;
+}
+
+/**
+ * Releases the names of the in-memory run
+ */
+static void free_names(scanner* s)
+{
+    vector_free(&s->names);
+    vector_new(&s->names);
+    arena_reset(&s->arena);
+    s->mem_used = 0;
+}
+
+/**
+ * Sorts the in-memory names and writes them to a new temporary run
+ * @return 0 upon success, different otherwise
+ */
+static int spill(scanner* s)
+{
+    FILE* file = tmpfile();
+    if (file == NULL)
+    {
+        perror("tmpfile");
+        return 1;
+    }
+
+    name_sort((char**)s->names.buffer, vector_size(&s->names));
+
+    for (int i = 0; i < vector_size(&s->names); ++i)
+    {
+        const char* name = vector_get(&s->names, i);
+        fwrite(name, sizeof(char), strlen(name) + 1, file);
+    }
+
+    if (fflush(file) != 0)
+    {
+        perror("spill");
+        fclose(file);
+        return 1;
+    }
+
+    scanner_run* run = scanner_run_vector_emplace(&s->runs, scanner_run_vector_size(&s->runs));
+    run->file = file;
+    run->name = NULL;
+    run->name_size = 0;
+
+    free_names(s);
+    return 0;
+}
+
+/**
+ * Releases the names and runs of a scan that failed, so it returns no name
+ * @return 1, the error returned by scanner_open
+ */
+static int scan_failed(scanner* s)
+{
+    scanner_close(s);
+    vector_new(&s->names);
+    scanner_run_vector_new(&s->runs);
+    arena_new(&s->arena);
+    s->heap_size = 0;
+    s->count = 0;
+    return 1;
+}
+
+/**
+ * Restores the heap property from index i downwards
+ */
+static void sift_down(scanner* s, int i)
+{
+    scanner_run* heap = scanner_run_vector_data(&s->runs);
+
+    for (;;)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < s->heap_size && name_compare(heap[left].name, heap[smallest].name) < 0)
+            smallest = left;
+        if (right < s->heap_size && name_compare(heap[right].name, heap[smallest].name) < 0)
+            smallest = right;
+
+        if (smallest == i)
+            return;
+
+        scanner_run temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+/**
+ * Removes the run at the top of the heap (it is kept in the vector so it can be freed later)
+ */
+static void heap_pop(scanner* s)
+{
+    scanner_run* heap = scanner_run_vector_data(&s->runs);
+
+    s->heap_size--;
+    scanner_run temp = heap[0];
+    heap[0] = heap[s->heap_size];
+    heap[s->heap_size] = temp;
+    sift_down(s, 0);
+}
+
+int scanner_open(scanner* s, const char* dir, scanner_selector selector, void* context, size_t mem_budget)
+{
+    assert(s);
+    assert(dir);
+
+    s->mem_budget = mem_budget;
+    s->mem_used = 0;
+    s->next = 0;
+    s->heap_size = 0;
+    s->count = 0;
+    vector_new(&s->names);
+    scanner_run_vector_new(&s->runs);
+    arena_new(&s->arena);
+
+    DIR* d = opendir(dir);
+    if (d == NULL)
+    {
+        perror("opendir");
+        return 1;
+    }
+
+    for (struct dirent* entry = readdir(d); entry != NULL; entry = readdir(d))
+    {
+        int selected = selector ? selector(entry, context) : 1;
+        if (!selected)
+            continue;
+
+        char name[sizeof(entry->d_name) + 1];
+        strcpy(name, entry->d_name);
+        if (selected == SCANNER_DIRECTORY)
+            strcat(name, "/");
+
+        vector_push_back(&s->names, arena_strdup(&s->arena, name));
+        s->count++;
+
+        s->mem_used += strlen(name) + 1 + sizeof(char*);
+        if (s->mem_budget && s->mem_used >= s->mem_budget && spill(s) != 0)
+        {
+            closedir(d);
+            return scan_failed(s);
+        }
+    }
+
+    closedir(d);
+
+    if (scanner_run_vector_size(&s->runs) == 0) // everything fits in memory
+    {
+        name_sort((char**)s->names.buffer, vector_size(&s->names));
+        return 0;
+    }
+
+    if (vector_size(&s->names) != 0 && spill(s) != 0)
+        return scan_failed(s);
+
+    scanner_run* runs = scanner_run_vector_data(&s->runs);
+    for (int i = 0; i < scanner_run_vector_size(&s->runs); ++i)
+    {
+        rewind(runs[i].file);
+
+        if (run_advance(&runs[i]))
+        {
+            scanner_run temp = runs[i];
+            runs[i] = runs[s->heap_size];
+            runs[s->heap_size] = temp;
+            s->heap_size++;
+        }
+    }
+
+    for (int i = s->heap_size / 2 - 1; i >= 0; --i)
+        sift_down(s, i);
+
+    return 0;
+}
+
+const char* scanner_next(scanner* s)
+{
+    assert(s);
+
+    if (scanner_run_vector_size(&s->runs) == 0)
+    {
+        if (s->next >= vector_size(&s->names))
+            return NULL;
+
+        return vector_get(&s->names, s->next++);
+    }
+
+    if (s->next++ != 0 && s->heap_size > 0) // advance the run that produced the previous name
+    {
+        if (run_advance(scanner_run_vector_get(&s->runs, 0)))
+            sift_down(s, 0);
+        else
+            heap_pop(s);
+    }
+
+    if (s->heap_size == 0)
+        return NULL;
+
+    return scanner_run_vector_get(&s->runs, 0)->name;
+}
+
+void scanner_close(scanner* s)
+{
+    assert(s);
+
+    vector_free(&s->names);
+    arena_free(&s->arena);
+
+    for (int i = 0; i < scanner_run_vector_size(&s->runs); ++i)
+    {
+        scanner_run* run = scanner_run_vector_get(&s->runs, i);
+        fclose(run->file);
+        free(run->name);
+    }
+
+    scanner_run_vector_free(&s->runs);
+}
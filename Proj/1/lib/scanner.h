@@ -0,0 +1,85 @@
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "vector.h"
+#include "arena.h"
+
+/** @defgroup scanner scanner
+ * @{
+ * Sorted directory scan with a bounded memory budget.
+ *
+ * Names are buffered in memory until the budget is reached; each full
+ * buffer is sorted and spilled to a temporary file (a "run"). When the
+ * directory is exhausted the runs are merged on the fly, so the names
+ * can be consumed one at a time in sorted order without ever holding
+ * the whole listing in memory.
+ */
+
+/// Returned by a selector to keep an entry with a '/' appended to its name, so a directory sorts where its contents would
+#define SCANNER_DIRECTORY 2
+
+/**
+ * Selector used to filter directory entries (same semantics as scandir's, plus SCANNER_DIRECTORY),
+ *  called with the context given to scanner_open
+ */
+typedef int (*scanner_selector)(const struct dirent* file, void* context);
+
+/**
+ * A spilled, sorted run being merged
+ */
+typedef struct
+{
+    FILE* file; ///< Temporary file holding '\0' separated names
+    char* name; ///< Current (smallest not yet consumed) name of the run
+    size_t name_size; ///< Allocated size of name
+} scanner_run;
+
+/// Vector of scanner_run values, the few runs of most spilled scans are stored inline
+VECTOR_DEFINE(scanner_run_vector, scanner_run, 4)
+
+/**
+ * Holds the state of a directory scan
+ */
+typedef struct
+{
+    size_t mem_budget; ///< Maximum number of bytes of names kept in memory, 0 for unbounded
+    size_t mem_used; ///< Bytes of names currently kept in memory
+    vector names; ///< vector<char*>, names of the current in-memory run
+    string_arena arena; ///< Storage of the names of the current in-memory run
+    int next; ///< Index of the next in-memory name to be returned
+    scanner_run_vector runs; ///< Spilled runs; used as a min-heap while merging
+    int heap_size; ///< Number of runs in the heap that still have names
+    int count; ///< Number of names of the scan
+} scanner;
+
+/**
+ * Scans the specified directory. Names are only available after this call through scanner_next.
+ * @param  s          scanner struct to initialize. Must not be NULL.
+ * @param  dir        Directory to scan
+ * @param  selector   Filter for the directory entries, NULL selects all
+ * @param  context    Passed to the selector
+ * @param  mem_budget Maximum number of bytes of names kept in memory, 0 for unbounded
+ * @return            0 upon success, different otherwise (the scan then holds no names, it must still be closed).
+ */
+int scanner_open(scanner* s, const char* dir, scanner_selector selector, void* context, size_t mem_budget);
+
+/**
+ * Returns the next name of the scan, in byte order (see name_compare)
+ * @param  s scanner struct. Must not be NULL.
+ * @return   Next name (valid until the next call) or NULL if there are no more names
+ */
+const char* scanner_next(scanner* s);
+
+/**
+ * Releases resources allocated by the scanner, including the temporary files
+ * @param s scanner struct. Must not be NULL.
+ */
+void scanner_close(scanner* s);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,299 @@
+#include "store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "namesort.h"
+#include "journal.h"
+
+/**
+ * Selects the iteration folders (named with BACKUP_FOLDER_NAME_FORMAT)
+ */
+static int folder_selection(const struct dirent* file)
+{
+    return file->d_type == DT_DIR && strlen(file->d_name) == 19;
+}
+
+int store_open(backup_store* store, const char* path)
+{
+    assert(store);
+    assert(path);
+
+    store->path = strdup(path);
+    store->count = 0;
+    store->folders = NULL;
+    store->iters = NULL;
+    store->infos = NULL;
+
+    struct dirent** dirs = NULL;
+    int size = scandir(path, &dirs, folder_selection, bytesort);
+    if (size < 0)
+        return 1;
+
+    store->folders = malloc(size * sizeof(char*));
+    store->iters = malloc(size * sizeof(int));
+    store->infos = malloc(size * sizeof(backup_info*));
+
+    for (int i = 0; i < size; ++i)
+    {
+        char info_path[PATH_MAX];
+        snprintf(info_path, sizeof(info_path), "%s/%s/%s", path, dirs[i]->d_name, BACKUP_FILE_INFO_NAME);
+
+        FILE* info_file = cipher_fopen(info_path, "r");
+        int iter;
+
+        // encrypted with another key, or without one: not a store that can be read
+        if (info_file == NULL && (errno == EACCES || errno == EBADMSG))
+        {
+            for (int j = i; j < size; ++j)
+                free(dirs[j]);
+            free(dirs);
+            return EOF;
+        }
+
+        char folder_path[PATH_MAX];
+        snprintf(folder_path, sizeof(folder_path), "%s/%s", path, dirs[i]->d_name);
+
+        // folders without a backup info are not (yet) iterations, nor are the ones still being stored
+        if (info_file != NULL && backup_info_read_header(info_file, &iter) == 0 && !journal_exists(folder_path))
+        {
+            store->folders[store->count] = strdup(dirs[i]->d_name);
+            store->iters[store->count] = iter;
+            store->infos[store->count] = NULL;
+            store->count++;
+        }
+
+        if (info_file != NULL)
+            fclose(info_file);
+        free(dirs[i]);
+    }
+
+    free(dirs);
+    return 0;
+}
+
+void store_close(backup_store* store)
+{
+    assert(store);
+
+    for (int i = 0; i < store->count; ++i)
+    {
+        free(store->folders[i]);
+        if (store->infos[i])
+        {
+            backup_info_free(store->infos[i]);
+            free(store->infos[i]);
+        }
+    }
+
+    free(store->folders);
+    free(store->iters);
+    free(store->infos);
+    free(store->path);
+}
+
+int store_find_iter(const backup_store* store, int iter)
+{
+    assert(store);
+
+    // iterations only increase with time, binary search them
+    int low = 0, high = store->count - 1;
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (store->iters[middle] == iter)
+            return middle;
+        else if (store->iters[middle] < iter)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    return -1;
+}
+
+int store_find_before(const backup_store* store, const char* time)
+{
+    assert(store);
+    assert(time);
+
+    // folder names sort in chronological order
+    int low = 0, high = store->count - 1;
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (name_compare(store->folders[middle], time) <= 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    return high;
+}
+
+char* store_folder_path(const backup_store* store, int index)
+{
+    assert(store);
+    assert(index >= 0 && index < store->count);
+
+    char* path = malloc(strlen(store->path) + strlen(store->folders[index]) + 2);
+    sprintf(path, "%s/%s", store->path, store->folders[index]);
+
+    return path;
+}
+
+backup_info* store_info(backup_store* store, int index)
+{
+    assert(store);
+    assert(index >= 0 && index < store->count);
+
+    if (store->infos[index])
+        return store->infos[index];
+
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s/%s/%s", store->path, store->folders[index], BACKUP_FILE_INFO_NAME);
+
+    FILE* info_file = cipher_fopen(info_path, "r");
+    if (info_file == NULL)
+    {
+        perror("fopen(info_path)");
+        return NULL;
+    }
+
+    backup_info* bi = malloc(sizeof(backup_info));
+    backup_info_new(bi);
+
+    if (backup_info_read(info_file, bi) != 0)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", info_path);
+        backup_info_free(bi);
+        free(bi);
+        fclose(info_file);
+        return NULL;
+    }
+
+    fclose(info_file);
+    store->infos[index] = bi;
+
+    return bi;
+}
+
+int store_find_file(backup_store* store, int index, const char* name, file_info* result)
+{
+    assert(store);
+    assert(index >= 0 && index < store->count);
+    assert(name);
+    assert(result);
+
+    if (store->infos[index])
+    {
+        const file_info_list* list = &store->infos[index]->file_list;
+        int position = file_info_list_find(list, name);
+        if (position < 0)
+            return 1;
+
+        file_info_assign(result, file_info_list_get(list, position));
+        return 0;
+    }
+
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s/%s/%s", store->path, store->folders[index], BACKUP_FILE_INFO_NAME);
+
+    FILE* info_file = cipher_fopen(info_path, "r");
+    if (info_file == NULL)
+    {
+        perror("fopen(info_path)");
+        return EOF;
+    }
+
+    int found = backup_info_find(info_file, name, result);
+    fclose(info_file);
+
+    return found;
+}
+
+int store_resolve(backup_store* store, const file_info* fi, file_segment** segments)
+{
+    assert(store);
+    assert(fi);
+    assert(segments);
+
+    int count = 0;
+    int capacity = 1;
+    *segments = malloc(capacity * sizeof(file_segment));
+
+    int iter = fi->iter;
+    int base_iter = fi->base_iter;
+    long long base_size = fi->base_size;
+
+    file_info base_fi;
+    file_info_new(&base_fi, NULL);
+
+    for (;;)
+    {
+        int index = store_find_iter(store, iter);
+        if (index < 0)
+        {
+            fprintf(stderr, "Could not find iteration %d of %s.\n", iter, fi->file_name);
+            file_info_free(&base_fi);
+            store_free_segments(*segments, count);
+            return -1;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *segments = realloc(*segments, capacity * sizeof(file_segment));
+        }
+
+        (*segments)[count].dir = store_folder_path(store, index);
+        (*segments)[count].offset = base_iter >= 0 ? base_size : 0;
+        count++;
+
+        if (base_iter < 0)
+            break;
+
+        // the previous version is the entry changed in the base iteration
+        index = store_find_iter(store, base_iter);
+        if (index < 0 || store_find_file(store, index, fi->file_name, &base_fi) != 0)
+        {
+            fprintf(stderr, "Could not find version %d of %s.\n", base_iter, fi->file_name);
+            file_info_free(&base_fi);
+            store_free_segments(*segments, count);
+            return -1;
+        }
+
+        iter = base_fi.iter;
+        base_iter = base_fi.base_iter;
+        base_size = base_fi.base_size;
+    }
+
+    file_info_free(&base_fi);
+
+    // segments were found from the newest to the oldest
+    for (int i = 0; i < count / 2; ++i)
+    {
+        file_segment temp = (*segments)[i];
+        (*segments)[i] = (*segments)[count - 1 - i];
+        (*segments)[count - 1 - i] = temp;
+    }
+
+    return count;
+}
+
+void store_free_segments(file_segment* segments, int count)
+{
+    for (int i = 0; i < count; ++i)
+        free(segments[i].dir);
+
+    free(segments);
+}
@@ -0,0 +1,103 @@
+#ifndef STORE_H_
+#define STORE_H_
+
+#include "backupinfo.h"
+#include "fileinfo.h"
+#include "utilities.h"
+
+/** @defgroup store store
+ * @{
+ * Read access to a backup destination: its iteration folders and their backup infos.
+ */
+
+/**
+ * A backup destination directory
+ */
+typedef struct
+{
+    char* path; ///< Path of the destination directory
+    int count; ///< Number of iteration folders
+    char** folders; ///< Names of the iteration folders, in chronological order
+    int* iters; ///< Iteration of each folder (read from its backup info header)
+    backup_info** infos; ///< Backup info of each folder, loaded on demand (NULL if not loaded)
+} backup_store;
+
+/**
+ * Opens a backup destination directory, listing its iteration folders
+ * @param  store backup_store struct to initialize. Must not be NULL.
+ * @param  path  Path of the destination directory
+ * @return       0 upon success, 1 if the directory could not be listed (errno is set), EOF if its
+ *               backup infos are encrypted with another key, or without the one loaded (this is reported)
+ */
+int store_open(backup_store* store, const char* path);
+
+/**
+ * Releases the resources of a backup_store
+ * @param store backup_store struct. Must not be NULL.
+ */
+void store_close(backup_store* store);
+
+/**
+ * Finds the folder of an iteration
+ * @param  store backup_store struct. Must not be NULL.
+ * @param  iter  Iteration
+ * @return       Index of the folder, -1 if not found
+ */
+int store_find_iter(const backup_store* store, int iter);
+
+/**
+ * Finds the latest folder created at or before a time
+ * @param  store backup_store struct. Must not be NULL.
+ * @param  time  Time in the format of the folder names (BACKUP_FOLDER_NAME_FORMAT); a
+ *               prefix such as "2013_04_20" stands for the start of that period
+ * @return       Index of the folder, -1 if every folder is later
+ */
+int store_find_before(const backup_store* store, const char* time);
+
+/**
+ * Path of an iteration folder
+ * @param  store backup_store struct. Must not be NULL.
+ * @param  index Index of the folder
+ * @return       Path of the folder, must be freed by the caller
+ */
+char* store_folder_path(const backup_store* store, int index);
+
+/**
+ * Backup info of an iteration folder, read on first use
+ * @param  store backup_store struct. Must not be NULL.
+ * @param  index Index of the folder
+ * @return       The backup info (owned by the store), NULL if it could not be read
+ */
+backup_info* store_info(backup_store* store, int index);
+
+/**
+ * Finds the entry of a file in the backup info of an iteration folder. If the backup info
+ *  was not loaded (see store_info) only the part of it that may hold the entry is read.
+ * @param  store  backup_store struct. Must not be NULL.
+ * @param  index  Index of the folder
+ * @param  name   Name of the file. Must not be NULL.
+ * @param  result file_info pointer to save the entry. Must not be NULL.
+ * @return        0 if found, 1 if the backup info has no such entry, EOF on errors
+ */
+int store_find_file(backup_store* store, int index, const char* name, file_info* result);
+
+/**
+ * Finds where the data of a file is stored. Files that were appended to are
+ *  made of several segments, found by following the base of each version.
+ * @param  store    backup_store struct. Must not be NULL.
+ * @param  fi       Entry of the file in some backup info of the store. Must not be NULL.
+ * @param  segments Resulting array of segments (see copy_file_segments), must be freed with store_free_segments
+ * @return          Number of segments, -1 if a version could not be found
+ */
+int store_resolve(backup_store* store, const file_info* fi, file_segment** segments);
+
+/**
+ * Releases an array of segments returned by store_resolve
+ * @param segments Array of segments
+ * @param count    Number of segments
+ */
+void store_free_segments(file_segment* segments, int count);
+
+/**@}*/
+
+#endif
@@ -0,0 +1,340 @@
+#include "tar.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "cipher.h"
+
+/// Archives are padded to a multiple of this size (the default blocking factor of tar)
+#define TAR_RECORD_SIZE (20 * TAR_BLOCK_SIZE)
+
+/// Largest size that fits the 11 octal digits of the size field
+#define TAR_MAX_OCTAL_SIZE 077777777777LL
+
+/**
+ * ustar header block
+ */
+typedef struct
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} tar_header;
+
+/**
+ * Writes the buffered bytes
+ * @return true if successful, false otherwise
+ */
+static bool flush(tar_writer* tar)
+{
+    for (size_t written = 0; written < tar->used; )
+    {
+        ssize_t count = write(tar->fd, tar->buffer + written, tar->used - written);
+        if (count < 0)
+        {
+            perror("Error writing archive");
+            return false;
+        }
+        written += count;
+    }
+
+    tar->used = 0;
+    return true;
+}
+
+/**
+ * Buffers bytes to be written
+ * @return true if successful, false otherwise
+ */
+static bool put(tar_writer* tar, const void* data, size_t size)
+{
+    while (size > 0)
+    {
+        if (tar->used == TAR_BUFFER_SIZE && !flush(tar))
+            return false;
+
+        size_t count = TAR_BUFFER_SIZE - tar->used < size ? TAR_BUFFER_SIZE - tar->used : size;
+        if (data)
+        {
+            memcpy(tar->buffer + tar->used, data, count);
+            data = (const char*)data + count;
+        }
+        else
+            memset(tar->buffer + tar->used, 0, count);
+
+        tar->used += count;
+        tar->written += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+/**
+ * Pads the archive with zeros up to a multiple of size
+ * @return true if successful, false otherwise
+ */
+static bool pad(tar_writer* tar, long long size)
+{
+    long long remainder = tar->written % size;
+    return remainder == 0 || put(tar, NULL, size - remainder);
+}
+
+/**
+ * Writes a number in octal, zero padded and '\0' terminated, to a header field
+ */
+static void set_octal(char* field, size_t length, long long value)
+{
+    snprintf(field, length, "%0*llo", (int)length - 1, value);
+}
+
+/**
+ * Writes a header block, computing its checksum
+ * @return true if successful, false otherwise
+ */
+static bool put_header(tar_writer* tar, tar_header* header)
+{
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+    memset(header->checksum, ' ', sizeof(header->checksum));
+
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < sizeof(tar_header); ++i)
+        checksum += ((unsigned char*)header)[i];
+
+    snprintf(header->checksum, sizeof(header->checksum), "%06o", checksum);
+
+    return put(tar, header, sizeof(tar_header));
+}
+
+/**
+ * Appends a pax extended header record ("<length> <key>=<value>\n", length counting itself)
+ */
+static void add_pax_record(char** records, size_t* size, const char* key, const char* value)
+{
+    size_t length = strlen(key) + strlen(value) + 3; // ' ', '=' and '\n'
+
+    // adding the digits of the length may add a digit to the length
+    size_t total = length + 1;
+    while (length + snprintf(NULL, 0, "%zu", total) != total)
+        total = length + snprintf(NULL, 0, "%zu", total);
+
+    *records = realloc(*records, *size + total + 1);
+    snprintf(*records + *size, total + 1, "%zu %s=%s\n", total, key, value);
+    *size += total;
+}
+
+/**
+ * Splits a name between the name and prefix fields of a ustar header
+ * @return true if the name fits, false otherwise
+ */
+static bool set_name(tar_header* header, const char* name)
+{
+    size_t length = strlen(name);
+
+    if (length <= sizeof(header->name))
+    {
+        memcpy(header->name, name, length);
+        return true;
+    }
+
+    // split on the first '/' that leaves at most 100 bytes for the name field
+    for (const char* slash = strchr(name, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        size_t prefix = slash - name;
+        if (prefix > sizeof(header->prefix))
+            break;
+
+        if (length - prefix - 1 <= sizeof(header->name))
+        {
+            memcpy(header->prefix, name, prefix);
+            memcpy(header->name, slash + 1, length - prefix - 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void tar_open(tar_writer* tar, int fd)
+{
+    assert(tar);
+
+    tar->fd = fd;
+    tar->buffer = malloc(TAR_BUFFER_SIZE);
+    tar->used = 0;
+    tar->written = 0;
+}
+
+/**
+ * Copies length bytes of a stored file to the archive, reading directly into the output buffer
+ * @return Number of bytes copied (less than length if the file is shorter or could not be read),
+ *         -1 if the archive could not be written
+ */
+static long long put_fd(tar_writer* tar, cipher_file* file, long long length)
+{
+    long long copied = 0;
+
+    while (length < 0 || copied < length)
+    {
+        if (tar->used == TAR_BUFFER_SIZE && !flush(tar))
+            return -1;
+
+        size_t count = TAR_BUFFER_SIZE - tar->used;
+        if (length >= 0 && (long long)count > length - copied)
+            count = length - copied;
+
+        ssize_t size = cipher_file_read(file, tar->buffer + tar->used, count);
+        if (size < 0)
+        {
+            perror("Error reading source file");
+            break;
+        }
+        if (size == 0)
+            break;
+
+        tar->used += size;
+        tar->written += size;
+        copied += size;
+    }
+
+    return copied;
+}
+
+bool tar_add_file(tar_writer* tar, const char* name, const file_segment* segments, int count, long long size, long long mtime)
+{
+    assert(tar);
+    assert(name);
+    assert(segments && count > 0);
+
+    // the permissions are the ones of the first version
+    char src_file_name[PATH_MAX];
+
+    struct stat buf;
+    if (!path_join(src_file_name, segments[0].dir, name) || stat(src_file_name, &buf) != 0)
+    {
+        perror("Error reading source file permissions");
+        return false;
+    }
+
+    tar_header header;
+    memset(&header, 0, sizeof(tar_header));
+
+    char* records = NULL;
+    size_t records_size = 0;
+
+    if (!set_name(&header, name))
+    {
+        add_pax_record(&records, &records_size, "path", name);
+        memcpy(header.name, name, sizeof(header.name));
+    }
+
+    if (size > TAR_MAX_OCTAL_SIZE)
+    {
+        char value[32];
+        snprintf(value, sizeof(value), "%lld", size);
+        add_pax_record(&records, &records_size, "size", value);
+    }
+
+    if (records)
+    {
+        tar_header pax;
+        memset(&pax, 0, sizeof(tar_header));
+        snprintf(pax.name, sizeof(pax.name), "PaxHeaders/%.88s", name);
+        set_octal(pax.mode, sizeof(pax.mode), 0644);
+        set_octal(pax.uid, sizeof(pax.uid), 0);
+        set_octal(pax.gid, sizeof(pax.gid), 0);
+        set_octal(pax.size, sizeof(pax.size), records_size);
+        set_octal(pax.mtime, sizeof(pax.mtime), mtime > 0 ? mtime / 1000000000LL : 0);
+        pax.typeflag = 'x';
+
+        bool written = put_header(tar, &pax) && put(tar, records, records_size) && pad(tar, TAR_BLOCK_SIZE);
+        free(records);
+
+        if (!written)
+            return false;
+    }
+
+    set_octal(header.mode, sizeof(header.mode), buf.st_mode & 07777);
+    set_octal(header.uid, sizeof(header.uid), buf.st_uid);
+    set_octal(header.gid, sizeof(header.gid), buf.st_gid);
+    set_octal(header.size, sizeof(header.size), size <= TAR_MAX_OCTAL_SIZE ? size : 0);
+    set_octal(header.mtime, sizeof(header.mtime), mtime > 0 ? mtime / 1000000000LL : 0);
+    header.typeflag = '0';
+
+    if (!put_header(tar, &header))
+        return false;
+
+    long long copied = 0;
+    bool success = true;
+
+    for (int i = 0; success && i < count && copied < size; ++i)
+    {
+        cipher_file source;
+        int sourcefd = path_join(src_file_name, segments[i].dir, name) ? open(src_file_name, O_RDONLY) : -1;
+        if (sourcefd < 0 || !cipher_file_open(&source, sourcefd))
+        {
+            perror("Error opening source file");
+            if (sourcefd >= 0) close(sourcefd);
+            success = false;
+            break;
+        }
+
+        posix_fadvise(sourcefd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        // each segment contributes the bytes up to the next one, never more than the recorded size
+        long long end = i + 1 < count && segments[i + 1].offset < size ? segments[i + 1].offset : size;
+        long long length = end - copied;
+        long long result = put_fd(tar, &source, length);
+        cipher_file_close(&source);
+
+        if (result < 0)
+            return false;
+
+        copied += result;
+        success = result == length;
+    }
+
+    if (copied < size)
+    {
+        fprintf(stderr, "%s: %lld of %lld bytes could be read, padding with zeros.\n", name, copied, size);
+        success = false;
+
+        if (!put(tar, NULL, size - copied))
+            return false;
+    }
+
+    return pad(tar, TAR_BLOCK_SIZE) && success;
+}
+
+bool tar_close(tar_writer* tar)
+{
+    assert(tar);
+
+    bool success = put(tar, NULL, 2 * TAR_BLOCK_SIZE) && pad(tar, TAR_RECORD_SIZE) && flush(tar);
+
+    free(tar->buffer);
+    tar->buffer = NULL;
+
+    return success;
+}
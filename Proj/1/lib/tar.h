@@ -0,0 +1,62 @@
+#ifndef TAR_H_
+#define TAR_H_
+
+#include <stdbool.h>
+
+#include "utilities.h"
+
+/** @defgroup tar tar
+ * @{
+ * Streaming writer of POSIX (ustar) tar archives.
+ *
+ * Names that do not fit the ustar header and sizes of 8 GiB or more are
+ * written in a pax extended header preceding the entry.
+ */
+
+/// Size of a tar block
+#define TAR_BLOCK_SIZE 512
+
+/// Size of the output buffer, also the size of the reads of file data
+#define TAR_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Holds the state of an archive being written
+ */
+typedef struct
+{
+    int fd; ///< File descriptor the archive is written to
+    char* buffer; ///< Output buffer (TAR_BUFFER_SIZE bytes)
+    size_t used; ///< Bytes of buffer waiting to be written
+    long long written; ///< Bytes of the archive written so far (including buffered ones)
+} tar_writer;
+
+/**
+ * Starts writing an archive
+ * @param tar tar_writer struct to initialize. Must not be NULL.
+ * @param fd  File descriptor to write the archive to
+ */
+void tar_open(tar_writer* tar, int fd);
+
+/**
+ * Adds a regular file to the archive, reading its data from its segments (see copy_file_segments)
+ * @param  tar      tar_writer struct. Must not be NULL.
+ * @param  name     Name of the file in the archive. Must not be NULL.
+ * @param  segments Segments of the file, by increasing offset (the first must be at 0)
+ * @param  count    Number of segments
+ * @param  size     Size of the file
+ * @param  mtime    Modification time of the file, in nanoseconds since the epoch
+ * @return          true if successful; false otherwise, if the data could be read only
+ *                  partially the entry is padded with zeros so the archive stays valid
+ */
+bool tar_add_file(tar_writer* tar, const char* name, const file_segment* segments, int count, long long size, long long mtime);
+
+/**
+ * Writes the end of the archive and releases the resources of the writer. The file descriptor is not closed.
+ * @param  tar tar_writer struct. Must not be NULL.
+ * @return     true if successful, false otherwise
+ */
+bool tar_close(tar_writer* tar);
+
+/**@}*/
+
+#endif
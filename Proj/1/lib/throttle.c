@@ -0,0 +1,206 @@
+#include "throttle.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <assert.h>
+
+/**
+ * Seconds elapsed between two times
+ */
+static double elapsed(const struct timespec* from, const struct timespec* to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/**
+ * Locks a bucket. A process that died holding the lock left the bucket consistent
+ *  (it is only changed by plain assignments), so it is simply taken over.
+ */
+static void throttle_lock(throttle* t)
+{
+    if (pthread_mutex_lock(&t->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&t->lock);
+}
+
+void throttle_init(throttle* t, double rate)
+{
+    assert(t);
+
+    pthread_mutex_init(&t->lock, NULL);
+    t->rate = rate;
+    t->burst = rate; // at most one second worth of I/O at once
+    t->tokens = rate;
+    clock_gettime(CLOCK_MONOTONIC, &t->last);
+}
+
+void throttle_init_shared(throttle* t, double rate)
+{
+    assert(t);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST); // copies can be killed at any time
+
+    pthread_mutex_init(&t->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    t->rate = rate;
+    t->burst = rate;
+    t->tokens = rate;
+    clock_gettime(CLOCK_MONOTONIC, &t->last);
+}
+
+void throttle_set_rate(throttle* t, double rate)
+{
+    assert(t);
+
+    throttle_lock(t);
+
+    t->rate = rate;
+    t->burst = rate;
+    if (t->tokens > t->burst)
+        t->tokens = t->burst;
+
+    pthread_mutex_unlock(&t->lock);
+}
+
+void throttle_take(throttle* t, size_t units)
+{
+    assert(t);
+
+    if (t->rate <= 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    throttle_lock(t);
+
+    double rate = t->rate;
+    if (rate <= 0) // changed since it was checked
+    {
+        pthread_mutex_unlock(&t->lock);
+        return;
+    }
+
+    t->tokens += elapsed(&t->last, &now) * rate;
+    if (t->tokens > t->burst)
+        t->tokens = t->burst;
+    t->last = now;
+
+    t->tokens -= units;
+    double wait = t->tokens < 0 ? -t->tokens / rate : 0;
+
+    pthread_mutex_unlock(&t->lock);
+
+    if (wait > 0)
+    {
+        struct timespec duration;
+        duration.tv_sec = (time_t)wait;
+        duration.tv_nsec = (long)((wait - duration.tv_sec) * 1e9);
+        nanosleep(&duration, NULL);
+    }
+}
+
+void throttle_destroy(throttle* t)
+{
+    assert(t);
+
+    pthread_mutex_destroy(&t->lock);
+}
+
+io_limits* io_limits_create(double bytes_rate, double ops_rate)
+{
+    io_limits* limits = mmap(NULL, sizeof(io_limits), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (limits == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    throttle_init_shared(&limits->bytes, bytes_rate);
+    throttle_init_shared(&limits->ops, ops_rate);
+    limits->parent = NULL;
+
+    return limits;
+}
+
+void io_limits_set(io_limits* limits, double bytes_rate, double ops_rate)
+{
+    assert(limits);
+
+    throttle_set_rate(&limits->bytes, bytes_rate);
+    throttle_set_rate(&limits->ops, ops_rate);
+}
+
+void io_limits_take(io_limits* limits, size_t bytes, size_t ops)
+{
+    if (limits == NULL)
+        return;
+
+    __atomic_add_fetch(&limits->bytes_done, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&limits->ops_done, ops, __ATOMIC_RELAXED);
+
+    if (bytes > 0)
+        throttle_take(&limits->bytes, bytes);
+    if (ops > 0)
+        throttle_take(&limits->ops, ops);
+
+    io_limits_take(limits->parent, bytes, ops);
+}
+
+bool io_limits_read(const char* path, double* bytes_rate, double* ops_rate)
+{
+    assert(path);
+    assert(bytes_rate && ops_rate);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    double rate = 0, ops = 0;
+    char key[16];
+    double value;
+    int read;
+    bool success = true;
+
+    while ((read = fscanf(file, "%15s %lf", key, &value)) != EOF)
+    {
+        if (read != 2 || value < 0 || (strcmp(key, "rate") != 0 && strcmp(key, "ops") != 0))
+        {
+            fprintf(stderr, "%s: invalid limit.\n", path);
+            success = false;
+            break;
+        }
+
+        if (strcmp(key, "rate") == 0)
+            rate = value * 1024 * 1024;
+        else
+            ops = value;
+    }
+
+    fclose(file);
+
+    if (success)
+    {
+        *bytes_rate = rate;
+        *ops_rate = ops;
+    }
+
+    return success;
+}
+
+void io_limits_free(io_limits* limits)
+{
+    assert(limits);
+
+    throttle_destroy(&limits->bytes);
+    throttle_destroy(&limits->ops);
+    munmap(limits, sizeof(io_limits));
+}
@@ -0,0 +1,120 @@
+#ifndef THROTTLE_H_
+#define THROTTLE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+/** @defgroup throttle throttle
+ * @{
+ * Token bucket limiting the rate of I/O shared by several threads or processes.
+ *
+ * Callers take the units (bytes or operations) they are about to use; when
+ * the bucket is in debt they sleep until the debt is paid at the configured
+ * rate. Buckets in shared memory are also shared by fork'ed processes.
+ */
+
+/**
+ * Token bucket
+ */
+typedef struct
+{
+    pthread_mutex_t lock; ///< Protects the other fields
+    double rate; ///< Units per second, 0 for unlimited
+    double burst; ///< Maximum number of tokens saved while idle
+    double tokens; ///< Available units (negative when in debt)
+    struct timespec last; ///< Time tokens was last updated
+} throttle;
+
+/**
+ * Bandwidth and operation limits of a process and its children
+ */
+typedef struct io_limits
+{
+    throttle bytes; ///< Bytes per second
+    throttle ops; ///< Operations (system calls doing I/O) per second
+    long long bytes_done; ///< Bytes taken so far, by every process
+    long long ops_done; ///< Operations taken so far, by every process
+    struct io_limits* parent; ///< Limits shared with others, taken from as well (NULL if none)
+} io_limits;
+
+/**
+ * Initializes a token bucket
+ * @param t    throttle struct to initialize. Must not be NULL.
+ * @param rate Units per second, 0 for unlimited
+ */
+void throttle_init(throttle* t, double rate);
+
+/**
+ * Initializes a token bucket that can be used by several processes (it must be in shared memory)
+ * @param t    throttle struct to initialize. Must not be NULL.
+ * @param rate Units per second, 0 for unlimited
+ */
+void throttle_init_shared(throttle* t, double rate);
+
+/**
+ * Changes the rate of a token bucket
+ * @param t    throttle struct. Must not be NULL.
+ * @param rate Units per second, 0 for unlimited
+ */
+void throttle_set_rate(throttle* t, double rate);
+
+/**
+ * Takes units from the bucket, sleeping if the rate is exceeded
+ * @param t     throttle struct. Must not be NULL.
+ * @param units Number of units about to be used
+ */
+void throttle_take(throttle* t, size_t units);
+
+/**
+ * Releases the resources of a token bucket
+ * @param t throttle struct. Must not be NULL.
+ */
+void throttle_destroy(throttle* t);
+
+/**
+ * Creates I/O limits in shared memory, so they hold for the calling process and the ones it forks
+ * @param  bytes_rate Bytes per second, 0 for unlimited
+ * @param  ops_rate   Operations per second, 0 for unlimited
+ * @return            The limits, NULL on errors
+ */
+io_limits* io_limits_create(double bytes_rate, double ops_rate);
+
+/**
+ * Changes I/O limits, for every process using them
+ * @param limits     io_limits struct. Must not be NULL.
+ * @param bytes_rate Bytes per second, 0 for unlimited
+ * @param ops_rate   Operations per second, 0 for unlimited
+ */
+void io_limits_set(io_limits* limits, double bytes_rate, double ops_rate);
+
+/**
+ * Takes bytes and operations from I/O limits and their parents, sleeping if they are
+ *  exceeded. They are counted even when unlimited. Reads are charged once done, with the
+ *  bytes actually read, the next transfer then waits for them.
+ * @param limits io_limits struct (NULL for no limits)
+ * @param bytes  Number of bytes transferred (about to be, or just read)
+ * @param ops    Number of operations
+ */
+void io_limits_take(io_limits* limits, size_t bytes, size_t ops);
+
+/**
+ * Reads I/O limits from a file of "<key> <value>" lines: "rate" in MiB per second and "ops"
+ *  in operations per second (missing keys and 0 mean unlimited)
+ * @param  path       Path of the file
+ * @param  bytes_rate Resulting bytes per second. Must not be NULL.
+ * @param  ops_rate   Resulting operations per second. Must not be NULL.
+ * @return            true if successful, false otherwise
+ */
+bool io_limits_read(const char* path, double* bytes_rate, double* ops_rate);
+
+/**
+ * Releases I/O limits created by io_limits_create
+ * @param limits io_limits struct. Must not be NULL.
+ */
+void io_limits_free(io_limits* limits);
+
+/**@}*/
+
+#endif
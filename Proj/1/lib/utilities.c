@@ -6,10 +6,101 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
 
-#define BUFFER_SIZE 1024
+#include "hash.h"
+#include "copyrecord.h"
+#include "capture.h"
+#include "cipher.h"
+
+#define BUFFER_SIZE (64 * 1024)
+
+// from linux/ioprio.h, which glibc does not wrap
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+static int RunningCopies = 0; ///< Number of fork'ed copies that were not waited for
+static int FailedCopies = 0; ///< Number of copies that failed since the last wait_copies
+static io_limits* CopyLimits = NULL; ///< I/O limits of the copies, NULL for none
+static bool DropCache = false; ///< Drop the copied data from the page cache after each copy
+static sem_t* CopySlots = NULL; ///< Copy slots shared with other processes, NULL for none
+static int MaxCopies = 0; ///< Maximum number of copies of this process at once, 0 for no limit
+
+/**
+ * Gives back the slot taken by take_copy_slot
+ */
+static void give_copy_slot(void)
+{
+    if (CopySlots != NULL)
+        sem_post(CopySlots);
+}
+
+/**
+ * Waits until less than max copies are running, counting the ones that failed in FailedCopies.
+ *  The copies that already finished are waited for too, so their slots are given back.
+ */
+static void reap_copies(int max)
+{
+    int status;
+    pid_t pid;
+
+    while (RunningCopies > 0 && (pid = waitpid(-1, &status, RunningCopies >= max ? 0 : WNOHANG)) != 0)
+    {
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // no children left
+            for (; RunningCopies > 0; RunningCopies--)
+                give_copy_slot();
+            break;
+        }
+
+        // the parent gives the slot back, a killed copy would not
+        RunningCopies--;
+        give_copy_slot();
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            FailedCopies++;
+    }
+}
+
+/**
+ * Waits for a copy slot of this process and one of CopySlots
+ */
+static void take_copy_slot(void)
+{
+    reap_copies(MaxCopies > 0 ? MaxCopies : INT_MAX);
+
+    if (CopySlots == NULL)
+        return;
+
+    // slots are given back when their copies are waited for: with all of them taken, this
+    //  process waits for one of its own copies, or for the other processes to wait for theirs
+    while (sem_trywait(CopySlots) != 0)
+    {
+        if (errno != EAGAIN)
+            continue;
+
+        if (RunningCopies > 0)
+            reap_copies(RunningCopies);
+        else
+        {
+            while (sem_wait(CopySlots) != 0 && errno == EINTR)
+                ;
+            return;
+        }
+    }
+}
 
 void iter_to_folder(int iter, const char* dst, time_t start_time, int dt, char** name)
 {
@@ -25,27 +116,170 @@ void iter_to_folder(int iter, const char* dst, time_t start_time, int dt, char**
     (*name)[size] = '\0';
 }
 
-void fork_copy_file(const char* src_dir, const char* dst_dir, const char* file_name)
+bool folder_to_time(const char* name, time_t* time)
 {
+    struct tm timestruct;
+    memset(&timestruct, 0, sizeof(timestruct));
+
+    if (sscanf(name, "%4d_%2d_%2d_%2d_%2d_%2d", &timestruct.tm_year, &timestruct.tm_mon, &timestruct.tm_mday,
+               &timestruct.tm_hour, &timestruct.tm_min, &timestruct.tm_sec) != 6)
+        return false;
+
+    timestruct.tm_year -= 1900;
+    timestruct.tm_mon -= 1;
+    timestruct.tm_isdst = -1; // named in local time, like iter_to_folder
+
+    *time = mktime(&timestruct);
+    return *time != (time_t)-1;
+}
+
+void fork_copy_file(const char* src_dir, const char* dst_dir, const char* file_name, off_t offset, const journal_entry* resume)
+{
+    take_copy_slot();
+
     pid_t pid = fork();
 
     if (pid == 0)
     {
-        copy_file(src_dir, dst_dir, file_name);
-        exit(0);
+        uint32_t crc;
+        bool consistent;
+        bool copied = copy_file(src_dir, dst_dir, file_name, offset, resume, &crc, &consistent)
+                      && copy_record_add(dst_dir, file_name, crc, consistent);
+        // _exit: flushing the inherited streams would move the parent's read offsets
+        _exit(copied ? 0 : 1);
     }
+    else if (pid > 0)
+        RunningCopies++;
+    else
+        give_copy_slot();
 }
 
-bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name)
+void fork_copy_file_targets(const char* src_dir, fanout_target* targets, int count, const char* file_name)
+{
+    take_copy_slot();
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        fanout_copy(src_dir, file_name, targets, count, CopyLimits, DropCache);
+
+        // a destination that failed does not fail the others
+        bool copied = false;
+        for (int i = 0; i < count; ++i)
+            if (targets[i].copied && copy_record_add(targets[i].dir, file_name, targets[i].crc, targets[i].consistent))
+                copied = true;
+
+        _exit(copied ? 0 : 1);
+    }
+    else if (pid > 0)
+        RunningCopies++;
+    else
+        give_copy_slot();
+}
+
+int wait_copies(int max)
+{
+    reap_copies(max);
+
+    int failed = FailedCopies;
+    FailedCopies = 0;
+    return failed;
+}
+
+/**
+ * Copies up to length bytes (or until the end of the file if length is negative) between two files
+ * @param  crc     If not NULL, updated with the CRC32C of the copied data
+ * @param  capture If not NULL, updated with the checksums of the blocks of the copied data
+ * @return         true if successful, false otherwise
+ */
+static bool copy_fd(cipher_file* source, cipher_file* dest, long long length, uint32_t* crc, capture* capture)
+{
+    char buffer[BUFFER_SIZE];
+
+    while (length != 0)
+    {
+        size_t to_read = length > 0 && length < BUFFER_SIZE ? length : BUFFER_SIZE;
+
+        ssize_t size = cipher_file_read(source, buffer, to_read);
+
+        if (size < 0)
+            return false;
+
+        // the bytes read, once they are known, and the write that (usually) follows
+        io_limits_take(CopyLimits, size, size > 0 ? 2 : 1);
+
+        if (size == 0)
+            return length < 0;
+
+        if (crc)
+            *crc = hash_crc32c(*crc, buffer, size);
+        if (capture)
+            capture_update(capture, buffer, size);
+
+        if (!cipher_file_write(dest, buffer, size))
+            return false;
+
+        if (length > 0)
+            length -= size;
+    }
+
+    if (DropCache)
+    {
+        // dirty pages cannot be dropped, so the copy is written back first
+        cipher_file_sync(dest);
+        posix_fadvise(source->fd, 0, 0, POSIX_FADV_DONTNEED);
+        posix_fadvise(dest->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    return true;
+}
+
+void set_copy_io_limits(io_limits* limits, bool drop_cache)
+{
+    CopyLimits = limits;
+    DropCache = drop_cache;
+}
+
+sem_t* copy_slots_create(int count)
+{
+    sem_t* slots = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (sem_init(slots, 1, count) != 0)
+    {
+        perror("sem_init");
+        munmap(slots, sizeof(sem_t));
+        return NULL;
+    }
+
+    return slots;
+}
+
+void set_copy_workers(sem_t* slots, int max)
+{
+    CopySlots = slots;
+    MaxCopies = max;
+}
+
+bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name, off_t offset, const journal_entry* resume,
+               uint32_t* crc, bool* consistent)
 {
     int destfd = -1;
+    cipher_file dest;
     bool return_code = true;
 
-    char src_file_name[1024];
-    sprintf(src_file_name, "%s/%s", src_dir, file_name);
-
-    char dst_file_name[1024];
-    sprintf(dst_file_name, "%s/%s", dst_dir, file_name);
+    char src_file_name[PATH_MAX];
+    char dst_file_name[PATH_MAX];
+    if (!path_join(src_file_name, src_dir, file_name) || !path_join(dst_file_name, dst_dir, file_name))
+    {
+        fprintf(stderr, "Could not copy %s/%s (%s).\n", src_dir, file_name, strerror(errno));
+        return false;
+    }
 
     int sourcefd = open(src_file_name, O_RDONLY);
     if (sourcefd < 0)
@@ -64,7 +298,37 @@ bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name)
         goto ret;
     }
 
-    destfd = open(dst_file_name, O_CREAT | O_EXCL | O_WRONLY, buf.st_mode);
+    long long done = resume != NULL ? resume->offset : 0; // bytes already stored
+    if (offset + done != 0 && lseek(sourcefd, offset + done, SEEK_SET) == (off_t)-1)
+    {
+        perror("Error seeking source file");
+        return_code = false;
+        goto ret;
+    }
+
+    if (resume != NULL)
+    {
+        // the bytes written after the checkpoint may not have reached the disk
+        destfd = open(dst_file_name, O_RDWR);
+        if (destfd != -1 && !cipher_file_resume(&dest, destfd, done))
+        {
+            close(destfd);
+            destfd = -1;
+        }
+    }
+    else
+    {
+        // read and written, blocks stored by an interrupted copy are compared by capture_check
+        destfd = open(dst_file_name, O_CREAT | O_EXCL | O_RDWR, buf.st_mode);
+        if (destfd == -1 && errno == ENOENT && make_parent_dirs(dst_file_name)) // file in a subdirectory
+            destfd = open(dst_file_name, O_CREAT | O_EXCL | O_RDWR, buf.st_mode);
+        if (destfd != -1 && !cipher_file_create(&dest, destfd))
+        {
+            close(destfd);
+            destfd = -1;
+        }
+    }
+
     if (destfd == -1)
     {
         perror("Error opening destination file");
@@ -72,13 +336,205 @@ bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name)
         goto ret;
     }
 
-    char buffer[BUFFER_SIZE];
-    for (int size = read(sourcefd, buffer, BUFFER_SIZE); size != 0; size = read(sourcefd, buffer, BUFFER_SIZE))
-        write(destfd, buffer, size);
+    cipher_file source;
+    cipher_file_plain(&source, sourcefd);
+
+    capture cap;
+    capture_init(&cap, &dest, offset, done);
+    capture* tracked = consistent != NULL ? &cap : NULL;
+
+    uint32_t checksum = resume != NULL ? resume->crc : 0;
+    long long remaining = buf.st_size - offset - done;
+
+    // large files are copied in chunks, each checkpointed once it is on disk
+    while (return_code && remaining > JOURNAL_CHECKPOINT_SIZE)
+    {
+        done += JOURNAL_CHECKPOINT_SIZE;
+        remaining -= JOURNAL_CHECKPOINT_SIZE;
+        return_code = copy_fd(&source, &dest, JOURNAL_CHECKPOINT_SIZE, &checksum, tracked) && cipher_file_sync(&dest) &&
+                      journal_checkpoint(dst_dir, file_name, done, checksum);
+    }
+
+    if (!return_code || !copy_fd(&source, &dest, -1, &checksum, tracked))
+    {
+        perror("Error copying file");
+        return_code = false;
+    }
+
+    // a file written while it was copied may be stored torn
+    if (return_code && tracked)
+    {
+        cap.crc = checksum;
+        return_code = capture_check(sourcefd, &buf, &cap, 1, CopyLimits) && !cap.failed;
+        checksum = cap.crc;
+        *consistent = cap.consistent;
+    }
+
+    capture_free(&cap);
+
+    if (crc)
+        *crc = checksum;
+
+    if (!cipher_file_close(&dest) && return_code)
+    {
+        perror("Error writing destination file");
+        return_code = false;
+    }
 
 ret:
     if (sourcefd != -1) close(sourcefd);
+
+    return return_code;
+}
+
+bool path_join(char* path, const char* dir, const char* name)
+{
+    assert(path);
+    assert(dir);
+    assert(name);
+
+    if (snprintf(path, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    return true;
+}
+
+bool make_parent_dirs(const char* path)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    // copies run in parallel, so another process may create a directory first
+    for (char* slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(dir, 0775) != 0 && errno != EEXIST)
+        {
+            perror(dir);
+            return false;
+        }
+        *slash = '/';
+    }
+
+    return true;
+}
+
+bool copy_file_segments(const file_segment* segments, int count, const char* dst_dir, const char* file_name, long long mtime)
+{
+    char dst_file_name[PATH_MAX];
+    if (!path_join(dst_file_name, dst_dir, file_name))
+    {
+        fprintf(stderr, "Could not restore %s/%s (%s).\n", dst_dir, file_name, strerror(errno));
+        return false;
+    }
+
+    char temp_file_name[PATH_MAX + 16];
+    snprintf(temp_file_name, sizeof(temp_file_name), "%s.rstr-%d", dst_file_name, (int)getpid());
+
+    int destfd = -1;
+    bool return_code = false;
+
+    for (int i = 0; i < count; ++i)
+    {
+        char src_file_name[PATH_MAX];
+
+        // the versions are stored encrypted, the restored file as it is
+        cipher_file source;
+        int sourcefd = path_join(src_file_name, segments[i].dir, file_name) ? open(src_file_name, O_RDONLY) : -1;
+        if (sourcefd < 0 || !cipher_file_open(&source, sourcefd))
+        {
+            perror("Error opening source file");
+            if (sourcefd >= 0) close(sourcefd);
+            break;
+        }
+
+        if (destfd == -1) // the permissions are the ones of the first version
+        {
+            struct stat buf;
+            if (fstat(sourcefd, &buf) == 0)
+            {
+                destfd = open(temp_file_name, O_CREAT | O_TRUNC | O_WRONLY, buf.st_mode);
+                if (destfd == -1 && errno == ENOENT && make_parent_dirs(temp_file_name)) // file in a subdirectory
+                    destfd = open(temp_file_name, O_CREAT | O_TRUNC | O_WRONLY, buf.st_mode);
+            }
+
+            if (destfd == -1)
+            {
+                perror("Error opening destination file");
+                cipher_file_close(&source);
+                return false;
+            }
+        }
+
+        cipher_file dest;
+        cipher_file_plain(&dest, destfd);
+
+        long long length = i + 1 < count ? segments[i + 1].offset - segments[i].offset : -1;
+        bool copied = copy_fd(&source, &dest, length, NULL, NULL);
+        cipher_file_close(&source);
+
+        if (!copied)
+        {
+            perror("Error copying file");
+            break;
+        }
+
+        return_code = i + 1 == count;
+    }
+
+    if (return_code && mtime >= 0)
+    {
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1].tv_sec = mtime / 1000000000LL;
+        times[1].tv_nsec = mtime % 1000000000LL;
+
+        if (futimens(destfd, times) != 0)
+            perror("Error setting modification time");
+    }
+
     if (destfd != -1) close(destfd);
 
+    if (return_code && rename(temp_file_name, dst_file_name) != 0)
+    {
+        perror("Error renaming destination file");
+        return_code = false;
+    }
+
+    if (!return_code)
+        unlink(temp_file_name);
+
     return return_code;
 }
+
+void fork_copy_file_segments(const file_segment* segments, int count, const char* dst_dir, const char* file_name, long long mtime)
+{
+    take_copy_slot();
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        _exit(copy_file_segments(segments, count, dst_dir, file_name, mtime) ? 0 : 1);
+    }
+    else if (pid > 0)
+        RunningCopies++;
+    else
+        give_copy_slot();
+}
+
+bool set_idle_io_priority(void)
+{
+    // with IOPRIO_WHO_PROCESS, 0 is the calling thread
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+    {
+        perror("ioprio_set");
+        return false;
+    }
+
+    return true;
+}
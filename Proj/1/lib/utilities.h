@@ -3,7 +3,14 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <semaphore.h>
+
+#include "throttle.h"
+#include "journal.h"
+#include "fanout.h"
 
 /** @defgroup utilities utilities
  * @{
@@ -26,6 +33,9 @@
 /// Time format for the name of the backup subdirectories
 #define BACKUP_FOLDER_NAME_FORMAT "%Y_%m_%d_%H_%M_%S"
 
+/// Length of the name of a backup subdirectory (see BACKUP_FOLDER_NAME_FORMAT)
+#define BACKUP_FOLDER_NAME_LENGTH 19
+
 /**
  * Converts an iteration number to the corresponding folder name,
  *  using start time and delta time between iterations
@@ -38,21 +48,137 @@
 void iter_to_folder(int iter, const char* dst, time_t startTime, int dt, char** name);
 
 /**
- * Copy file between two directories
- * @param  src_dir  Source directory name
- * @param  dst_dir  Destination directory name
+ * Converts the name of a backup subdirectory back to the time it was named after (see iter_to_folder)
+ * @param  name Folder name, without the destination
+ * @param  time resulting time
+ * @return      true if the name has the BACKUP_FOLDER_NAME_FORMAT format, false otherwise
+ */
+bool folder_to_time(const char* name, time_t* time);
+
+/**
+ * Copy file between two directories. Large files are checkpointed in the journal of
+ *  the destination directory, if it has one (see journal_checkpoint).
+ * @param  src_dir    Source directory name
+ * @param  dst_dir    Destination directory name
+ * @param  file_name  File name of the file to copy
+ * @param  offset     Offset of the first byte to copy (0 copies the whole file)
+ * @param  resume     Last checkpoint of an interrupted copy of the file, continued instead
+ *                    of copying from offset (NULL to copy to a new file)
+ * @param  crc        If not NULL, set to the CRC32C of the copied data
+ * @param  consistent If not NULL, the blocks of the source that changed during the copy are
+ *                    copied again (see capture_check) and it is set to false if the source
+ *                    kept changing, true otherwise
+ * @return            true if successful, false otherwise
+ */
+bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name, off_t offset, const journal_entry* resume,
+               uint32_t* crc, bool* consistent);
+
+/**
+ * Performs a file copy inside a fork'ed process, repairing the blocks of the source that
+ *  changed meanwhile. The checksum of the copied data, and whether it is consistent, is
+ *  added to the copy record of the destination directory (see copy_record_add).
+ * @param  src_dir   Source directory name
+ * @param  dst_dir   Destination directory name
  * @param  file_name File name of the file to copy
- * @return          true if successful, false otherwise
+ * @param  offset    Offset of the first byte to copy (0 copies the whole file)
+ * @param  resume    Last checkpoint of an interrupted copy of the file (NULL for none, see copy_file)
  */
-bool copy_file(const char* src_dir, const char* dst_dir, const char* file_name);
+void fork_copy_file(const char* src_dir, const char* dst_dir, const char* file_name, off_t offset, const journal_entry* resume);
 
 /**
- * Performs a file copy inside a fork'ed process
- * @param  src_dir  Source directory name
- * @param  dst_dir  Destination directory name
+ * Performs a copy of a file to several directories, reading it once (see fanout_copy), inside a
+ *  fork'ed process. The checksum of the data copied to each directory is added to its copy record.
+ * @param  src_dir   Source directory name
+ * @param  targets   Destinations, between 1 and FANOUT_MAX_TARGETS
+ * @param  count     Number of destinations
  * @param  file_name File name of the file to copy
  */
-void fork_copy_file(const char* src_dir, const char* dst_dir, const char* file_name);
+void fork_copy_file_targets(const char* src_dir, fanout_target* targets, int count, const char* file_name);
+
+/**
+ * Part of a file stored in a backup folder. A file that was appended to is
+ *  stored as its first version followed by the tails added in each iteration.
+ */
+typedef struct
+{
+    char* dir; ///< Backup folder where this part is stored
+    long long offset; ///< Offset in the whole file of the first byte stored in this part
+} file_segment;
+
+/**
+ * Joins a directory and a file name into a path
+ * @param  path Resulting path, PATH_MAX bytes
+ * @param  dir  Directory name
+ * @param  name File name, relative to dir
+ * @return      true if successful, false if the path does not fit (errno is set to ENAMETOOLONG)
+ */
+bool path_join(char* path, const char* dir, const char* name);
+
+/**
+ * Creates the missing directories of a path (all but its last component)
+ * @param  path Path of a file
+ * @return      true if successful, false otherwise
+ */
+bool make_parent_dirs(const char* path);
+
+/**
+ * Restores a file by concatenating its segments. Each segment contributes the
+ *  bytes up to the offset of the next one; the last one is copied entirely.
+ *  The file is written to a temporary file and renamed over any existing one.
+ * @param  segments  Segments of the file, by increasing offset (the first must be at 0)
+ * @param  count     Number of segments
+ * @param  dst_dir   Destination directory name
+ * @param  file_name File name of the file to restore
+ * @param  mtime     Modification time to set, in nanoseconds since the epoch (negative to keep the current time)
+ * @return           true if successful, false otherwise
+ */
+bool copy_file_segments(const file_segment* segments, int count, const char* dst_dir, const char* file_name, long long mtime);
+
+/**
+ * Performs copy_file_segments inside a fork'ed process
+ * @param  segments  Segments of the file, by increasing offset (the first must be at 0)
+ * @param  count     Number of segments
+ * @param  dst_dir   Destination directory name
+ * @param  file_name File name of the file to restore
+ * @param  mtime     Modification time to set, in nanoseconds since the epoch (negative to keep the current time)
+ */
+void fork_copy_file_segments(const file_segment* segments, int count, const char* dst_dir, const char* file_name, long long mtime);
+
+/**
+ * Sets the I/O limits of the copies made by the calling process and its children
+ * @param limits     I/O limits, in shared memory so fork'ed copies share them (NULL for none)
+ * @param drop_cache If true, the copied data is dropped from the page cache after each copy
+ */
+void set_copy_io_limits(io_limits* limits, bool drop_cache);
+
+/**
+ * Creates copy slots shared by the calling process and the ones it forks (see set_copy_workers)
+ * @param  count Number of copies that can run at once
+ * @return       The slots, NULL on errors
+ */
+sem_t* copy_slots_create(int count);
+
+/**
+ * Limits the copies made at once by the calling process and its children. Forking a copy
+ *  waits for one of its own copies to finish when max are running, then for a free slot.
+ * @param slots Slots shared with other processes, a copy holds one until it is waited for (NULL for none)
+ * @param max   Maximum number of copies of this process at once, 0 for no limit
+ */
+void set_copy_workers(sem_t* slots, int max);
+
+/**
+ * Waits until less than max copies started with fork_copy_file or fork_copy_file_segments are running
+ * @param  max Maximum number of running copies, 1 waits for all of them
+ * @return     Number of copies that failed (exited with an error or were killed) since the previous call
+ */
+int wait_copies(int max);
+
+/**
+ * Lowers the I/O priority of the calling thread to the idle class, so its
+ *  disk accesses are only served when no other process needs the disk
+ * @return true if successful, false otherwise
+ */
+bool set_idle_io_priority(void);
 
 /**@}*/
 
@@ -4,7 +4,6 @@
 #include <assert.h>
 #include <string.h>
 
-#define DEFAULT_CAPACITY 10
 #define CAPACITY_RATE 1.5f
 
 void vector_new(vector* v)
@@ -37,24 +36,33 @@ int vector_capacity(const vector* v)
     return v->capacity;
 }
 
-void vector_push_back(vector* v, void* data)
+void vector_reserve(vector* v, int capacity)
 {
     assert(v);
-    assert(data);
 
-    if (!v->capacity)
-    {
-        v->capacity = DEFAULT_CAPACITY;
-        v->buffer = (void**)malloc(v->capacity * sizeof(void*));
-        memset(v->buffer, 0, v->capacity * sizeof(void*));
-    }
+    if (capacity <= v->capacity)
+        return;
+
+    v->capacity = capacity;
+    v->buffer = (void**)realloc(v->buffer, v->capacity * sizeof(void*));
+    assert(v->buffer);
+}
 
+/**
+ * Makes room for one more element
+ */
+static void grow(vector* v)
+{
     if (v->capacity == v->count)
-    {
-        v->capacity *= CAPACITY_RATE;
-        v->buffer = (void**)realloc(v->buffer, v->capacity * sizeof(void*));
-        assert(v->buffer);
-    }
+        vector_reserve(v, v->capacity < VECTOR_DEFAULT_CAPACITY ? VECTOR_DEFAULT_CAPACITY : v->capacity * CAPACITY_RATE);
+}
+
+void vector_push_back(vector* v, void* data)
+{
+    assert(v);
+    assert(data);
+
+    grow(v);
 
     v->buffer[v->count] = data;
     v->count++;
@@ -64,17 +72,11 @@ void vector_insert(vector* v, void* data, int index)
 {
     assert(v);
     assert(index >= 0);
-    assert(index < v->count);
+    assert(index <= v->count);
 
-    if (v->capacity == v->count + 1)
-    {
-        v->capacity *= CAPACITY_RATE;
-        v->buffer = realloc(v->buffer, v->capacity * sizeof(void*));
-        assert(v->buffer);
-    }
+    grow(v);
 
-    for (int i = v->count; i >= index; --i)
-        v->buffer[i + 1] = v->buffer[i];
+    memmove(v->buffer + index + 1, v->buffer + index, (v->count - index) * sizeof(void*));
 
     v->buffer[index] = data;
     v->count++;
@@ -95,10 +97,8 @@ void vector_erase(vector* v, int index)
     assert(index >= 0);
     assert(index < v->count);
 
-    if (index != v->count -1)
-        for (int i = index; i < v->count - 1; ++i)
-            v->buffer[i] = v->buffer[i+1];
+    memmove(v->buffer + index, v->buffer + index + 1, (v->count - index - 1) * sizeof(void*));
 
     v->buffer[v->count - 1] = NULL;
-    v->count --;
+    v->count--;
 }
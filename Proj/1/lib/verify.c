@@ -0,0 +1,366 @@
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "fileinfo.h"
+#include "copyrecord.h"
+#include "parity.h"
+#include "hash.h"
+#include "throttle.h"
+#include "utilities.h"
+
+/**
+ * A stored file to check
+ */
+typedef struct
+{
+    char* path; ///< Path of the stored file
+    int name_offset; ///< Offset of its name (relative to the folder) in path
+    long long size; ///< Size in the backup info (the stored data differs if the file changed before it was copied)
+    uint32_t crc; ///< Expected CRC32C
+} verify_job;
+
+/**
+ * Bounded queue of jobs shared by the workers
+ */
+typedef struct
+{
+    pthread_mutex_t lock; ///< Protects the queue and result
+    pthread_mutex_t repair_lock; ///< Held while a folder is repaired, so the blocks shared by files are rebuilt once
+    bool repair; ///< Corrupt and missing files are rebuilt from parity
+    pthread_cond_t not_empty; ///< Signaled when a job is added or done is set
+    pthread_cond_t not_full; ///< Signaled when a job is taken
+    verify_job jobs[VERIFY_QUEUE_SIZE]; ///< Circular buffer of jobs
+    int head; ///< Index of the oldest job
+    int count; ///< Number of jobs in the queue
+    bool done; ///< No more jobs will be added
+    throttle io; ///< Shared read rate limit
+    verify_result* result; ///< Counters
+} verify_pool;
+
+/**
+ * Reads a stored file and computes its checksum
+ * @return 0 if successful, 1 if it could not be opened, EOF if it could not be decrypted or
+ *         read to its end (an error is printed)
+ */
+static int read_file(verify_pool* pool, const char* path, char* buffer, uint32_t* crc, long long* size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    // a damaged header or authentication tag (EBADMSG) is damaged data, not a missing file
+    cipher_file file;
+    if (!cipher_file_open(&file, fd))
+    {
+        perror(path);
+        close(fd);
+        return EOF;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ssize_t count;
+    bool failed = false;
+
+    for (;;)
+    {
+        throttle_take(&pool->io, VERIFY_BUFFER_SIZE);
+
+        count = cipher_file_read(&file, buffer, VERIFY_BUFFER_SIZE);
+        if (count <= 0)
+        {
+            failed = count < 0;
+            break;
+        }
+
+        *crc = hash_crc32c(*crc, buffer, count);
+        *size += count;
+    }
+
+    // do not evict the page cache of the foreground work
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    cipher_file_close(&file);
+
+    if (failed)
+    {
+        perror(path);
+        return EOF;
+    }
+
+    return 0;
+}
+
+/**
+ * Rebuilds the damaged blocks of a stored file from the parity set of its folder
+ * @return true if nothing was lost, false otherwise
+ */
+static bool repair_file(verify_pool* pool, const verify_job* job)
+{
+    char* folder = strndup(job->path, job->name_offset - 1);
+    parity_result result;
+    memset(&result, 0, sizeof(result));
+
+    pthread_mutex_lock(&pool->repair_lock);
+    int repaired = parity_repair_file(folder, job->path + job->name_offset, NULL, &result);
+    pthread_mutex_unlock(&pool->repair_lock);
+
+    if (repaired == 1)
+        fprintf(stderr, "%s is not in a parity set, it can not be repaired.\n", job->path);
+
+    free(folder);
+    return repaired == 0;
+}
+
+/**
+ * Reads a stored file and compares it with its job, repairing it if it does not match
+ */
+static void check_file(verify_pool* pool, const verify_job* job, char* buffer)
+{
+    uint32_t crc = 0;
+    long long size = 0;
+    int status = read_file(pool, job->path, buffer, &crc, &size);
+    bool missing = status == 1;
+    bool corrupt = status == EOF || (status == 0 && crc != job->crc);
+
+    if (status == EOF)
+        fprintf(stderr, "corrupt: %s (unreadable after %lld bytes; expected %lld bytes, crc32c %08" PRIx32 ")\n",
+                job->path, size, job->size, job->crc);
+    else if (corrupt)
+        fprintf(stderr, "corrupt: %s (%lld bytes, crc32c %08" PRIx32 "; expected %lld bytes, crc32c %08" PRIx32 ")\n",
+                job->path, size, crc, job->size, job->crc);
+
+    // read again once rebuilt, the parity only knows the data it was computed from
+    bool repaired = false;
+    if ((missing || corrupt) && pool->repair && repair_file(pool, job))
+    {
+        crc = 0;
+        size = 0;
+        repaired = read_file(pool, job->path, buffer, &crc, &size) == 0 && crc == job->crc;
+        fprintf(stderr, "%s: %s\n", repaired ? "repaired" : "not repaired", job->path);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->result->bytes += size;
+    if (missing)
+        pool->result->missing++;
+    else
+    {
+        pool->result->files++;
+        if (corrupt)
+            pool->result->corrupt++;
+    }
+    if (repaired)
+        pool->result->repaired++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Worker thread: checks jobs until the queue is empty and done
+ */
+static void* worker(void* arg)
+{
+    verify_pool* pool = arg;
+    char* buffer = malloc(VERIFY_BUFFER_SIZE);
+
+    set_idle_io_priority();
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        while (pool->count == 0 && !pool->done)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+
+        if (pool->count == 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        verify_job job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % VERIFY_QUEUE_SIZE;
+        pool->count--;
+
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        check_file(pool, &job, buffer);
+        free(job.path);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Adds a job to the queue, waiting while it is full
+ */
+static void push_job(verify_pool* pool, const verify_job* job)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->count == VERIFY_QUEUE_SIZE)
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+
+    pool->jobs[(pool->head + pool->count) % VERIFY_QUEUE_SIZE] = *job;
+    pool->count++;
+
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Queues the files stored in an iteration folder
+ * @return false if the backup info of the folder could not be read
+ */
+static bool queue_folder(verify_pool* pool, const char* folder)
+{
+    char info_path[PATH_MAX + 16];
+    snprintf(info_path, sizeof(info_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+
+    FILE* info = cipher_fopen(info_path, "r");
+    int iter;
+
+    if (info == NULL || backup_info_read_header(info, &iter) == EOF)
+    {
+        fprintf(stderr, "backup_info_read failed (%s).\n", info_path);
+        if (info != NULL)
+            fclose(info);
+        return false;
+    }
+
+    copy_record record;
+    copy_record_read(folder, &record);
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    while (file_info_read(info, &fi) != EOF)
+    {
+        // only the files changed in this iteration are stored in its folder
+        if (fi.iter != iter || (fi.state != STATE_ADDED && fi.state != STATE_MODIFIED && fi.state != STATE_APPENDED))
+            continue;
+
+        const copy_record_entry* entry = copy_record_find(&record, fi.file_name);
+        if (entry == NULL)
+        {
+            pthread_mutex_lock(&pool->lock);
+            pool->result->unchecked++;
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        verify_job job;
+        job.path = malloc(strlen(folder) + strlen(fi.file_name) + 2);
+        sprintf(job.path, "%s/%s", folder, fi.file_name);
+        job.name_offset = strlen(folder) + 1;
+
+        // its checksum matches what was stored, which may mix several versions of the file
+        if (!entry->consistent)
+        {
+            fprintf(stderr, "inconsistent: %s (changed while it was copied)\n", job.path);
+            pthread_mutex_lock(&pool->lock);
+            pool->result->inconsistent++;
+            pthread_mutex_unlock(&pool->lock);
+        }
+        job.size = fi.state == STATE_APPENDED ? fi.size - fi.base_size : fi.size;
+        job.crc = entry->crc;
+
+        push_job(pool, &job);
+    }
+
+    file_info_free(&fi);
+    copy_record_free(&record);
+    fclose(info);
+
+    return true;
+}
+
+bool verify_store(backup_store* store, const verify_options* options, verify_result* result)
+{
+    assert(store);
+    assert(options && options->threads > 0);
+    assert(result);
+
+    memset(result, 0, sizeof(verify_result));
+
+    verify_pool pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_mutex_init(&pool.repair_lock, NULL);
+    pool.repair = options->repair;
+    pthread_cond_init(&pool.not_empty, NULL);
+    pthread_cond_init(&pool.not_full, NULL);
+    pool.head = 0;
+    pool.count = 0;
+    pool.done = false;
+    pool.result = result;
+    throttle_init(&pool.io, options->rate);
+
+    pthread_t* threads = malloc(options->threads * sizeof(pthread_t));
+    int started = 0;
+
+    for (; started < options->threads; ++started)
+        if (pthread_create(&threads[started], NULL, worker, &pool) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+
+    bool success = started > 0;
+
+    for (int i = 0; success && i < store->count; ++i)
+    {
+        char* folder = store_folder_path(store, i);
+
+        // the parity is only read by repairs, it is checked while the files of the previous folders are
+        if (pool.repair)
+        {
+            parity_result parity;
+            memset(&parity, 0, sizeof(parity));
+
+            pthread_mutex_lock(&pool.repair_lock);
+            parity_repair_folder(folder, NULL, &parity);
+            pthread_mutex_unlock(&pool.repair_lock);
+
+            if (parity.damaged > 0)
+                fprintf(stderr, "%s: %lld damaged block(s) in the parity set, %lld rebuilt.\n", folder, parity.damaged,
+                        parity.repaired);
+        }
+
+        if (!queue_folder(&pool, folder))
+            success = false;
+        free(folder);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.done = true;
+    pthread_cond_broadcast(&pool.not_empty);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    throttle_destroy(&pool.io);
+    pthread_cond_destroy(&pool.not_full);
+    pthread_cond_destroy(&pool.not_empty);
+    pthread_mutex_destroy(&pool.repair_lock);
+    pthread_mutex_destroy(&pool.lock);
+
+    return success && result->corrupt + result->missing == result->repaired;
+}
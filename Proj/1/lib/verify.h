@@ -0,0 +1,60 @@
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include <stdbool.h>
+
+#include "store.h"
+
+/** @defgroup verify verify
+ * @{
+ * Scrubbing of the data of a backup store against its copy records.
+ *
+ * The stored files are read by a pool of threads with idle I/O priority,
+ * sharing a token bucket that bounds the total read rate, and their
+ * CRC32C is compared with the one recorded when they were copied. Damaged
+ * files can be rebuilt from the parity set of their folder (see parity).
+ */
+
+/// Number of bytes read at a time (and taken from the token bucket)
+#define VERIFY_BUFFER_SIZE (1024 * 1024)
+
+/// Maximum number of files waiting for a worker
+#define VERIFY_QUEUE_SIZE 256
+
+/**
+ * Options of a verification
+ */
+typedef struct
+{
+    int threads; ///< Number of worker threads
+    double rate; ///< Maximum number of bytes read per second, 0 for unlimited
+    bool repair; ///< Corrupt and missing files are rebuilt from the parity set of their folder
+} verify_options;
+
+/**
+ * Counters of a verification
+ */
+typedef struct
+{
+    long long files; ///< Stored files checked
+    long long bytes; ///< Bytes read
+    long long corrupt; ///< Files whose checksum does not match, or that could not be decrypted or read to their end
+    long long missing; ///< Files that could not be opened
+    long long unchecked; ///< Stored files without a recorded checksum (not read)
+    long long inconsistent; ///< Stored files recorded as changing while they were copied (checked like the others)
+    long long repaired; ///< Corrupt or missing files rebuilt from the parity set of their folder (with repair)
+} verify_result;
+
+/**
+ * Verifies every file stored in the iteration folders of a store. Files that do
+ *  not match, and the ones stored inconsistent, are reported on stderr.
+ * @param  store   backup_store struct. Must not be NULL.
+ * @param  options Options of the verification. Must not be NULL.
+ * @param  result  verify_result struct to fill. Must not be NULL.
+ * @return         true if every checked file matched or was repaired, false otherwise
+ */
+bool verify_store(backup_store* store, const verify_options* options, verify_result* result);
+
+/**@}*/
+
+#endif
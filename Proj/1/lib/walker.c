@@ -0,0 +1,609 @@
+#include "walker.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "backupinfo.h"
+#include "cipher.h"
+#include "namesort.h"
+#include "hash.h"
+#include "utilities.h"
+
+/// Directories modified less than this before the scan started are listed again next time (timestamps are coarse)
+#define WALKER_RACY_NS 1000000000LL
+
+/**
+ * Directory being listed, the context of walker_selector
+ */
+typedef struct
+{
+    walker* w; ///< Walker listing it
+    const char* key; ///< Path of the directory relative to the root, followed by '/' ("" for the root)
+} walker_listing;
+
+/**
+ * Checks if an entry of the directory being listed is one of the excluded directories
+ *  (a mount point is caught by open_level instead, its d_ino is the one of the directory under it)
+ */
+static bool is_excluded_dir(const walker_listing* listing, const struct dirent* file)
+{
+    const walker* w = listing->w;
+
+    for (int i = 0; i < w->excluded; ++i)
+        if (file->d_ino == w->exclude_ino[i])
+        {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s%s", w->root, listing->key, file->d_name);
+
+            struct stat buf;
+            return stat(path, &buf) == 0 && buf.st_dev == w->exclude_dev[i] && buf.st_ino == w->exclude_ino[i];
+        }
+
+    return false;
+}
+
+/**
+ * Selects regular files and directories (other than "." and ".."), unless they are excluded, their
+ *  path is too long or their name holds a newline, which the manifests can not hold (the listed
+ *  entries must be the ones walked, a reused listing is checked against their number)
+ */
+static int walker_selector(const struct dirent* file, void* context)
+{
+    int selected = 0;
+
+    if (file->d_type == DT_REG)
+        selected = 1;
+    else if (file->d_type == DT_DIR && strcmp(file->d_name, ".") != 0 && strcmp(file->d_name, "..") != 0)
+        selected = SCANNER_DIRECTORY;
+
+    walker_listing* listing = context;
+    walker* w = listing->w;
+
+    if (selected == SCANNER_DIRECTORY && is_excluded_dir(listing, file))
+        return 0;
+
+    // never stored truncated
+    if (selected != 0 && w->max_name > 0 && strlen(listing->key) + strlen(file->d_name) > w->max_name)
+    {
+        fprintf(stderr, "%s/%s%s: path too long, it is skipped.\n", w->root, listing->key, file->d_name);
+        return 0;
+    }
+
+    // the manifests hold a path per line
+    if (selected != 0 && strchr(file->d_name, '\n') != NULL)
+    {
+        fprintf(stderr, "%s/%s%s: name with a newline, it is skipped.\n", w->root, listing->key, file->d_name);
+        return 0;
+    }
+
+    if (selected == 0 || w->rules == NULL)
+        return selected;
+
+    size_t key_length = strlen(listing->key);
+    size_t length = key_length + strlen(file->d_name) + 1;
+    if (length > w->rule_path_size)
+    {
+        w->rule_path_size = length * 2;
+        w->rule_path = realloc(w->rule_path, w->rule_path_size);
+    }
+
+    memcpy(w->rule_path, listing->key, key_length);
+    strcpy(w->rule_path + key_length, file->d_name);
+
+    return rule_set_excludes(w->rules, w->rule_path, selected == SCANNER_DIRECTORY) ? 0 : selected;
+}
+
+/**
+ * Hash of the rules of a scan, the one of an empty rule set if there are none
+ */
+static uint64_t rules_hash(const rule_set* rules)
+{
+    return rules != NULL ? rules->hash : HASH_FNV1A_INIT;
+}
+
+/**
+ * Reads the hash of the rules of the previous scan from the start of its directory record
+ *  (scans without rules have none, the stream is then left at its start)
+ */
+static uint64_t prev_rules_hash(walker* w)
+{
+    unsigned long long hash;
+
+    if (getline(&w->prev_line, &w->prev_line_size, w->prev_dirs) > 0 && sscanf(w->prev_line, "rules %llx", &hash) == 1)
+        return hash;
+
+    rewind(w->prev_dirs);
+    return HASH_FNV1A_INIT;
+}
+
+/**
+ * Reads the next live entry of the previous backup info
+ */
+static void advance_prev_fi(walker* w)
+{
+    do
+        w->prev_fi_valid = w->prev_info != NULL && file_info_read(w->prev_info, &w->prev_fi) != EOF;
+    while (w->prev_fi_valid && w->prev_fi.state == STATE_REMOVED);
+}
+
+/**
+ * Reads the next entry of the previous directory record
+ */
+static void advance_prev_dir(walker* w)
+{
+    free(w->prev_dir.key);
+    w->prev_dir.key = NULL;
+    w->prev_dir_valid = false;
+
+    if (w->prev_dirs == NULL)
+        return;
+
+    ssize_t length = getline(&w->prev_line, &w->prev_line_size, w->prev_dirs);
+    int key_start = 0;
+
+    if (length <= 0 || sscanf(w->prev_line, "%lld %llu %d%n", &w->prev_dir.mtime, &w->prev_dir.ino,
+                              &w->prev_dir.entries, &key_start) != 3 || w->prev_line[key_start] != ' ')
+        return;
+
+    w->prev_line[length - 1] = '\0';
+    w->prev_dir.key = strdup(w->prev_line + key_start + 1);
+    w->prev_dir_valid = true;
+}
+
+/**
+ * Skips the previous directory records up to the one of a directory that is not scanned, so a
+ *  reused parent does not return it again
+ */
+static void skip_prev_dir(walker* w, const char* key)
+{
+    while (w->prev_dir_valid && name_compare(w->prev_dir.key, key) <= 0)
+        advance_prev_dir(w);
+}
+
+/**
+ * Returns the next entry of a reused directory: a file name, or a directory name followed by '/'
+ *  (NULL if there are no more). Both previous streams are in the order of the scan, so entries
+ *  of subdirectories that were listed instead of reused are simply skipped.
+ */
+static const char* reused_next(walker* w, walker_level* level)
+{
+    size_t key_length = strlen(level->key);
+
+    for (;;)
+    {
+        const char* file = w->prev_fi_valid ? w->prev_fi.file_name : NULL;
+        const char* dir = w->prev_dir_valid ? w->prev_dir.key : NULL;
+        bool is_file = file != NULL && (dir == NULL || name_compare(file, dir) < 0);
+        const char* next = is_file ? file : dir;
+
+        if (next == NULL)
+            return NULL;
+
+        if (strncmp(next, level->key, key_length) != 0)
+        {
+            if (name_compare(next, level->key) > 0)
+                return NULL;
+
+            // left behind by a directory that was scanned before this one
+            if (is_file)
+                advance_prev_fi(w);
+            else
+                advance_prev_dir(w);
+            continue;
+        }
+
+        const char* rest = next + key_length;
+        const char* slash = strchr(rest, '/');
+
+        if (is_file && slash == NULL)
+        {
+            size_t length = strlen(rest) + 1;
+            if (length > w->name_size)
+            {
+                w->name_size = length * 2;
+                w->name = realloc(w->name, w->name_size);
+            }
+
+            // the name is read by the caller after the entry is consumed
+            memcpy(w->name, rest, length);
+            advance_prev_fi(w);
+            return w->name;
+        }
+
+        if (!is_file && slash != NULL && slash[1] == '\0')
+            return rest; // consumed when the directory is opened
+
+        // in a subdirectory of this one
+        if (is_file)
+            advance_prev_fi(w);
+        else
+            advance_prev_dir(w);
+    }
+}
+
+/**
+ * Checks if a file of the previous backup info would not be returned by a scan with the current
+ *  rules and path limit
+ * @param  path       Path of the file relative to the root
+ * @param  key_length Length of the path of the directory it is carried from (whose entries were selected)
+ */
+static bool carried_excluded(walker* w, const char* path, size_t key_length)
+{
+    size_t length = strlen(path);
+    if (w->max_name > 0 && length > w->max_name)
+        return true;
+
+    if (w->rules == NULL)
+        return false;
+
+    if (length + 1 > w->rule_path_size)
+    {
+        w->rule_path_size = (length + 1) * 2;
+        w->rule_path = realloc(w->rule_path, w->rule_path_size);
+    }
+
+    strcpy(w->rule_path, path);
+
+    // the directories under the carried one, then the file
+    for (char* slash = strchr(w->rule_path + key_length, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        bool excluded = rule_set_excludes(w->rules, w->rule_path, true);
+        *slash = '/';
+
+        if (excluded)
+            return true;
+    }
+
+    return rule_set_excludes(w->rules, w->rule_path, false);
+}
+
+/**
+ * Returns the next file of a directory that could not be listed, taken from the previous backup info:
+ *  its path relative to the directory, in a subdirectory or not (NULL if there are no more)
+ */
+static const char* carried_next(walker* w, walker_level* level)
+{
+    size_t key_length = strlen(level->key);
+
+    for (; w->prev_fi_valid; advance_prev_fi(w))
+    {
+        const char* file = w->prev_fi.file_name;
+
+        if (strncmp(file, level->key, key_length) != 0)
+        {
+            if (name_compare(file, level->key) > 0)
+                return NULL;
+
+            continue; // left behind by a directory that was scanned before this one
+        }
+
+        if (carried_excluded(w, file, key_length))
+            continue;
+
+        size_t length = strlen(file + key_length) + 1;
+        if (length > w->name_size)
+        {
+            w->name_size = length * 2;
+            w->name = realloc(w->name, w->name_size);
+        }
+
+        // the name is read by the caller after the entry is consumed
+        memcpy(w->name, file + key_length, length);
+        advance_prev_fi(w);
+        return w->name;
+    }
+
+    return NULL;
+}
+
+/**
+ * Adds the level of a subdirectory that could not be listed. Its files are carried from the previous
+ *  backup info, so they are not seen as removed; on a first scan there is none and they are skipped.
+ *  It is recorded to be listed again, so a reused parent still returns it.
+ * @param key  Path of the directory relative to the root, followed by '/'
+ * @param path Path of the directory
+ * @param ino  Inode of the directory (0 if unknown)
+ */
+static void carry_level(walker* w, const char* key, const char* path, unsigned long long ino)
+{
+    if (w->dirs_out != NULL)
+        fprintf(w->dirs_out, "0 %llu 0 %s\n", ino, key);
+
+    if (w->prev_info == NULL)
+    {
+        fprintf(stderr, "Could not scan %s, it is skipped.\n", path);
+        return;
+    }
+
+    fprintf(stderr, "Could not scan %s, its files are kept from the previous iteration.\n", path);
+
+    walker_level* level = walker_level_vector_emplace(&w->levels, walker_level_vector_size(&w->levels));
+    level->key = strdup(key);
+    level->entries = 0;
+    level->expected = 0;
+    level->reused = false;
+    level->carried = true;
+}
+
+/**
+ * Starts scanning a directory, reusing its previous contents if it did not change. A subdirectory
+ *  that can not be listed is carried (see carry_level).
+ * @param  key Path of the directory relative to the root, followed by '/' ("" for the root)
+ * @return     true if successful (or the directory is excluded, removed or carried), false otherwise
+ */
+static bool open_level(walker* w, const char* key)
+{
+    size_t key_length = strlen(key);
+    size_t size = strlen(w->root) + key_length + 2;
+    char* path = malloc(size);
+    snprintf(path, size, "%s/%.*s", w->root, (int)(key_length ? key_length - 1 : 0), key);
+
+    struct stat buf;
+    if (stat(path, &buf) != 0)
+    {
+        int error = errno;
+        perror(path);
+        skip_prev_dir(w, key);
+
+        // a subdirectory removed since its parent was listed has no more files
+        if (*key != '\0' && error != ENOENT && error != ENOTDIR)
+            carry_level(w, key, path, 0);
+
+        free(path);
+        return *key != '\0';
+    }
+
+    for (int i = 0; i < w->excluded; ++i)
+        if (buf.st_dev == w->exclude_dev[i] && buf.st_ino == w->exclude_ino[i])
+        {
+            skip_prev_dir(w, key);
+            free(path);
+            return true;
+        }
+
+    // nothing else is added to levels while this one is filled
+    walker_level* level = walker_level_vector_emplace(&w->levels, walker_level_vector_size(&w->levels));
+    level->key = strdup(key);
+    level->entries = 0;
+    level->expected = 0;
+    level->reused = false;
+    level->carried = false;
+
+    bool success = true;
+    walker_dir record;
+    record.key = level->key;
+    record.mtime = buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec;
+    record.ino = buf.st_ino;
+
+    while (w->prev_dir_valid && name_compare(w->prev_dir.key, key) < 0)
+        advance_prev_dir(w);
+
+    if (w->prev_dir_valid && strcmp(w->prev_dir.key, key) == 0)
+    {
+        level->reused = w->prev_dir.mtime != 0 && w->prev_dir.mtime == record.mtime && w->prev_dir.ino == record.ino;
+        level->expected = w->prev_dir.entries;
+        advance_prev_dir(w);
+    }
+
+    if (level->reused)
+    {
+        record.entries = level->expected;
+        w->reused++;
+    }
+    else
+    {
+        walker_listing listing = { w, key };
+        success = scanner_open(&level->files, path, walker_selector, &listing, w->mem_budget) == 0;
+
+        record.entries = level->files.count;
+        w->listed++;
+
+        // changes made in the same timestamp tick as the listing would go unnoticed
+        if (record.mtime >= w->started - WALKER_RACY_NS)
+            record.mtime = 0;
+    }
+
+    if (!success)
+    {
+        scanner_close(&level->files);
+        free(level->key);
+        walker_level_vector_erase(&w->levels, walker_level_vector_size(&w->levels) - 1);
+
+        if (*key != '\0')
+            carry_level(w, key, path, buf.st_ino);
+        else
+            fprintf(stderr, "Could not scan %s.\n", path);
+
+        free(path);
+        return *key != '\0';
+    }
+
+    if (w->dirs_out != NULL)
+        fprintf(w->dirs_out, "%lld %llu %d %s\n", record.mtime, record.ino, record.entries, record.key);
+
+    free(path);
+    return true;
+}
+
+/**
+ * Stops scanning the innermost directory
+ */
+static void close_level(walker* w)
+{
+    int top = walker_level_vector_size(&w->levels) - 1;
+    walker_level* level = walker_level_vector_get(&w->levels, top);
+
+    if (level->reused && level->entries != level->expected)
+        fprintf(stderr, "The previous record of %s/%s does not match its backup info.\n", w->root, level->key);
+
+    if (!level->reused && !level->carried)
+        scanner_close(&level->files);
+
+    free(level->key);
+    walker_level_vector_erase(&w->levels, top);
+}
+
+int walker_open(walker* w, const char* root, const char* prev, FILE* dirs_out, const char* const* excludes, int exclude_count,
+                const rule_set* rules, size_t mem_budget, size_t max_name)
+{
+    assert(w);
+    assert(root);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    w->root = strdup(root);
+    w->mem_budget = mem_budget;
+    w->started = now.tv_sec * 1000000000LL + now.tv_nsec;
+    w->excluded = 0;
+    w->rules = rules;
+    w->max_name = max_name;
+    w->rule_path = NULL;
+    w->rule_path_size = 0;
+    w->name = NULL;
+    w->name_size = 0;
+    w->carried = false;
+    w->prev_info = NULL;
+    w->prev_fi_valid = false;
+    w->prev_dirs = NULL;
+    w->prev_dir.key = NULL;
+    w->prev_dir_valid = false;
+    w->prev_line = NULL;
+    w->prev_line_size = 0;
+    w->dirs_out = dirs_out;
+    w->listed = 0;
+    w->reused = 0;
+    walker_level_vector_new(&w->levels);
+    file_info_new(&w->prev_fi, NULL);
+
+    for (int i = 0; i < exclude_count; ++i)
+        walker_exclude(w, excludes[i]);
+
+    if (dirs_out != NULL && rules_hash(rules) != HASH_FNV1A_INIT)
+        fprintf(dirs_out, "rules %016llx\n", (unsigned long long)rules_hash(rules));
+
+    if (prev != NULL)
+    {
+        char path[PATH_MAX + 16];
+        snprintf(path, sizeof(path), "%s/%s", prev, WALKER_DIRS_NAME);
+        w->prev_dirs = cipher_fopen(path, "r"); // iterations backed up before directories were recorded have none
+
+        // the previous contents were selected by other rules
+        if (w->prev_dirs != NULL && prev_rules_hash(w) != rules_hash(rules))
+        {
+            fclose(w->prev_dirs);
+            w->prev_dirs = NULL;
+        }
+
+        // also read to carry the directories that can not be listed
+        snprintf(path, sizeof(path), "%s/%s", prev, BACKUP_FILE_INFO_NAME);
+        int iter;
+        if ((w->prev_info = cipher_fopen(path, "r")) == NULL || backup_info_read_header(w->prev_info, &iter) == EOF)
+        {
+            fprintf(stderr, "Could not read the previous backup info %s.\n", path);
+            return 1;
+        }
+
+        advance_prev_fi(w);
+        advance_prev_dir(w);
+    }
+
+    return open_level(w, "") ? 0 : 1;
+}
+
+bool walker_exclude(walker* w, const char* dir)
+{
+    assert(w);
+    assert(dir);
+
+    struct stat buf;
+    if (stat(dir, &buf) != 0)
+        return true;
+
+    if (w->excluded == WALKER_MAX_EXCLUDED)
+        return false;
+
+    w->exclude_dev[w->excluded] = buf.st_dev;
+    w->exclude_ino[w->excluded] = buf.st_ino;
+    w->excluded++;
+    return true;
+}
+
+const char* walker_next(walker* w)
+{
+    assert(w);
+
+    while (walker_level_vector_size(&w->levels) > 0)
+    {
+        walker_level* level = walker_level_vector_get(&w->levels, walker_level_vector_size(&w->levels) - 1);
+        const char* entry;
+        if (level->reused)
+            entry = reused_next(w, level);
+        else if (level->carried)
+            entry = carried_next(w, level);
+        else
+            entry = scanner_next(&level->files);
+
+        if (entry == NULL)
+        {
+            close_level(w);
+            continue;
+        }
+
+        level->entries++;
+
+        size_t key_length = strlen(level->key);
+        size_t length = key_length + strlen(entry) + 1;
+        char* full = malloc(length);
+        memcpy(full, level->key, key_length);
+        strcpy(full + key_length, entry);
+
+        if (full[length - 2] == '/')
+        {
+            open_level(w, full);
+            free(full);
+            continue;
+        }
+
+        if (length > w->name_size)
+        {
+            w->name_size = length * 2;
+            w->name = realloc(w->name, w->name_size);
+        }
+
+        memcpy(w->name, full, length);
+        free(full);
+        w->carried = level->carried;
+        return w->name;
+    }
+
+    return NULL;
+}
+
+void walker_close(walker* w)
+{
+    assert(w);
+
+    while (walker_level_vector_size(&w->levels) > 0)
+        close_level(w);
+
+    walker_level_vector_free(&w->levels);
+    file_info_free(&w->prev_fi);
+    free(w->prev_dir.key);
+    free(w->prev_line);
+    free(w->name);
+    free(w->rule_path);
+    free(w->root);
+
+    if (w->prev_info != NULL)
+        fclose(w->prev_info);
+    if (w->prev_dirs != NULL)
+        fclose(w->prev_dirs);
+}
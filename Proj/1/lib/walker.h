@@ -0,0 +1,146 @@
+#ifndef WALKER_H_
+#define WALKER_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "vector.h"
+#include "scanner.h"
+#include "fileinfo.h"
+#include "rules.h"
+
+/** @defgroup walker walker
+ * @{
+ * Recursive sorted scan of a directory tree.
+ *
+ * Regular files are returned with their path relative to the root, in the
+ * byte order of the whole path (the order of backup infos), so the scan can
+ * be merged with the previous backup info.
+ *
+ * Each directory scanned is recorded ("<mtime> <inode> <entries> <path>/",
+ * in the same order) in a file of the iteration folder. When a directory
+ * has the same mtime and inode as in the previous iteration, its contents
+ * are taken from the previous backup info and directory record instead of
+ * being listed again; the files in it are still stat'ed by the caller.
+ *
+ * A subdirectory that can not be listed (e.g. EACCES, EMFILE) does not
+ * look empty: its files, in its subdirectories too, are taken from the
+ * previous backup info and flagged as carried, so the caller keeps their
+ * previous versions. It is listed again by the next scan.
+ *
+ * Entries excluded by the rules of the scan are dropped while a directory
+ * is listed, so excluded directories are never opened. The record of a scan
+ * with rules starts with their hash ("rules <hash>"), and nothing is reused
+ * from a previous scan with different rules.
+ */
+
+/// File name of the directory record of an iteration folder
+#define WALKER_DIRS_NAME "__bckpdirs__"
+
+/// Maximum number of directories excluded from a scan
+#define WALKER_MAX_EXCLUDED 8
+
+/**
+ * Recorded state of a directory
+ */
+typedef struct
+{
+    char* key; ///< Path of the directory relative to the root, followed by '/' ("" for the root)
+    long long mtime; ///< Last modification time of the directory, in nanoseconds (0 if it must be listed again)
+    unsigned long long ino; ///< Inode of the directory
+    int entries; ///< Number of files and directories in it
+} walker_dir;
+
+/**
+ * Directory being scanned
+ */
+typedef struct
+{
+    char* key; ///< Path of the directory relative to the root, followed by '/' ("" for the root)
+    bool reused; ///< Entries come from the previous iteration instead of a listing
+    bool carried; ///< Could not be listed, its files (in subdirectories too) come from the previous backup info
+    scanner files; ///< Listing of the directory, if not reused
+    int entries; ///< Number of entries returned so far
+    int expected; ///< Number of entries recorded in the previous iteration, if reused
+} walker_level;
+
+/// Vector of walker_level values, the levels of most trees are stored inline
+VECTOR_DEFINE(walker_level_vector, walker_level, 8)
+
+/**
+ * Holds the state of a recursive scan
+ */
+typedef struct
+{
+    char* root; ///< Root directory
+    size_t mem_budget; ///< Memory budget of each directory listing (see scanner_open)
+    long long started; ///< Time the scan started, in nanoseconds
+    int excluded; ///< Number of directories excluded from the scan
+    dev_t exclude_dev[WALKER_MAX_EXCLUDED]; ///< Devices of the excluded directories
+    ino_t exclude_ino[WALKER_MAX_EXCLUDED]; ///< Inodes of the excluded directories
+    const rule_set* rules; ///< Include and exclude rules (NULL for none)
+    size_t max_name; ///< Longest path returned, longer ones are reported and skipped (0 for no limit)
+    char* rule_path; ///< Path of the entry checked against the rules
+    size_t rule_path_size; ///< Allocated size of rule_path
+    walker_level_vector levels; ///< Directories being scanned, from the root
+    char* name; ///< Current path returned by walker_next
+    size_t name_size; ///< Allocated size of name
+    bool carried; ///< The current path was taken from the previous backup info, as its directory could not be listed
+    FILE* prev_info; ///< Previous backup info, positioned after prev_fi (NULL if none)
+    file_info prev_fi; ///< Next live entry of prev_info
+    bool prev_fi_valid; ///< prev_fi holds an entry
+    FILE* prev_dirs; ///< Previous directory record (NULL if none)
+    walker_dir prev_dir; ///< Next entry of prev_dirs
+    bool prev_dir_valid; ///< prev_dir holds an entry
+    char* prev_line; ///< Line buffer used to read prev_dirs
+    size_t prev_line_size; ///< Allocated size of prev_line
+    FILE* dirs_out; ///< Where the directory record is written (NULL if not recorded)
+    int listed; ///< Number of directories listed
+    int reused; ///< Number of directories taken from the previous iteration
+} walker;
+
+/**
+ * Starts a recursive scan
+ * @param  w             walker struct to initialize. Must not be NULL.
+ * @param  root          Directory to scan
+ * @param  prev          Previous iteration folder, whose backup info and directory record are reused (NULL if none).
+ *                       Its backup info must be readable.
+ * @param  dirs_out      Where the directory record of this scan is written (NULL if not recorded)
+ * @param  excludes      Directories skipped by the scan, e.g. the backup destinations (NULL if none)
+ * @param  exclude_count Number of excludes, at most WALKER_MAX_EXCLUDED
+ * @param  rules         Include and exclude rules of the scan, kept until walker_close (NULL for none)
+ * @param  mem_budget    Memory budget of each directory listing (see scanner_open)
+ * @param  max_name      Longest path returned, longer ones are reported and skipped (0 for no limit)
+ * @return               0 upon success, different otherwise (the root or the previous backup info could not be read).
+ */
+int walker_open(walker* w, const char* root, const char* prev, FILE* dirs_out, const char* const* excludes, int exclude_count,
+                const rule_set* rules, size_t mem_budget, size_t max_name);
+
+/**
+ * Excludes another directory from a scan, e.g. another backup destination. The
+ *  directories already scanned are not affected.
+ * @param  w   walker struct. Must not be NULL.
+ * @param  dir Directory skipped by the scan
+ * @return     true if successful (or dir does not exist), false if too many directories are excluded
+ */
+bool walker_exclude(walker* w, const char* dir);
+
+/**
+ * Returns the path of the next regular file, relative to the root, in byte order (see name_compare).
+ *  Sets carried if it was taken from the previous backup info.
+ * @param  w walker struct. Must not be NULL.
+ * @return   Next path (valid until the next call) or NULL if there are no more files
+ */
+const char* walker_next(walker* w);
+
+/**
+ * Releases resources allocated by the walker
+ * @param w walker struct. Must not be NULL.
+ */
+void walker_close(walker* w);
+
+/**@}*/
+
+#endif
@@ -7,14 +7,36 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include <semaphore.h>
+#include <limits.h>
 
 #include "vector.h"
 #include "utilities.h"
 #include "backupinfo.h"
 #include "fileinfo.h"
+#include "namesort.h"
+#include "walker.h"
+#include "dedup.h"
+#include "copyrecord.h"
+#include "hash.h"
+#include "store.h"
+#include "replicate.h"
+#include "verify.h"
+#include "merkle.h"
+#include "control.h"
+#include "journal.h"
+#include "iterstats.h"
+#include "estimate.h"
+#include "history.h"
+#include "fanout.h"
+#include "parity.h"
+#include "cipher.h"
 
 /** @defgroup backup backup
  * @{
@@ -22,7 +44,97 @@
  */
 
 static bool Executing = true; ///< Boolean to know if backup is running or not
-static time_t InitIterTime; ///< Backup initial time
+static size_t MemoryBudget = 0; ///< Maximum number of bytes of file names kept in memory while scanning, 0 for unbounded
+static rule_set* Rules = NULL; ///< Include and exclude rules of the scans of every source, NULL if none
+static int ParityData = 0; ///< Data shards of the parity set of each iteration folder, 0 for none
+static int ParityShards = 0; ///< Parity shards of the parity set of each iteration folder
+static io_limits* Limits = NULL; ///< I/O limits shared by every source, or those of the source of the iteration being done
+static const char* LimitsPath = NULL; ///< File the limits are read from, again on SIGHUP (NULL if none)
+static volatile sig_atomic_t ReloadLimits = false; ///< SIGHUP was received
+
+/// Default number of copies (and of iterations) running at once
+#define DEFAULT_WORKERS 8
+
+/// Number of recorded iterations compared with by bckp estimate
+#define ESTIMATE_HISTORY 5
+
+/**
+ * Progress of the last iteration of a source, in memory shared with the process scheduling the iterations
+ */
+typedef struct
+{
+    int iteration; ///< Last iteration started
+    char phase; ///< 's' while it scans, 'c' while it stores the files, 'd' when done
+    long long scanned; ///< Files found by its scan so far
+    long long changed; ///< Entries added, modified, appended or removed so far
+    long long stored; ///< Files stored or being stored (copied or linked)
+} backup_progress;
+
+/**
+ * Schedule replaced by a now command: iterations before end started at init_time + iter * dt
+ */
+typedef struct
+{
+    int end; ///< First iteration of the next schedule
+    time_t init_time; ///< Backup initial time of this schedule
+} schedule_epoch;
+
+/**
+ * Directory backed up to a destination, with its schedule
+ */
+typedef struct
+{
+    char* src; ///< Directory to backup
+    vector dsts; ///< vector<char*>, destinations of the backup, written from a single scan and a single read of each file
+    int dt; ///< Delta time in seconds between each iteration
+    time_t init_time; ///< Backup initial time, in the current schedule
+    vector epochs; ///< vector<schedule_epoch*>, schedules replaced by now commands, oldest first
+    int iteration; ///< Last iteration started or skipped, -1 if none
+    pid_t pid; ///< Process doing the running iteration, 0 if none
+    bool run_now; ///< The next iteration starts without waiting for its time (now command)
+    bool failed; ///< An iteration failed, no more are started
+    int workers; ///< Maximum number of copies of the source at once
+    io_limits* limits; ///< I/O limits of the source, whose parent are the shared ones
+    backup_progress* progress; ///< Progress of the last iteration (shared with its process)
+} backup_source;
+
+/**
+ * Destination written by an iteration, with its own backup info compared with its own previous iteration
+ */
+typedef struct
+{
+    const char* dst; ///< Destination of the backup
+    char prev_dir[PATH_MAX]; ///< Folder of its previous iteration, empty if none (full backup)
+    FILE* prev; ///< Stream of the backup_info of prev_dir, NULL if none
+    file_info prev_fi; ///< Next entry of prev, while scanning
+    bool prev_has_files; ///< prev_fi holds an entry
+    time_t prev_time; ///< Time the previous iteration started
+    char info_path[PATH_MAX]; ///< Path of the new backup_info, moved into the new folder by commit_iteration
+    FILE* info; ///< Stream of info_path
+    backup_info_writer writer; ///< Writer of info, while scanning
+    char dirs_path[PATH_MAX]; ///< Path of the new directory record, moved into the new folder by commit_iteration
+    bool altered; ///< Files were added, modified or removed since its previous iteration
+    char* folder; ///< New iteration folder, NULL until it is created
+    file_info fi; ///< Next entry of info to store, while storing
+    bool has_fi; ///< fi holds an entry
+    dedup_index index; ///< Content index, while storing
+    vector deferred; ///< vector<char*>, files linked once the copies are done (see store_duplicate)
+    iteration_stats stats; ///< Statistics of the iteration in this destination
+} backup_target;
+
+static vector Sources; ///< vector<backup_source*>, sources backed up, in the order they were given
+static int NextSource = 0; ///< Source whose due iteration is started first, so they take turns when workers are busy
+static int Workers = DEFAULT_WORKERS; ///< Maximum number of copies, and of iterations, running at once
+static sem_t* CopySlots = NULL; ///< Copy slots shared by every iteration
+static bool DropCache = false; ///< Drop the copied files from the page cache
+static backup_progress* Progress = NULL; ///< Progress of the iteration done by this process
+static const char* ControlPath = NULL; ///< Path of the control socket, CONTROL_SOCKET_NAME in the destination of the first source if not given
+static int ControlFd = -1; ///< Listening control socket, -1 if none
+static bool Paused = false; ///< Scheduled iterations are skipped (pause command)
+static bool Stopping = false; ///< No more iterations are started, the running ones are waited for (stop command)
+static struct timespec StatsTime; ///< Time of the previous stats command (or of the start)
+static long long StatsBytes = 0; ///< Bytes transferred at StatsTime
+static long long StatsOps = 0; ///< I/O operations done at StatsTime
 
 /**
  * Returns the modification of the file with name $file in directory $dir
@@ -33,16 +145,35 @@ static time_t InitIterTime; ///< Backup initial time
 time_t get_file_last_modified_time(const char* dir, const char* file);
 
 /**
- * Selector used in scandir to select regular files
- * @param  file Dirent
- * @return      Returns 1 if dirent is a regular file, 0 otherwise
+ * Sets the size, modification time and tail hash of a file_info from the current contents of the file (with the same name) in $dir.
+ *  The stored data is the whole file (no base).
+ * @param  dir Name of the directory
+ * @param  fi  file_info struct with the file name. Must not be NULL.
+ * @return     true if successful, false if the file could not be read
+ */
+bool describe_file(const char* dir, file_info* fi);
+
+/**
+ * Checks if a file only grew since its previous version: it is bigger and the
+ *  last bytes of the previous version are still there
+ * @param  dir     Name of the directory
+ * @param  fi      Current file_info, already described (describe_file)
+ * @param  prev_fi file_info of the previous version
+ * @return         true if the file was only appended to, false otherwise
+ */
+bool is_append(const char* dir, const file_info* fi, const file_info* prev_fi);
+
+/**
+ * Copies the size, modification time, tail hash and base of the stored data from one file_info to another (the name is not copied)
+ * @param dest   Destination file_info. Must not be NULL.
+ * @param source Source file_info. Must not be NULL.
  */
-int regular_file_selector(const struct dirent* file);
+void copy_stored_data(file_info* dest, const file_info* source);
 
 /**
- * Selector used in scandir to select directories
+ * Selector used in scandir to select iteration folders
  * @param  file Dirent
- * @return      Returns 1 if dirent is a directory, 0 otherwise
+ * @return      Returns 1 if dirent is an iteration folder, 0 otherwise
  */
 int folder_selection(const struct dirent* file);
 
@@ -52,6 +183,56 @@ int folder_selection(const struct dirent* file);
  */
 void print_usage(bool err);
 
+/**
+ * Entry point of "bckp send": writes a replication stream of a backup destination to stdout
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code
+ */
+int send_main(int argc, char* argv[]);
+
+/**
+ * Entry point of "bckp receive": applies a replication stream read from stdin to a backup destination
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code
+ */
+int receive_main(int argc, char* argv[]);
+
+/**
+ * Entry point of "bckp verify": checks the stored data of a backup destination against its checksums
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code
+ */
+int verify_main(int argc, char* argv[]);
+
+/**
+ * Entry point of "bckp diff": lists the entries that differ between two iterations, possibly of different
+ *  backup destinations, descending only into the subtrees of their Merkle trees that differ
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code (EXIT_SUCCESS if the iterations are equal, 1 if they differ, 2 on errors)
+ */
+int diff_main(int argc, char* argv[]);
+
+/**
+ * Entry point of "bckp ctl": sends a command to the control socket of a running backup and prints the reply
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code (EXIT_SUCCESS if the command succeeded, 1 if it failed, 2 on errors)
+ */
+int ctl_main(int argc, char* argv[]);
+
+/**
+ * Entry point of "bckp estimate": estimates the cost of backing up a tree from random samples of it,
+ *  short throughput probes and the statistics of the iterations already done to a destination
+ * @param  argc Number of arguments (after "bckp")
+ * @param  argv Array of arguments (after "bckp")
+ * @return Program exit status code
+ */
+int estimate_main(int argc, char* argv[]);
+
 /**
  * Handles SIGUSR1 signal, used when we want to halt the backup process
  * @param signo Signal number, hopefully SIGUSR1
@@ -65,16 +246,188 @@ void sigusr1_handler(int signo);
 void sigchild_handler(int signo);
 
 /**
- * Function used to create backups, comparing two backup_infos
- * @param  src       Directory to be backup'ed
- * @param  dst       Destination of the backup
- * @param  prev      Previous backup_info state (can be NULL, 1st iteration)
- * @param  curr      Return backup_info state
- * @param  init_time Time of the first backup
- * @param  dt        Delta time in seconds between each iteration
- * @return           true if successful, false otherwise
+ * Handles SIGHUP signal, used to reload the I/O limits from LimitsPath
+ * @param signo Signal number
+ */
+void sighup_handler(int signo);
+
+/**
+ * Reads the I/O limits from LimitsPath and applies them to the running copies and the next iterations
+ * @return true if successful, false otherwise (the limits are kept)
+ */
+bool reload_limits(void);
+
+/**
+ * Creates a source, checking its arguments, and creates its destinations if needed
+ * @param  src       Directory to backup
+ * @param  dsts      Destinations of the backup, not used by another source
+ * @param  dst_count Number of destinations, at most FANOUT_MAX_TARGETS
+ * @param  dtstr     Delta time in seconds between each iteration
+ * @param  rate      Maximum bytes per second of the source, 0 for no limit besides the shared one
+ * @param  workers   Maximum number of copies of the source at once, 0 for Workers
+ * @return           The source, NULL if an argument is not valid (an error is printed)
+ */
+backup_source* source_new(const char* src, const char* const* dsts, int dst_count, const char* dtstr, double rate,
+                          int workers);
+
+/**
+ * Reads the sources of a configuration file into Sources. Each line has a source directory, one
+ *  or more destinations and an interval in seconds (the first number), optionally followed by
+ *  "rate <MiB/s>" and "workers <n>"; empty lines and lines starting with '#' are ignored.
+ * @param  path Path of the file
+ * @return      true if successful, false otherwise (an error is printed)
+ */
+bool read_config(const char* path);
+
+/**
+ * Does an iteration of a source: scans it once and stores the changes in a new folder of each of
+ *  its destinations. A destination that fails does not stop the others.
+ * @param  source    Source to backup
+ * @param  iteration Iteration to do
+ * @return           Exit status code of the process doing it (EXIT_FAILURE if every destination failed)
+ */
+int run_iteration(backup_source* source, int iteration);
+
+/**
+ * Prepares a destination for an iteration: finishes its last iteration if it was interrupted,
+ *  opens the backup_info of its previous iteration and creates its new backup_info
+ * @param  source Source to backup
+ * @param  target backup_target struct to initialize, with its destination set
+ * @param  iter   Current iteration
+ * @return        1 if the destination is scanned, 0 if its interrupted iteration was finished instead, -1 on errors
+ */
+int open_target(const backup_source* source, backup_target* target, int iter);
+
+/**
+ * Starts an iteration of a source in a new process
+ * @param source    Source to backup
+ * @param iteration Iteration to do
+ */
+void start_iteration(backup_source* source, int iteration);
+
+/**
+ * Starts the iterations that are due, as long as there are workers for them
+ * @return true if an iteration requested by a now command waits for the next second, false otherwise
+ */
+bool schedule_iterations(void);
+
+/**
+ * Returns the number of iterations running
+ */
+int running_iterations(void);
+
+/**
+ * Returns the time an iteration of a source started, taking into account the schedules replaced by now commands
+ * @param  source Source
+ * @param  iter   Iteration
+ * @return        Start time of the iteration
+ */
+time_t iteration_time(const backup_source* source, int iter);
+
+/**
+ * Continues the numbering of the iterations of a source from the last one in its destinations, which
+ *  keeps the time its folder is named after, so the first scan compares with the times of the files
+ * @param source Source, whose destinations may have iterations of a previous run
+ */
+void resume_schedule(backup_source* source);
+
+/**
+ * Reaps the iterations that finished, without waiting for the others. A source whose iteration
+ *  failed is not backed up anymore.
+ * @return false if waitpid failed, true otherwise
+ */
+bool reap_iterations(void);
+
+/**
+ * Serves the clients waiting on the control socket
+ */
+void serve_control(void);
+
+/**
+ * Writes the state of the backup and the progress and throughput counters of every source to a client of the control socket
+ * @param fd File descriptor of the client
+ */
+void write_stats(int fd);
+
+/**
+ * Function used to create backups, comparing the previous backup_info of each destination with the
+ *  source directory tree, which is scanned once. They are streamed (merge join) so memory usage is
+ *  bounded by MemoryBudget (per directory). Sets the altered flag of each destination.
+ * @param  source    Source to backup (its destinations are skipped if they are inside it)
+ * @param  targets   Destinations, with their previous and new backup_info streams (see open_target)
+ * @param  count     Number of destinations
+ * @param  dirs      Stream where the directories scanned are recorded (see walker_open)
+ * @param  iter      Current iteration
+ * @return           true upon success, false if the source could not be scanned or a previous
+ *                   backup_info could not be read (nothing is then written to the new ones)
+ */
+bool backup(const backup_source* source, backup_target* targets, int count, FILE* dirs, int iter);
+
+/**
+ * Creates the folder of an iteration in each destination that changed, moves its backup_info there
+ *  and stores the added and modified files, copying each one once to all the destinations that
+ *  need it (see fork_copy_file_targets)
+ * @param  source  Source backed up
+ * @param  targets Destinations scanned by backup(), with their scan statistics, which are completed
+ *                 with those of the copies and recorded in the folders
+ * @param  count   Number of destinations
+ * @param  iter    Current iteration
+ * @return         Number of destinations that failed
+ */
+int commit_iteration(const backup_source* source, backup_target* targets, int count, int iter);
+
+/**
+ * Finishes an iteration that was interrupted while its files were stored (its folder has a journal),
+ *  copying the files missing from its copy record. Large files are resumed from their last checkpoint.
+ *  A folder left before its backup_info was moved in is removed.
+ * @param  source Source backed up
+ * @param  dst    Destination of the folder
+ * @param  folder Iteration folder
+ * @return        0 if the iteration was finished, 1 if the folder was removed, -1 on errors
+ */
+int resume_iteration(const backup_source* source, const char* dst, const char* folder);
+
+/**
+ * Marks the sizes shared by several files stored by an iteration as worth checksumming
+ * @param source Stream of the backup_info of the iteration, positioned after the header
+ * @param index  Content index of the destination
+ */
+void mark_duplicate_sizes(FILE* source, dedup_index* index);
+
+/**
+ * Stores a whole file as a hardlink to identical contents stored before, if the content index has them
+ * @param  src      Directory to be backup'ed
+ * @param  dst      Destination of the backup
+ * @param  folder   Folder of the current iteration
+ * @param  fi       Entry of the file
+ * @param  index    Content index of the destination; the file is added to it if it is not a duplicate
+ * @param  deferred vector<char*>, names of the files that duplicate contents still being copied in this
+ *                  iteration, linked by link_deferred once the copies are done
+ * @param  crc      Checksum of the file, read once for every destination: computed if *hashed is false
+ * @param  hashed   Whether crc was computed, set once it is
+ * @return          true if the file is (or will be) stored, false if it has to be copied
+ */
+bool store_duplicate(const char* src, const char* dst, const char* folder, const file_info* fi, dedup_index* index,
+                     vector* deferred, uint32_t* crc, bool* hashed);
+
+/**
+ * Hardlinks a file of the current iteration to identical stored contents, after comparing them
+ * @param  src    Directory to be backup'ed
+ * @param  dst    Destination of the backup
+ * @param  folder Folder of the current iteration
+ * @param  name   Name of the file
+ * @param  stored Path of the stored contents, relative to dst
+ * @return        true if the file was linked, false if it has to be copied
+ */
+bool link_stored(const char* src, const char* dst, const char* folder, const char* name, const char* stored);
+
+/**
+ * Copies a manifest of a backup destination to another one (each is encrypted on its own, see cipher_fopen)
+ * @param  source Path of the manifest
+ * @param  dest   Path of the copy
+ * @return        true if successful, false otherwise (an error is printed)
  */
-bool backup(const char* src, const char* dst, backup_info* prev, backup_info* curr, time_t init_time, int dt);
+bool copy_manifest(const char* source, const char* dest);
 
 /**
 * Entry point to this program
@@ -90,44 +443,152 @@ int main(int argc, char* argv[])
         print_usage(false);
         return EXIT_SUCCESS;
     }
-    else if (argc != 4)
+
+    if (argc >= 2 && strcmp(argv[1], "send") == 0)
+        return send_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "receive") == 0)
+        return receive_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0)
+        return verify_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "diff") == 0)
+        return diff_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "ctl") == 0)
+        return ctl_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "estimate") == 0)
+        return estimate_main(argc - 1, argv + 1);
+
+    double bytes_rate = 0, ops_rate = 0;
+    bool idle = false;
+    const char* config_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:o:L:idc:w:f:x:p:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+        {
+            int mem_mb = atoi(optarg);
+            if (mem_mb <= 0)
+            {
+                fprintf(stderr, "<mem> (%s) needs to be a valid integer higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            MemoryBudget = (size_t)mem_mb * 1024 * 1024;
+            break;
+        }
+        case 'r':
+            bytes_rate = atof(optarg) * 1024 * 1024;
+            if (bytes_rate <= 0)
+            {
+                fprintf(stderr, "<rate> (%s) needs to be a valid number higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            ops_rate = atof(optarg);
+            if (ops_rate <= 0)
+            {
+                fprintf(stderr, "<ops> (%s) needs to be a valid number higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            LimitsPath = optarg;
+            break;
+        case 'i':
+            idle = true;
+            break;
+        case 'd':
+            DropCache = true;
+            break;
+        case 'c':
+            ControlPath = optarg;
+            break;
+        case 'w':
+            Workers = atoi(optarg);
+            if (Workers <= 0)
+            {
+                fprintf(stderr, "<workers> (%s) needs to be a valid integer higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            config_path = optarg;
+            break;
+        case 'x':
+            if (Rules == NULL)
+            {
+                Rules = malloc(sizeof(rule_set));
+                rule_set_new(Rules);
+            }
+            if (!rule_set_load(Rules, optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'p':
+            if (sscanf(optarg, "%d+%d", &ParityData, &ParityShards) != 2 || ParityData < 1 || ParityShards < 1
+                || ParityData + ParityShards > PARITY_MAX_SHARDS)
+            {
+                fprintf(stderr, "<k+m> (%s) needs to be two valid integers higher than 0, adding up to at most %d.\n",
+                        optarg, PARITY_MAX_SHARDS);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'k':
+            if (!cipher_load_key(optarg))
+                return EXIT_FAILURE;
+            break;
+        default:
+            print_usage(true);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the destinations are between the source and the interval
+    if (config_path != NULL ? argc - optind != 0 : argc - optind < 3)
     {
         print_usage(true);
         return EXIT_FAILURE;
     }
 
-    char* srcdirstr = argv[1];
-    char* destdirstr = argv[2];
-    const char* dtstr = argv[3];
+    if (LimitsPath != NULL && !io_limits_read(LimitsPath, &bytes_rate, &ops_rate))
+        return EXIT_FAILURE;
+
+    // the buckets are created even without limits, they count the I/O reported by the stats command
+    if ((Limits = io_limits_create(bytes_rate, ops_rate)) == NULL)
+        return EXIT_FAILURE;
 
-    int srcdirstrLen = strlen(srcdirstr);
-    if (srcdirstr[srcdirstrLen - 1] == '/')
-        srcdirstr[srcdirstrLen - 1] = '\0';
+    if ((CopySlots = copy_slots_create(Workers)) == NULL)
+        return EXIT_FAILURE;
 
-    int destdirstrLen = strlen(destdirstr);
-    if (destdirstr[destdirstrLen - 1] == '/')
-        destdirstr[destdirstrLen - 1] = '\0';
+    vector_new(&Sources);
 
-    int dt = atoi(dtstr); // atoi returns 0 if conversion is not successful
-    if (dt == 0)
+    if (config_path != NULL)
     {
-        fprintf(stderr, "<dt> (%s) needs to be a valid integer higher than 0.\n", dtstr);
-        return EXIT_FAILURE;
+        if (!read_config(config_path))
+            return EXIT_FAILURE;
     }
-
-    if (strcmp(srcdirstr, destdirstr) == 0)
+    else
     {
-        fprintf(stderr, "Cannot do backups to the same directory.\n");
-        return EXIT_FAILURE;
+        backup_source* source = source_new(argv[optind], (const char* const*)argv + optind + 1, argc - optind - 2,
+                                           argv[argc - 1], 0, 0);
+        if (source == NULL)
+            return EXIT_FAILURE;
+
+        vector_push_back(&Sources, source);
     }
 
-    DIR* srcdir = opendir(srcdirstr);
-    if (srcdir == NULL)
+    int count = vector_size(&Sources);
+    if (count == 0)
     {
-        fprintf(stderr, "Could not open directory %s (%s).\n", srcdirstr, strerror(errno));
+        fprintf(stderr, "No source to backup in %s.\n", config_path);
         return EXIT_FAILURE;
     }
 
+    // inherited by the iterations and their copies
+    if (idle && !set_idle_io_priority())
+        perror("ioprio_set");
+
     sigset_t newSigset, oldSigset;
 
     sigemptyset(&newSigset);
@@ -140,340 +601,2175 @@ int main(int argc, char* argv[])
 
     struct sigaction sigusr1_NewSigaction, sigusr1_OldSigaction;
 
+    memset(&sigusr1_NewSigaction, 0, sizeof(sigusr1_NewSigaction));
+    sigemptyset(&sigusr1_NewSigaction.sa_mask);
     sigusr1_NewSigaction.sa_handler = sigusr1_handler;
 
     sigaction(SIGUSR1, &sigusr1_NewSigaction, &sigusr1_OldSigaction);
 
     struct sigaction sigchild_NewSigaction, sigchild_OldSigaction;
 
+    // without SA_RESTART, so a finished iteration interrupts the wait for the next one
+    memset(&sigchild_NewSigaction, 0, sizeof(sigchild_NewSigaction));
+    sigemptyset(&sigchild_NewSigaction.sa_mask);
     sigchild_NewSigaction.sa_handler = sigchild_handler;
 
     sigaction(SIGCHLD, &sigchild_NewSigaction, &sigchild_OldSigaction);
 
-    int iteration = -1;
-    InitIterTime = time(NULL);
-
-    while (Executing) // will be exited when we receive SIGUSR1
-    {
-        pid_t pid = fork();
-        if (pid < 0) // error
-        {
-            fprintf(stderr, "Could not fork process (%s).\n", strerror(errno));
-            return EXIT_FAILURE;
-        }
-        else if (pid == 0) // child
-        {
-            iteration += 1;
-            DIR* destdir = opendir(destdirstr);
-
-            if (iteration == 0) // first run -  full backup
-            {
-
-                if (destdir == NULL)
-                {
-                    if (mkdir(destdirstr, 0775) == 0)
-                    {
-                        destdir = opendir(destdirstr);
-                        if (destdir == NULL)
-                        {
-                            fprintf(stderr, "Could not open directory %s after creation (%s).\n", srcdirstr, strerror(errno));
-                            return EXIT_FAILURE;
-                        }
-                    }
-                    else
-                    {
-                        fprintf(stderr, "Could not create directory %s (%s).\n", destdirstr, strerror(errno));
-                        if (closedir(srcdir) != 0)
-                            fprintf(stderr, "Could not close directory %s (%s).\n", srcdirstr, strerror(errno));
-                        return EXIT_FAILURE;
-                    }
-                }
-
-                backup_info current;
-                backup_info_new(&current);
-                current.iter = iteration;
+    struct sigaction sighup_NewSigaction;
 
-                backup(srcdirstr, destdirstr, NULL, &current, InitIterTime, dt);
+    memset(&sighup_NewSigaction, 0, sizeof(sighup_NewSigaction));
+    sigemptyset(&sighup_NewSigaction.sa_mask);
+    sighup_NewSigaction.sa_handler = sighup_handler;
 
-                char* newFolderPathName = NULL;
-                iter_to_folder(iteration, destdirstr, InitIterTime, dt, &newFolderPathName);
-
-                if (mkdir(newFolderPathName, 0775) != 0)
-                {
-                    perror("mkdir");
-                    free(newFolderPathName);
-                    exit(1);
-                }
+    sigaction(SIGHUP, &sighup_NewSigaction, NULL);
 
-                char newFilePathName[1024];
-                snprintf(newFilePathName, 1024, "%s/%s", newFolderPathName, BACKUP_FILE_INFO_NAME);
+    struct sigaction sigpipe_NewSigaction;
 
-                FILE* newFile = fopen(newFilePathName, "w");
-                if (newFile == NULL)
-                {
-                    perror("New backup file");
-                    free(newFolderPathName);
-                    exit(1);
-                }
-                backup_info_write(newFile, &current);
-                fclose(newFile);
+    // a control client that leaves before its reply must not stop the backup
+    memset(&sigpipe_NewSigaction, 0, sizeof(sigpipe_NewSigaction));
+    sigemptyset(&sigpipe_NewSigaction.sa_mask);
+    sigpipe_NewSigaction.sa_handler = SIG_IGN;
 
-                for (int i = 0; i < vector_size(&current.file_list); ++i)
-                {
-                    file_info* fi = vector_get(&current.file_list, i);
-                    if (fi->state == STATE_ADDED || fi->state == STATE_MODIFIED)
-                        fork_copy_file(srcdirstr, newFolderPathName, fi->file_name);
-                }
+    sigaction(SIGPIPE, &sigpipe_NewSigaction, NULL);
 
-                free(newFolderPathName);
-            }
-            else // N run - incremental backup
-            {
-                if (destdir == NULL)
-                {
-                    fprintf(stderr, "Doing an incremental backup but directory %s does not exist\n", destdirstr);
-                    // kill(getppid(), SIGUSR1); // critical error, interrupt backup process (maybe not required if we check termination child status)
-                    return EXIT_FAILURE;
-                }
+    char control_path[PATH_MAX];
+    if (ControlPath == NULL)
+    {
+        backup_source* first = vector_get(&Sources, 0);
+        snprintf(control_path, sizeof(control_path), "%s/%s", (char*)vector_get(&first->dsts, 0), CONTROL_SOCKET_NAME);
+        ControlPath = control_path;
+    }
 
-                backup_info previous;
-                backup_info current;
+    if ((ControlFd = control_listen(ControlPath)) < 0)
+        return EXIT_FAILURE;
 
-                struct dirent** folders = NULL;
-                int size = scandir(destdirstr, &folders, folder_selection, alphasort);
+    time_t start = time(NULL);
+    for (int i = 0; i < count; ++i)
+    {
+        // the first iterations are spread over the intervals, so the sources do not all scan and copy at once
+        backup_source* source = vector_get(&Sources, i);
+        resume_schedule(source);
+        source->init_time = start + (time_t)source->dt * i / count - (time_t)(source->iteration + 1) * source->dt;
+    }
 
-                char* prev_folder_path_name = folders[size - 1]->d_name;
-                char prev_file_path_name[1024];
-                snprintf(prev_file_path_name, 1024, "%s/%s/%s", destdirstr, prev_folder_path_name, BACKUP_FILE_INFO_NAME);
+    clock_gettime(CLOCK_MONOTONIC, &StatsTime);
 
-                FILE* prev_file = fopen(prev_file_path_name, "r");
-                if (prev_file == NULL)
-                {
-                    perror("Previous backup file");
-                    exit(1);
-                }
+    bool failed = false;
+    while (Executing && !Stopping) // will be exited when we receive SIGUSR1 or a stop command
+    {
+        if (!reap_iterations())
+        {
+            failed = true;
+            break;
+        }
 
-                backup_info_new(&previous);
-                backup_info_read(prev_file, &previous);
-                fclose(prev_file);
+        int active = 0;
+        for (int i = 0; i < count; ++i)
+            active += !((backup_source*)vector_get(&Sources, i))->failed;
 
-                backup_info_new(&current);
-                current.iter = iteration;
+        if (active == 0)
+        {
+            failed = true;
+            break;
+        }
 
-                if (backup(srcdirstr, destdirstr, &previous, &current, InitIterTime, dt))
-                {
-                    char* new_folder_path_name = NULL;
-                    iter_to_folder(iteration, destdirstr, InitIterTime, dt, &new_folder_path_name);
-
-                    if (mkdir(new_folder_path_name, 0775) != 0)
-                    {
-                        perror("mkdir");
-                        free(new_folder_path_name);
-                        exit(1);
-                    }
-
-                    char new_file_path_name[1024];
-                    snprintf(new_file_path_name, 1024, "%s/%s", new_folder_path_name, BACKUP_FILE_INFO_NAME);
-
-                    FILE* newFile = fopen(new_file_path_name, "w");
-                    if (newFile == NULL)
-                    {
-                        perror("New backup file");
-                        exit(1);
-                    }
-
-                    backup_info_write(newFile, &current);
-                    fclose(newFile);
-
-                    for (int i = 0; i < vector_size(&current.file_list); ++i)
-                    {
-                        file_info* fi = vector_get(&current.file_list, i);
-                        if (fi->state == STATE_ADDED || fi->state == STATE_MODIFIED)
-                            fork_copy_file(srcdirstr, new_folder_path_name, fi->file_name);
-                    }
-                }
+        bool waiting = schedule_iterations();
 
-            }
+        // the iterations are due at whole seconds; a finished one interrupts the wait (SIGCHLD)
+        struct pollfd control = { ControlFd, POLLIN, 0 };
+        int ready = poll(&control, 1, waiting ? 100 : 1000);
 
-            return EXIT_SUCCESS;
-        }
-        else // parent
+        if (ready < 0 && errno != EINTR)
         {
+            perror("poll");
+            sleep(1);
+        }
 
-            int sleep_time = dt;
-            while (Executing && sleep_time != 0)
-            {
-                sleep_time = sleep(sleep_time);
-
-                int status_child;
-                pid_t pid_child = waitpid(-1, &status_child, WNOHANG);
-
-                if (pid_child == (pid_t) - 1)
-                {
-                    if (errno != ECHILD)
-                    {
-                        fprintf(stderr, "waitpid failed (%s)\n", strerror(errno));
-                        return EXIT_FAILURE;
-                    }
-                }
-                else if (pid_child > (pid_t) 0)
-                {
-                    if (WEXITSTATUS(status_child) != 0)
-                    {
-                        fprintf(stderr, "Child failed with exit code %d\n", WEXITSTATUS(status_child));
-                        return EXIT_FAILURE;
-                    }
-                }
-            }
-            iteration++;
+        if (ReloadLimits)
+        {
+            ReloadLimits = false;
+            reload_limits();
         }
+
+        if (ready > 0)
+            serve_control();
     }
 
-    return EXIT_SUCCESS;
-}
+    // graceful stop: the running iterations wait for their copies before exiting
+    while (Executing && running_iterations() > 0 && reap_iterations())
+    {
+        struct pollfd control = { ControlFd, POLLIN, 0 };
+        if (poll(&control, 1, 1000) > 0)
+            serve_control();
+    }
 
-void print_usage(bool err)
-{
-    fprintf(err ? stderr : stdout, "Usage: bckp <srcdir> <destdir> <dt> &\n"
-            "  srcdir  - directory to backup;\n"
-            "  destdir - destination of the backup;\n"
-            "  dt      - interval between scannings of srcdir, in seconds.\n");
-}
+    close(ControlFd);
+    unlink(ControlPath);
 
-void sigusr1_handler(int signo)
-{
-    Executing = false;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-void sigchild_handler(int signo)
+void print_usage(bool err)
 {
+    fprintf(err ? stderr : stdout, "Usage: bckp [-m <mem>] [-r <rate>] [-o <ops>] [-L <limits>] [-i] [-d] [-c <socket>] [-w <workers>]\n"
+            "            [-x <rules>] [-p <k+m>] [-k <key>] <srcdir> <destdir>... <dt> | -f <config> &\n"
+            "       bckp send [--from <iter>] [--to <iter>] [-k <key>] <destdir> > stream\n"
+            "       bckp receive [-k <key>] <destdir> < stream\n"
+            "       bckp verify [-j <threads>] [-r <rate>] [-R] [-k <key>] <destdir>\n"
+            "       bckp diff [-q] [-d <dir>] [-k <key>] <destdir> <iter> [<destdir2>] <iter2>\n"
+            "       bckp ctl <destdir|socket> now [<source>]|pause|resume|stats|stop\n"
+            "       bckp estimate [-n <probes>] [-t <seconds>] [-r <rate>] [-x <rules>] [-k <key>] <srcdir> [<destdir>]\n"
+            "  srcdir     - directory to backup;\n"
+            "  destdir    - destination of the backup; with several, srcdir is scanned and\n"
+            "               each changed file is read once for all of them (at most 8);\n"
+            "  dt         - interval between scannings of srcdir, in seconds;\n"
+            "  -m mem     - maximum MiB of file names kept in memory while scanning\n"
+            "               (sorted runs are spilled to temporary files);\n"
+            "  -r rate    - maximum MiB read per second by the scan and the copies;\n"
+            "  -o ops     - maximum I/O operations per second of the scan and the copies;\n"
+            "  -L limits  - file with \"rate <MiB/s>\" and \"ops <n>\" lines, read again on SIGHUP;\n"
+            "  -i         - use the idle I/O priority class;\n"
+            "  -d         - drop the copied files from the page cache;\n"
+            "  -c socket  - path of the control socket (first destdir/__bckpctl__ by default);\n"
+            "  -w workers - maximum number of copies, and of iterations, at once (default 8);\n"
+            "  -f config  - back up the sources of a file of \"<srcdir> <destdir>... <dt>\" lines,\n"
+            "               each optionally followed by \"rate <MiB/s>\" and \"workers <n>\",\n"
+            "               sharing the workers and limits (the socket is in the first destdir);\n"
+            "  -x rules   - file of gitignore-style rules of the entries of every srcdir not\n"
+            "               backed up (excluded directories are not scanned), may be repeated;\n"
+            "  -p k+m     - write a Reed-Solomon parity set of the files stored by each\n"
+            "               iteration: k data shards and m parity shards, any m of which\n"
+            "               can be rebuilt (see verify -R and rstr -R);\n"
+            "  -k key     - encrypt the files stored in every destdir with AES-256-GCM, with\n"
+            "               the 32 bytes (raw or in hexadecimal) of the key file; the other\n"
+            "               commands, and rstr, need the same key to read them;\n"
+            "  send       - write the iterations after --from (all if not given) up to --to\n"
+            "               (the last one if not given) of destdir to stdout;\n"
+            "  receive    - add the iterations of a stream written by send to destdir, which\n"
+            "               must end with the iteration the stream was sent from;\n"
+            "  verify     - check the data stored in destdir against the checksums recorded\n"
+            "               when it was copied, with idle I/O priority;\n"
+            "  -j threads - number of files verified in parallel (default 4);\n"
+            "  -R         - rebuild the damaged files from the parity set of their folder;\n"
+            "               (-r also limits verify, unlimited by default);\n"
+            "  diff       - list the files added (+), removed (-) or changed (/) from iter of\n"
+            "               destdir to iter2 of destdir2 (destdir if not given);\n"
+            "  -q         - only report whether the iterations differ;\n"
+            "  -d dir     - only compare the files under dir;\n"
+            "  ctl        - send a command to the control socket of a running backup: start\n"
+            "               an iteration now (of every source, or of the numbered one), pause\n"
+            "               or resume the scheduled iterations, print progress and throughput\n"
+            "               counters, or stop once the running iterations and their copies\n"
+            "               are done;\n"
+            "  estimate   - estimate the files and bytes of srcdir from random probes, measure\n"
+            "               the disks, and project the time of a first and of a later iteration\n"
+            "               (compared with the last iterations recorded in destdir, if given);\n"
+            "  -n probes  - maximum number of probes (default 2000);\n"
+            "  -t seconds - maximum seconds of sampling, and of each disk probe (default 2);\n"
+            "               (-r also limits the projected copies of estimate, and -x excludes\n"
+            "               the same entries from its probes).\n");
 }
 
-bool backup(const char* src, const char* dst, backup_info* prev, backup_info* curr, time_t init_time, int dt)
+int send_main(int argc, char* argv[])
 {
-    bool altered = false;
-
-    if (!curr)
-        return false;
+    static const struct option options[] =
+    {
+        { "from", required_argument, NULL, 'f' },
+        { "to", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int from_iter = -1, to_iter = -1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:k:", options, NULL)) != -1)
+    {
+        if (opt == 'k')
+        {
+            if (!cipher_load_key(optarg))
+                return EXIT_FAILURE;
+            continue;
+        }
 
-    struct dirent** files;
-    int number_of_files = scandir(src, &files, regular_file_selector, alphasort);
+        int* iter = opt == 'f' ? &from_iter : &to_iter;
 
-    if (!prev)
-    {
-        file_info fi;
-        file_info_new(&fi, "");
-        fi.iter = 0;
-        fi.state = STATE_ADDED;
-        curr->iter = 0;
-        for (int i = 0; i < number_of_files; ++i)
+        if ((opt != 'f' && opt != 't') || sscanf(optarg, "%d", iter) != 1 || *iter < 0)
         {
-            file_info_set_name(&fi, files[i]->d_name);
-            backup_info_add_file(curr, &fi);
+            print_usage(true);
+            return EXIT_FAILURE;
         }
     }
-    else
+
+    if (argc - optind != 1)
     {
-        int prev_number_of_files = vector_size(&prev->file_list);
-        int i = 0, j = 0;
-        time_t prev_backup_time = init_time + prev->iter * dt;
-        file_info fi;
-        file_info_new(&fi, "");
-        while (i < prev_number_of_files && j < number_of_files)
-        {
-            file_info* prev_fi = vector_get(&prev->file_list, i);
-            switch (prev_fi->state)
-            {
-            case STATE_ADDED:
-            case STATE_MODIFIED:
-            case STATE_INALTERED:
-            {
-                int cmp = strcmp(prev_fi->file_name, files[j]->d_name);
+        print_usage(true);
+        return EXIT_FAILURE;
+    }
 
-                if (cmp == 0) // Equal names are considered same file
-                {
-                    if (get_file_last_modified_time(src, files[j]->d_name) > prev_backup_time)
-                        fi.state = STATE_MODIFIED;
-                    else
-                        fi.state = STATE_INALTERED;
-                }
-                else if (cmp > 0)
-                    fi.state = STATE_ADDED;
-                else // cmp < 0
-                    fi.state = STATE_REMOVED;
+    if (isatty(STDOUT_FILENO))
+    {
+        fprintf(stderr, "Refusing to write a replication stream to a terminal.\n");
+        return EXIT_FAILURE;
+    }
 
-                if (fi.state == STATE_REMOVED)
-                    file_info_set_name(&fi, prev_fi->file_name);
-                else
-                    file_info_set_name(&fi, files[j]->d_name);
+    backup_store store;
+    int opened = store_open(&store, argv[optind]);
+    if (opened != 0)
+    {
+        if (opened == 1) // a missing or wrong key is reported once by store_open
+            fprintf(stderr, "Could not open directory %s (%s).\n", argv[optind], strerror(errno));
+        store_close(&store);
+        return EXIT_FAILURE;
+    }
 
-                if (fi.state == STATE_ADDED || fi.state == STATE_MODIFIED)
-                    fi.iter = curr->iter;
-                else
-                    fi.iter = prev_fi->iter;
+    int from = from_iter >= 0 ? store_find_iter(&store, from_iter) : -1;
+    int to = to_iter >= 0 ? store_find_iter(&store, to_iter) : store.count - 1;
 
-                backup_info_add_file(curr, &fi);
+    if ((from_iter >= 0 && from < 0) || (to_iter >= 0 && to < 0) || to < from)
+    {
+        fprintf(stderr, "Could not find the iterations to send in %s.\n", argv[optind]);
+        store_close(&store);
+        return EXIT_FAILURE;
+    }
 
-                i += fi.state != STATE_ADDED;
-                j += fi.state != STATE_REMOVED;
+    bool success = replicate_send(&store, from, to, stdout);
+    store_close(&store);
 
-                if (fi.state != STATE_INALTERED)
-                    altered = true;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-                break;
-            }
-            case STATE_REMOVED:
-            {
-                i += 1;
-                break;
-            }
-            }
-        }
+int verify_main(int argc, char* argv[])
+{
+    verify_options options;
+    options.threads = 4;
+    options.rate = 0;
+    options.repair = false;
 
-        if (i < prev_number_of_files) // Last files were removed
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:Rk:")) != -1)
+    {
+        switch (opt)
         {
-            altered = true;
-            fi.state = STATE_REMOVED;
-
-            for (; i < prev_number_of_files; ++i)
+        case 'j':
+            options.threads = atoi(optarg);
+            if (options.threads <= 0)
             {
-                file_info* prev_fi = vector_get(&prev->file_list, i);
-                file_info_set_name(&fi, prev_fi->file_name);
-                fi.iter = prev_fi->iter;
-
-                backup_info_add_file(curr, &fi);
+                fprintf(stderr, "<threads> (%s) needs to be a valid integer higher than 0.\n", optarg);
+                return EXIT_FAILURE;
             }
-        }
-        else if (j < number_of_files) // Last new files were added
-        {
-            altered = true;
-            fi.state = STATE_ADDED;
-            fi.iter = prev->iter + 1;
-
-            for (; j < number_of_files; ++j)
+            break;
+        case 'r':
+            options.rate = atof(optarg) * 1024 * 1024;
+            if (options.rate <= 0)
             {
-                file_info_set_name(&fi, files[j]->d_name);
-                backup_info_add_file(curr, &fi);
+                fprintf(stderr, "<rate> (%s) needs to be a valid number higher than 0.\n", optarg);
+                return EXIT_FAILURE;
             }
+            break;
+        case 'R':
+            options.repair = true;
+            break;
+        case 'k':
+            if (!cipher_load_key(optarg))
+                return EXIT_FAILURE;
+            break;
+        default:
+            print_usage(true);
+            return EXIT_FAILURE;
         }
     }
-    return altered;
-}
 
-int regular_file_selector(const struct dirent* file)
-{
-    return file->d_type == DT_REG;
-}
+    if (argc - optind != 1)
+    {
+        print_usage(true);
+        return EXIT_FAILURE;
+    }
 
-int folder_selection(const struct dirent* file)
+    backup_store store;
+    int opened = store_open(&store, argv[optind]);
+    if (opened != 0)
+    {
+        if (opened == 1) // a missing or wrong key is reported once by store_open
+            fprintf(stderr, "Could not open directory %s (%s).\n", argv[optind], strerror(errno));
+        store_close(&store);
+        return EXIT_FAILURE;
+    }
+
+    verify_result result;
+    bool success = verify_store(&store, &options, &result);
+    store_close(&store);
+
+    printf("%lld file(s) verified (%.1f MiB), %lld corrupt, %lld missing, %lld without checksum, %lld inconsistent.\n",
+           result.files, result.bytes / (1024.0 * 1024.0), result.corrupt, result.missing, result.unchecked,
+           result.inconsistent);
+    if (options.repair)
+        printf("%lld file(s) repaired.\n", result.repaired);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int receive_main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "k:")) != -1)
+    {
+        if (opt != 'k')
+        {
+            print_usage(true);
+            return EXIT_FAILURE;
+        }
+        if (!cipher_load_key(optarg))
+            return EXIT_FAILURE;
+    }
+
+    if (argc - optind != 1)
+    {
+        print_usage(true);
+        return EXIT_FAILURE;
+    }
+
+    return replicate_receive(argv[optind], stdin) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Prints an entry reported by merkle_diff, if it is under the directory given in data (NULL for all)
+ */
+static void print_change(char change, const file_info* a, const file_info* b, void* data)
+{
+    const char* name = b ? b->file_name : a->file_name;
+    const char* dir = data;
+    size_t length = dir ? strlen(dir) : 0;
+
+    if (dir && (strncmp(name, dir, length) != 0 || name[length] != '/'))
+        return;
+
+    printf("%c %s\n", change, name);
+}
+
+int diff_main(int argc, char* argv[])
+{
+    bool quiet = false;
+    const char* dir = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qd:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            quiet = true;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'k':
+            if (!cipher_load_key(optarg))
+                return 2;
+            break;
+        default:
+            print_usage(true);
+            return 2;
+        }
+    }
+
+    int args = argc - optind;
+    if (args != 3 && args != 4)
+    {
+        print_usage(true);
+        return 2;
+    }
+
+    const char* paths[2] = { argv[optind], argv[optind + (args == 4 ? 2 : 0)] };
+    const char* iters[2] = { argv[optind + 1], argv[argc - 1] };
+
+    if (dir && dir[0] == '\0')
+        dir = NULL;
+
+    if (dir && dir[strlen(dir) - 1] == '/')
+    {
+        fprintf(stderr, "<dir> (%s) must not end with '/'.\n", dir);
+        return 2;
+    }
+
+    backup_store stores[2];
+    merkle_tree trees[2];
+    char folders[2][PATH_MAX];
+    int loaded = 0, opened = 0;
+
+    for (int i = 0; i < 2; ++i, ++loaded)
+    {
+        int status = store_open(&stores[i], paths[i]);
+        if (status != 0)
+        {
+            if (status == 1) // a missing or wrong key is reported once by store_open
+                fprintf(stderr, "Could not open directory %s (%s).\n", paths[i], strerror(errno));
+            store_close(&stores[i]);
+            break;
+        }
+        opened++;
+
+        int iter;
+        int index = sscanf(iters[i], "%d", &iter) == 1 ? store_find_iter(&stores[i], iter) : -1;
+        if (index < 0)
+        {
+            fprintf(stderr, "Could not find iteration %s in %s.\n", iters[i], paths[i]);
+            break;
+        }
+
+        snprintf(folders[i], sizeof(folders[i]), "%s/%s", stores[i].path, stores[i].folders[index]);
+        if (merkle_load(folders[i], &trees[i]) != 0)
+            break;
+    }
+
+    int result = 2;
+
+    if (loaded == 2)
+    {
+        if (dir)
+        {
+            // directories with equal subtree hashes hold the same files
+            const merkle_dir* dir_a = merkle_find_dir(&trees[0], dir);
+            const merkle_dir* dir_b = merkle_find_dir(&trees[1], dir);
+            bool equal = (dir_a == NULL && dir_b == NULL) || (dir_a && dir_b && dir_a->hash == dir_b->hash);
+
+            if (equal || quiet)
+                result = equal ? EXIT_SUCCESS : 1;
+            else
+            {
+                int changes = merkle_diff(folders[0], &trees[0], folders[1], &trees[1], print_change, (void*)dir);
+                result = changes < 0 ? 2 : 1;
+            }
+        }
+        else if (quiet || merkle_root(&trees[0]) == merkle_root(&trees[1]))
+            result = merkle_root(&trees[0]) == merkle_root(&trees[1]) ? EXIT_SUCCESS : 1;
+        else
+        {
+            int changes = merkle_diff(folders[0], &trees[0], folders[1], &trees[1], print_change, NULL);
+            result = changes < 0 ? 2 : changes > 0;
+        }
+    }
+
+    for (int i = 0; i < loaded; ++i)
+        merkle_free(&trees[i]);
+    for (int i = 0; i < opened; ++i)
+        store_close(&stores[i]);
+
+    return result;
+}
+
+int ctl_main(int argc, char* argv[])
+{
+    if (argc < 3 || argc > 4)
+    {
+        print_usage(true);
+        return 2;
+    }
+
+    const char* path = argv[1];
+    char command[CONTROL_COMMAND_SIZE];
+    snprintf(command, sizeof(command), "%s%s%s", argv[2], argc == 4 ? " " : "", argc == 4 ? argv[3] : "");
+    char socket_path[PATH_MAX];
+    struct stat buf;
+
+    if (stat(path, &buf) == 0 && S_ISDIR(buf.st_mode))
+    {
+        snprintf(socket_path, sizeof(socket_path), "%s/%s", path, CONTROL_SOCKET_NAME);
+        path = socket_path;
+    }
+
+    return control_request(path, command, stdout);
+}
+
+/**
+ * Writes a size with the largest binary unit it is a whole multiple of ("4 KiB", "16 MiB", ...)
+ */
+static void format_bound(long long bytes, char* buffer, size_t size)
+{
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    int unit = 0;
+
+    while (unit < 4 && bytes >= 1024 && bytes % 1024 == 0)
+    {
+        bytes /= 1024;
+        unit++;
+    }
+
+    snprintf(buffer, size, "%lld %s", bytes, units[unit]);
+}
+
+int estimate_main(int argc, char* argv[])
+{
+    int probes = 2000;
+    double seconds = 2;
+    double rate = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:r:x:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            probes = atoi(optarg);
+            if (probes <= 0)
+            {
+                fprintf(stderr, "<probes> (%s) needs to be a valid integer higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            seconds = atof(optarg);
+            if (seconds <= 0)
+            {
+                fprintf(stderr, "<seconds> (%s) needs to be a valid number higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            rate = atof(optarg) * 1024 * 1024;
+            if (rate <= 0)
+            {
+                fprintf(stderr, "<rate> (%s) needs to be a valid number higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'x':
+            if (Rules == NULL)
+            {
+                Rules = malloc(sizeof(rule_set));
+                rule_set_new(Rules);
+            }
+            if (!rule_set_load(Rules, optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'k':
+            if (!cipher_load_key(optarg))
+                return EXIT_FAILURE;
+            break;
+        default:
+            print_usage(true);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1 && argc - optind != 2)
+    {
+        print_usage(true);
+        return EXIT_FAILURE;
+    }
+
+    const char* src = argv[optind];
+    const char* dst = argc - optind == 2 ? argv[optind + 1] : NULL;
+    const double mib = 1024.0 * 1024.0;
+
+    tree_estimate estimate;
+    if (!estimate_tree(src, dst, Rules, probes, seconds, &estimate))
+    {
+        fprintf(stderr, "Could not open directory %s (%s).\n", src, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%d probe(s), %lld director%s listed, %lld file(s) stat'ed.\n", estimate.probes, estimate.listed,
+           estimate.listed == 1 ? "y" : "ies", estimate.stated);
+    printf("files        %.0f (+/- %.0f)\n", estimate.files, estimate.files_error);
+    printf("directories  %.0f\n", estimate.dirs);
+    printf("size         %.1f MiB (+/- %.1f MiB)\n", estimate.bytes / mib, estimate.bytes_error / mib);
+
+    for (int i = 0; i < ESTIMATE_BUCKETS; ++i)
+    {
+        char label[32];
+        long long bound = estimate_bucket_bound(i);
+
+        if (i == 0)
+            snprintf(label, sizeof(label), "empty");
+        else if (bound < 0)
+        {
+            format_bound(estimate_bucket_bound(i - 1), label + 3, sizeof(label) - 3);
+            memcpy(label, ">= ", 3);
+        }
+        else
+        {
+            format_bound(bound, label + 2, sizeof(label) - 2);
+            memcpy(label, "< ", 2);
+        }
+
+        printf("  %-10s %12.0f file(s) %12.1f MiB\n", label, estimate.bucket_files[i], estimate.bucket_bytes[i] / mib);
+    }
+
+    // the probes read from the source disk and write to the destination disk
+    double read_rate = estimate_read_rate(&estimate, seconds);
+    double write_rate = dst != NULL ? estimate_write_rate(dst, seconds) : 0;
+    double list_time = estimate.listed > 0 ? estimate.list_seconds / estimate.listed : 0;
+    double stat_time = estimate.stated > 0 ? estimate.stat_seconds / estimate.stated : 0;
+
+    printf("disks        read %.1f MiB/s", read_rate / mib);
+    if (write_rate > 0)
+        printf(", write %.1f MiB/s", write_rate / mib);
+    printf(", listing %.3f ms, stat %.3f ms\n", list_time * 1000, stat_time * 1000);
+
+    double copy_rate = read_rate;
+    if (write_rate > 0 && (copy_rate <= 0 || write_rate < copy_rate))
+        copy_rate = write_rate;
+    if (rate > 0 && (copy_rate <= 0 || rate < copy_rate))
+        copy_rate = rate;
+
+    // a first scan lists every directory and hashes the tail of every file; later ones
+    //  stat the files and the directories, listing only those that changed
+    double full_scan = estimate.dirs * list_time + estimate.files * stat_time +
+                       (read_rate > 0 ? estimate.tail_bytes / read_rate : 0);
+    double incremental_scan = (estimate.dirs + estimate.files) * stat_time;
+
+    printf("first        scan %.1f s, copy ", full_scan);
+    if (copy_rate > 0)
+        printf("%.1f s\n", estimate.bytes / copy_rate);
+    else
+        printf("unknown\n");
+
+    if (dst == NULL)
+    {
+        printf("later        scan %.1f s\n", incremental_scan);
+        estimate_free(&estimate);
+        return EXIT_SUCCESS;
+    }
+
+    backup_store store;
+    int opened = store_open(&store, dst);
+    if (opened != 0)
+    {
+        if (opened == 1) // a missing or wrong key is reported once by store_open
+            fprintf(stderr, "Could not open directory %s (%s).\n", dst, strerror(errno));
+        store_close(&store);
+        estimate_free(&estimate);
+        return EXIT_FAILURE;
+    }
+
+    // the last iterations after the first one are the model of the next ones; the
+    //  first one is also listed, to compare with the projection of a full backup
+    int recorded = 0;
+    double scanned = 0, scan_seconds = 0, copy_bytes = 0, copy_seconds = 0;
+
+    for (int i = store.count - 1; i >= 0; --i)
+    {
+        if (i > 0 && recorded == ESTIMATE_HISTORY)
+            continue;
+
+        char folder[PATH_MAX];
+        snprintf(folder, sizeof(folder), "%s/%s", dst, store.folders[i]);
+
+        iteration_stats stats;
+        if (iteration_stats_read(folder, &stats) != 0)
+            continue;
+
+        printf("iteration    %d (%s): scanned %lld in %.1f s, changed %lld, stored %lld (%.1f MiB) in %.1f s\n",
+               store.iters[i], store.folders[i], stats.scanned, stats.scan_seconds, stats.changed, stats.stored,
+               stats.copy_bytes / mib, stats.copy_seconds);
+
+        if (i == 0)
+            break;
+
+        recorded++;
+        scanned += stats.scanned;
+        scan_seconds += stats.scan_seconds;
+        copy_bytes += stats.copy_bytes;
+        copy_seconds += stats.copy_seconds;
+    }
+
+    store_close(&store);
+
+    if (recorded == 0)
+        printf("later        scan %.1f s (no recorded iteration in %s)\n", incremental_scan, dst);
+    else
+    {
+        // the recorded rates include the cache and the load of the real runs
+        if (scan_seconds > 0 && scanned > 0)
+            incremental_scan = estimate.files * scan_seconds / scanned;
+
+        printf("later        scan %.1f s, copy %.1f s (%.1f MiB, mean of %d recorded iteration(s))\n", incremental_scan,
+               copy_seconds / recorded, copy_bytes / recorded / mib, recorded);
+    }
+
+    estimate_free(&estimate);
+    return EXIT_SUCCESS;
+}
+
+void sigusr1_handler(int signo)
+{
+    Executing = false;
+}
+
+void sigchild_handler(int signo)
+{
+}
+
+void sighup_handler(int signo)
+{
+    ReloadLimits = true;
+}
+
+bool reload_limits(void)
+{
+    if (LimitsPath == NULL || Limits == NULL)
+    {
+        fprintf(stderr, "SIGHUP ignored, no limits file was given (-L).\n");
+        return false;
+    }
+
+    double bytes_rate, ops_rate;
+    if (!io_limits_read(LimitsPath, &bytes_rate, &ops_rate))
+    {
+        fprintf(stderr, "Keeping the previous I/O limits.\n");
+        return false;
+    }
+
+    io_limits_set(Limits, bytes_rate, ops_rate);
+    return true;
+}
+
+/**
+ * Checks if a destination is used by a source
+ */
+static bool source_uses(const backup_source* source, const char* dst)
+{
+    for (int i = 0; i < vector_size(&source->dsts); ++i)
+        if (strcmp(vector_get(&source->dsts, i), dst) == 0)
+            return true;
+
+    return false;
+}
+
+backup_source* source_new(const char* src, const char* const* dsts, int dst_count, const char* dtstr, double rate,
+                          int workers)
+{
+    backup_source* source = malloc(sizeof(backup_source));
+    source->src = strdup(src);
+    vector_new(&source->dsts);
+
+    int srcLen = strlen(source->src);
+    if (srcLen > 1 && source->src[srcLen - 1] == '/')
+        source->src[srcLen - 1] = '\0';
+
+    bool valid = true;
+
+    source->dt = atoi(dtstr); // atoi returns 0 if conversion is not successful
+    if (source->dt <= 0)
+    {
+        fprintf(stderr, "<dt> (%s) needs to be a valid integer higher than 0.\n", dtstr);
+        valid = false;
+    }
+    else if (dst_count > FANOUT_MAX_TARGETS)
+    {
+        fprintf(stderr, "Cannot do backups to more than %d destinations at once.\n", FANOUT_MAX_TARGETS);
+        valid = false;
+    }
+
+    for (int i = 0; valid && i < dst_count; ++i)
+    {
+        char* dst = strdup(dsts[i]);
+
+        int dstLen = strlen(dst);
+        if (dstLen > 1 && dst[dstLen - 1] == '/')
+            dst[dstLen - 1] = '\0';
+
+        if (strcmp(source->src, dst) == 0)
+        {
+            fprintf(stderr, "Cannot do backups to the same directory.\n");
+            valid = false;
+        }
+        else if (source_uses(source, dst))
+        {
+            fprintf(stderr, "Cannot do several backups to %s.\n", dst);
+            valid = false;
+        }
+
+        for (int j = 0; valid && j < vector_size(&Sources); ++j)
+            if (source_uses(vector_get(&Sources, j), dst))
+            {
+                // their iterations would be mixed in the same folders
+                fprintf(stderr, "Cannot do several backups to %s.\n", dst);
+                valid = false;
+            }
+
+        // the iterations create them too, but the control socket may be in the first one
+        if (valid && mkdir(dst, 0775) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Could not create directory %s (%s).\n", dst, strerror(errno));
+            valid = false;
+        }
+
+        vector_push_back(&source->dsts, dst);
+    }
+
+    DIR* srcdir = valid ? opendir(source->src) : NULL;
+    if (valid && srcdir == NULL)
+    {
+        fprintf(stderr, "Could not open directory %s (%s).\n", source->src, strerror(errno));
+        valid = false;
+    }
+    else if (srcdir != NULL)
+        closedir(srcdir);
+
+    if (valid)
+    {
+        source->progress = mmap(NULL, sizeof(backup_progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (source->progress == MAP_FAILED)
+        {
+            perror("mmap");
+            valid = false;
+        }
+        else if ((source->limits = io_limits_create(rate, 0)) == NULL)
+        {
+            munmap(source->progress, sizeof(backup_progress));
+            valid = false;
+        }
+    }
+
+    if (!valid)
+    {
+        for (int i = 0; i < vector_size(&source->dsts); ++i)
+            free(vector_get(&source->dsts, i));
+        vector_free(&source->dsts);
+        free(source->src);
+        free(source);
+        return NULL;
+    }
+
+    source->limits->parent = Limits;
+    source->progress->iteration = -1;
+    source->progress->phase = 'd';
+    source->init_time = time(NULL);
+    vector_new(&source->epochs);
+    source->iteration = -1;
+    source->pid = 0;
+    source->run_now = false;
+    source->failed = false;
+    source->workers = workers > 0 && workers < Workers ? workers : Workers;
+
+    return source;
+}
+
+bool read_config(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    char* line = NULL;
+    size_t line_size = 0;
+    int number = 0;
+    bool success = true;
+
+    while (success && getline(&line, &line_size, file) > 0)
+    {
+        number++;
+
+        char* text = line + strspn(line, " \t\r\n");
+        if (*text == '\0' || *text == '#')
+            continue;
+
+        char src[1024], dsts[FANOUT_MAX_TARGETS + 1][1024], dtstr[16];
+        const char* dst_names[FANOUT_MAX_TARGETS + 1];
+        int end = 0, dst_count = 0;
+        char* rest = text;
+
+        if (sscanf(rest, "%1023s %n", src, &end) == 1)
+            rest += end;
+
+        // the destinations go up to the interval, the first number
+        while (dst_count <= FANOUT_MAX_TARGETS && sscanf(rest, "%1023s %n", dsts[dst_count], &end) == 1
+               && strspn(dsts[dst_count], "0123456789") != strlen(dsts[dst_count]))
+        {
+            dst_names[dst_count] = dsts[dst_count];
+            dst_count++;
+            rest += end;
+        }
+
+        if (dst_count == 0 || sscanf(rest, "%15s %n", dtstr, &end) != 1)
+        {
+            fprintf(stderr, "%s:%d: expected <srcdir> <destdir>... <dt>.\n", path, number);
+            success = false;
+            break;
+        }
+
+        rest += end;
+
+        double rate = 0;
+        int workers = 0;
+        char key[16];
+        double value;
+        int used = 0;
+
+        for (; sscanf(rest, "%15s %lf %n", key, &value, &used) == 2 && value > 0; rest += used)
+            if (strcmp(key, "rate") == 0)
+                rate = value * 1024 * 1024;
+            else if (strcmp(key, "workers") == 0)
+                workers = value;
+            else
+                break;
+
+        if (*rest != '\0')
+        {
+            fprintf(stderr, "%s:%d: expected \"rate <MiB/s>\" or \"workers <n>\" instead of %s", path, number, rest);
+            success = false;
+            break;
+        }
+
+        backup_source* source = source_new(src, dst_names, dst_count, dtstr, rate, workers);
+        if (source == NULL)
+        {
+            fprintf(stderr, "%s:%d: source not valid.\n", path, number);
+            success = false;
+            break;
+        }
+
+        vector_push_back(&Sources, source);
+    }
+
+    free(line);
+    fclose(file);
+    return success;
+}
+
+int run_iteration(backup_source* source, int iteration)
+{
+    close(ControlFd);
+
+    // the scan and the copies take from the limits of the source, and from the shared ones
+    Limits = source->limits;
+    set_copy_io_limits(source->limits, DropCache);
+    set_copy_workers(CopySlots, source->workers);
+
+    Progress = source->progress;
+    Progress->iteration = iteration;
+    Progress->phase = 's';
+    Progress->scanned = 0;
+    Progress->changed = 0;
+    Progress->stored = 0;
+
+    int dst_count = vector_size(&source->dsts);
+    backup_target targets[FANOUT_MAX_TARGETS];
+    int count = 0, failed = 0;
+
+    for (int i = 0; i < dst_count; ++i)
+    {
+        backup_target* target = &targets[count];
+        target->dst = vector_get(&source->dsts, i);
+
+        int opened = open_target(source, target, iteration);
+        if (opened > 0)
+            count++;
+        else if (opened < 0)
+        {
+            fprintf(stderr, "Iteration %d of %s is not backed up to %s.\n", iteration, source->src, target->dst);
+            failed++;
+        }
+    }
+
+    if (count == 0) // every destination finished an interrupted iteration instead, or failed
+    {
+        Progress->phase = 'd';
+        return failed == dst_count ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // the directories are recorded once, and copied to the other destinations
+    FILE* new_dirs = cipher_fopen(targets[0].dirs_path, "w");
+    if (new_dirs == NULL)
+        perror("New directory record");
+
+    struct timespec scan_start, scan_end;
+    clock_gettime(CLOCK_MONOTONIC, &scan_start);
+    long long bytes_start = __atomic_load_n(&source->limits->bytes_done, __ATOMIC_RELAXED);
+
+    bool scanned = backup(source, targets, count, new_dirs, iteration);
+
+    clock_gettime(CLOCK_MONOTONIC, &scan_end);
+
+    if (new_dirs != NULL)
+        fclose(new_dirs);
+
+    for (int i = 0; i < count; ++i)
+    {
+        backup_target* target = &targets[i];
+
+        if (target->prev != NULL)
+            fclose(target->prev);
+        fclose(target->info);
+
+        if (i > 0 && new_dirs != NULL && scanned)
+            copy_manifest(targets[0].dirs_path, target->dirs_path);
+
+        target->stats.scan_bytes = __atomic_load_n(&source->limits->bytes_done, __ATOMIC_RELAXED) - bytes_start;
+        target->stats.scan_seconds = (scan_end.tv_sec - scan_start.tv_sec) + (scan_end.tv_nsec - scan_start.tv_nsec) / 1e9;
+    }
+
+    if (!scanned)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            unlink(targets[i].info_path);
+            unlink(targets[i].dirs_path);
+            fprintf(stderr, "Iteration %d of %s is not backed up to %s.\n", iteration, source->src, targets[i].dst);
+        }
+
+        Progress->phase = 'd';
+        return failed + count == dst_count ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    failed += commit_iteration(source, targets, count, iteration);
+
+    Progress->phase = 'd';
+    return failed == dst_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int open_target(const backup_source* source, backup_target* target, int iter)
+{
+    const char* destdirstr = target->dst;
+
+    target->prev_dir[0] = '\0';
+    target->prev = NULL;
+    target->info = NULL;
+    target->altered = false;
+    target->folder = NULL;
+    memset(&target->stats, 0, sizeof(target->stats));
+
+    DIR* destdir = opendir(destdirstr);
+    if (destdir == NULL)
+    {
+        if (mkdir(destdirstr, 0775) != 0 || (destdir = opendir(destdirstr)) == NULL)
+        {
+            fprintf(stderr, "Could not create directory %s (%s).\n", destdirstr, strerror(errno));
+            return -1;
+        }
+    }
+    closedir(destdir);
+
+    struct dirent** folders = NULL;
+    int size = scandir(destdirstr, &folders, folder_selection, bytesort);
+
+    // the last iteration is finished first if it was interrupted, instead of scanning again
+    if (size > 0)
+    {
+        char last_folder_path_name[PATH_MAX];
+        snprintf(last_folder_path_name, sizeof(last_folder_path_name), "%s/%s", destdirstr, folders[size - 1]->d_name);
+
+        char last_file_path_name[PATH_MAX + 16];
+        snprintf(last_file_path_name, sizeof(last_file_path_name), "%s/%s", last_folder_path_name, BACKUP_FILE_INFO_NAME);
+
+        if (journal_exists(last_folder_path_name) || access(last_file_path_name, F_OK) != 0)
+        {
+            int resumed = resume_iteration(source, destdirstr, last_folder_path_name);
+            if (resumed != 1)
+            {
+                for (int i = 0; i < size; ++i)
+                    free(folders[i]);
+                free(folders);
+
+                return resumed == 0 ? 0 : -1;
+            }
+
+            free(folders[--size]); // removed, the previous one is the base of this iteration
+        }
+    }
+
+    // a full backup when there is no previous iteration (they may have been skipped or failed)
+    if (size > 0)
+    {
+        snprintf(target->prev_dir, sizeof(target->prev_dir), "%s/%s", destdirstr, folders[size - 1]->d_name);
+        char prev_file_path_name[PATH_MAX + 16];
+        snprintf(prev_file_path_name, sizeof(prev_file_path_name), "%s/%s", target->prev_dir, BACKUP_FILE_INFO_NAME);
+
+        target->prev = cipher_fopen(prev_file_path_name, "r");
+        if (target->prev == NULL)
+            perror("Previous backup file");
+    }
+
+    for (int i = 0; i < size; ++i)
+        free(folders[i]);
+    free(folders);
+
+    if (size > 0 && target->prev == NULL)
+        return -1;
+
+    // the new backup info is streamed to a temporary file and only
+    // moved into a new backup folder if something changed
+    snprintf(target->info_path, sizeof(target->info_path), "%s/%s.%d", destdirstr, BACKUP_FILE_INFO_NAME, iter);
+    snprintf(target->dirs_path, sizeof(target->dirs_path), "%s/%s.%d", destdirstr, WALKER_DIRS_NAME, iter);
+
+    target->info = cipher_fopen(target->info_path, "w");
+    if (target->info == NULL)
+    {
+        perror("New backup file");
+        if (target->prev != NULL)
+            fclose(target->prev);
+        return -1;
+    }
+
+    return 1;
+}
+
+void start_iteration(backup_source* source, int iteration)
+{
+    time_t now = time(NULL);
+
+    if (source->run_now && now < source->init_time + (time_t)iteration * source->dt)
+    {
+        // the schedule is moved back so this iteration is named after now; the previous
+        //  iterations keep the times they started at
+        schedule_epoch* epoch = malloc(sizeof(schedule_epoch));
+        epoch->end = iteration;
+        epoch->init_time = source->init_time;
+        vector_push_back(&source->epochs, epoch);
+
+        source->init_time = now - (time_t)iteration * source->dt;
+    }
+
+    source->run_now = false;
+    source->iteration = iteration;
+
+    pid_t pid = fork();
+    if (pid < 0) // error, tried again at the next iteration
+        fprintf(stderr, "Could not fork process (%s).\n", strerror(errno));
+    else if (pid == 0) // child
+        exit(run_iteration(source, iteration));
+    else // parent
+        source->pid = pid;
+}
+
+bool schedule_iterations(void)
+{
+    int count = vector_size(&Sources);
+    time_t now = time(NULL);
+    bool waiting = false;
+
+    for (int k = 0; k < count; ++k)
+    {
+        int i = (NextSource + k) % count;
+        backup_source* source = vector_get(&Sources, i);
+
+        // the next iteration of a source waits for the running one, which may not have moved its backup info yet
+        if (source->failed || source->pid != 0)
+            continue;
+
+        // an iteration that could not start in time is skipped when the next one is due
+        int due = source->iteration + 1;
+        if (now >= source->init_time && (now - source->init_time) / source->dt > due)
+            due = (now - source->init_time) / source->dt;
+
+        if (source->run_now)
+        {
+            // folders are named after the second an iteration starts
+            if (now <= iteration_time(source, source->iteration))
+            {
+                waiting = true;
+                continue;
+            }
+        }
+        else if (now < source->init_time + (time_t)due * source->dt)
+            continue;
+        else if (Paused) // the iteration is skipped, the next one still compares with the last one done
+        {
+            source->iteration = due;
+            continue;
+        }
+
+        if (running_iterations() >= Workers) // started once another one is done
+            continue;
+
+        start_iteration(source, due);
+        NextSource = (i + 1) % count;
+    }
+
+    return waiting;
+}
+
+int running_iterations(void)
+{
+    int running = 0;
+
+    for (int i = 0; i < vector_size(&Sources); ++i)
+        running += ((backup_source*)vector_get(&Sources, i))->pid != 0;
+
+    return running;
+}
+
+time_t iteration_time(const backup_source* source, int iter)
+{
+    for (int i = 0; i < vector_size(&source->epochs); ++i)
+    {
+        schedule_epoch* epoch = vector_get(&source->epochs, i);
+        if (iter < epoch->end)
+            return epoch->init_time + (time_t)iter * source->dt;
+    }
+
+    return source->init_time + (time_t)iter * source->dt;
+}
+
+void resume_schedule(backup_source* source)
+{
+    int last_iter = -1;
+    time_t last_time = 0;
+
+    // the destinations may have missed iterations, the numbering continues from the latest one
+    for (int j = 0; j < vector_size(&source->dsts); ++j)
+    {
+        const char* dst = vector_get(&source->dsts, j);
+        struct dirent** folders = NULL;
+        int size = scandir(dst, &folders, folder_selection, bytesort);
+        bool found = false;
+
+        // an interrupted iteration counts as done, it is finished before the next one is scanned
+        for (int i = size - 1; i >= 0 && !found; --i)
+        {
+            char info_path[PATH_MAX];
+            snprintf(info_path, sizeof(info_path), "%s/%s/%s", dst, folders[i]->d_name, BACKUP_FILE_INFO_NAME);
+
+            FILE* info_file = cipher_fopen(info_path, "r");
+            int iter;
+            time_t folder_time;
+
+            if (info_file != NULL && backup_info_read_header(info_file, &iter) != EOF && iter >= 0 &&
+                folder_to_time(folders[i]->d_name, &folder_time))
+            {
+                found = true;
+                if (iter > last_iter)
+                {
+                    last_iter = iter;
+                    last_time = folder_time;
+                }
+            }
+
+            if (info_file != NULL)
+                fclose(info_file);
+        }
+
+        for (int i = 0; i < size; ++i)
+            free(folders[i]);
+        free(folders);
+    }
+
+    if (last_iter >= 0)
+    {
+        schedule_epoch* epoch = malloc(sizeof(schedule_epoch));
+        epoch->end = last_iter + 1;
+        epoch->init_time = last_time - (time_t)last_iter * source->dt;
+        vector_push_back(&source->epochs, epoch);
+
+        source->iteration = last_iter;
+    }
+}
+
+bool reap_iterations(void)
+{
+    int status_child;
+    pid_t pid_child;
+
+    while (running_iterations() > 0 && (pid_child = waitpid(-1, &status_child, WNOHANG)) != 0)
+    {
+        if (pid_child == (pid_t) - 1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "waitpid failed (%s)\n", strerror(errno));
+            return false;
+        }
+
+        for (int i = 0; i < vector_size(&Sources); ++i)
+        {
+            backup_source* source = vector_get(&Sources, i);
+            if (source->pid != pid_child)
+                continue;
+
+            source->pid = 0;
+            if (!WIFEXITED(status_child) || WEXITSTATUS(status_child) != 0)
+            {
+                fprintf(stderr, "Child failed with exit code %d, %s is not backed up anymore\n",
+                        WIFEXITED(status_child) ? WEXITSTATUS(status_child) : -1, source->src);
+                source->failed = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+void serve_control(void)
+{
+    char command[CONTROL_COMMAND_SIZE];
+    int client;
+
+    while ((client = control_accept(ControlFd, command, sizeof(command))) >= 0)
+    {
+        char name[16] = "";
+        int index = -1;
+        int count = vector_size(&Sources);
+
+        sscanf(command, "%15s %d", name, &index);
+
+        if (command[0] == '\0') // e.g. another backup checking whether the socket is in use
+            ;
+        else if (strcmp(name, "now") == 0)
+        {
+            if (Stopping)
+                dprintf(client, "error stopping\n");
+            else if (index >= count || (index < 0 && strcmp(command, "now") != 0))
+                dprintf(client, "error no source %s\n", command + 4);
+            else
+            {
+                dprintf(client, "ok\n");
+                for (int i = 0; i < count; ++i)
+                {
+                    backup_source* source = vector_get(&Sources, i);
+                    if ((index >= 0 && i != index) || source->failed)
+                        continue;
+
+                    source->run_now = true;
+                    dprintf(client, "source %d iteration %d %s\n", i, source->iteration + 1,
+                            source->pid != 0 ? "starts once the running one is done" : "starting");
+                }
+            }
+        }
+        else if (strcmp(command, "pause") == 0)
+        {
+            Paused = true;
+            dprintf(client, "ok paused\n");
+        }
+        else if (strcmp(command, "resume") == 0)
+        {
+            Paused = false;
+            dprintf(client, "ok resumed\n");
+        }
+        else if (strcmp(command, "stop") == 0)
+        {
+            Stopping = true;
+            dprintf(client, "ok stopping after %d running iterations\n", running_iterations());
+        }
+        else if (strcmp(command, "stats") == 0)
+            write_stats(client);
+        else
+            dprintf(client, "error unknown command %s\n", command);
+
+        close(client);
+    }
+}
+
+void write_stats(int fd)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double seconds = (now.tv_sec - StatsTime.tv_sec) + (now.tv_nsec - StatsTime.tv_nsec) / 1e9;
+    long long bytes = __atomic_load_n(&Limits->bytes_done, __ATOMIC_RELAXED);
+    long long ops = __atomic_load_n(&Limits->ops_done, __ATOMIC_RELAXED);
+
+    dprintf(fd, "ok\n"
+            "state %s\n"
+            "running %d\n"
+            "bytes %lld\n"
+            "ops %lld\n"
+            "bytes_rate %.0f\n"
+            "ops_rate %.0f\n",
+            Stopping ? "stopping" : Paused ? "paused" : "running", running_iterations(), bytes, ops,
+            seconds > 0 ? (bytes - StatsBytes) / seconds : 0, seconds > 0 ? (ops - StatsOps) / seconds : 0);
+
+    for (int i = 0; i < vector_size(&Sources); ++i)
+    {
+        backup_source* source = vector_get(&Sources, i);
+        backup_progress* progress = source->progress;
+        long next = (long)(source->init_time + (time_t)(source->iteration + 1) * source->dt - time(NULL));
+
+        dprintf(fd, "source %d %s", i, source->src);
+        for (int j = 0; j < vector_size(&source->dsts); ++j)
+            dprintf(fd, " %s", (char*)vector_get(&source->dsts, j));
+
+        dprintf(fd, "\n"
+                "iteration %d\n"
+                "phase %s\n"
+                "next %ld\n"
+                "scanned %lld\n"
+                "changed %lld\n"
+                "stored %lld\n"
+                "bytes %lld\n"
+                "ops %lld\n",
+                progress->iteration,
+                source->failed ? "failed" : progress->phase == 's' ? "scanning" : progress->phase == 'c' ? "storing" : "done",
+                Stopping || source->failed ? -1 : next < 0 ? 0 : next, progress->scanned, progress->changed, progress->stored,
+                __atomic_load_n(&source->limits->bytes_done, __ATOMIC_RELAXED),
+                __atomic_load_n(&source->limits->ops_done, __ATOMIC_RELAXED));
+    }
+
+    // the rates are those since the previous stats command
+    StatsTime = now;
+    StatsBytes = bytes;
+    StatsOps = ops;
+}
+
+/**
+ * Counts an entry written by backup() in the statistics of its destination and, for the
+ *  first destination, in the progress of the iteration
+ */
+static void count_entry(backup_target* target, const file_info* fi, bool first)
+{
+    if (fi->state != STATE_REMOVED)
+        target->stats.scanned++;
+    if (fi->state != STATE_INALTERED)
+        target->stats.changed++;
+
+    if (first)
+    {
+        Progress->scanned = target->stats.scanned;
+        Progress->changed = target->stats.changed;
+    }
+}
+
+bool backup(const backup_source* source, backup_target* targets, int count, FILE* dirs, int iter)
+{
+    const char* src = source->src;
+
+    // the unchanged directories are not listed again, taken from the latest previous iteration
+    const char* prev_dir = NULL;
+    for (int i = 0; i < count; ++i)
+        if (targets[i].prev != NULL
+            && (prev_dir == NULL || strcmp(strrchr(targets[i].prev_dir, '/'), strrchr(prev_dir, '/')) > 0))
+            prev_dir = targets[i].prev_dir;
+
+    // the destinations inside the source are not backed up
+    const char* excludes[FANOUT_MAX_TARGETS];
+    for (int i = 0; i < count; ++i)
+        excludes[i] = targets[i].dst;
+
+    // the paths of the source and of the stored files must fit in PATH_MAX, with room for
+    //  the suffix of a temporary folder (see replicate_receive)
+    size_t longest = strlen(src);
+    for (int i = 0; i < count; ++i)
+        if (strlen(targets[i].dst) + 1 + BACKUP_FOLDER_NAME_LENGTH + 16 > longest)
+            longest = strlen(targets[i].dst) + 1 + BACKUP_FOLDER_NAME_LENGTH + 16;
+
+    // a previous backup_info that can not be read would make every file look added
+    for (int i = 0; i < count; ++i)
+    {
+        backup_target* target = &targets[i];
+        target->prev_time = 0;
+        if (target->prev == NULL)
+            continue;
+
+        int prev_iter;
+        if (backup_info_read_header(target->prev, &prev_iter) == EOF)
+        {
+            fprintf(stderr, "Could not read the previous backup info of %s (%s).\n", target->dst, target->prev_dir);
+            return false;
+        }
+
+        // the earliest of the scheduled time and the one the folder is named after, so no change is missed
+        time_t folder_time;
+        target->prev_time = iteration_time(source, prev_iter);
+        if (folder_to_time(strrchr(target->prev_dir, '/') + 1, &folder_time) && folder_time < target->prev_time)
+            target->prev_time = folder_time;
+    }
+
+    walker files;
+    if (walker_open(&files, src, prev_dir, dirs, excludes, count, Rules, MemoryBudget,
+                    longest + 2 < PATH_MAX ? PATH_MAX - 2 - longest : 1) != 0)
+    {
+        walker_close(&files);
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        backup_target* target = &targets[i];
+        backup_info_writer_open(&target->writer, target->info, iter);
+        file_info_new(&target->prev_fi, NULL);
+        target->prev_has_files = target->prev != NULL && file_info_read(target->prev, &target->prev_fi) != EOF;
+    }
+
+    file_info fi;
+    file_info_new(&fi, "");
+
+    // the file is stat'ed and described once for every destination
+    file_info described;
+    file_info_new(&described, NULL);
+
+    for (const char* file_name = walker_next(&files); file_name != NULL; file_name = walker_next(&files))
+    {
+        file_info_set_name(&described, file_name);
+        bool is_described = false;
+        time_t mtime = 0;
+        bool has_mtime = false;
+
+        for (int i = 0; i < count; ++i)
+        {
+            backup_target* target = &targets[i];
+
+            // the files before it in the previous iteration were removed
+            while (target->prev_has_files
+                   && (target->prev_fi.state == STATE_REMOVED || name_compare(target->prev_fi.file_name, file_name) < 0))
+            {
+                if (target->prev_fi.state != STATE_REMOVED)
+                {
+                    fi.state = STATE_REMOVED;
+                    file_info_set_name(&fi, target->prev_fi.file_name);
+                    copy_stored_data(&fi, &target->prev_fi);
+                    backup_info_writer_add(&target->writer, &fi);
+                    count_entry(target, &fi, i == 0);
+                    target->altered = true;
+                }
+
+                target->prev_has_files = file_info_read(target->prev, &target->prev_fi) != EOF;
+            }
+
+            // Equal names are considered same file
+            bool found = target->prev_has_files && name_compare(target->prev_fi.file_name, file_name) == 0;
+            file_info_set_name(&fi, file_name);
+
+            // its directory could not be listed, only its previous version is known
+            if (files.carried && !found)
+                continue;
+
+            if (found && !has_mtime && !files.carried)
+            {
+                mtime = get_file_last_modified_time(src, file_name);
+                has_mtime = true;
+            }
+
+            if (found && (files.carried || mtime <= target->prev_time))
+            {
+                fi.state = STATE_INALTERED;
+                copy_stored_data(&fi, &target->prev_fi);
+            }
+            else
+            {
+                if (!is_described)
+                {
+                    describe_file(src, &described);
+                    is_described = true;
+                }
+
+                copy_stored_data(&fi, &described);
+                fi.iter = iter;
+
+                if (!found)
+                    fi.state = STATE_ADDED;
+                else if (is_append(src, &fi, &target->prev_fi))
+                {
+                    fi.state = STATE_APPENDED;
+                    fi.base_iter = target->prev_fi.iter;
+                    fi.base_size = target->prev_fi.size;
+                }
+                else
+                    fi.state = STATE_MODIFIED;
+
+                target->altered = true;
+            }
+
+            backup_info_writer_add(&target->writer, &fi);
+            count_entry(target, &fi, i == 0);
+
+            if (found)
+                target->prev_has_files = file_info_read(target->prev, &target->prev_fi) != EOF;
+        }
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        backup_target* target = &targets[i];
+
+        // Last files were removed
+        for (; target->prev_has_files; target->prev_has_files = file_info_read(target->prev, &target->prev_fi) != EOF)
+        {
+            if (target->prev_fi.state == STATE_REMOVED)
+                continue;
+
+            target->altered = true;
+            fi.state = STATE_REMOVED;
+            file_info_set_name(&fi, target->prev_fi.file_name);
+            copy_stored_data(&fi, &target->prev_fi);
+            backup_info_writer_add(&target->writer, &fi);
+            count_entry(target, &fi, i == 0);
+        }
+
+        file_info_free(&target->prev_fi);
+        backup_info_writer_close(&target->writer);
+    }
+
+    file_info_free(&described);
+    file_info_free(&fi);
+    walker_close(&files);
+    return true;
+}
+
+/**
+ * Reads the next entry of the backup_info of a destination whose data is stored in the new folder
+ */
+static void next_stored(backup_target* target)
+{
+    while ((target->has_fi = file_info_read(target->info, &target->fi) != EOF))
+        if (target->fi.state == STATE_ADDED || target->fi.state == STATE_MODIFIED || target->fi.state == STATE_APPENDED)
+            break;
+}
+
+/**
+ * Creates the folder of an iteration in a destination, moves its backup_info and directory record
+ *  there and prepares the storing of its files
+ * @return true if successful, false otherwise
+ */
+static bool open_folder(const backup_source* source, backup_target* target, int iter)
+{
+    char* new_folder_path_name = NULL;
+    iter_to_folder(iter, target->dst, source->init_time, source->dt, &new_folder_path_name);
+
+    if (mkdir(new_folder_path_name, 0775) != 0)
+    {
+        perror("mkdir");
+        free(new_folder_path_name);
+        return false;
+    }
+
+    // the folder is not finished until every file is stored
+    if (!journal_create(new_folder_path_name))
+    {
+        rmdir(new_folder_path_name);
+        free(new_folder_path_name);
+        return false;
+    }
+
+    target->folder = new_folder_path_name;
+
+    char new_file_path_name[PATH_MAX];
+    snprintf(new_file_path_name, sizeof(new_file_path_name), "%s/%s", new_folder_path_name, BACKUP_FILE_INFO_NAME);
+
+    if (rename(target->info_path, new_file_path_name) != 0)
+    {
+        perror("New backup file");
+        return false;
+    }
+
+    char new_dirs_path_name[PATH_MAX];
+    snprintf(new_dirs_path_name, sizeof(new_dirs_path_name), "%s/%s", new_folder_path_name, WALKER_DIRS_NAME);
+
+    // not fatal: without it the next iteration lists every directory
+    if (rename(target->dirs_path, new_dirs_path_name) != 0)
+        perror("New directory record");
+
+    target->info = cipher_fopen(new_file_path_name, "r");
+    if (target->info == NULL)
+    {
+        perror("New backup file");
+        return false;
+    }
+
+    dedup_index_load(&target->index, target->dst);
+    vector_new(&target->deferred);
+    file_info_new(&target->fi, NULL);
+    target->has_fi = false;
+
+    int new_iter;
+    if (backup_info_read_header(target->info, &new_iter) != EOF)
+    {
+        long entries_start = ftell(target->info);
+        mark_duplicate_sizes(target->info, &target->index);
+        fseek(target->info, entries_start, SEEK_SET); // the first entry is a restart, no name is shared
+
+        next_stored(target);
+    }
+
+    return true;
+}
+
+/**
+ * Finishes the folder of an iteration in a destination once its files are stored
+ * @return true if successful, false otherwise
+ */
+static bool close_folder(backup_target* target)
+{
+    const char* dst = target->dst;
+    const char* new_folder_path_name = target->folder;
+
+    vector_free(&target->deferred);
+    file_info_free(&target->fi);
+    fclose(target->info);
+
+    if (!dedup_index_save(&target->index, dst))
+        fprintf(stderr, "Could not update the content index of %s.\n", dst);
+    dedup_index_free(&target->index);
+
+    // not fatal: readers build the tree from the backup_info when it is missing
+    if (!merkle_build_folder(new_folder_path_name))
+        fprintf(stderr, "Could not write the tree of %s.\n", new_folder_path_name);
+
+    // not fatal: the stored files are only left unprotected
+    if (ParityData > 0 && !parity_build_folder(new_folder_path_name, ParityData, ParityShards, Limits))
+        fprintf(stderr, "Could not write the parity of %s.\n", new_folder_path_name);
+
+    // not fatal: only used by estimates
+    if (!iteration_stats_write(new_folder_path_name, &target->stats))
+        fprintf(stderr, "Could not write the statistics of %s.\n", new_folder_path_name);
+
+    // not fatal: added with the next iteration
+    if (!history_add(dst, strrchr(new_folder_path_name, '/') + 1))
+        fprintf(stderr, "Could not update the history of %s.\n", dst);
+
+    return journal_remove(new_folder_path_name);
+}
+
+int commit_iteration(const backup_source* source, backup_target* targets, int count, int iter)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const char* src = source->src;
+    backup_target* open[FANOUT_MAX_TARGETS];
+    int open_count = 0, failed = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        backup_target* target = &targets[i];
+
+        // nothing is stored when nothing changed, unless it is the first iteration
+        if (target->prev_dir[0] != '\0' && !target->altered)
+        {
+            unlink(target->info_path);
+            unlink(target->dirs_path);
+            continue;
+        }
+
+        if (open_folder(source, target, iter))
+            open[open_count++] = target;
+        else
+        {
+            // a folder left with its journal is finished or removed by the next iteration
+            unlink(target->info_path);
+            unlink(target->dirs_path);
+
+            fprintf(stderr, "Iteration %d of %s is not backed up to %s.\n", iter, src, target->dst);
+            free(target->folder);
+            failed++;
+        }
+    }
+
+    Progress->phase = 'c';
+
+    // the backup infos are merged by name, so each file is read once for all the destinations that store it
+    for (;;)
+    {
+        const char* name = NULL;
+        for (int i = 0; i < open_count; ++i)
+            if (open[i]->has_fi && (name == NULL || name_compare(open[i]->fi.file_name, name) < 0))
+                name = open[i]->fi.file_name;
+
+        if (name == NULL)
+            break;
+
+        char* file_name = strdup(name);
+        fanout_target copies[FANOUT_MAX_TARGETS];
+        int copy_count = 0;
+        uint32_t crc = 0;
+        bool hashed = false;
+
+        for (int i = 0; i < open_count; ++i)
+        {
+            backup_target* target = open[i];
+            if (!target->has_fi || strcmp(target->fi.file_name, file_name) != 0)
+                continue;
+
+            const file_info* fi = &target->fi;
+            target->stats.stored++;
+
+            if (fi->state == STATE_APPENDED) // only the new tail is stored
+            {
+                target->stats.copy_bytes += fi->size - fi->base_size;
+                copies[copy_count].dir = target->folder;
+                copies[copy_count++].offset = fi->base_size;
+            }
+            else
+            {
+                target->stats.copy_bytes += fi->size;
+                if (!store_duplicate(src, target->dst, target->folder, fi, &target->index, &target->deferred, &crc, &hashed))
+                {
+                    copies[copy_count].dir = target->folder;
+                    copies[copy_count++].offset = 0;
+                }
+            }
+
+            next_stored(target);
+        }
+
+        Progress->stored++;
+
+        if (copy_count == 1)
+            fork_copy_file(src, copies[0].dir, file_name, copies[0].offset, NULL);
+        else if (copy_count > 1)
+            fork_copy_file_targets(src, copies, copy_count, file_name);
+
+        free(file_name);
+    }
+
+    // the contents the deferred files duplicate are only complete once every copy is done
+    int failed_copies = wait_copies(1);
+
+    for (int j = 0; j < open_count; ++j)
+    {
+        backup_target* target = open[j];
+
+        for (int i = 0; i < vector_size(&target->deferred); ++i)
+        {
+            char* name = vector_get(&target->deferred, i);
+            char path[PATH_MAX];
+
+            uint32_t crc;
+            const dedup_entry* entry = NULL;
+            struct stat buf;
+
+            if (path_join(path, src, name) && stat(path, &buf) == 0 && dedup_file_crc(path, &crc))
+                entry = dedup_index_find(&target->index, crc, buf.st_size);
+
+            if (entry == NULL || !link_stored(src, target->dst, target->folder, name, entry->path))
+                fork_copy_file(src, target->folder, name, 0, NULL);
+
+            free(name);
+        }
+    }
+
+    failed_copies += wait_copies(1);
+    if (failed_copies > 0)
+        fprintf(stderr, "%d file(s) of iteration %d of %s could not be stored.\n", failed_copies, iter, src);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < open_count; ++i)
+    {
+        backup_target* target = open[i];
+        target->stats.copy_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (!close_folder(target))
+        {
+            fprintf(stderr, "Iteration %d of %s is not finished in %s.\n", iter, src, target->dst);
+            failed++;
+        }
+
+        free(target->folder);
+    }
+
+    return failed;
+}
+
+int resume_iteration(const backup_source* source, const char* dst, const char* folder)
+{
+    const char* src = source->src;
+
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s/%s", folder, BACKUP_FILE_INFO_NAME);
+
+    FILE* info_file = cipher_fopen(info_path, "r");
+    if (info_file == NULL)
+    {
+        // interrupted before any file was stored
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", folder, WALKER_DIRS_NAME);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s", folder, COPY_RECORD_NAME);
+        unlink(path);
+
+        if (!journal_remove(folder) || rmdir(folder) != 0)
+        {
+            fprintf(stderr, "Could not remove the unfinished iteration %s (%s).\n", folder, strerror(errno));
+            return -1;
+        }
+
+        return 1;
+    }
+
+    int iter;
+    if (backup_info_read_header(info_file, &iter) == EOF)
+    {
+        fprintf(stderr, "Could not read the backup info of %s.\n", folder);
+        fclose(info_file);
+        return -1;
+    }
+
+    copy_record record;
+    if (copy_record_read(folder, &record) == EOF)
+    {
+        fclose(info_file);
+        return -1;
+    }
+
+    journal j;
+    journal_read(folder, &j);
+
+    Progress->iteration = iter;
+    Progress->phase = 'c';
+
+    // the scan was not timed by this run, only the copies it resumes are (see estimate)
+    iteration_stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    while (file_info_read(info_file, &fi) != EOF)
+    {
+        if (fi.state != STATE_INALTERED)
+            stats.changed++;
+
+        if (fi.state != STATE_ADDED && fi.state != STATE_MODIFIED && fi.state != STATE_APPENDED)
+            continue;
+
+        Progress->stored++;
+        stats.stored++;
+
+        if (copy_record_find(&record, fi.file_name) != NULL) // stored before the interruption
+            continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", src, fi.file_name);
+
+        // the stored bytes are only kept if they are still the ones of the source
+        const journal_entry* checkpoint = journal_find(&j, fi.file_name);
+        struct stat buf;
+        if (checkpoint != NULL && (stat(path, &buf) != 0 || buf.st_size != fi.size ||
+                                   buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec != fi.mtime))
+            checkpoint = NULL;
+
+        if (checkpoint == NULL)
+        {
+            snprintf(path, sizeof(path), "%s/%s", folder, fi.file_name);
+            unlink(path); // partial copy
+        }
+
+        long long offset = fi.state == STATE_APPENDED ? fi.base_size : 0;
+        stats.copy_bytes += fi.size - offset - (checkpoint != NULL ? checkpoint->offset : 0);
+        fork_copy_file(src, folder, fi.file_name, offset, checkpoint);
+    }
+
+    int failed_copies = wait_copies(1);
+    if (failed_copies > 0)
+        fprintf(stderr, "%d file(s) of %s could not be stored.\n", failed_copies, folder);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats.copy_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (!iteration_stats_write(folder, &stats))
+        fprintf(stderr, "Could not write the statistics of %s.\n", folder);
+
+    if (!merkle_build_folder(folder))
+        fprintf(stderr, "Could not write the tree of %s.\n", folder);
+
+    if (ParityData > 0 && !parity_build_folder(folder, ParityData, ParityShards, Limits))
+        fprintf(stderr, "Could not write the parity of %s.\n", folder);
+
+    if (!history_add(dst, strrchr(folder, '/') + 1))
+        fprintf(stderr, "Could not update the history of %s.\n", dst);
+
+    bool finished = journal_remove(folder);
+
+    file_info_free(&fi);
+    journal_free(&j);
+    copy_record_free(&record);
+    fclose(info_file);
+
+    return finished ? 0 : -1;
+}
+
+/**
+ * qsort comparator of sizes
+ */
+static int compare_sizes(const void* a, const void* b)
+{
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+void mark_duplicate_sizes(FILE* source, dedup_index* index)
+{
+    long long* sizes = NULL;
+    int count = 0, capacity = 0;
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    while (file_info_read(source, &fi) != EOF)
+    {
+        if ((fi.state != STATE_ADDED && fi.state != STATE_MODIFIED) || fi.size < DEDUP_MIN_SIZE)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            sizes = realloc(sizes, capacity * sizeof(long long));
+        }
+
+        sizes[count++] = fi.size;
+    }
+
+    file_info_free(&fi);
+
+    qsort(sizes, count, sizeof(long long), compare_sizes);
+
+    for (int i = 1; i < count; ++i)
+        if (sizes[i] == sizes[i - 1])
+            dedup_index_add_size(index, sizes[i]);
+
+    free(sizes);
+}
+
+bool store_duplicate(const char* src, const char* dst, const char* folder, const file_info* fi, dedup_index* index,
+                     vector* deferred, uint32_t* crc, bool* hashed)
 {
-    return file->d_type == DT_DIR;
+    if (fi->size < DEDUP_MIN_SIZE || !dedup_index_has_size(index, fi->size))
+        return false;
+
+    char path[PATH_MAX];
+    if (!path_join(path, src, fi->file_name))
+        return false;
+
+    if (!*hashed)
+    {
+        io_limits_take(Limits, fi->size, 1 + fi->size / (256 * 1024));
+
+        if (!dedup_file_crc(path, crc))
+            return false;
+        *hashed = true;
+    }
+
+    const dedup_entry* entry = dedup_index_find(index, *crc, fi->size);
+
+    if (entry == NULL)
+    {
+        // copied now, later duplicates are linked to it
+        snprintf(path, sizeof(path), "%s/%s", folder + strlen(dst) + 1, fi->file_name);
+        dedup_index_add(index, *crc, fi->size, path, true);
+        return false;
+    }
+
+    if (entry->pending)
+    {
+        vector_push_back(deferred, strdup(fi->file_name));
+        return true;
+    }
+
+    return link_stored(src, dst, folder, fi->file_name, entry->path);
+}
+
+bool link_stored(const char* src, const char* dst, const char* folder, const char* name, const char* stored)
+{
+    char source_path[PATH_MAX], stored_path[PATH_MAX], dest_path[PATH_MAX];
+    if (!path_join(source_path, src, name) || !path_join(stored_path, dst, stored) || !path_join(dest_path, folder, name))
+        return false;
+
+    // the permissions are restored from the stored file, so they must match too
+    struct stat source_buf, stored_buf;
+    if (stat(source_path, &source_buf) != 0 || stat(stored_path, &stored_buf) != 0
+        || (source_buf.st_mode & 07777) != (stored_buf.st_mode & 07777))
+        return false;
+
+    io_limits_take(Limits, 2 * source_buf.st_size, 2 + source_buf.st_size / (128 * 1024));
+
+    uint32_t crc;
+    if (!dedup_files_equal(source_path, stored_path, &crc))
+        return false;
+
+    if (link(stored_path, dest_path) != 0
+        && (errno != ENOENT || !make_parent_dirs(dest_path) || link(stored_path, dest_path) != 0))
+        return false; // e.g. too many links, or a destination without hardlinks: copy it
+
+    if (!copy_record_add(folder, name, crc, true))
+        fprintf(stderr, "Could not record the checksum of %s/%s.\n", folder, name);
+
+    return true;
+}
+
+int folder_selection(const struct dirent* file)
+{
+    // iteration folders, not "." and ".."
+    return file->d_type == DT_DIR && strlen(file->d_name) == 19;
+}
+
+bool describe_file(const char* dir, file_info* fi)
+{
+    char f_path[PATH_MAX];
+
+    fi->base_iter = -1;
+    fi->base_size = 0;
+
+    struct stat new_FStat;
+    if (!path_join(f_path, dir, fi->file_name) || stat(f_path, &new_FStat) != 0)
+    {
+        fi->size = 0;
+        fi->mtime = 0;
+        fi->tail_hash = 0;
+        return false;
+    }
+
+    fi->size = new_FStat.st_size;
+    fi->mtime = new_FStat.st_mtim.tv_sec * 1000000000LL + new_FStat.st_mtim.tv_nsec;
+
+    io_limits_take(Limits, fi->size < HASH_TAIL_BLOCK_SIZE ? fi->size : HASH_TAIL_BLOCK_SIZE, 2);
+    return hash_file_tail(f_path, fi->size, &fi->tail_hash);
+}
+
+bool is_append(const char* dir, const file_info* fi, const file_info* prev_fi)
+{
+    if (prev_fi->size == 0 || fi->size <= prev_fi->size)
+        return false;
+
+    char f_path[PATH_MAX];
+    if (!path_join(f_path, dir, fi->file_name))
+        return false;
+
+    io_limits_take(Limits, prev_fi->size < HASH_TAIL_BLOCK_SIZE ? prev_fi->size : HASH_TAIL_BLOCK_SIZE, 1);
+
+    uint64_t hash;
+    return hash_file_tail(f_path, prev_fi->size, &hash) && hash == prev_fi->tail_hash;
+}
+
+void copy_stored_data(file_info* dest, const file_info* source)
+{
+    dest->iter = source->iter;
+    dest->size = source->size;
+    dest->mtime = source->mtime;
+    dest->tail_hash = source->tail_hash;
+    dest->base_iter = source->base_iter;
+    dest->base_size = source->base_size;
+}
+
+bool copy_manifest(const char* source, const char* dest)
+{
+    FILE* in = cipher_fopen(source, "r");
+    FILE* out = in != NULL ? cipher_fopen(dest, "w") : NULL;
+    bool success = out != NULL;
+
+    char buffer[64 * 1024];
+    size_t count;
+
+    while (success && (count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        success = fwrite(buffer, 1, count, out) == count;
+
+    success = success && !ferror(in);
+
+    if (in != NULL)
+        fclose(in);
+    if (out != NULL && fclose(out) != 0)
+        success = false;
+
+    if (!success)
+        perror(dest);
+
+    return success;
 }
 
 time_t get_file_last_modified_time(const char* dir, const char* file_name)
 {
-    char f_path[1024];
-    snprintf(f_path, 1024, "%s/%s", dir, file_name);
+    char f_path[PATH_MAX];
+    snprintf(f_path, sizeof(f_path), "%s/%s", dir, file_name);
+
+    io_limits_take(Limits, 0, 1);
 
     struct stat new_FStat;
     stat(f_path, &new_FStat);
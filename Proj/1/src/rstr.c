@@ -7,15 +7,22 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
-
-#define _XOPEN_SOURCE // required for strptime
-#define __USE_XOPEN
-#include <time.h>
+#include <sys/wait.h>
+#include <limits.h>
 
 #include "backupinfo.h"
-#include "vector.h"
 #include "utilities.h"
 #include "fileinfo.h"
+#include "store.h"
+#include "walker.h"
+#include "namesort.h"
+#include "hash.h"
+#include "pathmatch.h"
+#include "tar.h"
+#include "vector.h"
+#include "history.h"
+#include "parity.h"
+#include "cipher.h"
 
 /** @defgroup restore restore
  * @{
@@ -25,6 +32,16 @@
 //#define print_var_s(var) fprintf(stderr, "var %s: %s\n", #var, var)
 //#define print_var_i(var) fprintf(stderr, "var %s: %d\n", #var, var)
 
+static bool Incremental = false; ///< Only copy, replace or remove the files that differ in destdir
+static bool CheckHash = false; ///< Also compare the tail hash of files that look restored
+static int Jobs = 16; ///< Maximum number of files copied in parallel
+static path_filter Filter; ///< Include and exclude patterns of the files to restore
+static bool Archive = false; ///< Write the restore point as a tar archive to stdout instead of restoring it
+static bool Compress = false; ///< Compress the archive with gzip
+static const char* HistoryName = NULL; ///< File whose versions are listed or restored, NULL for whole restore points
+static bool Repair = false; ///< Check the stored parts of each file against the parity set of their folder first
+static int FailedCopies = 0; ///< Number of fork'ed copies of restored files that failed
+
 /**
  * Prints information on how to use this program
  * @param err if true, info will be printed to stderr; otherwise stdout
@@ -32,11 +49,111 @@
 void print_usage(bool err);
 
 /**
- * Function used in scandir to select our backup subdirectories
- * @param  file Dirent
- * @return      Returns 1 if valid dirent, 0 otherwise
+ * Asks the user which restore point to restore
+ * @param  store Backup store
+ * @param  out   Stream where the restore points and the question are printed
+ * @return       Index of the restore point, -1 if stdin was closed
+ */
+int ask_restore_point(const backup_store* store, FILE* out);
+
+/**
+ * Restores the files of a restore point that pass Filter
+ * @param  store      Backup store
+ * @param  index      Index of the restore point in the store
+ * @param  destdirstr Destination of the restore
+ * @return            true if successful, false otherwise
+ */
+bool restore(backup_store* store, int index, const char* destdirstr);
+
+/**
+ * Restores the files named by the (literal) include patterns of Filter. Only the
+ *  entries of those files are read from the backup infos.
+ * @param  store      Backup store
+ * @param  index      Index of the restore point in the store
+ * @param  destdirstr Destination of the restore
+ * @return            true if successful, false otherwise
+ */
+bool restore_named(backup_store* store, int index, const char* destdirstr);
+
+/**
+ * Copies a file of a restore point to the destination, unless it is already restored (with Incremental).
+ *  The copy runs in a fork'ed process, whose failure is reported by wait_restores.
+ * @param  store      Backup store
+ * @param  file       Entry of the restore point
+ * @param  destdirstr Destination of the restore
+ * @param  restored   Incremented if the file is copied
+ * @param  up_to_date Incremented if the file is already restored
+ * @return            true if successful, false otherwise
+ */
+bool restore_file(backup_store* store, const file_info* file, const char* destdirstr, int* restored, int* up_to_date);
+
+/**
+ * Waits for the copies started by restore_file, reporting the ones that failed
+ * @return true if every copy succeeded, false otherwise
+ */
+bool wait_restores(void);
+
+/**
+ * Checks the stored parts of a file against the parity sets of their folders, rebuilding
+ *  their damaged blocks. Folders without a parity set are not checked.
+ * @param  segments Segments of the file (see store_resolve)
+ * @param  count    Number of segments
+ * @param  name     Name of the file
+ * @return          true if nothing was lost, false otherwise
+ */
+bool repair_segments(const file_segment* segments, int count, const char* name);
+
+/**
+ * Writes the files of a restore point that pass Filter to stdout as a tar archive.
+ *  Files are grouped by the iteration folder that stores them, so the folders are read one after the other.
+ * @param  store Backup store
+ * @param  index Index of the restore point in the store
+ * @return       true if successful, false otherwise
+ */
+bool archive(backup_store* store, int index);
+
+/**
+ * Starts gzip in a child process, reading from a pipe and writing to stdout
+ * @param  fd Set to the write end of the pipe
+ * @return    pid of the child, -1 on errors
+ */
+pid_t spawn_compressor(int* fd);
+
+/**
+ * Lists the versions of a file, from the history of the backup
+ * @param  srcdirstr Directory that was used to backup
+ * @param  name      Name of the file
+ * @return           true if successful, false otherwise
  */
-int folder_selection(const struct dirent* file);
+bool list_versions(const char* srcdirstr, const char* name);
+
+/**
+ * Restores a version of a file, from the history of the backup
+ * @param  srcdirstr  Directory that was used to backup
+ * @param  name       Name of the file
+ * @param  iter       Iteration, the last version recorded at or before it is restored
+ * @param  destdirstr Destination of the restore
+ * @return            true if successful, false otherwise
+ */
+bool restore_version(const char* srcdirstr, const char* name, int iter, const char* destdirstr);
+
+/**
+ * Checks if a file in the destination directory already matches an entry
+ *  (same size and modification time and, if CheckHash, same tail hash)
+ * @param  destdirstr Destination of the restore
+ * @param  fi         Entry of the restore point
+ * @return            true if the file does not need to be restored, false otherwise
+ */
+bool is_restored(const char* destdirstr, const file_info* fi);
+
+/**
+ * Removes the files of the destination directory that pass Filter and are not in the restore point
+ * @param  bi         Backup info of the restore point
+ * @param  destdirstr Destination of the restore
+ * @return            Number of files removed
+ */
+int remove_extra_files(const backup_info* bi, const char* destdirstr);
+
 /**
 * Entry point to this program
 * @param  argc Number of arguments
@@ -51,197 +168,740 @@ int main(int argc, char const* argv[])
         print_usage(false);
         return EXIT_SUCCESS;
     }
-    else if (argc != 3)
+
+    int opt;
+    int iter = -1;
+    const char* exact_time = NULL;
+    const char* before_time = NULL;
+    bool latest = false;
+    int version = -1;
+
+    path_filter_new(&Filter);
+
+    while ((opt = getopt(argc, (char* const*)argv, "ucj:i:t:b:lI:E:TzH:V:Rk:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            Incremental = true;
+            break;
+        case 'c':
+            CheckHash = true;
+            break;
+        case 'j':
+            Jobs = atoi(optarg);
+            if (Jobs <= 0)
+            {
+                fprintf(stderr, "<jobs> (%s) needs to be a valid integer higher than 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i':
+            if (sscanf(optarg, "%d", &iter) != 1 || iter < 0)
+            {
+                fprintf(stderr, "<iter> (%s) needs to be a valid integer higher or equal to 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            exact_time = optarg;
+            break;
+        case 'b':
+            before_time = optarg;
+            break;
+        case 'l':
+            latest = true;
+            break;
+        case 'I':
+            pattern_set_add(&Filter.include, optarg);
+            break;
+        case 'E':
+            pattern_set_add(&Filter.exclude, optarg);
+            break;
+        case 'T':
+            Archive = true;
+            break;
+        case 'z':
+            Compress = true;
+            break;
+        case 'H':
+            HistoryName = optarg;
+            break;
+        case 'R':
+            Repair = true;
+            break;
+        case 'k':
+            if (!cipher_load_key(optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'V':
+            if (sscanf(optarg, "%d", &version) != 1 || version < 0)
+            {
+                fprintf(stderr, "<iter> (%s) needs to be a valid integer higher or equal to 0.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage(true);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the versions of a single file are listed or restored without a restore point
+    if (HistoryName != NULL || version >= 0)
+    {
+        bool other = Incremental || Archive || iter >= 0 || exact_time != NULL || before_time != NULL || latest
+                     || pattern_set_size(&Filter.include) + pattern_set_size(&Filter.exclude) > 0;
+        path_filter_free(&Filter);
+
+        if (HistoryName == NULL || other || argc - optind != (version >= 0 ? 2 : 1))
+        {
+            print_usage(true);
+            return EXIT_FAILURE;
+        }
+
+        bool success;
+        if (version >= 0)
+            success = restore_version(argv[optind], HistoryName, version, argv[optind + 1]);
+        else
+            success = list_versions(argv[optind], HistoryName);
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // at most one way of picking the restore point; archives have no destdir and are never incremental
+    if (argc - optind != (Archive ? 1 : 2) || (iter >= 0) + (exact_time != NULL) + (before_time != NULL) + latest > 1
+        || (Archive && Incremental) || (Compress && !Archive))
     {
         print_usage(true);
         return EXIT_FAILURE;
     }
 
-    const char* srcdirstr = argv[1];
-    const char* destdirstr = argv[2];
+    if (Archive && isatty(STDOUT_FILENO))
+    {
+        fprintf(stderr, "Refusing to write an archive to a terminal.\n");
+        return EXIT_FAILURE;
+    }
+
+    path_filter_compile(&Filter);
 
-    DIR* srcdir = opendir(srcdirstr);
-    if (srcdir == NULL)
+    const char* srcdirstr = argv[optind];
+    const char* destdirstr = Archive ? NULL : argv[optind + 1];
+
+    backup_store store;
+    int opened = store_open(&store, srcdirstr);
+    if (opened != 0)
     {
-        perror("opendir");
+        if (opened == 1) // a missing or wrong key is reported once by store_open
+            perror(srcdirstr);
+        store_close(&store);
+        path_filter_free(&Filter);
         return EXIT_FAILURE;
     }
 
-    DIR* destdir = opendir(destdirstr);
+    if (store.count == 0)
+    {
+        fprintf(Archive ? stderr : stdout, "Nothing to restore.\n");
 
-    vector subdirsstr;
-    vector_new(&subdirsstr);
+        store_close(&store);
+        path_filter_free(&Filter);
+        return EXIT_SUCCESS;
+    }
 
-    struct dirent** dirs = NULL;
-    int size = scandir(srcdirstr, &dirs, folder_selection, alphasort);
+    int index_to_restore;
+    if (iter >= 0)
+        index_to_restore = store_find_iter(&store, iter);
+    else if (exact_time != NULL)
+    {
+        index_to_restore = store_find_before(&store, exact_time);
+        if (index_to_restore >= 0 && strcmp(store.folders[index_to_restore], exact_time) != 0)
+            index_to_restore = -1;
+    }
+    else if (before_time != NULL)
+        index_to_restore = store_find_before(&store, before_time);
+    else if (latest)
+        index_to_restore = store.count - 1;
+    else
+        index_to_restore = ask_restore_point(&store, Archive ? stderr : stdout);
 
-    for (int i = 0; i < size; ++i)
+    if (index_to_restore < 0)
     {
-        char* name = malloc(strlen(dirs[i]->d_name) + 1);
-        strcpy(name, dirs[i]->d_name);
-        vector_push_back(&subdirsstr, name);
+        if (iter >= 0 || exact_time != NULL || before_time != NULL)
+            fprintf(stderr, "Could not find the intended restore point.\n");
+
+        store_close(&store);
+        path_filter_free(&Filter);
+        return EXIT_FAILURE;
     }
 
-    if (vector_size(&subdirsstr) == 0)
+    if (Archive)
     {
-        printf("Nothing to restore.\n");
+        bool success = archive(&store, index_to_restore);
 
-        vector_free(&subdirsstr);
-        if (destdir != NULL)
-            closedir(destdir);
-        return EXIT_SUCCESS;
+        store_close(&store);
+        path_filter_free(&Filter);
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    printf("List of available restore points:\n");
+    DIR* destdir = opendir(destdirstr);
+    if (destdir == NULL)
+    {
+        if (mkdir(destdirstr, 0775) == 0)
+        {
+            destdir = opendir(destdirstr);
+            if (destdir == NULL)
+            {
+                fprintf(stderr, "Could not open directory %s after creation (%s).\n", destdirstr, strerror(errno));
+                store_close(&store);
+                path_filter_free(&Filter);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Could not create directory %s (%s).\n", destdirstr, strerror(errno));
+            store_close(&store);
+            path_filter_free(&Filter);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool success;
+    if (path_filter_is_literal(&Filter))
+        success = restore_named(&store, index_to_restore, destdirstr);
+    else
+        success = restore(&store, index_to_restore, destdirstr);
+
+    store_close(&store);
+    closedir(destdir);
+    path_filter_free(&Filter);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int ask_restore_point(const backup_store* store, FILE* out)
+{
+    fprintf(out, "List of available restore points:\n");
 
-    for (int i = 0; i < vector_size(&subdirsstr); ++i)
-        printf("\t%d - %s\n", i + 1, (char*)vector_get(&subdirsstr, i));
+    for (int i = 0; i < store->count; ++i)
+        fprintf(out, "\t%d - %s\n", i + 1, store->folders[i]);
 
     char user_input[19 + 1];
-    char* iter_to_restore = NULL;
+    int index_to_restore = -1;
     do
     {
         // User can pick restore point either by time string or iteration;
         // time string corresponds to the folder name in the backup dir, iteration start at 0;
         // if user input'ed 19 characters we assume that input is a
-        //  time string and we try to find it in subdirsstr - O(n), otherwise we assume it's a
+        //  time string and we try to find it in the store - O(log n), otherwise we assume it's a
         //  iteration - O(1)
         // if not found, we ask the user for a new restore point
 
-        printf("Which restore point (time or iteration)? ");
-        int count = scanf("%s", user_input);
-        if (count != EOF && count != 0 && count <= 19)
+        fprintf(out, "Which restore point (time or iteration)? ");
+        fflush(out);
+        int count = scanf("%19s", user_input);
+        if (count == EOF)
+            return -1;
+        else if (count != 0)
         {
             if (strlen(user_input) == 19) // strlen("2013_04_20_16_44_21")
             {
-                for (int i = 0; i < vector_size(&subdirsstr); ++i)
-                {
-                    if (strcmp((char*)vector_get(&subdirsstr, i), user_input) == 0)
-                    {
-                        iter_to_restore = user_input;
-                        break;
-                    }
-                }
+                index_to_restore = store_find_before(store, user_input);
+                if (index_to_restore >= 0 && strcmp(store->folders[index_to_restore], user_input) != 0)
+                    index_to_restore = -1;
             }
             else
             {
                 int iter = -1;
                 sscanf(user_input, "%d", &iter);
-                if (iter > 0 && iter <= vector_size(&subdirsstr))
-                {
-                    iter_to_restore = (char*)vector_get(&subdirsstr, iter - 1);
-                    break;
-                }
+                if (iter > 0 && iter <= store->count)
+                    index_to_restore = iter - 1;
             }
         }
 
-        if (iter_to_restore == NULL)
-            printf("Could not find the intended restore point. Try again.\n");
+        if (index_to_restore == -1)
+            fprintf(out, "Could not find the intended restore point. Try again.\n");
 
     }
-    while (iter_to_restore == NULL);
+    while (index_to_restore == -1);
 
-    if (destdir == NULL)
+    return index_to_restore;
+}
+
+void print_usage(bool err)
+{
+    fprintf(err ? stderr : stdout, "Usage: rstr [-u [-c]] [-R] [-k <key>] [-j <jobs>] [-i <iter> | -t <time> | -b <time> | -l]\n"
+                                   "            [-I <pattern>]... [-E <pattern>]... <srcdir> <destdir>\n"
+                                   "       rstr -T [-z] [-R] [-k <key>] [-i <iter> | -t <time> | -b <time> | -l]\n"
+                                   "            [-I <pattern>]... [-E <pattern>]... <srcdir>\n"
+                                   "       rstr -H <file> [-k <key>] <srcdir>\n"
+                                   "       rstr -H <file> -V <iter> [-R] [-k <key>] <srcdir> <destdir>\n"
+                                   "  srcdir     - directory that was used to backup;\n"
+                                   "  destdir    - destination of the restore;\n"
+                                   "  -u         - incremental: only copy, replace or remove the files of\n"
+                                   "               destdir that differ from the restore point;\n"
+                                   "  -c         - with -u, also compare the contents of the end of each file;\n"
+                                   "  -R         - check the stored data of each file against the parity of its\n"
+                                   "               iteration (see bckp -p) and rebuild it if it is damaged;\n"
+                                   "  -k key     - key file the backup was encrypted with (see bckp -k);\n"
+                                   "  -j jobs    - maximum number of files copied in parallel (default 16);\n"
+                                   "  -i iter    - restore the backup of iteration iter;\n"
+                                   "  -t time    - restore the backup made at time (YYYY_MM_DD_HH_MM_SS);\n"
+                                   "  -b time    - restore the latest backup made at or before time (or a prefix of it);\n"
+                                   "  -l         - restore the latest backup;\n"
+                                   "  -I pattern - only restore the files matching pattern (shell wildcards);\n"
+                                   "  -E pattern - do not restore the files matching pattern;\n"
+                                   "  -T         - write the restore point to stdout as a tar archive;\n"
+                                   "  -z         - with -T, compress the archive with gzip;\n"
+                                   "  -H file    - list the versions of file (its name in srcdir);\n"
+                                   "  -V iter    - with -H, restore the version of file of iteration iter.\n"
+                                   "Without -i, -t, -b or -l the restore point is asked on stdin.\n");
+}
+
+bool list_versions(const char* srcdirstr, const char* name)
+{
+    history_entry* entries;
+    int count = history_find(srcdirstr, name, &entries);
+    if (count < 0)
+        return false;
+
+    if (count == 0)
+        printf("%s has no versions.\n", name);
+
+    for (int i = 0; i < count; ++i)
     {
-        if (mkdir(destdirstr, 0775) == 0)
+        time_t mtime = entries[i].mtime / 1000000000LL;
+        char time_str[32];
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+
+        if (entries[i].state == STATE_REMOVED)
+            printf("%6d  %s  removed\n", entries[i].iter, entries[i].folder);
+        else
+            printf("%6d  %s  %-8s %12lld  %s  %016llx\n", entries[i].iter, entries[i].folder,
+                   entries[i].state == STATE_ADDED ? "added" : entries[i].state == STATE_APPENDED ? "appended" : "modified",
+                   entries[i].size, time_str, (unsigned long long)entries[i].tail_hash);
+    }
+
+    free(entries);
+    return true;
+}
+
+bool restore_version(const char* srcdirstr, const char* name, int iter, const char* destdirstr)
+{
+    history_entry* entries;
+    int count = history_find(srcdirstr, name, &entries);
+    if (count < 0)
+        return false;
+
+    int index = count - 1;
+    while (index >= 0 && entries[index].iter > iter)
+        index--;
+
+    char folder_path[PATH_MAX];
+    if (index >= 0)
+        snprintf(folder_path, sizeof(folder_path), "%s/%s", srcdirstr, entries[index].folder);
+
+    if (index < 0 || entries[index].state == STATE_REMOVED)
+    {
+        fprintf(stderr, "%s did not exist at iteration %d.\n", name, iter);
+        free(entries);
+        return false;
+    }
+
+    if (journal_exists(folder_path))
+    {
+        fprintf(stderr, "The iteration of %s was interrupted.\n", entries[index].folder);
+        free(entries);
+        return false;
+    }
+
+    file_segment* segments;
+    int segment_count = history_resolve(srcdirstr, name, entries, index, &segments);
+    if (segment_count < 0)
+    {
+        free(entries);
+        return false;
+    }
+
+    bool repaired = !Repair || repair_segments(segments, segment_count, name);
+
+    printf("\trestoring %s\t(from %s", name, segments[segment_count - 1].dir);
+    if (segment_count > 1)
+        printf(" and %d previous version%s", segment_count - 1, segment_count > 2 ? "s" : "");
+    printf(")\n");
+
+    bool success = copy_file_segments(segments, segment_count, destdirstr, name, entries[index].mtime) && repaired;
+
+    store_free_segments(segments, segment_count);
+    free(entries);
+    return success;
+}
+
+bool restore(backup_store* store, int index, const char* destdirstr)
+{
+    const backup_info* bi = store_info(store, index);
+    if (bi == NULL)
+        return false;
+
+    bool success = true;
+    int restored = 0, up_to_date = 0, removed = 0;
+
+    if (Incremental)
+        removed = remove_extra_files(bi, destdirstr);
+
+    for (int i = 0; i < file_info_list_size(&bi->file_list); ++i)
+    {
+        const file_info* file = file_info_list_get(&bi->file_list, i);
+
+        if (file->state == STATE_REMOVED || !path_filter_match(&Filter, file->file_name))
+            continue;
+
+        if (!restore_file(store, file, destdirstr, &restored, &up_to_date))
+            success = false;
+    }
+
+    if (!wait_restores())
+        success = false;
+
+    if (Incremental)
+        printf("%d file(s) restored, %d up to date, %d removed.\n", restored, up_to_date, removed);
+
+    return success;
+}
+
+bool restore_named(backup_store* store, int index, const char* destdirstr)
+{
+    bool success = true;
+    int restored = 0, up_to_date = 0, removed = 0;
+
+    file_info file;
+    file_info_new(&file, NULL);
+
+    for (int i = 0; i < vector_size(&Filter.include.literals); ++i)
+    {
+        const char* name = vector_get(&Filter.include.literals, i);
+        if (!path_filter_match(&Filter, name))
+            continue;
+
+        int found = store_find_file(store, index, name, &file);
+        if (found == EOF)
         {
-            destdir = opendir(destdirstr);
-            if (destdir == NULL)
-            {
-                fprintf(stderr, "Could not open directory %s after creation (%s).\n", srcdirstr, strerror(errno));
-                closedir(srcdir);
-                return EXIT_FAILURE;
-            }
+            success = false;
+            continue;
         }
-        else
+
+        if (found == 0 && file.state != STATE_REMOVED)
         {
-            fprintf(stderr, "Could not create directory %s (%s).\n", destdirstr, strerror(errno));
-            closedir(srcdir);
-            return EXIT_FAILURE;
+            if (!restore_file(store, &file, destdirstr, &restored, &up_to_date))
+                success = false;
+            continue;
+        }
+
+        char path[PATH_MAX];
+
+        if (!Incremental)
+            fprintf(stderr, "%s is not in the restore point.\n", name);
+        else if (path_join(path, destdirstr, name) && access(path, F_OK) == 0)
+        {
+            printf("\tremoving %s\n", name);
+            if (unlink(path) != 0)
+                perror("unlink");
+            else
+                removed++;
         }
     }
 
-    char buffer[512];
-    snprintf(buffer, 512, "%s/%s/%s", srcdirstr, iter_to_restore, BACKUP_FILE_INFO_NAME);
+    file_info_free(&file);
+    if (!wait_restores())
+        success = false;
 
-    FILE* backup_info_file = fopen(buffer, "r");
-    if (backup_info_file == NULL)
-    {
-        perror("fopen(buffer)");
+    if (Incremental)
+        printf("%d file(s) restored, %d up to date, %d removed.\n", restored, up_to_date, removed);
 
-        for (int i = 0; i < vector_size(&subdirsstr); ++i)
-            free(vector_get(&subdirsstr, i));
-        vector_free(&subdirsstr);
-        closedir(destdir);
-        return EXIT_FAILURE;
+    return success;
+}
+
+bool restore_file(backup_store* store, const file_info* file, const char* destdirstr, int* restored, int* up_to_date)
+{
+    if (Incremental && is_restored(destdirstr, file))
+    {
+        (*up_to_date)++;
+        return true;
     }
 
-    backup_info backup_to_restore;
-    backup_info_new(&backup_to_restore);
-    if (backup_info_read(backup_info_file, &backup_to_restore) != 0)
+    file_segment* segments;
+    int count = store_resolve(store, file, &segments);
+
+    if (count < 0)
+        return false;
+
+    // damaged data that could not be rebuilt is still restored, as a partial copy is better than none
+    bool repaired = !Repair || repair_segments(segments, count, file->file_name);
+
+    printf("\trestoring %s\t(from %s", file->file_name, segments[count - 1].dir);
+    if (count > 1)
+        printf(" and %d previous version%s", count - 1, count > 2 ? "s" : "");
+    printf(")\n");
+
+    fflush(stdout); // do not duplicate buffered output in the child
+    FailedCopies += wait_copies(Jobs);
+    fork_copy_file_segments(segments, count, destdirstr, file->file_name, file->mtime);
+    store_free_segments(segments, count);
+    (*restored)++;
+
+    return repaired;
+}
+
+bool wait_restores(void)
+{
+    FailedCopies += wait_copies(1);
+
+    if (FailedCopies == 0)
+        return true;
+
+    fprintf(stderr, "%d file(s) could not be restored.\n", FailedCopies);
+    FailedCopies = 0;
+    return false;
+}
+
+bool repair_segments(const file_segment* segments, int count, const char* name)
+{
+    bool success = true;
+
+    for (int i = 0; i < count; ++i)
     {
-        fprintf(stderr, "backup_info_read failed.");
+        parity_result result;
+        memset(&result, 0, sizeof(result));
 
-        for (int i = 0; i < vector_size(&subdirsstr); ++i)
-            free(vector_get(&subdirsstr, i));
-        vector_free(&subdirsstr);
-        closedir(destdir);
-        fclose(backup_info_file);
-        return EXIT_FAILURE;
+        if (parity_repair_file(segments[i].dir, name, NULL, &result) == EOF)
+            success = false;
+
+        if (result.repaired > 0)
+            fprintf(stderr, "\trepaired %lld block(s) of %s in %s\n", result.repaired, name, segments[i].dir);
     }
 
-    fclose(backup_info_file);
-    backup_info_file = NULL;
+    return success;
+}
+
+/// Vector of the file_info structs of the files of an archive
+VECTOR_DEFINE(file_info_vector, file_info, 0)
+
+/**
+ * qsort comparator of file_info structs, by iteration and then by name
+ */
+static int archive_order(const void* a, const void* b)
+{
+    const file_info* x = a;
+    const file_info* y = b;
+
+    if (x->iter != y->iter)
+        return x->iter < y->iter ? -1 : 1;
+
+    return name_compare(x->file_name, y->file_name);
+}
+
+bool archive(backup_store* store, int index)
+{
+    bool success = true;
+    file_info_vector files;
+    file_info_vector_new(&files);
 
-    struct tm tp;
-    strptime((const char*)vector_get(&subdirsstr, 0), BACKUP_FOLDER_NAME_FORMAT, &tp);
-    time_t start_time = mktime(&tp);
+    if (path_filter_is_literal(&Filter))
+    {
+        file_info file;
+        file_info_new(&file, NULL);
 
-    struct tm tp1;
-    strptime(iter_to_restore, BACKUP_FOLDER_NAME_FORMAT, &tp1);
-    time_t current_time = mktime(&tp1);
+        for (int i = 0; i < vector_size(&Filter.include.literals); ++i)
+        {
+            const char* name = vector_get(&Filter.include.literals, i);
+            if (!path_filter_match(&Filter, name))
+                continue;
+
+            int found = store_find_file(store, index, name, &file);
+            if (found == 0 && file.state != STATE_REMOVED)
+            {
+                file_info* copy = file_info_vector_emplace(&files, file_info_vector_size(&files));
+                file_info_copy(&file, &copy);
+            }
+            else
+            {
+                if (found != EOF)
+                    fprintf(stderr, "%s is not in the restore point.\n", name);
+                success = false;
+            }
+        }
 
-    int dt;
-    if (backup_to_restore.iter == 0)
-        dt = 0;
+        file_info_free(&file);
+    }
     else
-        dt = (difftime(current_time, start_time)) / backup_to_restore.iter;
+    {
+        const backup_info* bi = store_info(store, index);
+        if (bi == NULL)
+        {
+            file_info_vector_free(&files);
+            return false;
+        }
 
-    for (int i = 0; i < vector_size(&backup_to_restore.file_list); ++i)
+        for (int i = 0; i < file_info_list_size(&bi->file_list); ++i)
+        {
+            const file_info* file = file_info_list_get(&bi->file_list, i);
+
+            if (file->state != STATE_REMOVED && path_filter_match(&Filter, file->file_name))
+            {
+                file_info* copy = file_info_vector_emplace(&files, file_info_vector_size(&files));
+                file_info_copy(file, &copy);
+            }
+        }
+    }
+
+    qsort(file_info_vector_data(&files), file_info_vector_size(&files), sizeof(file_info), archive_order);
+
+    int fd = STDOUT_FILENO;
+    pid_t compressor = -1;
+    if (Compress && (compressor = spawn_compressor(&fd)) < 0)
+        success = false;
+
+    tar_writer tar;
+    if (!Compress || compressor >= 0)
     {
-        file_info* file = (file_info*)vector_get(&backup_to_restore.file_list, i);
+        tar_open(&tar, fd);
 
-        if (file->state == STATE_REMOVED)
-            continue;
+        for (int i = 0; i < file_info_vector_size(&files); ++i)
+        {
+            const file_info* file = file_info_vector_get(&files, i);
 
-        char* source_folder_name;
-        iter_to_folder(file->iter, srcdirstr, start_time, dt, &source_folder_name);
+            file_segment* segments;
+            int count = store_resolve(store, file, &segments);
 
-        printf("\trestoring %s\t(from %s)\n", file->file_name, source_folder_name);
+            if (count < 0)
+            {
+                success = false;
+                continue;
+            }
 
-        fork_copy_file(source_folder_name, destdirstr, file->file_name);
-        free(source_folder_name);
+            if (Repair && !repair_segments(segments, count, file->file_name))
+                success = false;
+
+            if (!tar_add_file(&tar, file->file_name, segments, count, file->size, file->mtime))
+                success = false;
+
+            store_free_segments(segments, count);
+        }
+
+        if (!tar_close(&tar))
+            success = false;
     }
 
-    for (int i = 0; i < vector_size(&subdirsstr); ++i)
-        free(vector_get(&subdirsstr, i));
-    vector_free(&subdirsstr);
-    closedir(destdir);
-    backup_info_free(&backup_to_restore);
+    if (compressor >= 0)
+    {
+        close(fd);
+
+        int status;
+        if (waitpid(compressor, &status, 0) != compressor || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "gzip failed.\n");
+            success = false;
+        }
+    }
+
+    for (int i = 0; i < file_info_vector_size(&files); ++i)
+        file_info_free(file_info_vector_get(&files, i));
 
-    return EXIT_SUCCESS;
+    file_info_vector_free(&files);
+    return success;
 }
 
-void print_usage(bool err)
+pid_t spawn_compressor(int* fd)
 {
-    fprintf(err ? stderr : stdout, "Usage: rstr <srcdir> <destdir>\n"
-                                   "  srcdir  - directory that was used to backup;\n"
-                                   "  destdir - destination of the restore.\n");
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        execlp("gzip", "gzip", "-c", (char*)NULL);
+        perror("execlp(gzip)");
+        _exit(127);
+    }
+
+    close(fds[0]);
+    *fd = fds[1];
+
+    return pid;
 }
 
-int folder_selection(const struct dirent* file)
+bool is_restored(const char* destdirstr, const file_info* fi)
 {
-    return file->d_type == DT_DIR && strlen(file->d_name) == 19;
+    char path[PATH_MAX];
+    struct stat buf;
+    if (!path_join(path, destdirstr, fi->file_name) || lstat(path, &buf) != 0 || !S_ISREG(buf.st_mode))
+        return false;
+
+    if (buf.st_size != fi->size || buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec != fi->mtime)
+        return false;
+
+    uint64_t hash;
+    return !CheckHash || (hash_file_tail(path, buf.st_size, &hash) && hash == fi->tail_hash);
+}
+
+int remove_extra_files(const backup_info* bi, const char* destdirstr)
+{
+    walker files;
+    if (walker_open(&files, destdirstr, NULL, NULL, NULL, 0, NULL, 0, 0) != 0)
+    {
+        walker_close(&files);
+        return 0;
+    }
+
+    // both lists are sorted by name, merge them
+    int removed = 0;
+    int i = 0;
+    int size = file_info_list_size(&bi->file_list);
+
+    for (const char* name = walker_next(&files); name != NULL; name = walker_next(&files))
+    {
+        int cmp = -1;
+        const file_info* fi = NULL;
+
+        for (; i < size; ++i)
+        {
+            fi = file_info_list_get(&bi->file_list, i);
+            cmp = name_compare(fi->file_name, name);
+            if (cmp >= 0)
+                break;
+        }
+
+        if ((cmp == 0 && fi->state != STATE_REMOVED) || !path_filter_match(&Filter, name))
+            continue;
+
+        char path[PATH_MAX];
+
+        printf("\tremoving %s\n", name);
+        if (!path_join(path, destdirstr, name) || unlink(path) != 0)
+            perror("unlink");
+        else
+            removed++;
+    }
+
+    walker_close(&files);
+    return removed;
 }
 
 /**@}*/
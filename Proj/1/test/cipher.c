@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "cipher.h"
+
+/** @defgroup test_cipher test_cipher
+ * @{
+ * Writes encrypted files, streams and sealed lines and reads them back, checks damaged and cut
+ *  ones are refused (EBADMSG), and prints the encryption and decryption throughput.
+ */
+
+/// Number of bytes written to the file whose throughput is measured
+#define BENCH_SIZE (64 * 1024 * 1024)
+
+/// Number of lines written to the encrypted stream
+#define LINE_COUNT 100000
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Writes a file of random bytes with the key and returns them
+ * @param path  Path of the file
+ * @param size  Number of bytes written, in pieces of random sizes
+ * @return      The bytes written (to be freed)
+ */
+static unsigned char* write_file(const char* path, size_t size)
+{
+    unsigned char* data = malloc(size + 1);
+    for (size_t i = 0; i < size; ++i)
+        data[i] = rand();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd != -1);
+
+    cipher_file f;
+    CHECK(cipher_file_create(&f, fd));
+
+    for (size_t written = 0; written < size; )
+    {
+        size_t n = rand() % (2 * CIPHER_CHUNK_SIZE);
+        if (n > size - written)
+            n = size - written;
+
+        CHECK(cipher_file_write(&f, data + written, n));
+        written += n;
+    }
+
+    CHECK(cipher_file_close(&f));
+    return data;
+}
+
+/**
+ * Checks a file holds size bytes of data, read sequentially and at offsets
+ */
+static void check_file(const char* path, const unsigned char* data, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    cipher_file f;
+    CHECK(fd != -1 && cipher_file_open(&f, fd));
+    CHECK(f.size == (long long)size);
+
+    unsigned char* read = malloc(size + 1);
+    size_t total = 0;
+    for (ssize_t n; (n = cipher_file_read(&f, read + total, 1000)) > 0; )
+        total += n;
+    CHECK(total == size && memcmp(read, data, size) == 0);
+
+    for (int i = 0; i < 20 && size > 0; ++i)
+    {
+        size_t offset = rand() % size, length = rand() % (3 * CIPHER_CHUNK_SIZE);
+        size_t expected = length < size - offset ? length : size - offset;
+        CHECK(cipher_file_pread(&f, read, length, offset) == (ssize_t)expected);
+        CHECK(memcmp(read, data + offset, expected) == 0);
+    }
+
+    free(read);
+    cipher_file_close(&f);
+}
+
+/**
+ * Files written, rewritten in place, cut and resumed
+ */
+static void test_files(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/file", dir);
+
+    size_t sizes[] = { 0, 1, CIPHER_CHUNK_SIZE - 1, CIPHER_CHUNK_SIZE, CIPHER_CHUNK_SIZE + 1, 3 * CIPHER_CHUNK_SIZE + 5 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        unsigned char* data = write_file(path, sizes[i]);
+        check_file(path, data, sizes[i]);
+
+        // the plaintext is not stored
+        FILE* file = fopen(path, "r");
+        char magic[sizeof(CIPHER_MAGIC)] = "";
+        CHECK(file && fread(magic, 1, strlen(CIPHER_MAGIC), file) == strlen(CIPHER_MAGIC));
+        CHECK(strcmp(magic, CIPHER_MAGIC) == 0);
+        if (file)
+            fclose(file);
+
+        free(data);
+    }
+
+    // rewritten across chunks, cut, then resumed and appended to
+    size_t size = 3 * CIPHER_CHUNK_SIZE + 5;
+    unsigned char* data = write_file(path, size);
+    data = realloc(data, size + 1000);
+
+    int fd = open(path, O_RDWR);
+    cipher_file f;
+    CHECK(fd != -1 && cipher_file_open(&f, fd));
+
+    memset(data + CIPHER_CHUNK_SIZE - 10, 'p', 20);
+    CHECK(cipher_file_pwrite(&f, data + CIPHER_CHUNK_SIZE - 10, 20, CIPHER_CHUNK_SIZE - 10));
+    size = 2 * CIPHER_CHUNK_SIZE + 7;
+    CHECK(cipher_file_truncate(&f, size));
+    CHECK(cipher_file_close(&f));
+    check_file(path, data, size);
+
+    size = CIPHER_CHUNK_SIZE + 3;
+    fd = open(path, O_RDWR);
+    CHECK(fd != -1 && cipher_file_resume(&f, fd, size));
+    memset(data + size, 'r', 1000);
+    CHECK(cipher_file_write(&f, data + size, 1000));
+    size += 1000;
+    CHECK(cipher_file_close(&f));
+    check_file(path, data, size);
+
+    free(data);
+    unlink(path);
+}
+
+/**
+ * Damaged and cut files are refused with EBADMSG
+ */
+static void test_damaged(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/damaged", dir);
+
+    size_t size = 3 * CIPHER_CHUNK_SIZE + 5;
+    unsigned char* data = write_file(path, size);
+
+    // a flipped bit in the first chunk
+    int fd = open(path, O_RDWR);
+    unsigned char byte = 0;
+    CHECK(pread(fd, &byte, 1, 100) == 1);
+    byte ^= 1;
+    CHECK(pwrite(fd, &byte, 1, 100) == 1);
+    close(fd);
+
+    fd = open(path, O_RDONLY);
+    cipher_file f;
+    errno = 0;
+    if (cipher_file_open(&f, fd))
+    {
+        CHECK(cipher_file_pread(&f, data, size, 0) == -1);
+        CHECK(errno == EBADMSG);
+        cipher_file_close(&f);
+    }
+    else
+    {
+        CHECK(errno == EBADMSG);
+        close(fd);
+    }
+
+    free(data);
+
+    // cut at a chunk boundary
+    data = write_file(path, size);
+    CHECK(truncate(path, CIPHER_HEADER_SIZE + 2 * (CIPHER_NONCE_SIZE + CIPHER_CHUNK_SIZE + CIPHER_TAG_SIZE)) == 0);
+
+    fd = open(path, O_RDONLY);
+    errno = 0;
+    CHECK(!cipher_file_open(&f, fd));
+    CHECK(errno == EBADMSG);
+    close(fd);
+
+    free(data);
+    unlink(path);
+}
+
+/**
+ * Manifests written and read through cipher_fopen
+ */
+static void test_stream(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/stream", dir);
+
+    FILE* stream = cipher_fopen(path, "w");
+    CHECK(stream);
+    if (!stream)
+        return;
+
+    long offset = 0;
+    for (int i = 0; i < LINE_COUNT; ++i)
+    {
+        if (i == LINE_COUNT / 2)
+            offset = ftell(stream);
+        fprintf(stream, "line %d\n", i);
+    }
+    fclose(stream);
+
+    stream = cipher_fopen(path, "r");
+    CHECK(stream);
+    if (!stream)
+        return;
+
+    char line[64], expected[64];
+    int count = 0;
+    while (fgets(line, sizeof(line), stream))
+    {
+        sprintf(expected, "line %d\n", count++);
+        CHECK(strcmp(line, expected) == 0);
+    }
+    CHECK(count == LINE_COUNT);
+
+    sprintf(expected, "line %d\n", LINE_COUNT / 2);
+    CHECK(fseek(stream, offset, SEEK_SET) == 0 && fgets(line, sizeof(line), stream) && strcmp(line, expected) == 0);
+    rewind(stream);
+    CHECK(fgets(line, sizeof(line), stream) && strcmp(line, "line 0\n") == 0);
+    fclose(stream);
+
+    unlink(path);
+}
+
+/**
+ * Lines of the append-only logs
+ */
+static void test_lines(void)
+{
+    for (int length = 1; length < 100; ++length)
+    {
+        char line[100], sealed[CIPHER_SEALED_SIZE(100)];
+        memset(line, 'a' + length % 26, length - 1);
+        line[length - 1] = '\n';
+
+        int n = cipher_seal_line(line, length, sealed);
+        CHECK(n > 0 && sealed[n - 1] == '\n');
+        CHECK(cipher_open_line(sealed, n) == length && memcmp(sealed, line, length) == 0);
+
+        // changed or cut (lines are opened in place, so they are sealed again)
+        n = cipher_seal_line(line, length, sealed);
+        sealed[n / 2] ^= 1;
+        CHECK(cipher_open_line(sealed, n) == -1);
+        n = cipher_seal_line(line, length, sealed);
+        CHECK(cipher_open_line(sealed + 4, n - 4) == -1);
+    }
+}
+
+/**
+ * Times writing and reading BENCH_SIZE bytes
+ */
+static void bench(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/bench", dir);
+
+    unsigned char* data = malloc(CIPHER_CHUNK_SIZE);
+    memset(data, 'b', CIPHER_CHUNK_SIZE);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    cipher_file f;
+    CHECK(fd != -1 && cipher_file_create(&f, fd));
+    for (long long written = 0; written < BENCH_SIZE; written += CIPHER_CHUNK_SIZE)
+        CHECK(cipher_file_write(&f, data, CIPHER_CHUNK_SIZE));
+    CHECK(cipher_file_close(&f));
+
+    double write_seconds = elapsed(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    fd = open(path, O_RDONLY);
+    CHECK(fd != -1 && cipher_file_open(&f, fd));
+    long long total = 0;
+    for (ssize_t n; (n = cipher_file_read(&f, data, CIPHER_CHUNK_SIZE)) > 0; )
+        total += n;
+    CHECK(total == BENCH_SIZE);
+    cipher_file_close(&f);
+
+    double read_seconds = elapsed(&start);
+
+    printf("test_cipher: %d MB, write %.1f MB/s, read %.1f MB/s\n", BENCH_SIZE / (1024 * 1024),
+           BENCH_SIZE / 1e6 / write_seconds, BENCH_SIZE / 1e6 / read_seconds);
+
+    free(data);
+    unlink(path);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/test_cipherXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    // a key of hexadecimal digits
+    char key_path[PATH_MAX];
+    snprintf(key_path, sizeof(key_path), "%s/key", dir);
+    FILE* key = fopen(key_path, "w");
+    CHECK(key && fchmod(fileno(key), 0600) == 0);
+    if (key)
+    {
+        srand(3);
+        for (int i = 0; i < CIPHER_KEY_SIZE; ++i)
+            fprintf(key, "%02x", rand() & 0xff);
+        fprintf(key, "\n");
+        fclose(key);
+    }
+
+    CHECK(cipher_load_key(key_path) && cipher_enabled());
+
+    if (cipher_enabled())
+    {
+        test_files(dir);
+        test_damaged(dir);
+        test_stream(dir);
+        test_lines();
+        bench(dir);
+    }
+
+    unlink(key_path);
+    CHECK(rmdir(dir) == 0);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_cipher: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_cipher: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
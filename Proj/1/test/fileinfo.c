@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backupinfo.h"
+#include "fileinfo.h"
+#include "frontcode.h"
+
+/** @defgroup test_fileinfo test_fileinfo
+ * @{
+ * Writes backup infos and reads them back, entry by entry and with backup_info_find.
+ */
+
+/// Number of generated names, so several front coding blocks are written
+#define NAME_COUNT (NAME_DICT_RESTART_INTERVAL * 4)
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Compares strings in byte order (the order of backup infos)
+ */
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/**
+ * Writes names (sorted) to a backup info and checks they are read back unchanged
+ * @param names Names of the entries
+ * @param count Number of names
+ */
+static void round_trip(char** names, int count)
+{
+    qsort(names, count, sizeof(char*), compare_names);
+
+    FILE* file = tmpfile();
+    CHECK(file);
+    if (!file)
+        return;
+
+    backup_info_writer writer;
+    CHECK(backup_info_writer_open(&writer, file, 3) == 0);
+
+    for (int i = 0; i < count; ++i)
+    {
+        file_info fi;
+        file_info_new(&fi, names[i]);
+        fi.iter = 3;
+        fi.size = i;
+        CHECK(backup_info_writer_add(&writer, &fi) == 0);
+        file_info_free(&fi);
+    }
+
+    backup_info_writer_close(&writer);
+    rewind(file);
+
+    int iter;
+    CHECK(backup_info_read_header(file, &iter) == 0 && iter == 3);
+
+    file_info fi;
+    file_info_new(&fi, NULL);
+
+    int read = 0;
+    while (file_info_read(file, &fi) != EOF)
+    {
+        CHECK(read < count && strcmp(fi.file_name, names[read]) == 0 && fi.size == read);
+        read++;
+    }
+    CHECK(read == count);
+
+    for (int i = 0; i < count; ++i)
+    {
+        CHECK(backup_info_find(file, names[i], &fi) == 0);
+        CHECK(strcmp(fi.file_name, names[i]) == 0 && fi.size == i);
+    }
+
+    CHECK(backup_info_find(file, "a  ", &fi) == 1);
+
+    file_info_free(&fi);
+    fclose(file);
+}
+
+/**
+ * Names whose front coded suffix starts with spaces
+ */
+static void test_spaces(void)
+{
+    char* names[] = { "a", "a b", "a  c", " a", "  a", "a ", "b/ c/  d", "b/ c/ d" };
+    round_trip(names, sizeof(names) / sizeof(names[0]));
+
+    // every restart entry starts with a space
+    char* generated[NAME_COUNT];
+    for (int i = 0; i < NAME_COUNT; ++i)
+    {
+        generated[i] = malloc(16);
+        sprintf(generated[i], " dir/ %03d", i);
+    }
+
+    round_trip(generated, NAME_COUNT);
+
+    for (int i = 0; i < NAME_COUNT; ++i)
+        free(generated[i]);
+}
+
+/**
+ * Names longer than the buffers of the reader, in and out of a shared prefix
+ */
+static void test_long_names(void)
+{
+    char* names[NAME_COUNT];
+    for (int i = 0; i < NAME_COUNT; ++i)
+    {
+        size_t length = 500 + i * 100;
+        names[i] = malloc(length + 1);
+        memset(names[i], 'a' + i % 3, length);
+        sprintf(names[i] + length - 4, "%04d", i);
+    }
+
+    round_trip(names, NAME_COUNT);
+
+    for (int i = 0; i < NAME_COUNT; ++i)
+        free(names[i]);
+}
+
+int main(void)
+{
+    test_spaces();
+    test_long_names();
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_fileinfo: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_fileinfo: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
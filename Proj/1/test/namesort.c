@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+
+#include "namesort.h"
+
+/** @defgroup test_namesort test_namesort
+ * @{
+ * Checks name_sort against a byte order qsort, and times it against the strcoll order of alphasort.
+ *
+ * Usage: test_namesort [count], count being the number of names (1000000 by default).
+ */
+
+/// Number of names sorted by default
+#define DEFAULT_COUNT 1000000
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * qsort comparator in byte order
+ */
+static int byte_compare(const void* a, const void* b)
+{
+    return name_compare(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * qsort comparator in the order of the locale, the one of alphasort
+ */
+static int locale_compare(const void* a, const void* b)
+{
+    return strcoll(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Paths of a tree, in random order: long shared prefixes, a few non-ASCII bytes and
+ *  names that only differ in case
+ */
+static char** make_names(int count)
+{
+    static const char* const exts[] = { ".c", ".h", ".o", ".txt", "", ".\xc3\xa9t\xc3\xa9" };
+    char** names = malloc(count * sizeof(char*));
+    char buffer[128];
+
+    srand(42);
+    for (int i = 0; i < count; ++i)
+    {
+        int r = rand();
+        snprintf(buffer, sizeof(buffer), "%s%03d/sub%02d/%s_%07d%s", r % 2 ? "src/" : "Src/", r % 100, (r / 100) % 30,
+                 r % 3 ? "file" : "File", i, exts[(r / 3000) % 6]);
+        names[i] = strdup(buffer);
+    }
+
+    return names;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char** names = make_names(count);
+    char** expected = malloc(count * sizeof(char*));
+    char** collated = malloc(count * sizeof(char*));
+    memcpy(expected, names, count * sizeof(char*));
+    memcpy(collated, names, count * sizeof(char*));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    name_sort(names, count);
+    double radix_seconds = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    qsort(expected, count, sizeof(char*), byte_compare);
+    double qsort_seconds = elapsed(&start);
+
+    for (int i = 0; i < count; ++i)
+        CHECK(names[i] == expected[i] || strcmp(names[i], expected[i]) == 0);
+
+    // the order of alphasort, in the locale of the environment
+    setlocale(LC_ALL, "");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    qsort(collated, count, sizeof(char*), locale_compare);
+    double collate_seconds = elapsed(&start);
+
+    printf("test_namesort: %d names, name_sort %.3f s, qsort byte order %.3f s, qsort strcoll (%s) %.3f s (%.1fx)\n",
+           count, radix_seconds, qsort_seconds, setlocale(LC_COLLATE, NULL), collate_seconds,
+           radix_seconds > 0 ? collate_seconds / radix_seconds : 0);
+
+    for (int i = 0; i < count; ++i)
+        free(names[i]);
+    free(names);
+    free(expected);
+    free(collated);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_namesort: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_namesort: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
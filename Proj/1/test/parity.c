@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "parity.h"
+#include "backupinfo.h"
+#include "cipher.h"
+#include "fileinfo.h"
+#include "utilities.h"
+
+/** @defgroup test_parity test_parity
+ * @{
+ * Builds the parity set of an iteration folder, damages its files and parity, and checks they
+ *  are repaired (or reported lost), then that its header names no file once a key is loaded.
+ *  Prints the encoding and repair throughput.
+ */
+
+/// Number of data shards of the set
+#define DATA_SHARDS 4
+
+/// Number of parity shards of the set
+#define PARITY_SHARDS 2
+
+/// Iteration of the folder
+#define ITER 0
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * A stored file and the content it must have
+ */
+typedef struct
+{
+    const char* name; ///< Name of the file in the folder
+    size_t size; ///< Size of the file
+    unsigned char* data; ///< Content of the file
+} stored_file;
+
+/// Files of the folder, in the order of the backup info
+static stored_file Files[] =
+{
+    { "big", 5000000, NULL },
+    { "empty", 0, NULL },
+    { "mid", 3300000, NULL },
+    { "small", 100, NULL },
+};
+
+/// Number of files of the folder
+#define FILE_COUNT ((int)(sizeof(Files) / sizeof(Files[0])))
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Writes size bytes of data at offset of a file of the folder (truncating it to size if offset is negative)
+ */
+static void damage(const char* dir, const char* name, long long offset, const void* data, size_t size)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    if (offset < 0)
+    {
+        CHECK(truncate(path, size) == 0);
+        return;
+    }
+
+    FILE* file = fopen(path, "r+");
+    CHECK(file);
+    if (!file)
+        return;
+
+    fseek(file, offset, SEEK_SET);
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+/**
+ * Checks a file of the folder has the content it was stored with
+ */
+static bool same_content(const char* dir, const stored_file* sf)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, sf->name);
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    unsigned char* data = malloc(sf->size + 1);
+    size_t read = fread(data, 1, sf->size + 1, file);
+    bool same = read == sf->size && memcmp(data, sf->data, sf->size) == 0;
+
+    free(data);
+    fclose(file);
+    return same;
+}
+
+/**
+ * Creates the files of the folder (the same ones every time) and its backup info, encrypted if a key is loaded
+ */
+static void create_folder(const char* dir)
+{
+    char path[PATH_MAX];
+    srand(7);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, BACKUP_FILE_INFO_NAME);
+    FILE* info = cipher_fopen(path, "w");
+    CHECK(info);
+    if (!info)
+        return;
+
+    backup_info_writer writer;
+    CHECK(backup_info_writer_open(&writer, info, ITER) == 0);
+
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        if (Files[i].data == NULL)
+        {
+            Files[i].data = malloc(Files[i].size + 1);
+            for (size_t j = 0; j < Files[i].size; ++j)
+                Files[i].data[j] = rand();
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", dir, Files[i].name);
+        FILE* file = fopen(path, "w");
+        CHECK(file);
+        if (file)
+        {
+            fwrite(Files[i].data, 1, Files[i].size, file);
+            fclose(file);
+        }
+
+        file_info fi;
+        file_info_new(&fi, Files[i].name);
+        fi.state = STATE_ADDED;
+        fi.iter = ITER;
+        fi.size = Files[i].size;
+        CHECK(backup_info_writer_add(&writer, &fi) == 0);
+        file_info_free(&fi);
+    }
+
+    backup_info_writer_close(&writer);
+    fclose(info);
+}
+
+/**
+ * Repairs every file of the folder and checks their content
+ * @return Counters of the repair
+ */
+static parity_result repair_files(const char* dir)
+{
+    parity_result result;
+    memset(&result, 0, sizeof(result));
+
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        CHECK(parity_repair_file(dir, Files[i].name, NULL, &result) == 0);
+        CHECK(same_content(dir, &Files[i]));
+    }
+
+    return result;
+}
+
+/**
+ * Builds the parity set with a key loaded, and checks its header does not show the stored files
+ *  and the set still repairs them
+ */
+static void test_sealed(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/key", dir);
+    FILE* key = fopen(path, "w");
+    CHECK(key && fchmod(fileno(key), 0600) == 0);
+    if (!key)
+        return;
+
+    for (int i = 0; i < CIPHER_KEY_SIZE; ++i)
+        fprintf(key, "%02x", rand() & 0xff);
+    fprintf(key, "\n");
+    fclose(key);
+
+    CHECK(cipher_load_key(path));
+    CHECK(unlink(path) == 0);
+
+    create_folder(dir);
+    CHECK(parity_build_folder(dir, DATA_SHARDS, PARITY_SHARDS, NULL));
+
+    snprintf(path, sizeof(path), "%s/%s", dir, PARITY_NAME);
+    FILE* file = fopen(path, "r");
+    CHECK(file);
+    if (file)
+    {
+        char header[4096];
+        size_t size = fread(header, 1, sizeof(header) - 1, file);
+        header[size] = '\0';
+        fclose(file);
+        CHECK(strncmp(header, "parity ", 7) != 0 && strstr(header, " small\n") == NULL);
+    }
+
+    damage(dir, "mid", 10, "ZZZZ", 4);
+    parity_result result = repair_files(dir);
+    CHECK(result.damaged > 0 && result.repaired == result.damaged && result.lost == 0);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/test_parityXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    create_folder(dir);
+
+    long long total = 0;
+    for (int i = 0; i < FILE_COUNT; ++i)
+        total += Files[i].size;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(parity_build_folder(dir, DATA_SHARDS, PARITY_SHARDS, NULL));
+    double build_seconds = elapsed(&start);
+
+    // nothing to repair
+    parity_result result = repair_files(dir);
+    CHECK(result.blocks > 0 && result.damaged == 0);
+
+    // a bad sector, a truncated file and a lost one
+    damage(dir, "big", 2000000, "XXXXXXXXXXXXXXXX", 16);
+    damage(dir, "mid", -1, NULL, 3000000);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/small", dir);
+    CHECK(unlink(path) == 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = repair_files(dir);
+    double repair_seconds = elapsed(&start);
+    CHECK(result.damaged > 0 && result.repaired == result.damaged && result.lost == 0);
+
+    // damaged parity
+    snprintf(path, sizeof(path), "%s/%s", dir, PARITY_NAME);
+    FILE* file = fopen(path, "r");
+    CHECK(file);
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fclose(file);
+        damage(dir, PARITY_NAME, size - 1000, "YYYY", 4);
+    }
+
+    memset(&result, 0, sizeof(result));
+    CHECK(parity_repair_folder(dir, NULL, &result) == 0);
+    CHECK(result.damaged > 0 && result.repaired == result.damaged);
+    memset(&result, 0, sizeof(result));
+    CHECK(parity_repair_folder(dir, NULL, &result) == 0);
+    CHECK(result.damaged == 0);
+
+    // more damaged shards at an offset than parity shards
+    long long shard_size = (total + DATA_SHARDS - 1) / DATA_SHARDS;
+    for (int s = 0; s <= PARITY_SHARDS; ++s)
+        damage(dir, "big", s * shard_size + 10, "Q", 1);
+
+    memset(&result, 0, sizeof(result));
+    CHECK(parity_repair_file(dir, "big", NULL, &result) == EOF);
+    CHECK(result.lost > 0);
+
+    printf("test_parity: %d+%d shards of %lld bytes, build %.1f MB/s, repair %.1f MB/s\n", DATA_SHARDS, PARITY_SHARDS,
+           total, total / 1e6 / build_seconds, total / 1e6 / repair_seconds);
+
+    test_sealed(dir);
+
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, Files[i].name);
+        unlink(path);
+        free(Files[i].data);
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, BACKUP_FILE_INFO_NAME);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", dir, PARITY_NAME);
+    unlink(path);
+    CHECK(rmdir(dir) == 0);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_parity: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_parity: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include "rules.h"
+
+/** @defgroup test_rules test_rules
+ * @{
+ * Checks the include and exclude rules, on cases of the gitignore syntax and against fnmatch on
+ *  random rules and paths, and times them against fnmatch on a typical rules file.
+ *
+ * Usage: test_rules [count], count being the number of paths timed (1000000 by default).
+ */
+
+/// Number of paths timed by default
+#define DEFAULT_COUNT 1000000
+
+/// Number of random rule sets compared with fnmatch
+#define RANDOM_SETS 200
+
+/// Number of random paths checked against each random rule set
+#define RANDOM_PATHS 500
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Rule as fnmatch matches it
+ */
+typedef struct
+{
+    const char* pattern; ///< Pattern, without '!', its leading and its trailing '/'
+    bool negated; ///< Includes what it matches
+    bool dir_only; ///< Only matches directories
+    bool anchored; ///< Matched against the whole path
+} reference_rule;
+
+/// Rules of a typical project
+static const char* const TypicalRules[] =
+{
+    "# build outputs", "*.o", "*.a", "*.so", "*.obj", "*.exe", "*.class", "*.pyc", "*.d", "*.tmp", "*~",
+    "*.swp", ".#*", "build/", "dist/", "bin/", "obj/", "out/", "target/", "node_modules/", "__pycache__/",
+    ".cache/", ".git/", ".svn/", ".idea/", ".vscode/", "*.log", "!important.log", "/tmp", "/coverage",
+    "doc/**/*.pdf", "**/generated/*.c", "*.[oa]-*", "core.[0-9]*", "Thumbs.db", ".DS_Store", "*.bak",
+    "src/**/test_*.dat", "!src/keep/**",
+};
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Checks if an entry is excluded by rules
+ * @param rules Rules, separated by '\n'
+ */
+static bool excluded(const char* rules, const char* path, bool is_dir)
+{
+    rule_set set;
+    rule_set_new(&set);
+
+    char* copy = strdup(rules);
+    for (char* line = strtok(copy, "\n"); line != NULL; line = strtok(NULL, "\n"))
+        CHECK(rule_set_add(&set, line));
+    free(copy);
+
+    bool result = rule_set_excludes(&set, path, is_dir);
+    rule_set_free(&set);
+    return result;
+}
+
+/**
+ * Cases of the gitignore syntax
+ */
+static void test_syntax(void)
+{
+    CHECK(!excluded("", "a.o", false));
+    CHECK(excluded("*.o", "a.o", false) && excluded("*.o", "src/deep/a.o", false));
+    CHECK(!excluded("*.o", "a.c", false) && !excluded("*.o", "a.o/b", false));
+
+    // the last rule that matches decides
+    CHECK(!excluded("*.log\n!keep.log", "d/keep.log", false));
+    CHECK(excluded("!keep.log\n*.log", "d/keep.log", false));
+
+    // directories only
+    CHECK(excluded("build/", "a/build", true) && !excluded("build/", "a/build", false));
+
+    // anchored
+    CHECK(excluded("/tmp", "tmp", true) && !excluded("/tmp", "a/tmp", true));
+    CHECK(excluded("a/b", "a/b", false) && !excluded("a/b", "x/a/b", false));
+    CHECK(excluded("a/*/c", "a/b/c", false) && !excluded("a/*/c", "a/b/d/c", false));
+
+    // "**"
+    CHECK(excluded("**/gen", "gen", true) && excluded("**/gen", "x/y/gen", true));
+    CHECK(excluded("doc/**/*.pdf", "doc/a.pdf", false) && excluded("doc/**/*.pdf", "doc/x/y/a.pdf", false));
+    CHECK(!excluded("doc/**/*.pdf", "src/doc/a.pdf", false));
+    CHECK(excluded("logs/**", "logs/a/b", false) && !excluded("logs/**", "logs", true));
+    CHECK(excluded("a**b", "axxb", false) && !excluded("a**b", "ax/b", false));
+
+    // wildcards and classes do not match '/'
+    CHECK(excluded("a?c", "abc", false) && !excluded("/a?c", "a/c", false));
+    CHECK(excluded("[a-c]x", "bx", false) && !excluded("[!a-c]x", "bx", false) && excluded("[^a-c]x", "dx", false));
+
+    // comments, blank lines, quoting and trailing blanks
+    CHECK(!excluded("# a.o\n\n   ", "# a.o", false));
+    CHECK(excluded("\\#a", "#a", false) && excluded("\\!a", "!a", false));
+    CHECK(excluded("a\\*", "a*", false) && !excluded("a\\*", "ab", false));
+    CHECK(excluded("a.o   ", "a.o", false) && excluded("a\\ ", "a ", false));
+
+    // suffixes of several lengths, literal names and paths together
+    const char* mixed = "*.o\n*.tmp\n*~\nMakefile\n/src/main.c\n!keep.tmp";
+    CHECK(excluded(mixed, "x/a.tmp", false) && excluded(mixed, "x/a~", false) && excluded(mixed, "Makefile", false));
+    CHECK(excluded(mixed, "src/main.c", false) && !excluded(mixed, "x/src/main.c", false));
+    CHECK(!excluded(mixed, "keep.tmp", false) && !excluded(mixed, "a.c", false));
+
+    rule_set set;
+    rule_set_new(&set);
+    CHECK(!rule_set_add(&set, "a\\"));
+    CHECK(!rule_set_add(&set, "/"));
+    rule_set_free(&set);
+}
+
+/**
+ * Parses a rule like rule_set_add, for fnmatch
+ */
+static reference_rule reference_parse(char* rule)
+{
+    reference_rule r;
+    r.negated = rule[0] == '!';
+    if (r.negated)
+        rule++;
+
+    r.dir_only = false;
+    for (size_t end = strlen(rule); end > 0 && rule[end - 1] == '/'; --end)
+    {
+        rule[end - 1] = '\0';
+        r.dir_only = true;
+    }
+
+    r.anchored = strchr(rule, '/') != NULL;
+    while (*rule == '/')
+        rule++;
+
+    r.pattern = rule;
+    return r;
+}
+
+/**
+ * Checks if an entry is excluded by rules, with fnmatch
+ */
+static bool reference_excludes(const reference_rule* rules, int count, const char* path, bool is_dir)
+{
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL ? slash + 1 : path;
+
+    for (int i = count - 1; i >= 0; --i)
+        if ((!rules[i].dir_only || is_dir) && fnmatch(rules[i].pattern, rules[i].anchored ? path : name, FNM_PATHNAME) == 0)
+            return !rules[i].negated;
+
+    return false;
+}
+
+/**
+ * Random rules (without "**", which fnmatch does not know) and paths, compared with fnmatch
+ */
+static void test_random(void)
+{
+    static const char* const patterns[] =
+    {
+        "a", "b", "ab", "*.o", "a*", "*b", "?b", "[ab]*", "[!a]?", "a/b", "/a", "/ab/", "a/*/c", "*/b",
+        "*.t?t", "x.o", "y.txt", "*a*b*", "c", "[a-c].o", "*.txt", "a/b/c", "b/*",
+    };
+    static const char* const components[] = { "a", "b", "ab", "x.o", "ba", "c", "y.txt", "a.tmt", "b.o", "abab" };
+    const int pattern_count = sizeof(patterns) / sizeof(patterns[0]);
+    const int component_count = sizeof(components) / sizeof(components[0]);
+
+    srand(11);
+    for (int s = 0; s < RANDOM_SETS; ++s)
+    {
+        rule_set set;
+        rule_set_new(&set);
+
+        int count = 1 + rand() % 8;
+        char texts[8][16];
+        reference_rule rules[8];
+
+        for (int i = 0; i < count; ++i)
+        {
+            int r = rand();
+            snprintf(texts[i], sizeof(texts[i]), "%s%s%s", r % 4 == 0 ? "!" : "", patterns[(r / 4) % pattern_count],
+                     (r / 100) % 5 == 0 ? "/" : "");
+            CHECK(rule_set_add(&set, texts[i]));
+            rules[i] = reference_parse(texts[i]);
+        }
+
+        for (int p = 0; p < RANDOM_PATHS; ++p)
+        {
+            char path[64] = "";
+            int depth = 1 + rand() % 3;
+            for (int d = 0; d < depth; ++d)
+                sprintf(path + strlen(path), "%s%s", d > 0 ? "/" : "", components[rand() % component_count]);
+
+            bool is_dir = rand() % 2;
+            CHECK(rule_set_excludes(&set, path, is_dir) == reference_excludes(rules, count, path, is_dir));
+        }
+
+        rule_set_free(&set);
+    }
+}
+
+/**
+ * Times the typical rules on count paths, against fnmatch (its rules without "**")
+ */
+static void bench(int count)
+{
+    static const char* const dirs[] = { "src", "src/lib", "src/app/ui", "doc", "doc/api", "build", "test/data" };
+    static const char* const exts[] = { ".c", ".h", ".o", ".txt", ".log", ".pdf", "", ".tmp", ".dat" };
+    const int rule_count = sizeof(TypicalRules) / sizeof(TypicalRules[0]);
+
+    rule_set set;
+    rule_set_new(&set);
+    char texts[sizeof(TypicalRules) / sizeof(TypicalRules[0])][32];
+    reference_rule rules[sizeof(TypicalRules) / sizeof(TypicalRules[0])];
+    int reference_count = 0;
+
+    for (int i = 0; i < rule_count; ++i)
+    {
+        CHECK(rule_set_add(&set, TypicalRules[i]));
+        if (TypicalRules[i][0] != '#' && strstr(TypicalRules[i], "**") == NULL)
+        {
+            snprintf(texts[reference_count], sizeof(texts[0]), "%s", TypicalRules[i]);
+            rules[reference_count] = reference_parse(texts[reference_count]);
+            reference_count++;
+        }
+    }
+
+    char (*paths)[64] = malloc(count * sizeof(*paths));
+    srand(5);
+    for (int i = 0; i < count; ++i)
+    {
+        int r = rand();
+        snprintf(paths[i], sizeof(paths[i]), "%s/file%d%s", dirs[r % 7], r % 1000, exts[(r / 7) % 9]);
+    }
+
+    struct timespec start;
+    int excluded_count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; ++i)
+        excluded_count += rule_set_excludes(&set, paths[i], false);
+    double rules_seconds = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int reference_excluded = 0;
+    for (int i = 0; i < count; ++i)
+        reference_excluded += reference_excludes(rules, reference_count, paths[i], false);
+    double reference_seconds = elapsed(&start);
+
+    CHECK(excluded_count > 0 && excluded_count < count);
+    printf("test_rules: %d paths, %d rules, rule_set_excludes %.1f ns/path, fnmatch %.1f ns/path (%d excluded, %d)\n",
+           count, set.count, rules_seconds * 1e9 / count, reference_seconds * 1e9 / count, excluded_count,
+           reference_excluded);
+
+    free(paths);
+    rule_set_free(&set);
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    test_syntax();
+    test_random();
+    bench(count);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_rules: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_rules: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
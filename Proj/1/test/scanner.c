@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/resource.h>
+
+#include "scanner.h"
+#include "namesort.h"
+
+/** @defgroup test_scanner test_scanner
+ * @{
+ * Scans a directory with budgets that spill more runs than are stored inline, and checks the order.
+ *  A scan whose runs can not be spilled returns no name.
+ */
+
+/// Number of files created in the scanned directory
+#define FILE_COUNT 2000
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Scans dir with a memory budget and checks every file is returned once, in byte order
+ */
+static void check_scan(const char* dir, size_t mem_budget, int min_runs)
+{
+    scanner s;
+    CHECK(scanner_open(&s, dir, NULL, NULL, mem_budget) == 0);
+    CHECK(scanner_run_vector_size(&s.runs) >= min_runs);
+
+    char previous[NAME_MAX + 2] = "";
+    int count = 0;
+
+    for (const char* name = scanner_next(&s); name != NULL; name = scanner_next(&s))
+    {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        CHECK(count == 0 || name_compare(previous, name) < 0);
+        snprintf(previous, sizeof(previous), "%s", name);
+        count++;
+    }
+
+    CHECK(count == FILE_COUNT);
+    scanner_close(&s);
+}
+
+/**
+ * Scans dir with no descriptor left for a run once the directory is opened
+ */
+static void check_failed_spill(const char* dir)
+{
+    struct rlimit limit;
+    CHECK(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+    int next_fd = dup(0);
+    close(next_fd);
+
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = next_fd + 1;
+    CHECK(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    scanner s;
+    CHECK(scanner_open(&s, dir, NULL, NULL, 256) != 0);
+    CHECK(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+    CHECK(s.count == 0 && scanner_next(&s) == NULL);
+    scanner_close(&s);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/test_scannerXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    char path[PATH_MAX];
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        // not created in order
+        snprintf(path, sizeof(path), "%s/f%d", dir, (i * 7919) % FILE_COUNT);
+        FILE* file = fopen(path, "w");
+        CHECK(file != NULL);
+        if (file != NULL)
+            fclose(file);
+    }
+
+    check_scan(dir, 0, 0);
+    check_scan(dir, 4096, 5); // more runs than scanner_run_vector stores inline
+    check_scan(dir, 256, 50);
+    check_failed_spill(dir);
+
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_scanner: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_scanner: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
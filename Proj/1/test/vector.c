@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vector.h"
+
+/** @defgroup test_vector test_vector
+ * @{
+ * Checks the vectors declared with VECTOR_DEFINE, and times them against vector holding
+ *  allocated elements, counting the allocations of both.
+ *
+ * Usage: test_vector [count], count being the number of elements (1000000 by default).
+ */
+
+/// Number of elements added by default
+#define DEFAULT_COUNT 1000000
+
+/// Number of insertions and removals at the front (each moves every element)
+#define FRONT_COUNT 200
+
+/**
+ * Element of the vectors, the size of a scanner run
+ */
+typedef struct
+{
+    long long offset; ///< Some offset
+    long long length; ///< Some length
+    int index; ///< Number of the element
+} element;
+
+VECTOR_DEFINE(element_vector, element, 4)
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Inline storage, growth, insertion and removal
+ */
+static void test_operations(void)
+{
+    element_vector v;
+    element_vector_new(&v);
+    CHECK(element_vector_size(&v) == 0 && element_vector_capacity(&v) == 4);
+
+    // stored inline
+    for (int i = 0; i < 4; ++i)
+        element_vector_push_back(&v, (element) { i, i, i });
+    CHECK(v.heap == NULL && element_vector_data(&v) == v.local);
+
+    // a copy is independent while heap is NULL
+    element_vector copy = v;
+    element_vector_get(&copy, 0)->index = 100;
+    CHECK(element_vector_get(&v, 0)->index == 0);
+
+    // moved to the heap
+    element_vector_insert(&v, (element) { -1, -1, -1 }, 0);
+    CHECK(v.heap != NULL && element_vector_capacity(&v) >= 5);
+
+    for (int i = 4; i < 1000; ++i)
+        element_vector_push_back(&v, (element) { i, i, i });
+    CHECK(element_vector_size(&v) == 1001);
+
+    for (int i = 0; i < 1001; ++i)
+        CHECK(element_vector_get(&v, i)->index == i - 1);
+
+    element_vector_erase(&v, 0);
+    element_vector_erase(&v, 500);
+    element_vector_emplace(&v, 500)->index = 500;
+    element_vector_erase(&v, element_vector_size(&v) - 1);
+    CHECK(element_vector_size(&v) == 999);
+
+    for (int i = 0; i < 999; ++i)
+        CHECK(element_vector_get(&v, i)->index == i);
+
+    element_vector_reserve(&v, 5000);
+    CHECK(element_vector_capacity(&v) == 5000 && element_vector_get(&v, 998)->index == 998);
+
+    element_vector_free(&v);
+    CHECK(element_vector_size(&v) == 0 && v.heap == NULL);
+}
+
+/// Phases of the benchmark, timed separately
+enum { PHASE_PUSH, PHASE_FRONT, PHASE_GET, PHASE_COUNT };
+
+/// Names of the phases
+static const char* const PhaseNames[PHASE_COUNT] = { "push_back", "insert/erase at front", "get" };
+
+/**
+ * Adds count elements, inserts and removes FRONT_COUNT at the front, and reads them all
+ * @param  count       Number of elements added
+ * @param  seconds     Time of each phase, added to
+ * @param  allocations Number of allocations, added to
+ * @return             Sum of the indexes read, so the reads are not optimized out
+ */
+static long long bench_typed(int count, double seconds[PHASE_COUNT], long long* allocations)
+{
+    element_vector v;
+    element_vector_new(&v);
+    long long sum = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; ++i)
+    {
+        int capacity = element_vector_capacity(&v);
+        element_vector_push_back(&v, (element) { i, i, i });
+        *allocations += element_vector_capacity(&v) != capacity;
+    }
+    seconds[PHASE_PUSH] += elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < FRONT_COUNT; ++i)
+    {
+        int capacity = element_vector_capacity(&v);
+        element_vector_insert(&v, (element) { i, i, i }, 0);
+        *allocations += element_vector_capacity(&v) != capacity;
+    }
+
+    for (int i = 0; i < FRONT_COUNT; ++i)
+        element_vector_erase(&v, 0);
+    seconds[PHASE_FRONT] += elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < element_vector_size(&v); ++i)
+        sum += element_vector_get(&v, i)->index;
+    seconds[PHASE_GET] += elapsed(&start);
+
+    element_vector_free(&v);
+    return sum;
+}
+
+/**
+ * Same operations as bench_typed, with vector and an allocation per element
+ */
+static long long bench_pointers(int count, double seconds[PHASE_COUNT], long long* allocations)
+{
+    vector v;
+    vector_new(&v);
+    long long sum = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; ++i)
+    {
+        int capacity = vector_capacity(&v);
+        element* e = malloc(sizeof(element));
+        *e = (element) { i, i, i };
+        vector_push_back(&v, e);
+        *allocations += 1 + (vector_capacity(&v) != capacity);
+    }
+    seconds[PHASE_PUSH] += elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < FRONT_COUNT; ++i)
+    {
+        int capacity = vector_capacity(&v);
+        element* e = malloc(sizeof(element));
+        *e = (element) { i, i, i };
+        vector_insert(&v, e, 0);
+        *allocations += 1 + (vector_capacity(&v) != capacity);
+    }
+
+    for (int i = 0; i < FRONT_COUNT; ++i)
+    {
+        free(vector_get(&v, 0));
+        vector_erase(&v, 0);
+    }
+    seconds[PHASE_FRONT] += elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < vector_size(&v); ++i)
+        sum += ((element*)vector_get(&v, i))->index;
+    seconds[PHASE_GET] += elapsed(&start);
+
+    for (int i = 0; i < vector_size(&v); ++i)
+        free(vector_get(&v, i));
+    vector_free(&v);
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    test_operations();
+
+    long long typed_allocations = 0, pointer_allocations = 0;
+    double typed_seconds[PHASE_COUNT] = { 0 }, pointer_seconds[PHASE_COUNT] = { 0 };
+
+    long long typed_sum = bench_typed(count, typed_seconds, &typed_allocations);
+    long long pointer_sum = bench_pointers(count, pointer_seconds, &pointer_allocations);
+    CHECK(typed_sum == pointer_sum && typed_sum == (long long)count * (count - 1) / 2);
+
+    int operations[PHASE_COUNT] = { count, 2 * FRONT_COUNT, count };
+    printf("test_vector: %d elements of %zu bytes, VECTOR_DEFINE %lld allocations, vector %lld allocations\n",
+           count, sizeof(element), typed_allocations, pointer_allocations);
+    for (int i = 0; i < PHASE_COUNT; ++i)
+        printf("test_vector: %-22s VECTOR_DEFINE %10.1f ns/op, vector %10.1f ns/op\n", PhaseNames[i],
+               typed_seconds[i] * 1e9 / operations[i], pointer_seconds[i] * 1e9 / operations[i]);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_vector: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_vector: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
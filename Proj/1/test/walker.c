@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "walker.h"
+#include "backupinfo.h"
+#include "fileinfo.h"
+#include "utilities.h"
+
+/** @defgroup test_walker test_walker
+ * @{
+ * Scans a tree whose subdirectories can not be listed (no descriptor is left for them), and checks
+ *  their files are carried from the previous backup info, or skipped on a first scan. A file whose
+ *  name holds a newline is never returned.
+ */
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/// Files of the tree, in byte order
+static const char* const Files[] = { "a/sub/y", "a/x", "b/z", "f" };
+
+/// Number of files of the tree
+#define FILE_COUNT ((int)(sizeof(Files) / sizeof(Files[0])))
+
+/**
+ * Creates a file (and its directories) in the tree
+ */
+static void create_file(const char* root, const char* name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+
+    for (char* slash = strchr(path + strlen(root) + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+
+    FILE* file = fopen(path, "w");
+    CHECK(file);
+    if (file)
+        fclose(file);
+}
+
+/**
+ * Scans the tree, the subdirectories without a descriptor to be listed, and checks the paths returned
+ * @param  prev     Previous iteration folder (NULL if none)
+ * @param  rules    Rules of the scan (NULL for none)
+ * @param  expected Paths expected, in order
+ * @param  count    Number of paths expected
+ * @param  carried  Number of the first paths expected to be carried
+ */
+static void check_scan(const char* root, const char* prev, const rule_set* rules, const char* const* expected, int count,
+                       int carried)
+{
+    walker w;
+    CHECK(walker_open(&w, root, prev, NULL, NULL, 0, rules, 0, 0) == 0);
+
+    // the root is listed, its subdirectories are opened by walker_next
+    struct rlimit limit;
+    CHECK(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+    int next_fd = dup(0);
+    close(next_fd);
+
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = next_fd;
+    CHECK(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    int i = 0;
+    for (const char* name = walker_next(&w); name != NULL; name = walker_next(&w), ++i)
+    {
+        CHECK(i < count && strcmp(name, expected[i]) == 0);
+        CHECK(w.carried == (i < carried));
+    }
+
+    CHECK(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+    CHECK(i == count);
+    walker_close(&w);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/test_walkerXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    char root[PATH_MAX], prev[PATH_MAX], path[PATH_MAX + 16];
+    snprintf(root, sizeof(root), "%s/root", dir);
+    snprintf(prev, sizeof(prev), "%s/prev", dir);
+    CHECK(mkdir(root, 0755) == 0 && mkdir(prev, 0755) == 0);
+
+    for (int i = 0; i < FILE_COUNT; ++i)
+        create_file(root, Files[i]);
+
+    // not one of Files, the manifests hold a path per line
+    create_file(root, "a/new\nline");
+
+    // a first scan skips them, there is nothing to carry
+    check_scan(root, NULL, NULL, Files + FILE_COUNT - 1, 1, 0);
+
+    // the previous iteration, fully listed
+    walker w;
+    CHECK(walker_open(&w, root, NULL, NULL, NULL, 0, NULL, 0, 0) == 0);
+    snprintf(path, sizeof(path), "%s/%s", prev, BACKUP_FILE_INFO_NAME);
+    FILE* info = fopen(path, "w");
+    CHECK(info);
+
+    backup_info_writer writer;
+    CHECK(backup_info_writer_open(&writer, info, 0) == 0);
+    int count = 0;
+    for (const char* name = walker_next(&w); name != NULL; name = walker_next(&w), ++count)
+    {
+        file_info fi;
+        file_info_new(&fi, name);
+        fi.state = STATE_ADDED;
+        CHECK(backup_info_writer_add(&writer, &fi) == 0);
+        file_info_free(&fi);
+    }
+    backup_info_writer_close(&writer);
+    fclose(info);
+    walker_close(&w);
+    CHECK(count == FILE_COUNT);
+
+    // a file added since is not seen, the previous ones are kept
+    create_file(root, "a/new");
+    check_scan(root, prev, NULL, Files, FILE_COUNT, FILE_COUNT - 1);
+
+    // unless the rules now exclude them
+    rule_set rules;
+    rule_set_new(&rules);
+    CHECK(rule_set_add(&rules, "x") && rule_set_add(&rules, "sub/"));
+    const char* const selected[] = { "b/z", "f" };
+    check_scan(root, prev, &rules, selected, 2, 1);
+    rule_set_free(&rules);
+
+    // without the previous backup info the scan fails
+    CHECK(unlink(path) == 0);
+    CHECK(walker_open(&w, root, prev, NULL, NULL, 0, NULL, 0, 0) != 0);
+    walker_close(&w);
+
+    snprintf(path, sizeof(path), "rm -rf %s", dir);
+    CHECK(system(path) == 0);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_walker: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_walker: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
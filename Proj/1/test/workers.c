@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "utilities.h"
+#include "throttle.h"
+
+/** @defgroup test_workers test_workers
+ * @{
+ * Checks the copy slots and I/O limits shared by the sources of a daemon: every copy is made,
+ *  the slots of failed and killed copies are given back, and the sources of a parent io_limits
+ *  share its rate. Prints the time of the copies of several sources with and without slots.
+ */
+
+/// Number of sources copying at once
+#define SOURCE_COUNT 3
+
+/// Number of files copied by each source
+#define FILE_COUNT 40
+
+/// Size of each copied file
+#define FILE_SIZE (64 * 1024)
+
+/// Number of copy slots shared by the sources
+#define SLOT_COUNT 2
+
+/// Bytes per second of the parent limits
+#define PARENT_RATE (8 * 1024 * 1024)
+
+/// Bytes per second of the limits of the slower source
+#define CHILD_RATE (2 * 1024 * 1024)
+
+/// Bytes taken at once from the limits
+#define TAKE_SIZE (64 * 1024)
+
+static int Failures = 0; ///< Number of failed checks
+
+/**
+ * Reports a failed check
+ */
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); Failures++; } } while (0)
+
+/**
+ * Seconds elapsed since start
+ */
+static double elapsed(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Waits for a process
+ * @return Its exit status, -1 if it did not exit
+ */
+static int wait_process(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Checks the copies of a source are the same as the files
+ */
+static bool same_files(const char* src, const char* dst)
+{
+    char src_path[PATH_MAX], dst_path[PATH_MAX];
+    char* expected = malloc(FILE_SIZE);
+    char* copied = malloc(FILE_SIZE + 1);
+    bool same = true;
+
+    for (int i = 0; i < FILE_COUNT && same; ++i)
+    {
+        snprintf(src_path, sizeof(src_path), "%s/f%d", src, i);
+        snprintf(dst_path, sizeof(dst_path), "%s/f%d", dst, i);
+
+        FILE* a = fopen(src_path, "r");
+        FILE* b = fopen(dst_path, "r");
+        same = a && b && fread(expected, 1, FILE_SIZE, a) == FILE_SIZE && fread(copied, 1, FILE_SIZE + 1, b) == FILE_SIZE
+               && memcmp(expected, copied, FILE_SIZE) == 0;
+
+        if (a)
+            fclose(a);
+        if (b)
+            fclose(b);
+    }
+
+    free(expected);
+    free(copied);
+    return same;
+}
+
+/**
+ * Copies the files of src to the destinations of SOURCE_COUNT processes, as the iterations of the sources of a daemon
+ * @param slots Copy slots shared by the sources (NULL for none)
+ * @return      Seconds taken
+ */
+static double copy_sources(const char* src, const char* dir, sem_t* slots)
+{
+    char dst[SOURCE_COUNT][PATH_MAX];
+    pid_t pids[SOURCE_COUNT];
+    struct timespec start;
+
+    for (int s = 0; s < SOURCE_COUNT; ++s)
+    {
+        snprintf(dst[s], sizeof(dst[s]), "%s/dst%d%s", dir, s, slots ? "s" : "");
+        CHECK(mkdir(dst[s], 0755) == 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int s = 0; s < SOURCE_COUNT; ++s)
+        if ((pids[s] = fork()) == 0)
+        {
+            set_copy_workers(slots, 0);
+
+            char name[16];
+            for (int i = 0; i < FILE_COUNT; ++i)
+            {
+                snprintf(name, sizeof(name), "f%d", i);
+                fork_copy_file(src, dst[s], name, 0, NULL);
+            }
+
+            _exit(wait_copies(1) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+    for (int s = 0; s < SOURCE_COUNT; ++s)
+        CHECK(pids[s] > 0 && wait_process(pids[s]) == EXIT_SUCCESS);
+
+    double seconds = elapsed(&start);
+
+    for (int s = 0; s < SOURCE_COUNT; ++s)
+        CHECK(same_files(src, dst[s]));
+
+    if (slots)
+    {
+        int value = -1;
+        CHECK(sem_getvalue(slots, &value) == 0 && value == SLOT_COUNT);
+    }
+
+    return seconds;
+}
+
+/**
+ * Copies that fail or are killed give their slot back
+ */
+static void test_failed_copies(const char* src, const char* dir)
+{
+    sem_t* slots = copy_slots_create(1);
+    CHECK(slots);
+    if (!slots)
+        return;
+
+    char dst[PATH_MAX];
+    snprintf(dst, sizeof(dst), "%s/failed", dir);
+    CHECK(mkdir(dst, 0755) == 0);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        alarm(20); // a lost slot would block the next copy forever
+        set_copy_workers(slots, 0);
+        int failures = 0;
+
+        // missing file
+        fork_copy_file(src, dst, "missing", 0, NULL);
+        failures += wait_copies(1) != 1;
+
+        // killed while it copies, slowly
+        set_copy_io_limits(io_limits_create(16 * 1024, 0), false);
+        fork_copy_file(src, dst, "f0", 0, NULL);
+        usleep(100000);
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+        FILE* children = fopen(path, "r");
+        int child = 0;
+        if (children == NULL || fscanf(children, "%d", &child) != 1 || kill(child, SIGKILL) != 0)
+            failures++;
+        if (children)
+            fclose(children);
+        failures += wait_copies(1) != 1;
+
+        set_copy_io_limits(NULL, false);
+        fork_copy_file(src, dst, "f1", 0, NULL);
+        failures += wait_copies(1) != 0;
+
+        _exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    CHECK(pid > 0 && wait_process(pid) == EXIT_SUCCESS);
+
+    int value = -1;
+    CHECK(sem_getvalue(slots, &value) == 0 && value == 1);
+}
+
+/**
+ * Takes bytes from limits until total are taken
+ */
+static void take(io_limits* limits, long long total)
+{
+    for (long long taken = 0; taken < total; taken += TAKE_SIZE)
+        io_limits_take(limits, TAKE_SIZE, 1);
+}
+
+/**
+ * Two sources with their own limits, one of them slower, share the rate of their parent
+ */
+static void test_shared_limits(void)
+{
+    io_limits* parent = io_limits_create(PARENT_RATE, 0);
+    io_limits* fast = io_limits_create(0, 0);
+    io_limits* slow = io_limits_create(CHILD_RATE, 0);
+    CHECK(parent && fast && slow);
+    if (!parent || !fast || !slow)
+        return;
+
+    fast->parent = parent;
+    slow->parent = parent;
+
+    // without the second of burst of a new bucket
+    throttle_take(&parent->bytes, PARENT_RATE);
+    throttle_take(&slow->bytes, CHILD_RATE);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pids[2];
+    if ((pids[0] = fork()) == 0)
+    {
+        take(fast, 4 * 1024 * 1024);
+        _exit(EXIT_SUCCESS);
+    }
+
+    if ((pids[1] = fork()) == 0)
+    {
+        struct timespec slow_start;
+        clock_gettime(CLOCK_MONOTONIC, &slow_start);
+        take(slow, 1024 * 1024);
+        // 1 MiB at CHILD_RATE
+        _exit(elapsed(&slow_start) >= 0.4 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    CHECK(pids[0] > 0 && wait_process(pids[0]) == EXIT_SUCCESS);
+    CHECK(pids[1] > 0 && wait_process(pids[1]) == EXIT_SUCCESS);
+
+    // 5 MiB at PARENT_RATE
+    double seconds = elapsed(&start);
+    CHECK(seconds >= 0.5 && seconds < 3);
+    CHECK(parent->bytes_done == 5 * 1024 * 1024 && fast->bytes_done == 4 * 1024 * 1024);
+    CHECK(slow->bytes_done == 1024 * 1024);
+
+    printf("test_workers: 2 sources sharing %d MiB/s, %.1f MiB/s\n", PARENT_RATE / (1024 * 1024), 5 / seconds);
+
+    io_limits_free(fast);
+    io_limits_free(slow);
+    io_limits_free(parent);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/test_workersXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    char src[PATH_MAX];
+    snprintf(src, sizeof(src), "%s/src", dir);
+    CHECK(mkdir(src, 0755) == 0);
+
+    char* data = malloc(FILE_SIZE);
+    srand(9);
+    for (int i = 0; i < FILE_COUNT; ++i)
+    {
+        for (int j = 0; j < FILE_SIZE; ++j)
+            data[j] = rand();
+
+        char path[PATH_MAX + 16];
+        snprintf(path, sizeof(path), "%s/f%d", src, i);
+        FILE* file = fopen(path, "w");
+        CHECK(file);
+        if (file)
+        {
+            fwrite(data, 1, FILE_SIZE, file);
+            fclose(file);
+        }
+    }
+    free(data);
+
+    sem_t* slots = copy_slots_create(SLOT_COUNT);
+    CHECK(slots);
+
+    double unlimited_seconds = copy_sources(src, dir, NULL);
+    double slots_seconds = slots ? copy_sources(src, dir, slots) : 0;
+    printf("test_workers: %d sources of %d files, %d shared slots %.3f s, one process per file %.3f s\n",
+           SOURCE_COUNT, FILE_COUNT, SLOT_COUNT, slots_seconds, unlimited_seconds);
+
+    test_failed_copies(src, dir);
+    test_shared_limits();
+
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    CHECK(system(command) == 0);
+
+    if (Failures > 0)
+    {
+        fprintf(stderr, "test_workers: %d check(s) failed.\n", Failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("test_workers: ok\n");
+    return EXIT_SUCCESS;
+}
+
+/**@}*/
@@ -38,8 +38,8 @@ int cards_compare(const void* a, const void* b)
 {
     assert(a && b);
 
-    card* c1 = *((card**)a);
-    card* c2 = *((card**)b);
+    const card* c1 = a;
+    const card* c2 = b;
 
     if (c1->suit == c2->suit)
     {
@@ -105,8 +105,8 @@ card_s card_to_string(card* card);
 
 /**
  * Compare two cards (in the format expected by qsort)
- * @param  a First card
- * @param  b Second card
+ * @param  a Pointer to the first card
+ * @param  b Pointer to the second card
  * @return   0 if same card, -1 if 1st card is before 2nd card, 1 otherwise
  */
 int cards_compare(const void* a, const void* b);
@@ -12,7 +12,7 @@ void hand_init(hand* h)
 {
     assert(h);
 
-    vector_new(&h->cards);
+    card_vector_new(&h->cards);
 }
 
 hand hand_new(void)
@@ -24,49 +24,42 @@ hand hand_new(void)
 
 void hand_free(hand* h)
 {
-    for (int i = 0; i < vector_size(&h->cards); ++i)
-        free(vector_get(&h->cards, i));
-
-    vector_free(&h->cards);
+    card_vector_free(&h->cards);
 }
 
 void hand_add_card(hand* h, card c)
 {
-    card* card_copy = malloc(sizeof(card));
-    card_copy->suit = c.suit;
-    card_copy->rank = c.rank;
-
-    vector_push_back(&h->cards, card_copy);
+    card_vector_push_back(&h->cards, c);
 }
 
 void hand_remove_card(hand* h, card c)
 {
-    int i = -1;
-    for (i = 0; i < vector_size(&h->cards); ++i)
+    int i;
+    for (i = 0; i < card_vector_size(&h->cards); ++i)
     {
-        card* ctemp = (card*)vector_get(&h->cards, i);
+        card* ctemp = card_vector_get(&h->cards, i);
         if (ctemp->rank == c.rank && ctemp->suit == c.suit)
             break;
     }
 
-    if (i == -1)
+    if (i == card_vector_size(&h->cards))
     {
         fprintf(stderr, "Trying to remove card that does not exist.\n");
         assert(false);
         return;
     }
 
-    vector_erase(&h->cards, i);
+    card_vector_erase(&h->cards, i);
 }
 
 void hand_sort(hand* h)
 {
     assert(h);
 
-    if (vector_size(&h->cards) == 0)
+    if (card_vector_size(&h->cards) == 0)
         return; // already sorted
 
-    qsort(h->cards.buffer, vector_size(&h->cards), sizeof(card*), cards_compare);
+    qsort(card_vector_data(&h->cards), card_vector_size(&h->cards), sizeof(card), cards_compare);
 }
 
 char* hand_to_string(hand* h)
@@ -78,9 +71,9 @@ char* hand_to_string(hand* h)
     char buffer[1024];
 
     int total_suit_counts[] = { 0, 0, 0, 0 };
-    for (int i = 0; i < vector_size(&h->cards); ++i)
+    for (int i = 0; i < card_vector_size(&h->cards); ++i)
     {
-        card* c = (card*)vector_get(&h->cards, i);
+        card* c = card_vector_get(&h->cards, i);
         total_suit_counts[c->suit] += 1;
     }
 
@@ -109,9 +102,9 @@ char* hand_to_string(hand* h)
 
     strcpy(buffer, "");
 
-    for (int i = 0; i < vector_size(&h->cards); ++i)
+    for (int i = 0; i < card_vector_size(&h->cards); ++i)
     {
-        card* c = (card*)vector_get(&h->cards, i);
+        card* c = card_vector_get(&h->cards, i);
 
         suit_counts[c->suit] += 1;
 
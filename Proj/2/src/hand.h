@@ -9,12 +9,15 @@
  * Structs, and functions used to represent a hand.
  */
 
+/// Vector of cards, a whole deck fits without allocating.
+VECTOR_DEFINE(card_vector, card, NUMBER_OF_CARDS)
+
 /**
  * Hand.
  */
 typedef struct hand_t
 {
-    vector cards; ///< Vector of cards.
+    card_vector cards; ///< Vector of cards.
 } hand;
 
 void hand_init(hand* h); ///< Initialize hand
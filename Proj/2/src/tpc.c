@@ -430,11 +430,11 @@ void* KeyboardFunc(void* dummy __attribute__((unused)))
                             continue;
                         }
 
-                        int numOfCards = vector_size(&globals.PlayerHand.cards);
+                        int numOfCards = card_vector_size(&globals.PlayerHand.cards);
 
                         for (int i = 0; i < numOfCards; ++i)
                         {
-                            card* c = vector_get(&globals.PlayerHand.cards, i);
+                            card* c = card_vector_get(&globals.PlayerHand.cards, i);
                             card_s cStr = card_to_string(c);
                             if (strncmp(buffer, cStr.str, strlen(cStr.str)) == 0)
                             {
@@ -1,9 +1,16 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
 /** @defgroup vector vector
  * @{
  * Functions to manage vector ADT
+ *
+ * vector holds pointers, for elements that are shared or outlive it. Vectors of
+ * values are declared with VECTOR_DEFINE, which stores the elements themselves.
  */
 
 typedef struct vector_t
@@ -17,11 +24,137 @@ void vector_new(vector* v); ///< Create new vector
 void vector_free(vector* v); ///< Delete vector
 int vector_size(const vector* v); ///< Size of vector
 int vector_capacity(const vector* v); ///< Capacity of vector
+void vector_reserve(vector* v, int capacity); ///< Allocates room for at least capacity elements
 void vector_push_back(vector* v, void* data); ///< Adds element to back of vector
-void vector_insert(vector* v, void* data, int index); ///< Adds element at position index
+void vector_insert(vector* v, void* data, int index); ///< Adds element at position index (at most the size)
 void* vector_get(const vector* v, int index); ///< Element at position index
 void vector_erase(vector* v, int index); ///< Removes element at position index
 
+/// Capacity of the first allocation of a vector
+#define VECTOR_DEFAULT_CAPACITY 10
+
+/**
+ * Declares a vector of values of a type, stored contiguously, and its functions (prefixed by name):
+ *  name_new, name_free, name_size, name_capacity, name_reserve, name_data, name_get, name_push_back,
+ *  name_insert, name_erase and name_emplace, which adds an uninitialized element and returns it.
+ *
+ * The first small elements are stored in the struct itself, so a vector that never holds more does
+ *  not allocate (0 for none); they are moved to the heap once they do not fit. A copy of the struct is
+ *  only independent while heap is NULL: afterwards both copies own the same heap, so only one of them
+ *  may be used and freed (moving the struct is fine). Elements are moved with memmove, pointers to
+ *  them are valid until the next insertion or removal.
+ * @param name  Name of the vector type
+ * @param type  Type of the elements
+ * @param small Number of elements stored in the struct itself
+ */
+#define VECTOR_DEFINE(name, type, small)                                                        \
+typedef struct                                                                                  \
+{                                                                                               \
+    type* heap; /* elements, NULL while they are stored in local */                            \
+    int capacity; /* number of elements that fit */                                             \
+    int count; /* number of elements */                                                         \
+    type local[(small) > 0 ? (small) : 1]; /* the first small elements */                       \
+} name;                                                                                         \
+                                                                                                \
+static inline void name##_new(name* v)                                                          \
+{                                                                                               \
+    assert(v);                                                                                  \
+    v->heap = NULL;                                                                             \
+    v->capacity = (small);                                                                      \
+    v->count = 0;                                                                               \
+}                                                                                               \
+                                                                                                \
+static inline void name##_free(name* v)                                                         \
+{                                                                                               \
+    assert(v);                                                                                  \
+    free(v->heap);                                                                              \
+    name##_new(v);                                                                              \
+}                                                                                               \
+                                                                                                \
+static inline int name##_size(const name* v)                                                    \
+{                                                                                               \
+    assert(v);                                                                                  \
+    return v->count;                                                                            \
+}                                                                                               \
+                                                                                                \
+static inline int name##_capacity(const name* v)                                                \
+{                                                                                               \
+    assert(v);                                                                                  \
+    return v->capacity;                                                                         \
+}                                                                                               \
+                                                                                                \
+static inline void name##_reserve(name* v, int capacity)                                        \
+{                                                                                               \
+    assert(v);                                                                                  \
+                                                                                                \
+    if (capacity <= v->capacity)                                                                \
+        return;                                                                                 \
+                                                                                                \
+    if (v->heap == NULL)                                                                        \
+    {                                                                                           \
+        v->heap = malloc(capacity * sizeof(type));                                              \
+        assert(v->heap);                                                                        \
+        memcpy(v->heap, v->local, v->count * sizeof(type));                                     \
+    }                                                                                           \
+    else                                                                                        \
+    {                                                                                           \
+        v->heap = realloc(v->heap, capacity * sizeof(type));                                    \
+        assert(v->heap);                                                                        \
+    }                                                                                           \
+                                                                                                \
+    v->capacity = capacity;                                                                     \
+}                                                                                               \
+                                                                                                \
+static inline type* name##_data(name* v)                                                        \
+{                                                                                               \
+    assert(v);                                                                                  \
+    return v->heap != NULL ? v->heap : v->local;                                                \
+}                                                                                               \
+                                                                                                \
+static inline type* name##_get(name* v, int index)                                              \
+{                                                                                               \
+    assert(v);                                                                                  \
+    assert(index >= 0);                                                                         \
+    assert(index < v->count);                                                                   \
+    return name##_data(v) + index;                                                              \
+}                                                                                               \
+                                                                                                \
+static inline type* name##_emplace(name* v, int index)                                          \
+{                                                                                               \
+    assert(v);                                                                                  \
+    assert(index >= 0);                                                                         \
+    assert(index <= v->count);                                                                  \
+                                                                                                \
+    if (v->count == v->capacity) /* grows as vector does */                                   \
+        name##_reserve(v, v->capacity < VECTOR_DEFAULT_CAPACITY ? VECTOR_DEFAULT_CAPACITY : v->capacity * 3 / 2); \
+                                                                                                \
+    type* data = name##_data(v);                                                                \
+    memmove(data + index + 1, data + index, (v->count - index) * sizeof(type));                 \
+    v->count++;                                                                                 \
+    return data + index;                                                                        \
+}                                                                                               \
+                                                                                                \
+static inline void name##_push_back(name* v, type value)                                        \
+{                                                                                               \
+    *name##_emplace(v, v->count) = value;                                                       \
+}                                                                                               \
+                                                                                                \
+static inline void name##_insert(name* v, type value, int index)                                \
+{                                                                                               \
+    *name##_emplace(v, index) = value;                                                          \
+}                                                                                               \
+                                                                                                \
+static inline void name##_erase(name* v, int index)                                             \
+{                                                                                               \
+    assert(v);                                                                                  \
+    assert(index >= 0);                                                                         \
+    assert(index < v->count);                                                                   \
+                                                                                                \
+    type* data = name##_data(v);                                                                \
+    memmove(data + index, data + index + 1, (v->count - index - 1) * sizeof(type));             \
+    v->count--;                                                                                 \
+}
+
 /**@}*/
 
 #endif // VECTOR_H